@@ -0,0 +1,11 @@
+/*
+ * Built against the host's C library, outside of Zephyr.
+ */
+#include "host_clock_bottom.h"
+#include <time.h>
+
+uint64_t host_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,14 @@
+/**
+ * @brief The host's monotonic clock, for code running on native_sim.
+ */
+#ifndef HOST_CLOCK_BOTTOM_H
+#define HOST_CLOCK_BOTTOM_H
+
+#include <stdint.h>
+
+/**
+ * @brief Nanoseconds on the host's CLOCK_MONOTONIC.
+ */
+uint64_t host_clock_ns(void);
+
+#endif /* HOST_CLOCK_BOTTOM_H */
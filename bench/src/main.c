@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2024 Marko Vejnovic
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * @detail
+ * Microbenchmarks of the firmware's hot paths, meant to be run on native_sim
+ * before and after a change. Every benchmark prints a single line of JSON:
+ *
+ *   {"bench":"format_row","ops":20000,"ns":...,"ns_per_op":...,
+ *    "bytes":...,"bytes_per_s":...,"errors":0}
+ *
+ * "bytes" and "bytes_per_s" are only present for the benchmarks producing
+ * data. Lines not starting with '{' are log output and can be ignored.
+ *
+ * Storage writes go to a FAT formatted RAM disk through the same export
+ * passthrough as on the logger, so they measure the firmware's own overhead
+ * rather than an SD card's. They are then repeated against every other
+ * storage backend built in, reported as "storage_write_row/<backend>".
+ */
+#include "experiment.h"
+#include "observer.h"
+#include "storage.h"
+#include "storage_backend.h"
+#include "str.h"
+#include "trutime.h"
+#include "sensor/ximpedance_amp/v2i_ximpedance10x_lut.h"
+#include "sensor/ximpedance_amp/v2i_ximpedance22x_lut.h"
+#include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/printk.h>
+
+#if defined(CONFIG_ARCH_POSIX)
+#include "host_clock_bottom.h"
+#include <posix_board_if.h>
+#endif
+
+#define FORMAT_OPS 20000
+#define LUT_OPS 1000000
+#define PUSH_OPS 20000
+#define FLUSH_ROUNDS 2000
+#define STORAGE_WRITE_OPS 20000
+
+// One less than EXPERIMENT_AUTO_FLUSH_THRESHOLD, so the rows stay in the
+// experiment until the timed flush.
+#define FLUSH_ROWS 9
+
+// The inputs swept through the lookups, in microvolts. The sweep starts below
+// the first entry of either table and runs past the end of both.
+#define LUT_MIN_UV 0
+#define LUT_MAX_UV 2100000
+
+LOG_MODULE_REGISTER(bench);
+
+OBSERVER_DECL(bench_observer);
+TRUTIME_DECL(bench_time);
+
+struct bench_result {
+    const char* name;
+    uint32_t ops;
+    uint64_t ns;
+    /*!< The bytes produced or written, 0 if not applicable. */
+    uint64_t bytes;
+    uint32_t errors;
+};
+
+static struct experiment_row format_row_data;
+static char format_buf[EXPERIMENT_ROW_STR_MAX];
+
+static uint64_t now_ns(void) {
+#if defined(CONFIG_ARCH_POSIX)
+    return host_clock_ns();
+#else
+    return k_cyc_to_ns_floor64(k_cycle_get_64());
+#endif
+}
+
+static void report(const struct bench_result* r) {
+    const double ns = r->ns == 0 ? 1.0 : (double)r->ns;
+
+    printk("{\"bench\":\"%s\",\"ops\":%u,\"ns\":%llu,\"ns_per_op\":%.3f",
+           r->name, r->ops, r->ns, ns / r->ops);
+    if (r->bytes != 0) {
+        printk(",\"bytes\":%llu,\"bytes_per_s\":%.0f",
+               r->bytes, (double)r->bytes * 1e9 / ns);
+    }
+    printk(",\"errors\":%u}\n", r->errors);
+}
+
+/**
+ * @brief A noisy value shaped like the logger's currents in mA.
+ */
+static double synthetic_value(uint32_t i, size_t c) {
+    const int32_t noise = (int32_t)((i * 7919 + c * 104729) % 2001) - 1000;
+    return -0.05 * (c + 1) + noise * 1e-6;
+}
+
+/**
+ * @brief Fill every column of columns.h with a synthetic value.
+ */
+static void fill_row(struct experiment_row* row, uint32_t i) {
+#define FILL(field, type, name, unit, source)                               \
+    row->values.field = (type)synthetic_value(i, EXPERIMENT_COLUMN_##field);
+    EXPERIMENT_COLUMNS(FILL)
+#undef FILL
+}
+
+static void bench_format_row(void) {
+    struct bench_result r = { .name = "format_row", .ops = FORMAT_OPS };
+
+    fill_row(&format_row_data, 0);
+
+    const uint64_t start = now_ns();
+    for (uint32_t i = 0; i < FORMAT_OPS; i++) {
+        format_row_data.millis_since_start = i * 100ull;
+        const struct strv s = experiment_row_format(&format_row_data,
+                                                    format_buf);
+        r.bytes += s.len + 1; // The newline storage adds.
+    }
+    r.ns = now_ns() - start;
+
+    report(&r);
+}
+
+static void bench_lut(const char* name, int32_t (*lut)(int32_t)) {
+    struct bench_result r = { .name = name, .ops = LUT_OPS };
+    volatile int32_t sink;
+    int32_t acc = 0;
+
+    const uint64_t start = now_ns();
+    for (uint32_t i = 0; i < LUT_OPS; i++) {
+        acc += lut((int32_t)(LUT_MIN_UV
+                             + (i * 7919u) % (LUT_MAX_UV - LUT_MIN_UV)));
+    }
+    r.ns = now_ns() - start;
+    sink = acc;
+    (void)sink;
+
+    report(&r);
+}
+
+static struct experiment_row* new_row(uint32_t i) {
+    struct experiment_row* row = experiment_row_new(i * 100ull);
+    if (row != NULL) {
+        fill_row(row, i);
+    }
+    return row;
+}
+
+static void bench_push_row(struct experiment* experiment) {
+    struct bench_result r = { .name = "experiment_push_row", .ops = PUSH_OPS };
+
+    // Every tenth push flushes the rows into the storage queue, just like on
+    // the logger.
+    const uint64_t start = now_ns();
+    for (uint32_t i = 0; i < PUSH_OPS; i++) {
+        struct experiment_row* row = new_row(i);
+        if (row == NULL || experiment_push_row(experiment, row) != 0) {
+            r.errors++;
+        }
+    }
+    r.ns = now_ns() - start;
+
+    report(&r);
+}
+
+static void bench_flush(struct experiment* experiment) {
+    struct bench_result r = {
+        .name = "experiment_flush",
+        .ops = FLUSH_ROUNDS * FLUSH_ROWS,
+    };
+
+    (void)experiment_flush(experiment);
+    for (uint32_t round = 0; round < FLUSH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < FLUSH_ROWS; i++) {
+            struct experiment_row* row = new_row(i);
+            if (row == NULL || experiment_push_row(experiment, row) != 0) {
+                r.errors++;
+            }
+        }
+
+        const uint64_t start = now_ns();
+        if (experiment_flush(experiment) != 0) {
+            r.errors++;
+        }
+        r.ns += now_ns() - start;
+    }
+
+    report(&r);
+}
+
+static void bench_storage_write(storage_t storage,
+                                const struct storage_backend* backend) {
+    char name[48];
+    struct bench_result r = {
+        .name = name,
+        .ops = STORAGE_WRITE_OPS,
+    };
+
+    // The FAT backend keeps the name it had before there were other backends,
+    // so that older runs stay comparable.
+    if (backend == &storage_backend_fatfs) {
+        snprintk(name, sizeof(name), "storage_write_row");
+    } else {
+        snprintk(name, sizeof(name), "storage_write_row/%s", backend->name);
+    }
+
+    fill_row(&format_row_data, 0);
+    const struct strv row = experiment_row_format(&format_row_data,
+                                                  format_buf);
+
+    // Start from an empty queue, and only stop once every row is on the disk.
+    (void)storage_flush(storage);
+    const uint64_t start = now_ns();
+    for (uint32_t i = 0; i < STORAGE_WRITE_OPS; i++) {
+        if (storage_write_row(storage, STORAGE_STREAM_DATA, row, K_FOREVER)
+                != 0) {
+            r.errors++;
+        }
+        r.bytes += row.len + 1;
+    }
+    if (storage_flush(storage) != 0) {
+        r.errors++;
+    }
+    r.ns = now_ns() - start;
+
+    report(&r);
+}
+
+/**
+ * @brief Bring up a storage of its own on backend and time writing into a
+ *        transaction of it.
+ */
+static void bench_storage_backend(observer_t observer,
+                                  const struct storage_backend* backend) {
+    const struct tm start_time = {
+        .tm_year = 124,
+        .tm_mon = 4,
+        .tm_mday = 1,
+    };
+    int err;
+
+    storage_t storage = storage_init(observer, backend, 0);
+    if (storage == NULL) {
+        LOG_ERR("Could not initialize the %s storage.", backend->name);
+        return;
+    }
+
+    storage_wait_until_available(storage);
+    if ((err = storage_transaction(storage, &start_time)) != 0) {
+        LOG_ERR("Could not open a transaction on %s (%d).", backend->name,
+                err);
+    } else {
+        bench_storage_write(storage, backend);
+    }
+
+    storage_close(storage);
+}
+
+int main(void) {
+    int err;
+
+    // The RAM disk starts out empty.
+    if ((err = fs_mkfs(FS_FATFS,
+                       (uintptr_t)CONFIG_BIOLOGGER_STORAGE_DISK_NAME ":",
+                       NULL, 0)) != 0) {
+        LOG_ERR("Failed to format the RAM disk (%d).", err);
+        return err;
+    }
+
+    observer_t observer = OBSERVER_INIT(bench_observer);
+    storage_t storage = storage_init(observer, &storage_backend_fatfs, 0);
+    if (storage == NULL) {
+        LOG_ERR("Could not initialize storage.");
+        return -ENOMEM;
+    }
+    trutime_t time_provider = TRUTIME_INIT(bench_time, observer);
+
+    struct experiment* experiment = experiment_init(storage, time_provider);
+    if (experiment == NULL) {
+        LOG_ERR("Failed to initialize the experiment");
+        return -ENOMEM;
+    }
+
+    bench_format_row();
+    bench_lut("v2i_ximpedance22x_lut",
+              v2i_ximpedance22x_lut_get_nanoamps_from_microvolts);
+    bench_lut("v2i_ximpedance10x_lut",
+              v2i_ximpedance10x_lut_get_nanoamps_from_microvolts);
+    bench_push_row(experiment);
+    bench_flush(experiment);
+    bench_storage_write(storage, &storage_backend_fatfs);
+
+    experiment_free(experiment);
+    storage_close(storage);
+
+#if defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_RAM)
+    bench_storage_backend(observer, &storage_backend_ram);
+#endif
+#if defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_HOST)
+    bench_storage_backend(observer, &storage_backend_host);
+#endif
+
+#if defined(CONFIG_ARCH_POSIX)
+    posix_exit(0);
+#endif
+    return 0;
+}
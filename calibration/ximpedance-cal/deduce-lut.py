@@ -9,13 +9,28 @@ def strictly_decreasing(L):
     return all(x>y for x, y in zip(L, L[1:]))
 
 
-def codegen(name: str, arr: np.ndarray):
+def fnv1a(data: bytes) -> int:
+    h = 0x811c9dc5
+    for byte in data:
+        h = ((h ^ byte) * 0x01000193) & 0xffffffff
+    return h
+
+
+def codegen(name: str, calibration_id: str, arr: np.ndarray):
     data = np.array((arr[1], arr[0])).T
 
     plt.subplot(223)
     plt.plot(arr[1], arr[0], 'x--')
     plt.grid()
 
+    # The same points for the host, which calibrates raw ADC codes itself. The
+    # firmware names the table and its hash in the header of such logs.
+    table = "Voltage [uV],Current [nA]\n" + "".join(
+        f"{int(dp[0] * 1e6)},{int(dp[1] * 1e9)}\n" for dp in data)
+    with open(f"tables/{calibration_id}.csv", "w+") as table_f:
+        table_f.write(table)
+    table_hash = fnv1a(table.encode())
+
     with open(f"{name}.h", "w+") as header:
         header.write(textwrap.dedent(f"""\
         #ifndef {name.upper()}_H
@@ -23,6 +38,11 @@ def codegen(name: str, arr: np.ndarray):
 
         #include <stdint.h>
 
+        /// @brief The calibration the table was deduced from.
+        #define {name.upper()}_ID "{calibration_id}"
+        /// @brief The FNV-1a hash of tables/{calibration_id}.csv, as 8 hex digits.
+        #define {name.upper()}_HASH "{table_hash:08x}"
+
         /// @brief Return the nanoamps measured by the sensor from given microvolts.
         int32_t {name}_get_nanoamps_from_microvolts(int32_t microvolts);
 
@@ -50,9 +70,9 @@ def codegen(name: str, arr: np.ndarray):
             }}
 
             for (size_t i = 0; i < {data.shape[0]} - 1; i++) {{
-                const int32_t candidate_voltage_higher = {name}_uv2ni[i][0];
-                const int32_t candidate_voltage_lower = {name}_uv2ni[i + 1][0];
-                if (candidate_voltage_lower <= microvolts && microvolts >= candidate_voltage_higher) {{
+                const int32_t candidate_voltage_lower = {name}_uv2ni[i][0];
+                const int32_t candidate_voltage_higher = {name}_uv2ni[i + 1][0];
+                if (candidate_voltage_lower <= microvolts && microvolts <= candidate_voltage_higher) {{
                     // Perform a lerp between the two points.
                     return LERP(microvolts, candidate_voltage_lower, candidate_voltage_higher,
                                 {name}_uv2ni[i][1], {name}_uv2ni[i + 1][1]);
@@ -88,8 +108,8 @@ def main():
     iv_10x_cont = np.ascontiguousarray(optimally_decimate_array(iv_10x))
     iv_22x_cont = np.ascontiguousarray(optimally_decimate_array(iv_22x))
 
-    codegen("v2i_ximpedance10x_lut", iv_10x_cont)
-    codegen("v2i_ximpedance22x_lut", iv_22x_cont)
+    codegen("v2i_ximpedance10x_lut", "10x-1", iv_10x_cont)
+    codegen("v2i_ximpedance22x_lut", "22x-1", iv_22x_cont)
 
     plt.subplot(221)
     plt.title("G=10K")
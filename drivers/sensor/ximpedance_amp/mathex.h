@@ -1,6 +1,8 @@
-// @brief Perform a linear interpolation
+#include <stdint.h>
+
+// @brief Perform a linear interpolation. The product is taken in 64 bits,
+// since microvolts times nanoamps overflows 32 bits.
 #ifndef LERP
 #define LERP(x, x0, x1, y0, y1) \
-    ((y0) * ((x1) - (x0))) + ((y1) * ((x) - (x0))) \
-    / ((x1) - (x0))
+    ((y0) + (int64_t)((y1) - (y0)) * ((x) - (x0)) / ((x1) - (x0)))
 #endif // LERP
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 
+/// @brief The calibration the table was deduced from.
+#define V2I_XIMPEDANCE10X_LUT_ID "10x-1"
+/// @brief The FNV-1a hash of tables/10x-1.csv, as 8 hex digits.
+#define V2I_XIMPEDANCE10X_LUT_HASH "f491e255"
+
 /// @brief Return the nanoamps measured by the sensor from given microvolts.
 int32_t v2i_ximpedance10x_lut_get_nanoamps_from_microvolts(int32_t microvolts);
 
@@ -36,9 +36,9 @@ int32_t v2i_ximpedance22x_lut_get_nanoamps_from_microvolts(int32_t microvolts) {
     }
 
     for (size_t i = 0; i < 20 - 1; i++) {
-        const int32_t candidate_voltage_higher = v2i_ximpedance22x_lut_uv2ni[i][0];
-        const int32_t candidate_voltage_lower = v2i_ximpedance22x_lut_uv2ni[i + 1][0];
-        if (candidate_voltage_lower <= microvolts && microvolts >= candidate_voltage_higher) {
+        const int32_t candidate_voltage_lower = v2i_ximpedance22x_lut_uv2ni[i][0];
+        const int32_t candidate_voltage_higher = v2i_ximpedance22x_lut_uv2ni[i + 1][0];
+        if (candidate_voltage_lower <= microvolts && microvolts <= candidate_voltage_higher) {
             // Perform a lerp between the two points.
             return LERP(microvolts, candidate_voltage_lower, candidate_voltage_higher,
                         v2i_ximpedance22x_lut_uv2ni[i][1], v2i_ximpedance22x_lut_uv2ni[i + 1][1]);
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 
+/// @brief The calibration the table was deduced from.
+#define V2I_XIMPEDANCE22X_LUT_ID "22x-1"
+/// @brief The FNV-1a hash of tables/22x-1.csv, as 8 hex digits.
+#define V2I_XIMPEDANCE22X_LUT_HASH "209cec18"
+
 /// @brief Return the nanoamps measured by the sensor from given microvolts.
 int32_t v2i_ximpedance22x_lut_get_nanoamps_from_microvolts(int32_t microvolts);
 
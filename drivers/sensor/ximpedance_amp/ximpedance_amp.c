@@ -12,6 +12,13 @@
 
 LOG_MODULE_REGISTER(ximpedance_amp);
 
+BUILD_ASSERT(DT_ENUM_HAS_VALUE(XIMPEDANCE_AMP_ADC_CHANNEL, zephyr_gain,
+                               ADC_GAIN_1)
+             && DT_ENUM_HAS_VALUE(XIMPEDANCE_AMP_ADC_CHANNEL,
+                                  zephyr_reference, ADC_REF_INTERNAL),
+             "XIMPEDANCE_AMP_ADC_FULL_SCALE_MV assumes a gain of 1 and the "
+             "internal reference.");
+
 inline static int32_t get_nanoamps_for_microvolts(size_t adc_idx, int32_t uv) {
     switch (adc_idx) {
         case 0:
@@ -48,8 +55,8 @@ static int ximpedance_amp_sample_fetch(const struct device* dev,
             goto continue_loop;
         }
 
-        // Configure the sequence
-        uint16_t buf;
+        // Configure the sequence. The ADS1X1X codes are two's complement.
+        int16_t buf;
         struct adc_sequence sequence = {
             .buffer = &buf,
             .buffer_size = sizeof(buf),
@@ -66,17 +73,9 @@ static int ximpedance_amp_sample_fetch(const struct device* dev,
             goto continue_loop;
         }
 
-        int32_t val_mv = (int32_t)buf;
-        if ((err = adc_raw_to_millivolts_dt(&data->adc_spec, &val_mv)) != 0) {
-            LOG_ERR("Failed to convert ADC raw to mV for transimpedance channel"
-                    "%d (%d).", channel, err);
-            goto continue_loop;
-        }
-
-        // Now we need to follow the IV curve to compute the current we just
-        // sampled.
-        data->sampled_nanoamps[channel] =
-            get_nanoamps_for_microvolts(channel, val_mv * 1000);
+        // The codes are only converted into currents once asked for, so that
+        // logging the raw codes costs no conversion at all.
+        data->sampled_codes[channel] = buf;
 
 continue_loop:
         cum_error = MIN(cum_error, err);
@@ -91,29 +90,58 @@ static int ximpedance_amp_channel_get(const struct device *dev,
     struct ximpedance_amp_data* data = dev->data;
 
     size_t adc_index;
+    bool code = false;
     switch ((int)chan) {
+        case XIMPEDANCE_CHAN_22KX_CODE_1:
+            code = true;
+            __fallthrough;
         case XIMPEDANCE_CHAN_22KX_MILLIAMPS_1:
             adc_index = 0;
             break;
 
+        case XIMPEDANCE_CHAN_22KX_CODE_2:
+            code = true;
+            __fallthrough;
         case XIMPEDANCE_CHAN_22KX_MILLIAMPS_2:
             adc_index = 1;
             break;
 
+        case XIMPEDANCE_CHAN_10KX_CODE_1:
+            code = true;
+            __fallthrough;
         case XIMPEDANCE_CHAN_10KX_MILLIAMPS_1:
             adc_index = 2;
             break;
 
+        case XIMPEDANCE_CHAN_10KX_CODE_2:
+            code = true;
+            __fallthrough;
         case XIMPEDANCE_CHAN_10KX_MILLIAMPS_2:
             adc_index = 3;
             break;
 
         default:
-            LOG_ERR("The Ximpedance requires chan is one of 0-3.");
+            LOG_ERR("The Ximpedance requires chan is one of 0-7.");
             return -ENOTSUP;
     }
 
-    int32_t nanoamps = data->sampled_nanoamps[adc_index];
+    if (code) {
+        val->val1 = data->sampled_codes[adc_index];
+        val->val2 = 0;
+        return 0;
+    }
+
+    int32_t val_mv = data->sampled_codes[adc_index];
+    int err;
+    if ((err = adc_raw_to_millivolts_dt(&data->adc_spec, &val_mv)) != 0) {
+        LOG_ERR("Failed to convert ADC raw to mV for transimpedance channel"
+                "%zu (%d).", adc_index, err);
+        return err;
+    }
+
+    // Now we need to follow the IV curve to compute the current we just
+    // sampled.
+    int32_t nanoamps = get_nanoamps_for_microvolts(adc_index, val_mv * 1000);
     val->val1 = nanoamps / (1000 * 1000);
     val->val2 = nanoamps % (1000 * 1000);
 
@@ -2,6 +2,7 @@
 #define XIMPEDANCE_AMP_H
 
 #include <zephyr/device.h>
+#include <zephyr/devicetree.h>
 #include <zephyr/drivers/adc.h>
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/sys/util.h>
@@ -10,11 +11,26 @@
 #define XIMPEDANCE_AMP_22K_GAIN_CHANNELS { 0, 1 }
 #define XIMPEDANCE_AMP_10K_GAIN_CHANNELS { 2, 3 }
 
+// The ADC channel every input is read through.
+#define XIMPEDANCE_AMP_ADC_CHANNEL \
+    DT_CHILD(DT_NODELABEL(ads1115_adc), channel_0)
+// A code of 2^XIMPEDANCE_AMP_ADC_RESOLUTION stands for
+// XIMPEDANCE_AMP_ADC_FULL_SCALE_MV, as in adc_raw_to_millivolts_dt.
+#define XIMPEDANCE_AMP_ADC_RESOLUTION \
+    DT_PROP(XIMPEDANCE_AMP_ADC_CHANNEL, zephyr_resolution)
+// The internal reference of the ADS1x1x at a gain of 1.
+#define XIMPEDANCE_AMP_ADC_FULL_SCALE_MV 2048
+
 enum ximpedance_amp_sensor_channel {
     XIMPEDANCE_CHAN_22KX_MILLIAMPS_1 = SENSOR_CHAN_PRIV_START,
     XIMPEDANCE_CHAN_22KX_MILLIAMPS_2,
     XIMPEDANCE_CHAN_10KX_MILLIAMPS_1,
     XIMPEDANCE_CHAN_10KX_MILLIAMPS_2,
+    // The ADC code each current was computed from, in val1.
+    XIMPEDANCE_CHAN_22KX_CODE_1,
+    XIMPEDANCE_CHAN_22KX_CODE_2,
+    XIMPEDANCE_CHAN_10KX_CODE_1,
+    XIMPEDANCE_CHAN_10KX_CODE_2,
 };
 
 struct ximpedance_amp_config {
@@ -25,7 +41,8 @@ struct ximpedance_amp_data {
     // the ADC mux pinout) we pack it as data rather than config.
     struct adc_dt_spec adc_spec;
 
-    int32_t sampled_nanoamps[XIMPEDANCE_AMP_V1_CHANNELS];
+    // Converted into currents by channel_get.
+    int16_t sampled_codes[XIMPEDANCE_AMP_V1_CHANNELS];
 };
 
 #endif /* XIMPEDANCE_AMP_H */
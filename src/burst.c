@@ -0,0 +1,452 @@
+#include "burst.h"
+#include "storage.h"
+#include "str.h"
+#include "thread_specs.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/errno.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/printk.h>
+
+#define PRE_SAMPLES CONFIG_BIOLOGGER_BURST_PRE_SAMPLES
+#define POST_SAMPLES CONFIG_BIOLOGGER_BURST_POST_SAMPLES
+// The trigger sample itself sits between the pre- and post-trigger samples.
+#define BURST_SAMPLES (PRE_SAMPLES + 1 + POST_SAMPLES)
+#define STALE_AFTER_MS (10 * 1000 / CONFIG_BIOLOGGER_BURST_RATE_HZ)
+
+// A burst is written a few rows at a time, with a pause in between, so that it
+// never takes up more than a small part of the storage queue.
+#define CHUNK_ROWS 8
+#define MAX_LINE_LEN 96
+#define WRITE_TIMEOUT_MS 100
+#define WRITE_PAUSE_MS 10
+
+#define HEADER "Timestamp [us],Burst [#],Current 22KX 1 [nA]," \
+               "Current 22KX 2 [nA],Current 10KX 1 [nA],Current 10KX 2 [nA]"
+
+BUILD_ASSERT(XIMPEDANCE_AMP_V1_CHANNELS == 4,
+             "HEADER and write_burst expect four amplifier channels");
+
+LOG_MODULE_REGISTER(burst);
+
+static const struct device* const ximpedance_amp =
+    DEVICE_DT_GET(DT_NODELABEL(ximpedance_amp));
+
+static storage_t burst_storage;
+static trutime_t burst_trutime;
+static const struct experiment* burst_experiment;
+
+/*
+ * The latest sample, published for the experiment. As in thermometer.c, the
+ * lock is only ever held for the duration of a struct copy.
+ */
+static struct k_spinlock published_lock;
+static struct burst_sample published;
+static bool published_valid = false;
+
+static struct k_spinlock trigger_lock;
+static struct burst_trigger trigger = {
+    .channel = CONFIG_BIOLOGGER_BURST_TRIGGER_CHANNEL,
+    .level_na = CONFIG_BIOLOGGER_BURST_TRIGGER_LEVEL_NA,
+    .slope_na = CONFIG_BIOLOGGER_BURST_TRIGGER_SLOPE_NA,
+};
+static atomic_t fire_requested;
+
+static atomic_t bursts_written;
+static atomic_t bursts_missed;
+static atomic_t rows_dropped;
+static atomic_t sample_errors;
+
+/*
+ * Only ever touched by the sampling thread.
+ */
+static struct burst_sample ring[BURST_SAMPLES];
+static size_t ring_head;
+static size_t ring_filled;
+
+/*
+ * The burst being written. Filled in by the sampling thread while writer_busy
+ * is clear, then only read by the writing thread until it clears it again.
+ */
+static struct burst_sample burst[BURST_SAMPLES];
+static size_t burst_len;
+static uint32_t burst_number;
+static atomic_t writer_busy;
+static K_SEM_DEFINE(burst_ready, 0, 1);
+
+/*
+ * Only ever touched by the writing thread.
+ */
+static bool header_written = false;
+static char chunk_buf[CHUNK_ROWS * MAX_LINE_LEN];
+
+K_THREAD_STACK_DEFINE(sample_thread_stack, THREAD_BURST_SAMPLE_STACK_SIZE);
+static struct k_thread sample_thread_data;
+K_THREAD_STACK_DEFINE(write_thread_stack, THREAD_BURST_WRITE_STACK_SIZE);
+static struct k_thread write_thread_data;
+
+/******************************************************************************
+ * Sampling.
+ *****************************************************************************/
+
+static int acquire(struct burst_sample* out) {
+    int err;
+
+    if ((err = sensor_sample_fetch(ximpedance_amp)) != 0) {
+        return err;
+    }
+
+    for (size_t i = 0; i < XIMPEDANCE_AMP_V1_CHANNELS; i++) {
+        struct sensor_value val;
+        if ((err = sensor_channel_get(
+                ximpedance_amp, XIMPEDANCE_CHAN_22KX_MILLIAMPS_1 + i,
+                &val)) != 0) {
+            return err;
+        }
+        // The driver reports milliamps with val2 in millionths, so nanoamps.
+        out->nanoamps[i] = val.val1 * 1000 * 1000 + val.val2;
+
+#if defined(CONFIG_BIOLOGGER_RAW_CURRENTS)
+        if ((err = sensor_channel_get(
+                ximpedance_amp, XIMPEDANCE_CHAN_22KX_CODE_1 + i,
+                &val)) != 0) {
+            return err;
+        }
+        out->codes[i] = val.val1;
+#endif
+    }
+
+    out->uptime_us = k_ticks_to_us_floor64(k_uptime_ticks());
+    return 0;
+}
+
+static void publish(const struct burst_sample* sample) {
+    k_spinlock_key_t key = k_spin_lock(&published_lock);
+    published = *sample;
+    published_valid = true;
+    k_spin_unlock(&published_lock, key);
+}
+
+/**
+ * @brief Check whether the trigger fires on a sample.
+ *
+ * @param [in] sample The sample just taken.
+ * @param [in] previous The sample before it, or NULL if there is none.
+ */
+static bool triggered(const struct burst_sample* sample,
+                      const struct burst_sample* previous) {
+    if (atomic_cas(&fire_requested, 1, 0)) {
+        return true;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&trigger_lock);
+    const struct burst_trigger t = trigger;
+    k_spin_unlock(&trigger_lock, key);
+
+    if (previous == NULL) {
+        return false;
+    }
+
+    const int64_t now = sample->nanoamps[t.channel];
+    const int64_t before = previous->nanoamps[t.channel];
+
+    // The level only fires when it is crossed, not for as long as it is
+    // exceeded.
+    if (t.level_na > 0 && llabs(now) >= t.level_na
+            && llabs(before) < t.level_na) {
+        return true;
+    }
+
+    return t.slope_na > 0 && llabs(now - before) >= t.slope_na;
+}
+
+/**
+ * @brief Copy the last burst_len samples of the ring out for the writer.
+ */
+static void hand_over_burst(void) {
+    burst_len = ring_filled;
+    const size_t first = (ring_head + BURST_SAMPLES - ring_filled)
+        % BURST_SAMPLES;
+    for (size_t i = 0; i < burst_len; i++) {
+        burst[i] = ring[(first + i) % BURST_SAMPLES];
+    }
+    burst_number++;
+
+    k_sem_give(&burst_ready);
+}
+
+static void sample_thread_runnable(void* p0, void* p1, void* p2) {
+    LOG_INF("Sampling the amplifier at %d Hz...",
+            CONFIG_BIOLOGGER_BURST_RATE_HZ);
+
+    const int64_t start_ticks = k_uptime_ticks();
+    uint64_t period = 0;
+
+    bool failing = false;
+    bool capturing = false;
+    size_t post_remaining = 0;
+
+    while (true) {
+        // Each deadline is computed from the start so rounding never adds up.
+        k_sleep(K_TIMEOUT_ABS_TICKS(start_ticks + k_us_to_ticks_floor64(
+            period * 1000 * 1000 / CONFIG_BIOLOGGER_BURST_RATE_HZ)));
+        period++;
+
+        struct burst_sample sample;
+        int err;
+        if ((err = acquire(&sample)) != 0) {
+            atomic_inc(&sample_errors);
+            if (!failing) {
+                LOG_WRN("Failed to sample the amplifier (%d).", err);
+            }
+            failing = true;
+            continue;
+        }
+        if (failing) {
+            LOG_INF("Amplifier samples recovered.");
+        }
+        failing = false;
+        publish(&sample);
+
+        const struct burst_sample* previous = ring_filled == 0 ? NULL
+            : &ring[(ring_head + BURST_SAMPLES - 1) % BURST_SAMPLES];
+        const bool fired = triggered(&sample, previous);
+
+        ring[ring_head] = sample;
+        ring_head = (ring_head + 1) % BURST_SAMPLES;
+        ring_filled = MIN(ring_filled + 1, BURST_SAMPLES);
+
+        if (capturing) {
+            // Triggers during a capture are part of the same burst.
+            post_remaining--;
+        } else if (fired) {
+            if (atomic_get(&writer_busy)) {
+                atomic_inc(&bursts_missed);
+                continue;
+            }
+            atomic_set(&writer_busy, 1);
+            capturing = true;
+            post_remaining = POST_SAMPLES;
+            // Only the samples from here on and the PRE_SAMPLES before count.
+            ring_filled = MIN(ring_filled, PRE_SAMPLES + 1);
+        }
+
+        if (capturing && post_remaining == 0) {
+            capturing = false;
+            hand_over_burst();
+        }
+    }
+}
+
+/******************************************************************************
+ * Writing.
+ *****************************************************************************/
+
+static int write_chunk(const char* buf, size_t len) {
+    return storage_write_row(burst_storage, STORAGE_STREAM_BURST,
+                             (struct strv) { (char*)buf, len },
+                             K_MSEC(WRITE_TIMEOUT_MS));
+}
+
+static void write_burst(void) {
+    int err;
+
+    if (!header_written) {
+        if ((err = write_chunk(HEADER, sizeof(HEADER) - 1)) != 0) {
+            LOG_ERR("Failed to write the burst header (%d).", err);
+            return;
+        }
+        header_written = true;
+    }
+
+    // Samples carry the uptime. Line it up with the experiment timestamps.
+    const int64_t offset_us =
+        trutime_millis_since(burst_trutime,
+                             experiment_start_time(burst_experiment)) * 1000
+        - (int64_t)k_ticks_to_us_floor64(k_uptime_ticks());
+
+    size_t len = 0;
+    size_t rows = 0;
+    for (size_t i = 0; i < burst_len; i++) {
+        const struct burst_sample* s = &burst[i];
+        const int n = snprintk(chunk_buf + len, sizeof(chunk_buf) - len,
+                               "%s%lld,%u,%d,%d,%d,%d", len == 0 ? "" : "\n",
+                               s->uptime_us + offset_us, burst_number,
+                               s->nanoamps[0], s->nanoamps[1],
+                               s->nanoamps[2], s->nanoamps[3]);
+        len = MIN(len + MAX(n, 0), sizeof(chunk_buf) - 1);
+        rows++;
+
+        if (rows < CHUNK_ROWS && i + 1 < burst_len) {
+            continue;
+        }
+
+        if ((err = write_chunk(chunk_buf, len)) != 0) {
+            LOG_WRN("Dropped %u burst rows (%d).", (unsigned int)rows, err);
+            atomic_add(&rows_dropped, rows);
+        }
+        len = 0;
+        rows = 0;
+        k_msleep(WRITE_PAUSE_MS);
+    }
+}
+
+static void write_thread_runnable(void* p0, void* p1, void* p2) {
+    while (true) {
+        k_sem_take(&burst_ready, K_FOREVER);
+
+        write_burst();
+        atomic_inc(&bursts_written);
+        LOG_INF("Wrote burst %u.", burst_number);
+
+        atomic_set(&writer_busy, 0);
+    }
+}
+
+/******************************************************************************
+ * Public interface.
+ *****************************************************************************/
+
+int burst_init(storage_t storage, trutime_t trutime,
+               const struct experiment* experiment) {
+    if (!device_is_ready(ximpedance_amp)) {
+        LOG_ERR("The transimpedance amplifier is not ready.");
+        return -ENODEV;
+    }
+
+    burst_storage = storage;
+    burst_trutime = trutime;
+    burst_experiment = experiment;
+
+    k_thread_create(
+        &write_thread_data,
+        write_thread_stack,
+        K_THREAD_STACK_SIZEOF(write_thread_stack),
+        write_thread_runnable, NULL, NULL, NULL,
+        THREAD_BURST_WRITE_PRIORITY, 0, K_NO_WAIT
+    );
+    k_thread_name_set(&write_thread_data, "burst_write");
+
+    k_thread_create(
+        &sample_thread_data,
+        sample_thread_stack,
+        K_THREAD_STACK_SIZEOF(sample_thread_stack),
+        sample_thread_runnable, NULL, NULL, NULL,
+        THREAD_BURST_SAMPLE_PRIORITY, 0, K_NO_WAIT
+    );
+    k_thread_name_set(&sample_thread_data, "burst_sample");
+
+    LOG_INF("Capturing %d samples before and %d after each trigger.",
+            PRE_SAMPLES, POST_SAMPLES);
+    return 0;
+}
+
+int burst_latest(struct burst_sample* out) {
+    k_spinlock_key_t key = k_spin_lock(&published_lock);
+    const bool valid = published_valid;
+    *out = published;
+    k_spin_unlock(&published_lock, key);
+
+    if (!valid) {
+        return -ENODATA;
+    }
+
+    if (k_uptime_get() - out->uptime_us / 1000 > STALE_AFTER_MS) {
+        return -ESTALE;
+    }
+
+    return 0;
+}
+
+int burst_trigger_set(const struct burst_trigger* t) {
+    if (t->channel >= XIMPEDANCE_AMP_V1_CHANNELS) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&trigger_lock);
+    trigger = *t;
+    k_spin_unlock(&trigger_lock, key);
+    return 0;
+}
+
+void burst_trigger_get(struct burst_trigger* t) {
+    k_spinlock_key_t key = k_spin_lock(&trigger_lock);
+    *t = trigger;
+    k_spin_unlock(&trigger_lock, key);
+}
+
+void burst_fire(void) {
+    atomic_set(&fire_requested, 1);
+}
+
+void burst_stats_get(struct burst_stats* stats) {
+    stats->bursts_written = atomic_get(&bursts_written);
+    stats->bursts_missed = atomic_get(&bursts_missed);
+    stats->rows_dropped = atomic_get(&rows_dropped);
+    stats->sample_errors = atomic_get(&sample_errors);
+}
+
+/******************************************************************************
+ * Shell commands.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+static int cmd_trigger(const struct shell* sh, size_t argc, char** argv) {
+    long values[3];
+    for (size_t i = 0; i < ARRAY_SIZE(values); i++) {
+        char* end;
+        values[i] = strtol(argv[i + 1], &end, 10);
+        if (*end != '\0' || values[i] < 0 || values[i] > INT32_MAX) {
+            shell_error(sh, "Invalid value: %s", argv[i + 1]);
+            return -EINVAL;
+        }
+    }
+
+    const struct burst_trigger t = {
+        .channel = values[0] < UINT8_MAX ? values[0] : UINT8_MAX,
+        .level_na = values[1],
+        .slope_na = values[2],
+    };
+    if (burst_trigger_set(&t) != 0) {
+        shell_error(sh, "Invalid channel: %s", argv[1]);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int cmd_fire(const struct shell* sh, size_t argc, char** argv) {
+    burst_fire();
+    return 0;
+}
+
+static int cmd_status(const struct shell* sh, size_t argc, char** argv) {
+    struct burst_trigger t;
+    burst_trigger_get(&t);
+    struct burst_stats stats;
+    burst_stats_get(&stats);
+
+    shell_print(sh, "Channel %u, level %d nA, slope %d nA", t.channel,
+                t.level_na, t.slope_na);
+    shell_print(sh, "Wrote %u bursts, missed %u, dropped %u rows, "
+                "%u sample errors", stats.bursts_written, stats.bursts_missed,
+                stats.rows_dropped, stats.sample_errors);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(burst_cmds,
+    SHELL_CMD_ARG(trigger, NULL, "Fire on <channel> crossing <level nA> or "
+                  "changing by <slope nA>, 0 to never.", cmd_trigger, 4, 0),
+    SHELL_CMD(fire, NULL, "Capture a burst right now.", cmd_fire),
+    SHELL_CMD(status, NULL, "Show the trigger and counters.", cmd_status),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((biologger), burst, &burst_cmds,
+                 "Event-triggered burst capture.", NULL, 0, 0);
+#endif
@@ -0,0 +1,125 @@
+/**
+ * @brief Captures short events on the transimpedance amplifier at a much
+ *        higher rate than the experiment samples.
+ *
+ * @details
+ * A dedicated thread samples every amplifier channel at
+ * CONFIG_BIOLOGGER_BURST_RATE_HZ into a RAM ring holding the last
+ * CONFIG_BIOLOGGER_BURST_PRE_SAMPLES samples. When the trigger fires, the
+ * thread keeps sampling for CONFIG_BIOLOGGER_BURST_POST_SAMPLES more, then
+ * hands the whole burst to a low-priority thread which appends it to the
+ * transaction's "<start time>.burst.csv" file:
+ *
+ *   Timestamp [us],Burst [#],Current 22KX 1 [nA],...,Current 10KX 2 [nA]
+ *
+ * Timestamps are in microseconds since the start of the experiment, and every
+ * burst gets its own number. A trigger that fires while the previous burst is
+ * still being written is counted as missed.
+ *
+ * The trigger watches a single channel and fires when
+ *
+ * - its magnitude rises to the level, or
+ * - it changes by at least the slope from one sample to the next.
+ *
+ * Either is turned off by setting it to 0. The trigger is set from the shell:
+ *
+ *   biologger burst trigger <channel> <level nA> <slope nA>
+ *   biologger burst fire      Capture a burst right now.
+ *   biologger burst status    Show the trigger and counters.
+ *
+ * This thread owns the amplifier. The experiment reads the latest sample with
+ * burst_latest instead of fetching the sensor itself, so the amplifier is only
+ * ever read from one thread.
+ */
+#ifndef BURST_H
+#define BURST_H
+
+#include "experiment.h"
+#include "sensor/ximpedance_amp/ximpedance_amp.h"
+#include "trutime.h"
+#include <stdint.h>
+
+/**
+ * @brief A single sample of every amplifier channel.
+ */
+struct burst_sample {
+    /*!< The uptime at which the sample was taken. */
+    int64_t uptime_us;
+    /*!< The current of every channel, in driver order. */
+    int32_t nanoamps[XIMPEDANCE_AMP_V1_CHANNELS];
+#if defined(CONFIG_BIOLOGGER_RAW_CURRENTS)
+    /*!< The ADC code every current was computed from. */
+    int16_t codes[XIMPEDANCE_AMP_V1_CHANNELS];
+#endif
+};
+
+/**
+ * @brief What fires the trigger.
+ */
+struct burst_trigger {
+    /*!< The amplifier channel watched, in driver order. */
+    uint8_t channel;
+    /*!< Fire when the magnitude rises to this, 0 to never. */
+    int32_t level_na;
+    /*!< Fire when consecutive samples differ by this, 0 to never. */
+    int32_t slope_na;
+};
+
+/**
+ * @brief Counters describing the captures so far.
+ */
+struct burst_stats {
+    /*!< The number of bursts written to storage. */
+    uint32_t bursts_written;
+    /*!< The number of triggers ignored while a burst was being written. */
+    uint32_t bursts_missed;
+    /*!< The number of burst rows the storage did not accept. */
+    uint32_t rows_dropped;
+    /*!< The number of samples which could not be read from the amplifier. */
+    uint32_t sample_errors;
+};
+
+/**
+ * @brief Start sampling the amplifier and watching the trigger.
+ *
+ * @param [in] storage The storage to write bursts to.
+ * @param [in] trutime The clock the experiment timestamps come from.
+ * @param [in] experiment The experiment, for its start time.
+ *
+ * @return 0 on success, -ENODEV if the amplifier is not ready.
+ */
+int burst_init(storage_t storage, trutime_t trutime,
+               const struct experiment* experiment);
+
+/**
+ * @brief Retrieve the latest sample. Never blocks.
+ *
+ * @return 0 on success, -ENODATA if nothing was sampled yet, -ESTALE if the
+ *         latest sample is older than ten sampling periods. out is filled in
+ *         either way.
+ */
+int burst_latest(struct burst_sample* out);
+
+/**
+ * @brief Change what fires the trigger.
+ *
+ * @return 0 on success, -EINVAL if the channel does not exist.
+ */
+int burst_trigger_set(const struct burst_trigger* trigger);
+
+/**
+ * @brief Retrieve what fires the trigger.
+ */
+void burst_trigger_get(struct burst_trigger* trigger);
+
+/**
+ * @brief Fire the trigger on the next sample.
+ */
+void burst_fire(void);
+
+/**
+ * @brief Retrieve the burst counters.
+ */
+void burst_stats_get(struct burst_stats* stats);
+
+#endif /* BURST_H */
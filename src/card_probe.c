@@ -0,0 +1,188 @@
+#include "card_probe.h"
+#include <stdio.h>
+#include <sys/errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#define PROBE_BYTES (CONFIG_BIOLOGGER_CARD_PROBE_KIB * 1024u)
+#define MAX_SYNC_BYTES (CONFIG_BIOLOGGER_CARD_PROBE_MAX_SYNC_KIB * 1024u)
+#define PROBE_FILE_NAME "probe.tmp"
+#define MAX_PATH 64
+
+LOG_MODULE_REGISTER(card_probe);
+
+/**
+ * @brief Append up to PROBE_BYTES in writes of size and sync them. Stops
+ *        writing early once budget_ticks have passed.
+ */
+static int timed_run(const struct storage_backend* backend,
+                     struct storage_backend_file* file, const uint8_t* buf,
+                     size_t size, int64_t budget_ticks,
+                     struct card_probe_result* result,
+                     uint32_t* worst_sync_us) {
+    const struct storage_backend_api* api = backend->api;
+    uint32_t worst_cycles = 0;
+    size_t done;
+    int err;
+
+    const int64_t start = k_uptime_ticks();
+    for (done = 0;
+            done < PROBE_BYTES
+                && (done == 0 || k_uptime_ticks() - start < budget_ticks);
+            done += size) {
+        const uint32_t write_start = k_cycle_get_32();
+        const ssize_t n = api->append(backend, file, buf, size);
+        worst_cycles = MAX(worst_cycles, k_cycle_get_32() - write_start);
+
+        if (n < 0) {
+            return n;
+        }
+        if ((size_t)n != size) {
+            return -ENOSPC;
+        }
+    }
+
+    const uint32_t sync_start = k_cycle_get_32();
+    if ((err = api->sync(backend, file)) != 0) {
+        return err;
+    }
+    *worst_sync_us = MAX(*worst_sync_us,
+                         k_cyc_to_us_ceil32(k_cycle_get_32() - sync_start));
+
+    const uint64_t elapsed_us =
+        MAX(k_ticks_to_us_ceil64(k_uptime_ticks() - start), 1);
+    *result = (struct card_probe_result){
+        .write_size = size,
+        .bytes_per_s = MIN((uint64_t)done * 1000000ull / elapsed_us,
+                           UINT32_MAX),
+        .worst_write_us = k_cyc_to_us_ceil32(worst_cycles),
+    };
+    return 0;
+}
+
+/**
+ * @brief Pick the write size, alignment and sync interval from the runs.
+ */
+static void pick(struct card_profile* profile) {
+    const struct card_probe_result* chosen = NULL;
+    uint32_t best = 0;
+
+    for (size_t i = 0; i < profile->result_count; i++) {
+        best = MAX(best, profile->results[i].bytes_per_s);
+    }
+
+    for (size_t i = 0; i < profile->result_count; i++) {
+        if ((uint64_t)profile->results[i].bytes_per_s * 100
+                >= (uint64_t)best * CARD_PROBE_GOOD_ENOUGH_PCT) {
+            chosen = &profile->results[i];
+            break;
+        }
+    }
+
+    profile->write_size = chosen->write_size;
+    profile->bytes_per_s = chosen->bytes_per_s;
+    profile->worst_stall_us = MAX(chosen->worst_write_us,
+                                  profile->worst_sync_us);
+}
+
+static void pick_sync_interval(struct card_profile* profile) {
+    // The slowest sync should take at most CARD_PROBE_SYNC_BUDGET_PCT of the
+    // time it takes to write what it syncs.
+    const uint64_t bytes = (uint64_t)profile->worst_sync_us
+        * profile->bytes_per_s / 1000000ull
+        * 100 / CARD_PROBE_SYNC_BUDGET_PCT;
+    const uint64_t writes = DIV_ROUND_UP(MAX(bytes, 1), profile->write_size);
+
+    profile->sync_bytes = MAX(MIN(writes * profile->write_size,
+                                  MAX_SYNC_BYTES),
+                              profile->write_size);
+}
+
+int card_probe_run(const struct storage_backend* backend, const uint8_t* buf,
+                   size_t buf_size, uint32_t budget_ms,
+                   struct card_profile* profile) {
+    const struct storage_backend_api* api = backend->api;
+    struct storage_backend_file file;
+    char path[MAX_PATH];
+    off_t size;
+    int err;
+
+    if (api->remove == NULL) {
+        return -ENOTSUP;
+    }
+
+    // Every size gets the same share of the budget, and so does the run off
+    // alignment.
+    size_t runs = 1;
+    for (size_t write_size = CARD_PROBE_MIN_WRITE;
+            write_size <= buf_size && runs <= CARD_PROBE_MAX_RESULTS;
+            write_size *= 2) {
+        runs++;
+    }
+    const int64_t run_ticks = MAX(k_ms_to_ticks_ceil64(budget_ms) / runs, 1);
+
+    *profile = (struct card_profile){ 0 };
+    snprintf(path, sizeof(path), "%s/" PROBE_FILE_NAME, backend->root);
+
+    // A probe interrupted by a reset leaves its file behind.
+    (void)api->remove(backend, path);
+    if ((err = api->open(backend, &file, path, &size)) != 0) {
+        LOG_ERR("Failed to create %s (%d).", path, err);
+        return err;
+    }
+
+    for (size_t write_size = CARD_PROBE_MIN_WRITE;
+            write_size <= buf_size
+                && profile->result_count < CARD_PROBE_MAX_RESULTS;
+            write_size *= 2) {
+        if ((err = timed_run(backend, &file, buf, write_size, run_ticks,
+                             &profile->results[profile->result_count],
+                             &profile->worst_sync_us)) != 0) {
+            LOG_ERR("Failed to write %zu B blocks to %s (%d).", write_size,
+                    path, err);
+            goto exit_remove;
+        }
+        profile->result_count++;
+    }
+
+    if (profile->result_count == 0) {
+        err = -EINVAL;
+        goto exit_remove;
+    }
+    pick(profile);
+
+    // Every run so far wrote a multiple of every size, so they were all
+    // aligned. Shift the chosen size off by a sector to see if that matters.
+    struct card_probe_result misaligned;
+    if (profile->write_size > CARD_PROBE_MIN_WRITE) {
+        if ((err = api->append(backend, &file, buf, CARD_PROBE_MIN_WRITE))
+                    < 0
+                || (err = timed_run(backend, &file, buf, profile->write_size,
+                                    run_ticks, &misaligned,
+                                    &profile->worst_sync_us))
+                    != 0) {
+            LOG_ERR("Failed to write misaligned blocks to %s (%d).", path,
+                    err);
+            goto exit_remove;
+        }
+        profile->misaligned_bytes_per_s = misaligned.bytes_per_s;
+    } else {
+        profile->misaligned_bytes_per_s = profile->bytes_per_s;
+    }
+
+    profile->align = (uint64_t)profile->misaligned_bytes_per_s * 100
+            < (uint64_t)profile->bytes_per_s * CARD_PROBE_GOOD_ENOUGH_PCT
+        ? profile->write_size : CARD_PROBE_MIN_WRITE;
+    profile->worst_stall_us = MAX(profile->worst_stall_us,
+                                  profile->worst_sync_us);
+    pick_sync_interval(profile);
+    err = 0;
+
+exit_remove:
+    (void)api->close(backend, &file);
+    if (api->remove(backend, path) != 0) {
+        LOG_WRN("Failed to remove %s.", path);
+    }
+    return err;
+}
@@ -0,0 +1,91 @@
+/**
+ * @brief Measures how the card behaves under the writes the storage thread
+ *        issues, and picks how to size them.
+ *
+ * @details
+ * Cards differ by an order of magnitude in sustained write speed, and most
+ * only reach it with writes of several sectors which start on a multiple of
+ * their size. card_probe_run appends CONFIG_BIOLOGGER_CARD_PROBE_KIB to a
+ * scratch file next to the logs, once for every power of two from 512 B up to
+ * the write buffer, timing every write and the sync after each run. It then
+ * repeats the chosen size one sector off its alignment, and removes the file.
+ * Every run stops early once its share of the time budget is spent, since the
+ * storage thread serves no rows meanwhile.
+ *
+ * From that, it picks:
+ * - the write size: the smallest size within CARD_PROBE_GOOD_ENOUGH_PCT of the
+ *   fastest, since larger writes hold more rows back in RAM;
+ * - the alignment: the write size if writing off alignment is slower by more
+ *   than that margin, a sector otherwise;
+ * - the sync interval: enough bytes that the slowest sync costs at most
+ *   CARD_PROBE_SYNC_BUDGET_PCT of the time spent writing them, up to
+ *   CONFIG_BIOLOGGER_CARD_PROBE_MAX_SYNC_KIB.
+ *
+ * Only ever called from the storage thread.
+ */
+#ifndef CARD_PROBE_H
+#define CARD_PROBE_H
+
+#include "storage_backend.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define CARD_PROBE_MIN_WRITE 512
+// 512 B to 64 KiB.
+#define CARD_PROBE_MAX_RESULTS 8
+#define CARD_PROBE_GOOD_ENOUGH_PCT 90
+#define CARD_PROBE_SYNC_BUDGET_PCT 10
+
+/**
+ * @brief How the card fared with writes of a single size.
+ */
+struct card_probe_result {
+    uint32_t write_size;
+    /*!< Over the whole run, including the sync at its end. */
+    uint32_t bytes_per_s;
+    /*!< The slowest single write. */
+    uint32_t worst_write_us;
+};
+
+/**
+ * @brief What was measured, and what was made of it.
+ */
+struct card_profile {
+    struct card_probe_result results[CARD_PROBE_MAX_RESULTS];
+    size_t result_count;
+    /*!< The write size, one sector off its alignment. */
+    uint32_t misaligned_bytes_per_s;
+    /*!< The slowest sync of every run. */
+    uint32_t worst_sync_us;
+
+    /*!< The write size to gather rows into. */
+    uint32_t write_size;
+    /*!< Writes should end on a multiple of this many bytes of the file. */
+    uint32_t align;
+    /*!< The number of bytes to write between syncs. */
+    uint32_t sync_bytes;
+    /*!< The measured speed at write_size. */
+    uint32_t bytes_per_s;
+    /*!< The longest the card was seen to stall, in a write or a sync. */
+    uint32_t worst_stall_us;
+};
+
+/**
+ * @brief Measure the card through backend and fill in profile.
+ *
+ * @param [in] backend The backend, which must be able to remove files.
+ * @param [in] buf What to write. Its contents do not matter.
+ * @param [in] buf_size The largest write to try, a power of two of at least
+ *                      CARD_PROBE_MIN_WRITE.
+ * @param [in] budget_ms Roughly how long writing may take, in total. A sync
+ *                       which is slow to return can overrun it.
+ * @param [out] profile The measurements and the sizes picked from them.
+ *
+ * @return 0 on success, -ENOTSUP if the backend cannot remove the scratch
+ *         file, or the error of the failed operation.
+ */
+int card_probe_run(const struct storage_backend* backend, const uint8_t* buf,
+                   size_t buf_size, uint32_t budget_ms,
+                   struct card_profile* profile);
+
+#endif /* CARD_PROBE_H */
@@ -0,0 +1,75 @@
+/**
+ * @brief The columns the biologger records, in the order they are logged.
+ *
+ * @details
+ * This table is the only place a column is defined. Everything else is
+ * generated from it at compile time by experiment.h: the CSV header, the
+ * fields of struct experiment_values, the row formatter, and the code in
+ * main.c that fills every row. Each entry is
+ *
+ *   X(field, type, name, unit, source)
+ *
+ * - field  The member of struct experiment_values holding the value.
+ * - type   Its C type: float, double, int32_t or uint32_t. An int32_t column
+ *          holding INT32_MIN is missing, like a floating point one holding
+ *          NaN.
+ * - name   The column name in the CSV header.
+ * - unit   The column unit in the CSV header.
+ * - source The expression main.c evaluates to obtain the value. It may use
+ *          the err variable of collect_data_10hz to report failures.
+ *
+ * To log something new, add a line here and, if needed, the function its
+ * source calls to main.c.
+ */
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#if defined(CONFIG_BIOLOGGER_RAW_CURRENTS)
+#include "sensor/ximpedance_amp/v2i_ximpedance10x_lut.h"
+#include "sensor/ximpedance_amp/v2i_ximpedance22x_lut.h"
+#include "sensor/ximpedance_amp/ximpedance_amp.h"
+#include <zephyr/sys/util.h>
+
+/*
+ * The unit of a raw code column, e.g. "code;res=11;fs=2048mV;cal=22x-1@<hash>".
+ * A code of 2^res stands for fs at the ADC, and cal names the calibration
+ * table in calibration/ximpedance-cal/tables, with the FNV-1a hash of the
+ * table the firmware was built with.
+ */
+#define EXPERIMENT_CODE_UNIT(cal_id, cal_hash)                                \
+    "code;res=" STRINGIFY(XIMPEDANCE_AMP_ADC_RESOLUTION)                      \
+    ";fs=" STRINGIFY(XIMPEDANCE_AMP_ADC_FULL_SCALE_MV) "mV;cal="              \
+    cal_id "@" cal_hash
+#define EXPERIMENT_CODE_UNIT_22X                                              \
+    EXPERIMENT_CODE_UNIT(V2I_XIMPEDANCE22X_LUT_ID, V2I_XIMPEDANCE22X_LUT_HASH)
+#define EXPERIMENT_CODE_UNIT_10X                                              \
+    EXPERIMENT_CODE_UNIT(V2I_XIMPEDANCE10X_LUT_ID, V2I_XIMPEDANCE10X_LUT_HASH)
+
+#define EXPERIMENT_CURRENT_COLUMNS(X)                                         \
+    X(code_22kx_1, int32_t, "ADC 22KX 1", EXPERIMENT_CODE_UNIT_22X,           \
+      read_code(XIMPEDANCE_CHAN_22KX_CODE_1, &err))                           \
+    X(code_22kx_2, int32_t, "ADC 22KX 2", EXPERIMENT_CODE_UNIT_22X,           \
+      read_code(XIMPEDANCE_CHAN_22KX_CODE_2, &err))                           \
+    X(code_10kx_1, int32_t, "ADC 10KX 1", EXPERIMENT_CODE_UNIT_10X,           \
+      read_code(XIMPEDANCE_CHAN_10KX_CODE_1, &err))                           \
+    X(code_10kx_2, int32_t, "ADC 10KX 2", EXPERIMENT_CODE_UNIT_10X,           \
+      read_code(XIMPEDANCE_CHAN_10KX_CODE_2, &err))
+#else
+#define EXPERIMENT_CURRENT_COLUMNS(X)                                         \
+    X(current_22kx_1, double, "Current 22KX 1", "mA",                         \
+      read_current(XIMPEDANCE_CHAN_22KX_MILLIAMPS_1, &err))                   \
+    X(current_22kx_2, double, "Current 22KX 2", "mA",                         \
+      read_current(XIMPEDANCE_CHAN_22KX_MILLIAMPS_2, &err))                   \
+    X(current_10kx_1, double, "Current 10KX 1", "mA",                         \
+      read_current(XIMPEDANCE_CHAN_10KX_MILLIAMPS_1, &err))                   \
+    X(current_10kx_2, double, "Current 10KX 2", "mA",                         \
+      read_current(XIMPEDANCE_CHAN_10KX_MILLIAMPS_2, &err))
+#endif
+
+#define EXPERIMENT_COLUMNS(X)                                                 \
+    /* Field         Type    Name              Unit  Source */                \
+    EXPERIMENT_CURRENT_COLUMNS(X)                                             \
+    X(temperature,    double, "Temperature",    "C",                          \
+      read_temperature())
+
+#endif /* COLUMNS_H */
@@ -1,48 +1,115 @@
 #include "experiment.h"
+#include "perf.h"
+#include "sample_bus.h"
 #include "storage.h"
+#include "thread_specs.h"
 #include "trutime.h"
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/errno.h>
+#include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/sys/slist.h>
 
 #define EXPERIMENT_AUTO_FLUSH_THRESHOLD (10)
+// How long a flush may wait for the storage queue before dropping a row. This
+// must stay well below the sampling period.
+#define EXPERIMENT_WRITE_TIMEOUT_MS (10)
 
 #define MAX_CELL_WIDTH (48)
-#define MAX_COL_NAME_LEN (32)
-#define MAX_COL_UNIT_LEN (MAX_CELL_WIDTH - (MAX_COL_NAME_LEN))
+// The timestamp, interval and row count, then five statistics per column.
+#define MAX_ROLLUP_STR_LEN \
+    ((MAX_CELL_WIDTH + 1) * (3 + 5 * EXPERIMENT_COLUMN_COUNT))
 
-// Add +1 here because of the comma in the "%s," format string.
-#define MAX_ROW_STR_LEN ((MAX_CELL_WIDTH + 1) * MAX_EXPERIMENT_COLS)
+// Add +1 here because of the comma separating the cells, and another +1 for
+// the timestamp.
+#define MAX_ROW_STR_LEN ((MAX_CELL_WIDTH + 1) * (EXPERIMENT_COLUMN_COUNT + 1))
+
+BUILD_ASSERT(EXPERIMENT_ROW_STR_MAX >= MAX_ROW_STR_LEN,
+             "EXPERIMENT_ROW_STR_MAX does not fit every row.");
 
 static char row_str_buf[MAX_ROW_STR_LEN];
+static char rollup_str_buf[MAX_ROLLUP_STR_LEN];
+
+static const uint32_t rollup_intervals_s[EXPERIMENT_ROLLUP_COUNT] = {
+    CONFIG_BIOLOGGER_ROLLUP_FINE_S,
+    CONFIG_BIOLOGGER_ROLLUP_COARSE_S,
+};
 
 LOG_MODULE_REGISTER(experiment);
 
-static void free_caption(struct experiment_caption* capt) {
-    k_free(capt->column_name);
-    k_free(capt->unit);
-    k_free(capt);
+#if defined(CONFIG_SHELL)
+static struct experiment* shell_experiment;
+#endif
+
+/******************************************************************************
+ * Memory. With CONFIG_BIOLOGGER_STATIC_ALLOC everything comes from pools sized
+ * at build time, otherwise from the system heap.
+ *****************************************************************************/
+
+#if defined(CONFIG_BIOLOGGER_STATIC_ALLOC)
+// Every subscriber may fall behind at once, each holding a full queue of rows
+// nobody else still needs. The experiment holds up to
+// EXPERIMENT_AUTO_FLUSH_THRESHOLD rows, including the one it is working on,
+// the others one row each besides their queue. One more is being sampled.
+#define EXPERIMENT_ROWS_HELD                                                \
+    (EXPERIMENT_AUTO_FLUSH_THRESHOLD + SAMPLE_BUS_EXPERIMENT_DEPTH          \
+     + SAMPLE_BUS_TELEMETRY_DEPTH + 1 + SAMPLE_BUS_USB_STREAM_DEPTH + 1 + 1)
+BUILD_ASSERT(CONFIG_BIOLOGGER_STATIC_ROWS >= EXPERIMENT_ROWS_HELD,
+             "CONFIG_BIOLOGGER_STATIC_ROWS must cover the rows every "
+             "subscriber of the sample bus may hold at once.");
+
+K_MEM_SLAB_DEFINE_STATIC(row_slab, sizeof(struct experiment_row),
+                         CONFIG_BIOLOGGER_STATIC_ROWS, 8);
+
+static struct experiment experiment_data;
+static bool experiment_data_in_use;
+
+static struct experiment* alloc_experiment(void) {
+    if (experiment_data_in_use) {
+        return NULL;
+    }
+    experiment_data_in_use = true;
+    return &experiment_data;
 }
 
-static void free_row(struct experiment_row* row) {
-    k_free(row);
+static void free_experiment(struct experiment* exp) {
+    experiment_data_in_use = false;
 }
 
-static void free_columns(struct experiment* exp) {
-    // Only need to free the columns if they haven't been flushed. Otherwise,
-    // they are eagerly freed during the flush.
-    if (!exp->columns_flushed) {
-        struct experiment_caption * entry, * next;
-        SYS_SLIST_FOR_EACH_CONTAINER_SAFE(&exp->columns, entry, next, node) {
-            free_caption(entry);
-            sys_slist_remove(&exp->columns, NULL, &entry->node);
-        }
+static struct experiment_row* alloc_row(void) {
+    struct experiment_row* row;
+    if (k_mem_slab_alloc(&row_slab, (void**)&row, K_NO_WAIT) != 0) {
+        return NULL;
     }
+    return row;
+}
+
+static void free_row(struct experiment_row* row) {
+    k_mem_slab_free(&row_slab, row);
+}
+#else
+static struct experiment* alloc_experiment(void) {
+    return k_malloc(sizeof(struct experiment));
 }
 
+static void free_experiment(struct experiment* exp) {
+    k_free(exp);
+}
+
+static struct experiment_row* alloc_row(void) {
+    return k_malloc(sizeof(struct experiment_row));
+}
+
+static void free_row(struct experiment_row* row) {
+    k_free(row);
+}
+#endif
+
 /**
  * @brief Format the row of an experiment into CSV form.
  */
@@ -53,17 +120,19 @@ static struct strv format_row(
     char* write_buf = buf;
 
     // Write the relative timestamp.
-    write_buf += snprintk(write_buf, MAX_CELL_WIDTH, "%llu,",
+    write_buf += snprintk(write_buf, MAX_CELL_WIDTH, "%llu",
                           exp->millis_since_start);
 
-    // Write every single row value.
-    for (size_t i = 0; i < exp->value_count; i++) {
-        const double value = exp->values[i];
-        write_buf += snprintk(write_buf, MAX_CELL_WIDTH, "%10.10f,", value);
-    }
-
-    // Null terminate the string, overriding the last comma.
-    *(--write_buf) = 0;
+    // Write every single row value, each with the conversion for its type.
+#define FORMAT_CELL(field, type, name, unit, source)                        \
+    *write_buf++ = ',';                                                     \
+    write_buf += EXPERIMENT_VALUE_MISSING(exp->values.field)                \
+        ? snprintk(write_buf, MAX_CELL_WIDTH, "nan")                        \
+        : snprintk(write_buf, MAX_CELL_WIDTH,                               \
+                   EXPERIMENT_VALUE_FMT(exp->values.field),                 \
+                   exp->values.field);
+    EXPERIMENT_COLUMNS(FORMAT_CELL)
+#undef FORMAT_CELL
 
     return (struct strv) {
         .len = write_buf - buf,
@@ -72,63 +141,154 @@ static struct strv format_row(
 }
 
 /**
- * @brief Commit all the columns to the database.
- *
- * @todo(markovejnovic) This is some really dangerous code right here. There's
- * a ton of malloc that looks pretty scary.
+ * @brief Commit the header to the database.
  */
-static void flush_columns(struct experiment* experiment) {
+static void flush_header(struct experiment* experiment) {
+    static const char header[] = EXPERIMENT_HEADER;
+    static const char rollup_header[] = EXPERIMENT_ROLLUP_HEADER;
     int err;
-// The buffer size is large enough to match the whole column name, the units,
-// the 4 characters " [],". The format is "%s [%s],..." hence the 4 extra
-// characters.
-#define MAX_COL_STR_LEN (MAX_COL_NAME_LEN + MAX_COL_UNIT_LEN + 4)
-#define MAX_TOTAL_COL_STR_LEN (MAX_COL_STR_LEN * MAX_EXPERIMENT_COLS)
-
-    // Add +1 for '\0'.
-    char* column_str = k_malloc(MAX_TOTAL_COL_STR_LEN + 1);
-    if (column_str == NULL) {
-        LOG_ERR("Failed to initialize enough memory for column_str");
+
+    if ((err = storage_write_row(experiment->storage, STORAGE_STREAM_DATA,
+                                 (struct strv) {
+                                     (char*)header, sizeof(header) - 1
+                                 },
+                                 K_FOREVER)) != 0) {
+        LOG_ERR("Failed to write to storage (%d)", err);
+    }
+
+    if (CONFIG_BIOLOGGER_ROLLUP_FINE_S == 0
+            && CONFIG_BIOLOGGER_ROLLUP_COARSE_S == 0) {
         return;
     }
-    char* work_ptr = column_str;
+    if ((err = storage_write_row(experiment->storage, STORAGE_STREAM_ROLLUP,
+                                 (struct strv) {
+                                     (char*)rollup_header,
+                                     sizeof(rollup_header) - 1
+                                 },
+                                 K_FOREVER)) != 0) {
+        LOG_ERR("Failed to write to storage (%d)", err);
+    }
+}
 
-    // Add the timestamp column.
-    work_ptr += snprintk(work_ptr, MAX_COL_STR_LEN, "Timestamp [ms],");
+/******************************************************************************
+ * Rollups. Every column is summarized in a single pass over the rows, so a
+ * preview of a long log only needs to read the rollup file.
+ *****************************************************************************/
+
+static void rollup_reset(struct experiment_rollup* rollup, uint64_t interval) {
+    rollup->interval = interval;
+    rollup->rows = 0;
+    for (size_t c = 0; c < EXPERIMENT_COLUMN_COUNT; c++) {
+        rollup->columns[c] = (struct experiment_stats){
+            .min = INFINITY,
+            .max = -INFINITY,
+        };
+    }
+}
 
-    // For each single column, convert it to a string and append it to the
-    // "long" string representing the columns.
-    struct experiment_caption * entry;
-    SYS_SLIST_FOR_EACH_CONTAINER(&experiment->columns, entry, node) {
-        work_ptr += snprintk(work_ptr, MAX_COL_STR_LEN, "%s [%s],",
-                             entry->column_name, entry->unit);
+static void rollup_init(struct experiment* experiment) {
+    for (size_t i = 0; i < EXPERIMENT_ROLLUP_COUNT; i++) {
+        experiment->rollups[i].interval_ms = rollup_intervals_s[i] * 1000;
+        rollup_reset(&experiment->rollups[i], 0);
     }
+}
 
-    // Move the pointer back by one to delete the last ','. Null-terminate the
-    // string.
-    *(--work_ptr) = 0;
+static void stats_add(struct experiment_stats* stats, double value) {
+    if (isnan(value)) {
+        return;
+    }
 
-    const size_t str_len = work_ptr - column_str;
-    if ((err = storage_write_row(experiment->storage,
-                                 (struct strv) { column_str, str_len })) != 0) {
-        LOG_ERR("Failed to write to storage (%d)", err);
+    // Welford's update keeps the mean and variance accurate even after
+    // millions of values.
+    stats->count++;
+    const double delta = value - stats->mean;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * (value - stats->mean);
+    stats->min = MIN(stats->min, value);
+    stats->max = MAX(stats->max, value);
+}
+
+/**
+ * @brief Append the statistics of the current interval of a rollup to the
+ *        rollup file. Unknown statistics are written as NaN, like missing
+ *        values in the data.
+ */
+static void rollup_write(struct experiment* experiment,
+                         const struct experiment_rollup* rollup) {
+    char* write_buf = rollup_str_buf;
+    int err;
+
+    write_buf += snprintk(write_buf, MAX_CELL_WIDTH, "%llu,%u,%u",
+                          rollup->interval * rollup->interval_ms,
+                          rollup->interval_ms / 1000, rollup->rows);
+
+    for (size_t c = 0; c < EXPERIMENT_COLUMN_COUNT; c++) {
+        const struct experiment_stats* s = &rollup->columns[c];
+        const bool any = s->count > 0;
+
+        write_buf += snprintk(write_buf, MAX_CELL_WIDTH, ",%u", s->count);
+        write_buf += snprintk(write_buf, 4 * (MAX_CELL_WIDTH + 1),
+                              ",%10.10f,%10.10f,%10.10f,%10.10f",
+                              any ? s->mean : NAN, any ? s->min : NAN,
+                              any ? s->max : NAN,
+                              s->count > 1 ? s->m2 / (s->count - 1) : NAN);
     }
-    k_free(column_str);
 
-#undef MAX_COL_STR_LEN
-#undef MAX_TOTAL_COL_STR_LEN
+    if ((err = storage_write_row(experiment->storage, STORAGE_STREAM_ROLLUP,
+                                 (struct strv) {
+                                     rollup_str_buf, write_buf - rollup_str_buf
+                                 },
+                                 K_MSEC(EXPERIMENT_WRITE_TIMEOUT_MS))) != 0) {
+        LOG_ERR("Failed to write a rollup (%d).", err);
+    }
+}
+
+static void rollup_add(struct experiment* experiment,
+                       const struct experiment_row* row) {
+    for (size_t i = 0; i < EXPERIMENT_ROLLUP_COUNT; i++) {
+        struct experiment_rollup* rollup = &experiment->rollups[i];
+        if (rollup->interval_ms == 0) {
+            continue;
+        }
+
+        const uint64_t interval = row->millis_since_start
+            / rollup->interval_ms;
+        if (interval != rollup->interval) {
+            if (rollup->rows > 0) {
+                rollup_write(experiment, rollup);
+            }
+            rollup_reset(rollup, interval);
+        }
+
+        rollup->rows++;
+        for (size_t c = 0; c < EXPERIMENT_COLUMN_COUNT; c++) {
+            stats_add(&rollup->columns[c], experiment_row_value(row, c));
+        }
+    }
+}
+
+/**
+ * @brief Write out the intervals that are still going.
+ */
+static void rollup_finish(struct experiment* experiment) {
+    for (size_t i = 0; i < EXPERIMENT_ROLLUP_COUNT; i++) {
+        struct experiment_rollup* rollup = &experiment->rollups[i];
+        if (rollup->interval_ms != 0 && rollup->rows > 0) {
+            rollup_write(experiment, rollup);
+            rollup_reset(rollup, rollup->interval);
+        }
+    }
 }
 
 struct experiment* experiment_init(storage_t storage, trutime_t trutime) {
-    struct experiment* exp = k_malloc(sizeof(struct experiment));
+    struct experiment* exp = alloc_experiment();
     if (exp == NULL) {
         LOG_ERR("Failed to initialize enough memory in experiment_init.");
         return NULL;
     }
 
-    sys_slist_init(&exp->columns);
-    exp->column_count = 0;
-    exp->columns_flushed = false;
+    exp->header_flushed = false;
+    rollup_init(exp);
 
     sys_slist_init(&exp->rows);
     exp->rows_count = 0;
@@ -147,81 +307,58 @@ struct experiment* experiment_init(storage_t storage, trutime_t trutime) {
     }
     storage_transaction(storage, (struct tm*)&exp->start_time_utc);
 
+#if defined(CONFIG_SHELL)
+    shell_experiment = exp;
+#endif
     return exp;
 }
 
 void experiment_free(struct experiment * exp) {
     experiment_flush(exp);
-    free_columns(exp);
-
-    k_free(exp);
-}
-
-int experiment_add_column(
-    struct experiment *experiment,
-    const char * name,
-    const char * units
-) {
-    struct experiment_caption* node
-        = k_malloc(sizeof(struct experiment_caption));
-    if (node == NULL) {
-        LOG_ERR("Failed to initialize enough memory for struct "
-                "experiment_caption");
-        return -ENOMEM;
-    }
-
-    const size_t name_len = strlen(name);
-    node->column_name = k_malloc(name_len + 1);
-    if (node->column_name == NULL) {
-        k_free(node);
-        LOG_ERR("Failed to initialize enough memory for node->column_name");
-        return -ENOMEM;
-    }
-    strncpy(node->column_name, name, name_len + 1);
-
-    const size_t unit_len = strlen(units);
-    node->unit = k_malloc(unit_len + 1);
-    if (node->unit == NULL) {
-        k_free(node->column_name);
-        k_free(node);
-        LOG_ERR("Failed to initialize enough memory for node->unit");
-        return -ENOMEM;
-    }
-    strncpy(node->unit, units, unit_len + 1);
-
-    sys_slist_append(&experiment->columns, &node->node);
-    experiment->column_count++;
+    rollup_finish(exp);
 
-    return 0;
+#if defined(CONFIG_SHELL)
+    shell_experiment = NULL;
+#endif
+    free_experiment(exp);
 }
 
 struct experiment_row* experiment_row_new(
     unsigned long long millis_since_start
 ) {
     // Allocate values for the row.
-    struct experiment_row* row = k_malloc(sizeof(struct experiment_row));
+    struct experiment_row* row = alloc_row();
     if (row == NULL) {
-        LOG_ERR("Could not k_malloc enough memory for an experiment_row");
+        LOG_ERR("Could not allocate enough memory for an experiment_row");
         return NULL;
     }
-    row->value_count = 0;
     row->millis_since_start = millis_since_start;
+    row->seq = 0;
+    atomic_set(&row->refs, 1);
     return row;
 }
 
+void experiment_row_ref(struct experiment_row* row) {
+    atomic_inc(&row->refs);
+}
+
+void experiment_row_unref(struct experiment_row* row) {
+    if (atomic_dec(&row->refs) == 1) {
+        free_row(row);
+    }
+}
+
 int experiment_push_row(
     struct experiment* experiment,
     struct experiment_row* row
 ) {
-    if (!experiment->columns_flushed) {
-        flush_columns(experiment);
-
-        // It is safe to deallocate the whole list now.
-        free_columns(experiment);
-
-        experiment->columns_flushed = true;
+    if (!experiment->header_flushed) {
+        flush_header(experiment);
+        experiment->header_flushed = true;
     }
 
+    rollup_add(experiment, row);
+
     sys_slist_append(&experiment->rows, &row->node);
     experiment->rows_count++;
 
@@ -238,10 +375,15 @@ int experiment_flush(struct experiment* experiment) {
     // Write every single experiment into the storage.
     struct experiment_row * entry, * next;
     SYS_SLIST_FOR_EACH_CONTAINER_SAFE(&experiment->rows, entry, next, node) {
+        PERF_BEGIN(format);
         const struct strv row_str = format_row(row_str_buf, entry);
+        PERF_END(PERF_STAGE_FORMAT, format);
 
         // Attempt to write this to persistent storage.
-        if ((err = storage_write_row(experiment->storage, row_str)) != 0) {
+        if ((err = storage_write_row(experiment->storage, STORAGE_STREAM_DATA,
+                                     row_str,
+                                     K_MSEC(EXPERIMENT_WRITE_TIMEOUT_MS)))
+                != 0) {
             LOG_ERR("Failed to push the experiment row.");
             err++;
         }
@@ -251,30 +393,425 @@ int experiment_flush(struct experiment* experiment) {
         sys_slist_remove(&experiment->rows, NULL, &entry->node);
         experiment->rows_count--;
 
-        free_row(entry);
+        experiment_row_unref(entry);
     }
 
     return err;
 }
 
-int experiment_row_add_value(struct experiment_row *row, double value) {
-    row->values[row->value_count++] = value;
+/******************************************************************************
+ * The experiment as a subscriber of the sample bus.
+ *****************************************************************************/
+
+SAMPLE_BUS_SUBSCRIBER_DEFINE(experiment_subscriber,
+                             SAMPLE_BUS_EXPERIMENT_DEPTH);
+
+K_THREAD_STACK_DEFINE(experiment_thread_stack, THREAD_EXPERIMENT_STACK_SIZE);
+static struct k_thread experiment_thread_data;
+static atomic_t subscribed = ATOMIC_INIT(0);
+
+static void experiment_thread_runnable(void* p0, void* p1, void* p2) {
+    struct experiment* experiment = p0;
+    int err;
+
+    while (true) {
+        struct experiment_row* row = sample_bus_take(&experiment_subscriber,
+                                                     K_FOREVER);
+        if (row == NULL) {
+            continue;
+        }
+
+        PERF_BEGIN(push);
+        if ((err = experiment_push_row(experiment, row)) != 0) {
+            LOG_ERR("Failed to push a row into the experiment (%d)", err);
+        }
+        PERF_END(PERF_STAGE_PUSH, push);
+    }
+}
+
+int experiment_subscribe(struct experiment* experiment) {
+    if (!atomic_cas(&subscribed, 0, 1)) {
+        return -EBUSY;
+    }
+
+    sample_bus_subscribe(&experiment_subscriber);
+
+    k_thread_create(
+        &experiment_thread_data,
+        experiment_thread_stack,
+        K_THREAD_STACK_SIZEOF(experiment_thread_stack),
+        experiment_thread_runnable, experiment, NULL, NULL,
+        THREAD_EXPERIMENT_PRIORITY, 0, K_NO_WAIT
+    );
+    k_thread_name_set(&experiment_thread_data, "experiment");
     return 0;
 }
 
+uint32_t experiment_rows_dropped(void) {
+    return atomic_get(&experiment_subscriber.rows_dropped);
+}
+
+double experiment_row_value(
+    const struct experiment_row* row,
+    enum experiment_column column
+) {
+    switch (column) {
+#define ROW_VALUE(field, type, name, unit, source)                          \
+    case EXPERIMENT_COLUMN_##field:                                         \
+        return EXPERIMENT_VALUE_MISSING(row->values.field)                  \
+            ? NAN : (double)row->values.field;
+    EXPERIMENT_COLUMNS(ROW_VALUE)
+#undef ROW_VALUE
+    default:
+        return NAN;
+    }
+}
+
 const struct rtc_time* experiment_start_time(
     const struct experiment* experiment
 ) {
     return &experiment->start_time_utc;
 }
 
-struct strv experiment_row_format(struct experiment_row *row) {
-    char* memory = k_malloc(MAX_ROW_STR_LEN);
-    if unlikely(memory == NULL) {
-        LOG_ERR("Failed to allocate memory. The system is now in an "
-                "indeterminate state");
-        return (struct strv){};
+struct strv experiment_row_format(struct experiment_row *row, char* buf) {
+    return format_row(buf, row);
+}
+
+/******************************************************************************
+ * Shell commands. They read the current data file back a chunk at a time, so
+ * they only ever need a couple of small buffers and logging carries on in
+ * between the chunks.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+// Must hold at least one whole row.
+#define EXTRACT_CHUNK_SIZE 512
+// Must hold any single line of the index.
+#define INDEX_LINE_MAX 96
+
+BUILD_ASSERT(EXTRACT_CHUNK_SIZE > MAX_ROW_STR_LEN,
+             "A row must fit into a single chunk.");
+
+// Only ever touched by the shell thread.
+static char extract_buf[EXTRACT_CHUNK_SIZE];
+static char index_line_buf[INDEX_LINE_MAX];
+
+/**
+ * @brief Parse the number a line starts with.
+ *
+ * @return The number of digits, 0 if the line does not start with one.
+ */
+static size_t parse_leading_u64(const char* str, size_t len, uint64_t* out) {
+    uint64_t value = 0;
+    size_t i;
+
+    for (i = 0; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+        value = value * 10 + (str[i] - '0');
+    }
+
+    *out = value;
+    return i;
+}
+
+static int parse_arg(const struct shell* sh, const char* arg, uint64_t* out) {
+    char* end;
+
+    *out = strtoull(arg, &end, 10);
+    if (end == arg || *end != '\0') {
+        shell_error(sh, "Not a number: %s", arg);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Print the bytes [from, to) of the data file as they are.
+ */
+static int print_data(const struct shell* sh, storage_t storage, off_t from,
+                      off_t to) {
+    while (from < to) {
+        const int n = storage_read(storage, STORAGE_STREAM_DATA, from,
+                                   extract_buf,
+                                   MIN(sizeof(extract_buf), to - from), NULL);
+        if (n <= 0) {
+            return n;
+        }
+
+        shell_fprintf(sh, SHELL_NORMAL, "%.*s", n, extract_buf);
+        from += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Find where the rows of the data file start, i.e. the end of its
+ *        header.
+ */
+static int find_data_start(storage_t storage, off_t* start, off_t* size) {
+    off_t pos = 0;
+
+    while (true) {
+        const int n = storage_read(storage, STORAGE_STREAM_DATA, pos,
+                                   extract_buf, sizeof(extract_buf), size);
+        if (n <= 0) {
+            return n == 0 ? -ENODATA : n;
+        }
+
+        const char* eol = memchr(extract_buf, '\n', n);
+        if (eol != NULL) {
+            *start = pos + (eol - extract_buf) + 1;
+            return 0;
+        }
+        pos += n;
+    }
+}
+
+/**
+ * @brief Read the first whole line of the index that starts at or after pos
+ *        into index_line_buf.
+ *
+ * @param [out] start Where the line starts.
+ * @param [out] len The length of the line, without its newline.
+ * @return 0 on success, -ENOENT if there is no whole line after pos.
+ */
+static int read_index_line(storage_t storage, off_t pos, off_t* start,
+                           size_t* len) {
+    // A line starts right at pos only if the byte before it ends a line.
+    const off_t at = pos > 0 ? pos - 1 : 0;
+    int n = storage_read(storage, STORAGE_STREAM_INDEX, at, index_line_buf,
+                         sizeof(index_line_buf), NULL);
+    if (n <= 0) {
+        return n == 0 ? -ENOENT : n;
+    }
+
+    size_t skip = 0;
+    if (pos > 0) {
+        const char* eol = memchr(index_line_buf, '\n', n);
+        if (eol == NULL) {
+            return -ENOENT;
+        }
+        skip = eol - index_line_buf + 1;
+    }
+    *start = at + skip;
+
+    const char* eol = memchr(index_line_buf + skip, '\n', n - skip);
+    if (eol != NULL) {
+        *len = eol - (index_line_buf + skip);
+        memmove(index_line_buf, index_line_buf + skip, *len);
+        return 0;
+    }
+
+    // The line goes on past what was read, read it again from its start.
+    n = storage_read(storage, STORAGE_STREAM_INDEX, *start, index_line_buf,
+                     sizeof(index_line_buf), NULL);
+    if (n <= 0) {
+        return n == 0 ? -ENOENT : n;
+    }
+    eol = memchr(index_line_buf, '\n', n);
+    if (eol == NULL) {
+        return -ENOENT;
+    }
+    *len = eol - index_line_buf;
+    return 0;
+}
+
+/**
+ * @brief Find the first "<timestamp>,<offset>" entry of the index which starts
+ *        in [pos, end), skipping its header and footers.
+ *
+ * @param [out] next Where the line after the entry starts.
+ */
+static int next_index_entry(storage_t storage, off_t pos, off_t end,
+                            uint64_t* ms, uint64_t* offset, off_t* next) {
+    int err;
+
+    while (pos < end) {
+        off_t start;
+        size_t len;
+        if ((err = read_index_line(storage, pos, &start, &len)) != 0) {
+            return err;
+        }
+        if (start >= end) {
+            break;
+        }
+        pos = start + len + 1;
+
+        const size_t digits = parse_leading_u64(index_line_buf, len, ms);
+        if (digits > 0 && digits < len && index_line_buf[digits] == ','
+                && parse_leading_u64(index_line_buf + digits + 1,
+                                     len - digits - 1, offset) > 0) {
+            *next = pos;
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+/**
+ * @brief Binary search the index for where the rows at or after ms start.
+ *
+ * @return The offset of the last entry at or before ms, or data_start if
+ *         there is none or no index at all.
+ */
+static off_t index_seek(storage_t storage, uint64_t ms, off_t data_start) {
+    off_t size;
+    off_t best = data_start;
+
+    if (storage_read(storage, STORAGE_STREAM_INDEX, 0, index_line_buf, 0,
+                     &size) < 0) {
+        return best;
     }
 
-    return format_row(memory, row);
+    // Every entry before the first one past ms is at or before it. The entry
+    // starting at or after mid is either the best so far, or shows that
+    // nothing from mid on is.
+    off_t lo = 0;
+    off_t hi = size;
+    while (lo < hi) {
+        const off_t mid = lo + (hi - lo) / 2;
+        uint64_t entry_ms, entry_offset;
+        off_t next;
+
+        if (next_index_entry(storage, mid, hi, &entry_ms, &entry_offset,
+                             &next) != 0 || entry_ms > ms) {
+            hi = mid;
+        } else {
+            best = entry_offset;
+            lo = next;
+        }
+    }
+
+    return MAX(best, data_start);
 }
+
+static int cmd_experiment_tail(const struct shell* sh, size_t argc,
+                               char** argv) {
+    uint64_t rows;
+    off_t data_start, size;
+    int err;
+
+    if (shell_experiment == NULL) {
+        shell_error(sh, "There is no experiment running.");
+        return -ENODEV;
+    }
+    storage_t storage = shell_experiment->storage;
+
+    if ((err = parse_arg(sh, argv[1], &rows)) != 0) {
+        return err;
+    }
+
+    if ((err = find_data_start(storage, &data_start, &size)) != 0) {
+        shell_error(sh, "Could not read the log (%d).", err);
+        return err;
+    }
+
+    // Walk back from the end of the file one chunk at a time until the end of
+    // the row before the ones to print is found. The file ends with the end
+    // of the last row.
+    off_t start = data_start;
+    off_t pos = size;
+    uint64_t row_ends = 0;
+    while (pos > data_start && start == data_start) {
+        const off_t chunk_start = MAX(pos - (off_t)sizeof(extract_buf),
+                                      data_start);
+        const int n = storage_read(storage, STORAGE_STREAM_DATA, chunk_start,
+                                   extract_buf, pos - chunk_start, NULL);
+        if (n <= 0) {
+            shell_error(sh, "Could not read the log (%d).", n);
+            return n == 0 ? -EIO : n;
+        }
+
+        for (int i = n - 1; i >= 0; i--) {
+            if (extract_buf[i] == '\n' && row_ends++ == rows) {
+                start = chunk_start + i + 1;
+                break;
+            }
+        }
+        pos = chunk_start;
+    }
+
+    if ((err = print_data(sh, storage, 0, data_start)) != 0
+            || (err = print_data(sh, storage, start, size)) != 0) {
+        shell_error(sh, "Could not read the log (%d).", err);
+    }
+    return err;
+}
+
+static int cmd_experiment_range(const struct shell* sh, size_t argc,
+                                char** argv) {
+    uint64_t from_ms, to_ms;
+    off_t data_start, size;
+    int err;
+
+    if (shell_experiment == NULL) {
+        shell_error(sh, "There is no experiment running.");
+        return -ENODEV;
+    }
+    storage_t storage = shell_experiment->storage;
+
+    if ((err = parse_arg(sh, argv[1], &from_ms)) != 0
+            || (err = parse_arg(sh, argv[2], &to_ms)) != 0) {
+        return err;
+    }
+
+    if ((err = find_data_start(storage, &data_start, &size)) != 0) {
+        shell_error(sh, "Could not read the log (%d).", err);
+        return err;
+    }
+    if ((err = print_data(sh, storage, 0, data_start)) != 0) {
+        shell_error(sh, "Could not read the log (%d).", err);
+        return err;
+    }
+
+    // Scan forward from the closest index entry, a chunk of whole rows at a
+    // time, until the rows are past the range.
+    off_t pos = index_seek(storage, from_ms, data_start);
+    while (true) {
+        const int n = storage_read(storage, STORAGE_STREAM_DATA, pos,
+                                   extract_buf, sizeof(extract_buf), NULL);
+        if (n < 0) {
+            shell_error(sh, "Could not read the log (%d).", n);
+            return n;
+        }
+
+        size_t line_start = 0;
+        for (size_t i = 0; i < (size_t)n; i++) {
+            if (extract_buf[i] != '\n') {
+                continue;
+            }
+
+            const char* line = extract_buf + line_start;
+            const size_t len = i - line_start;
+            uint64_t ms;
+            if (parse_leading_u64(line, len, &ms) > 0) {
+                if (ms > to_ms) {
+                    return 0;
+                }
+                if (ms >= from_ms) {
+                    shell_fprintf(sh, SHELL_NORMAL, "%.*s\n", (int)len, line);
+                }
+            }
+            line_start = i + 1;
+        }
+
+        // Either the end of the file, or a row cut off by a power loss.
+        if (line_start == 0) {
+            return 0;
+        }
+        pos += line_start;
+    }
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(experiment_cmds,
+    SHELL_CMD_ARG(tail, NULL, "Print the last <rows> rows of the log.",
+                  cmd_experiment_tail, 2, 0),
+    SHELL_CMD_ARG(range, NULL,
+                  "Print the rows from <from ms> to <to ms>, inclusive.",
+                  cmd_experiment_range, 3, 0),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((biologger), experiment, &experiment_cmds,
+                 "Read back the log being written.", NULL, 0, 0);
+#endif
@@ -4,23 +4,24 @@
  *
  * Example:
  * @code{.c}
- * // Initialize the experiment.
- * struct experiment* experiment = experiment_init(storage);
- *
- * // Add columns to the experiment.
- * experiment_add_column(experiment, "Windspeed X", "m/s");
- * experiment_add_column(experiment, "Windspeed Y", "m/s");
+ * // The columns are defined in columns.h, e.g.
+ * //   X(windspeed_x, float, "Windspeed X", "m/s", windspeed_x_sample_get())
+ * //   X(windspeed_y, float, "Windspeed Y", "m/s", windspeed_y_sample_get())
  *
- * // Perform some measurements, for the sake of the example.
- * const double windspeed_x = windspeed_x_sample_get();
- * const double windspeed_y = windspeed_y_sample_get();
+ * // Initialize the experiment.
+ * struct experiment* experiment = experiment_init(storage, trutime);
  *
- * // Create a new row.
- * struct experiment_row* row = experiment_row_new();
- * experiment_row_add_value(row, windspeed_x);
- * experiment_row_add_value(row, windspeed_y);
+ * // Create a new row and fill in its values.
+ * struct experiment_row* row = experiment_row_new(millis_since_start);
+ * row->values.windspeed_x = windspeed_x_sample_get();
+ * row->values.windspeed_y = windspeed_y_sample_get();
  * experiment_push_row(experiment, row);
  *
+ * // Or, instead of pushing rows directly, have the experiment take them off
+ * // the sample bus on a thread of its own.
+ * experiment_subscribe(experiment);
+ * sample_bus_publish(row);
+ *
  * // ...
  * // When the application is destroyed, ensure you destroy the experiment to
  * // ensure it is fully flushed.
@@ -30,14 +31,98 @@
 #ifndef EXPERIMENT_H
 #define EXPERIMENT_H
 
+#include "columns.h"
 #include "trutime.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/sys/slist.h>
+#include <zephyr/toolchain.h>
+
+/******************************************************************************
+ * Generated from the EXPERIMENT_COLUMNS table in columns.h.
+ *****************************************************************************/
+
+#define EXPERIMENT_COLUMN_INDEX_(field, type, name, unit, source) \
+    EXPERIMENT_COLUMN_##field,
+#define EXPERIMENT_COLUMN_FIELD_(field, type, name, unit, source) type field;
+#define EXPERIMENT_COLUMN_HEADER_(field, type, name, unit, source) \
+    "," name " [" unit "]"
+#define EXPERIMENT_ROLLUP_HEADER_(field, type, name, unit, source)      \
+    "," name " count [#]," name " mean [" unit "]," name " min [" unit  \
+    "]," name " max [" unit "]," name " variance [" unit "^2]"
+
+/**
+ * @brief The index of every column, e.g. EXPERIMENT_COLUMN_temperature.
+ */
+enum experiment_column {
+    EXPERIMENT_COLUMNS(EXPERIMENT_COLUMN_INDEX_)
+
+    EXPERIMENT_COLUMN_COUNT,
+};
 
-#define MAX_EXPERIMENT_COLS (128)
+/**
+ * @brief The values of a single row, one typed field per column.
+ */
+struct __packed experiment_values {
+    EXPERIMENT_COLUMNS(EXPERIMENT_COLUMN_FIELD_)
+};
+
+/*!< The CSV header, as a string constant. */
+#define EXPERIMENT_HEADER \
+    "Timestamp [ms]" EXPERIMENT_COLUMNS(EXPERIMENT_COLUMN_HEADER_)
+
+/*!< The header of the rollup file, as a string constant. */
+#define EXPERIMENT_ROLLUP_HEADER                 \
+    "Timestamp [ms],Interval [s],Rows [#]"       \
+    EXPERIMENT_COLUMNS(EXPERIMENT_ROLLUP_HEADER_)
+
+/*!< The number of rollup intervals, see CONFIG_BIOLOGGER_ROLLUP_*_S. */
+#define EXPERIMENT_ROLLUP_COUNT 2
+
+/*!< The printf conversion a value of the given type is formatted with. */
+#define EXPERIMENT_VALUE_FMT(value) _Generic((value), \
+    float: "%10.10f",                                  \
+    double: "%10.10f",                                 \
+    int32_t: "%d",                                     \
+    uint32_t: "%u")
+
+/*!< Whether a value is missing, i.e. NaN or an int32_t INT32_MIN. */
+#define EXPERIMENT_VALUE_MISSING(value) _Generic((value), \
+    float: (value) != (value),                             \
+    double: (value) != (value),                            \
+    int32_t: (value) == INT32_MIN,                         \
+    uint32_t: false)
+
+/*!< The size of a buffer any formatted row fits in, including the '\0'. */
+#define EXPERIMENT_ROW_STR_MAX ((48 + 1) * (EXPERIMENT_COLUMN_COUNT + 1))
 
 // Forward declaration required in experiment_init.
 typedef struct storage* storage_t;
 
+/**
+ * @brief The running statistics of a single column over an interval, kept
+ *        with Welford's algorithm. NaN values are left out.
+ */
+struct experiment_stats {
+    uint32_t count;
+    double mean;
+    double m2; /*!< The sum of squared differences from the mean. */
+    double min;
+    double max;
+};
+
+/**
+ * @brief The statistics of every column over the current interval of a
+ *        rollup.
+ */
+struct experiment_rollup {
+    uint32_t interval_ms; /*!< 0 if this rollup is disabled. */
+    uint64_t interval; /*!< The index of the current interval. */
+    uint32_t rows; /*!< The rows in the current interval. */
+    struct experiment_stats columns[EXPERIMENT_COLUMN_COUNT];
+};
+
 /**
  * @brief Represents an ongoing experiment.
  *
@@ -46,36 +131,33 @@ typedef struct storage* storage_t;
  * time, offset from a start time. Data is a matrix of columns representing the
  * axes of the experiment and rows representing increasing values in time.
  *
- * This structure encodes this meaning in two linked lists. The columns
- * linked list is a set of axes the user defines via the experiment_add_column
- * function. The rows are represented as a linked list of rows. A new row is
- * added with experiment_push_row.
+ * The columns are fixed at compile time by columns.h. The rows are
+ * represented as a linked list of rows. A new row is added with
+ * experiment_push_row.
  */
 struct experiment {
     struct rtc_time start_time_utc; /*!< The experiment start time. */
 
-    sys_slist_t columns; /*!< The columns linked list. */
-    size_t column_count; /*!< The total number of columns */
-    bool columns_flushed; /*!< Whether the columns have been flushed. */
+    bool header_flushed; /*!< Whether the header has been written. */
 
     sys_slist_t rows; /*!< The rows linked list. */
     size_t rows_count; /*!< The total number of rows. */
 
+    /*!< Summaries of every column, see experiment_push_row. */
+    struct experiment_rollup rollups[EXPERIMENT_ROLLUP_COUNT];
+
     storage_t storage; /*!< A reference to the application storage. */
     trutime_t trutime; /*!< A reference to the application clock provider. */
 };
 
-struct experiment_caption {
-    char* column_name;
-    char* unit;
-    sys_snode_t node;
-};
-
 struct experiment_row {
-    double values[MAX_EXPERIMENT_COLS];
-    size_t value_count;
+    struct experiment_values values;
     sys_snode_t node;
     unsigned long long millis_since_start;
+    /*!< Numbered by sample_bus_publish, from 0 on. */
+    uint32_t seq;
+    /*!< The row goes back to the pool once the last reference is dropped. */
+    atomic_t refs;
 };
 
 /**
@@ -89,65 +171,86 @@ struct experiment* experiment_init(storage_t storage, trutime_t trutime);
 
 void experiment_free(struct experiment*);
 
-/**
- * Allocate and add a new column to an already open experiment.
- *
- * @param [in] experiment The experiment to add a column to.
- * @param [in] name The new column name.
- * @param [in] units The column units.
- *
- * @return 0 On a successful addition or -ENOMEM if the device is OOM.
- *
- * @warning It is illegal to add a column after the first row has been added.
- */
-int experiment_add_column(struct experiment* experiment,
-                          const char* name, const char* units);
-
 /**
  * @brief Create a new heap-allocated experiment row.
  * @param [in] millis_since_start The total count of milliseconds since the
  *                                experiment was started.
+ *
+ * @return The row, holding a single reference for the caller.
  */
 struct experiment_row* experiment_row_new(
     unsigned long long millis_since_start
 );
 
 /**
- * @brief Append a new value to the experiment.
+ * @brief Take another reference to a row. Safe from any thread.
+ */
+void experiment_row_ref(struct experiment_row* row);
+
+/**
+ * @brief Drop a reference to a row, freeing it if it was the last one. Safe
+ *        from any thread.
+ */
+void experiment_row_unref(struct experiment_row* row);
+
+/**
+ * @brief Read a value of a row by its column index, e.g. to serialize every
+ *        column in turn.
  *
- * @param [in] row The experiment row to add values into.
- * @param [in] value The new value to push
+ * @param [in] row The experiment row.
+ * @param [in] column The column index.
  *
- * @note Experiment values must be pushed into the row in the same order that
- *       the columns were defined.
+ * @return The value, or NAN if the column does not exist.
  */
-int experiment_row_add_value(struct experiment_row* row, double value);
+double experiment_row_value(const struct experiment_row* row,
+                            enum experiment_column column);
 
 /**
- * @brief Format a row to a new heap-allocated string. The string is guaranteed
- *        to be null-terminated.
- * @warning This new string MUST be k_freed.
+ * @brief Format a row into buf, exactly as it is written to storage. The
+ *        string is guaranteed to be null-terminated.
  *
  * @param [in] row The experiment row to format.
+ * @param [out] buf At least EXPERIMENT_ROW_STR_MAX bytes to format into.
  */
-struct strv experiment_row_format(struct experiment_row* row);
+struct strv experiment_row_format(struct experiment_row* row, char* buf);
 
 /**
  * @brief Append a new row to an already-open experiment.
  *
  * @param [in] experiment The experiment to add a new row to.
  * @param [in] row A pointer to a heap-allocated row. This row must already be
- *                 initialized. This function will take ownership of the row.
+ *                 initialized. This function takes over the caller's
+ *                 reference to the row.
  *
- * @warning data MUST be an array of floats containing as many elements as
- *          columns have been defined. This function will not perform said
- *          validation.
+ * @note The row is also added to the rollups. Once a row falls into the next
+ *       interval of a rollup, the statistics of the previous one are appended
+ *       to the rollup file. experiment_free writes out the last, partial
+ *       intervals.
  *
  * @return 0 on success, -ENOMEM if the device is out of memory.
  */
 int experiment_push_row(struct experiment* experiment,
                         struct experiment_row* data);
 
+/**
+ * @brief Push every row published on the sample bus into the experiment, from
+ *        a thread of its own. Only a single experiment may subscribe.
+ *
+ * @details
+ * Formatting and writing the rows then no longer holds up the sampling
+ * thread. From here on the experiment must only be touched by that thread,
+ * apart from experiment_start_time and experiment_rows_dropped.
+ *
+ * @return 0 on success, -EBUSY if an experiment has already subscribed.
+ */
+int experiment_subscribe(struct experiment* experiment);
+
+/**
+ * @brief The number of rows published on the sample bus which never reached
+ *        the experiment because it did not keep up.
+ */
+uint32_t experiment_rows_dropped(void);
+
 /**
  * @brief Flush the experiment down into permanent storage. The object is still
  *        re-usable after this function is called.
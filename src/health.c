@@ -0,0 +1,360 @@
+#include "health.h"
+#include "perf.h"
+#include "storage.h"
+#include "str.h"
+#include "telemetry.h"
+#include "thread_specs.h"
+#include "usb_stream.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/sys_heap.h>
+
+// Health rows are rare and small, so they can afford to wait for the queue
+// much longer than data rows.
+#define HEALTH_WRITE_TIMEOUT_MS 100
+// Threads created after the first row are not recorded.
+#define MAX_THREADS 16
+#define MAX_THREAD_NAME_LEN 32
+#define MAX_LINE_LEN 1024
+// Marks a value as unknown. It is written as an empty cell.
+#define UNKNOWN (-1)
+
+LOG_MODULE_REGISTER(health);
+
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS)
+extern struct k_heap _system_heap;
+#endif
+
+static storage_t health_storage;
+static trutime_t health_trutime;
+static const struct experiment* health_experiment;
+
+/*
+ * The sampling jitter since the previous health row. Updated by the sampling
+ * thread in health_mark_sample and collected by the health thread.
+ */
+static struct k_spinlock jitter_lock;
+static struct {
+    uint32_t nominal_cycles;
+    uint32_t last_cycles;
+    bool have_last;
+    uint32_t samples;
+    uint32_t periods;
+    uint64_t total_deviation;
+    uint32_t max_deviation;
+} jitter;
+
+/*
+ * Everything below is only ever touched by the health thread.
+ */
+struct thread_column {
+    const struct k_thread* thread;
+    char name[MAX_THREAD_NAME_LEN];
+    int64_t stack_unused;
+};
+static struct thread_column thread_columns[MAX_THREADS];
+static size_t thread_column_count;
+
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+static k_thread_runtime_stats_t last_runtime;
+#endif
+#if defined(CONFIG_BIOLOGGER_PERF)
+static struct perf_stage_stats last_write;
+static struct perf_stage_stats last_sync;
+#endif
+
+static char line_buf[MAX_LINE_LEN];
+static size_t line_len;
+
+K_THREAD_STACK_DEFINE(health_thread_stack, THREAD_HEALTH_STACK_SIZE);
+static struct k_thread health_thread_data;
+
+void health_mark_sample(void) {
+    const uint32_t now = k_cycle_get_32();
+
+    k_spinlock_key_t key = k_spin_lock(&jitter_lock);
+    if (jitter.have_last) {
+        // Unsigned arithmetic takes care of the counter wrapping around.
+        const uint32_t period = now - jitter.last_cycles;
+        const uint32_t deviation = period > jitter.nominal_cycles
+            ? period - jitter.nominal_cycles
+            : jitter.nominal_cycles - period;
+
+        jitter.periods++;
+        jitter.total_deviation += deviation;
+        jitter.max_deviation = MAX(jitter.max_deviation, deviation);
+    }
+    jitter.last_cycles = now;
+    jitter.have_last = true;
+    jitter.samples++;
+    k_spin_unlock(&jitter_lock, key);
+}
+
+static void append(const char* fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    const int n = vsnprintk(line_buf + line_len, sizeof(line_buf) - line_len,
+                            fmt, args);
+    va_end(args);
+
+    if (n > 0) {
+        line_len = MIN(line_len + n, sizeof(line_buf) - 1);
+    }
+}
+
+static void append_cell(int64_t value) {
+    if (value == UNKNOWN) {
+        append(",");
+    } else {
+        append(",%lld", value);
+    }
+}
+
+#if defined(CONFIG_THREAD_MONITOR)
+static void add_thread_column(const struct k_thread* thread, void* user_data) {
+    if (thread_column_count >= MAX_THREADS) {
+        return;
+    }
+
+    struct thread_column* column = &thread_columns[thread_column_count++];
+    column->thread = thread;
+
+    const char* name = k_thread_name_get((k_tid_t)thread);
+    if (name != NULL && name[0] != '\0') {
+        snprintk(column->name, sizeof(column->name), "%s", name);
+    } else {
+        snprintk(column->name, sizeof(column->name), "%p", thread);
+    }
+}
+
+static void measure_thread(const struct k_thread* thread, void* user_data) {
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+    for (size_t i = 0; i < thread_column_count; i++) {
+        size_t unused;
+        if (thread_columns[i].thread == thread
+                && k_thread_stack_space_get(thread, &unused) == 0) {
+            thread_columns[i].stack_unused = unused;
+            return;
+        }
+    }
+#endif
+}
+#endif
+
+/**
+ * @brief Write the header, and pick the threads whose stacks are recorded.
+ */
+static int write_header(void) {
+#if defined(CONFIG_THREAD_MONITOR)
+    k_thread_foreach_unlocked(add_thread_column, NULL);
+#endif
+
+    line_len = 0;
+    append("Timestamp [ms],Heap used [B],Heap peak [B],CPU idle [%%],"
+           "Jitter mean [us],Jitter max [us],Samples [#],Dropped SD [#],"
+           "Dropped USB [#],Dropped console [#],IO errors [#],"
+           "Held back [#],Replayed [#],Lost [#],Write p50 [us],"
+           "Write p99 [us],Sync p50 [us],Sync p99 [us]");
+    for (size_t i = 0; i < thread_column_count; i++) {
+        append(",Stack %s [B]", thread_columns[i].name);
+    }
+
+    return storage_write_row(health_storage, STORAGE_STREAM_HEALTH,
+                             (struct strv) { line_buf, line_len },
+                             K_MSEC(HEALTH_WRITE_TIMEOUT_MS));
+}
+
+#if defined(CONFIG_BIOLOGGER_PERF)
+/**
+ * @brief The upper bound of the pct-th percentile of the durations recorded
+ *        between two snapshots of a stage, in microseconds.
+ */
+static int64_t percentile_us(const struct perf_stage_stats* now,
+                             const struct perf_stage_stats* before,
+                             uint32_t pct) {
+    // perf_reset may have been called in between.
+    const bool reset = now->count < before->count;
+    const uint32_t total = reset ? now->count : now->count - before->count;
+    if (total == 0) {
+        return UNKNOWN;
+    }
+
+    const uint32_t rank = ((uint64_t)total * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (size_t b = 0; b < PERF_HISTOGRAM_BUCKETS; b++) {
+        seen += reset ? now->histogram[b]
+                      : now->histogram[b] - before->histogram[b];
+        if (seen >= rank) {
+            return k_cyc_to_us_ceil64(1ull << b);
+        }
+    }
+    return UNKNOWN;
+}
+#endif
+
+static void append_latencies(void) {
+#if defined(CONFIG_BIOLOGGER_PERF)
+    struct perf_stage_stats write, sync;
+    perf_stats_get(PERF_STAGE_WRITE, &write);
+    perf_stats_get(PERF_STAGE_SYNC, &sync);
+
+    append_cell(percentile_us(&write, &last_write, 50));
+    append_cell(percentile_us(&write, &last_write, 99));
+    append_cell(percentile_us(&sync, &last_sync, 50));
+    append_cell(percentile_us(&sync, &last_sync, 99));
+
+    last_write = write;
+    last_sync = sync;
+#else
+    for (size_t i = 0; i < 4; i++) {
+        append_cell(UNKNOWN);
+    }
+#endif
+}
+
+static int write_record(void) {
+    int64_t heap_used = UNKNOWN;
+    int64_t heap_peak = UNKNOWN;
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS)
+    struct sys_memory_stats heap;
+    if (sys_heap_runtime_stats_get(&_system_heap.heap, &heap) == 0) {
+        heap_used = heap.allocated_bytes;
+        heap_peak = heap.max_allocated_bytes;
+    }
+#endif
+
+    int64_t idle_permille = UNKNOWN;
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+    // execution_cycles includes the cycles spent idling.
+    k_thread_runtime_stats_t runtime;
+    if (k_thread_runtime_stats_all_get(&runtime) == 0) {
+        const uint64_t elapsed = runtime.execution_cycles
+            - last_runtime.execution_cycles;
+        const uint64_t idle = runtime.idle_cycles - last_runtime.idle_cycles;
+        if (elapsed != 0) {
+            idle_permille = idle * 1000 / elapsed;
+        }
+        last_runtime = runtime;
+    }
+#endif
+
+    k_spinlock_key_t key = k_spin_lock(&jitter_lock);
+    const uint32_t samples = jitter.samples;
+    const uint32_t periods = jitter.periods;
+    const uint64_t total_deviation = jitter.total_deviation;
+    const uint32_t max_deviation = jitter.max_deviation;
+    jitter.samples = 0;
+    jitter.periods = 0;
+    jitter.total_deviation = 0;
+    jitter.max_deviation = 0;
+    k_spin_unlock(&jitter_lock, key);
+
+    struct storage_status storage;
+    (void)storage_status(health_storage, &storage);
+#if defined(CONFIG_USBD_CDC_ACM_CLASS)
+    struct usb_stream_stats usb;
+    usb_stream_stats_get(&usb);
+#else
+    // There is no stream to drop rows from.
+    const struct usb_stream_stats usb = { 0 };
+#endif
+    struct telemetry_stats console;
+    telemetry_stats_get(&console);
+
+    line_len = 0;
+    append("%lld", trutime_millis_since(health_trutime,
+                                        experiment_start_time(
+                                            health_experiment)));
+    append_cell(heap_used);
+    append_cell(heap_peak);
+    if (idle_permille == UNKNOWN) {
+        append(",");
+    } else {
+        append(",%u.%u", (unsigned int)(idle_permille / 10),
+               (unsigned int)(idle_permille % 10));
+    }
+    append_cell(periods == 0 ? UNKNOWN
+                : (int64_t)k_cyc_to_us_floor64(total_deviation / periods));
+    append_cell(periods == 0 ? UNKNOWN
+                : (int64_t)k_cyc_to_us_floor64(max_deviation));
+    append_cell(samples);
+    append_cell(storage.rows_dropped + experiment_rows_dropped());
+    append_cell(usb.rows_dropped);
+    append_cell(console.rows_dropped);
+    append_cell(storage.io_errors);
+    append_cell(storage.rows_pending);
+    append_cell(storage.rows_replayed);
+    append_cell(storage.rows_lost);
+    append_latencies();
+
+#if defined(CONFIG_THREAD_MONITOR)
+    for (size_t i = 0; i < thread_column_count; i++) {
+        thread_columns[i].stack_unused = UNKNOWN;
+    }
+    k_thread_foreach_unlocked(measure_thread, NULL);
+#endif
+    for (size_t i = 0; i < thread_column_count; i++) {
+        append_cell(thread_columns[i].stack_unused);
+    }
+
+    return storage_write_row(health_storage, STORAGE_STREAM_HEALTH,
+                             (struct strv) { line_buf, line_len },
+                             K_MSEC(HEALTH_WRITE_TIMEOUT_MS));
+}
+
+static void health_thread_runnable(void* p0, void* p1, void* p2) {
+    int err;
+
+    if ((err = write_header()) != 0) {
+        LOG_ERR("Failed to write the health header (%d).", err);
+    }
+
+    while (1) {
+        k_sleep(K_SECONDS(CONFIG_BIOLOGGER_HEALTH_PERIOD_S));
+
+        if ((err = write_record()) != 0) {
+            LOG_ERR("Failed to write a health record (%d).", err);
+        }
+    }
+}
+
+int health_init(storage_t storage, trutime_t trutime,
+                const struct experiment* experiment,
+                uint32_t sampling_period_ms) {
+    if (CONFIG_BIOLOGGER_HEALTH_PERIOD_S == 0) {
+        return 0;
+    }
+
+    health_storage = storage;
+    health_trutime = trutime;
+    health_experiment = experiment;
+    jitter.nominal_cycles = k_ms_to_cyc_near32(sampling_period_ms);
+
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+    (void)k_thread_runtime_stats_all_get(&last_runtime);
+#endif
+#if defined(CONFIG_BIOLOGGER_PERF)
+    perf_stats_get(PERF_STAGE_WRITE, &last_write);
+    perf_stats_get(PERF_STAGE_SYNC, &last_sync);
+#endif
+
+    k_thread_create(
+        &health_thread_data,
+        health_thread_stack,
+        K_THREAD_STACK_SIZEOF(health_thread_stack),
+        health_thread_runnable, NULL, NULL, NULL,
+        THREAD_HEALTH_PRIORITY, 0, K_NO_WAIT
+    );
+    k_thread_name_set(&health_thread_data, "health");
+
+    LOG_INF("Recording the health every %d s.",
+            CONFIG_BIOLOGGER_HEALTH_PERIOD_S);
+    return 0;
+}
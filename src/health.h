@@ -0,0 +1,53 @@
+/**
+ * @brief Periodically records the health of the firmware next to the data.
+ *
+ * @details
+ * Every CONFIG_BIOLOGGER_HEALTH_PERIOD_S seconds a row is appended to the
+ * transaction's "<start time>.health.csv" file. It shares its "Timestamp [ms]"
+ * column with the data file, so both can be lined up after a deployment. A
+ * row holds:
+ *
+ * - the heap usage and its high-water mark,
+ * - the share of time the CPU was idle since the previous row,
+ * - the mean and worst deviation from the sampling period since the previous
+ *   row, and how many samples were taken,
+ * - the number of rows dropped by the card, USB and console so far, and the
+ *   number of failed card operations,
+ * - the number of rows currently held back while the card is unavailable,
+ *   and how many held back rows were replayed or lost so far,
+ * - the median and 99th percentile card write and sync latency since the
+ *   previous row, if CONFIG_BIOLOGGER_PERF is enabled,
+ * - the unused stack of every thread.
+ *
+ * Latencies are rounded up to a power of two cycles. Anything the kernel is
+ * not configured to track is left empty.
+ */
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include "experiment.h"
+#include "trutime.h"
+
+/**
+ * @brief Start recording the health of the firmware.
+ *
+ * @param [in] storage The storage to write to.
+ * @param [in] trutime The clock the experiment timestamps come from.
+ * @param [in] experiment The experiment, for its start time.
+ * @param [in] sampling_period_ms The period health_mark_sample is expected to
+ *                                be called with.
+ *
+ * @return 0 on success.
+ */
+int health_init(storage_t storage, trutime_t trutime,
+                const struct experiment* experiment,
+                uint32_t sampling_period_ms);
+
+/**
+ * @brief Mark that a sample is being taken, to measure the sampling jitter.
+ *
+ * @warning Must only ever be called from a single thread.
+ */
+void health_mark_sample(void);
+
+#endif /* HEALTH_H */
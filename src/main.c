@@ -6,9 +6,10 @@
  * @detail
  * Hello! This module is the main entrypoint of the biologger firmware. It is
  * in this file that you should most likely attempt to perform your work. If
- * you are only attempting to add new columns/rows, please have a look at
- * declare_columns and collect_data_10hz.
+ * you are only attempting to add new columns, please have a look at
+ * columns.h and collect_data_10hz.
  */
+#include <math.h>
 #include <sys/_timespec.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
@@ -17,9 +18,17 @@
 #include <zephyr/shell/shell.h>
 #include "experiment.h"
 #include "observer.h"
+#include "sample_bus.h"
 #include <zephyr/device.h>
 #include "trutime.h"
 #include "storage.h"
+#include "thermometer.h"
+#include "usb.h"
+#include "usb_stream.h"
+#include "telemetry.h"
+#include "perf.h"
+#include "health.h"
+#include "burst.h"
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/drivers/adc.h>
 #include "sensor/ximpedance_amp/ximpedance_amp.h"
@@ -29,6 +38,20 @@
 
 #define SAMPLING_PERIOD_MS 100
 
+// The logs go to the first storage backend built in, which is the FAT volume
+// on the SD card unless CONFIG_BIOLOGGER_STORAGE_BACKEND_FATFS is turned off.
+#if defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_FATFS)
+#define STORAGE_BACKEND (&storage_backend_fatfs)
+#elif defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_RAW)
+#define STORAGE_BACKEND (&storage_backend_raw)
+#elif defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_HOST)
+#define STORAGE_BACKEND (&storage_backend_host)
+#elif defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_RAM)
+#define STORAGE_BACKEND (&storage_backend_ram)
+#else
+#error "Enable at least one CONFIG_BIOLOGGER_STORAGE_BACKEND_*."
+#endif
+
 LOG_MODULE_REGISTER(main);
 
 OBSERVER_DECL(main_observer);
@@ -41,9 +64,13 @@ static const struct device* ximpedance_amp =
     DEVICE_DT_GET(DT_NODELABEL(ximpedance_amp));
 
 /******************************************************************************
- * Static Variables Used In This Module
+ * Shell Commands
  *****************************************************************************/
-static size_t collection_counter = 0;
+#if defined(CONFIG_SHELL)
+// Every module adds its own commands under "biologger" with SHELL_SUBCMD_ADD.
+SHELL_SUBCMD_SET_CREATE(biologger_cmds, (biologger));
+SHELL_CMD_REGISTER(biologger, &biologger_cmds, "Biologger commands", NULL);
+#endif
 
 /**
  * @brief Initialize drivers required for the operation of the application.
@@ -59,64 +86,117 @@ static int init_drivers() {
     return err;
 }
 
+#if defined(CONFIG_BIOLOGGER_BURST)
+/*
+ * The burst capture owns the amplifier and samples it much faster than this
+ * loop. Every row takes its currents from a single one of its samples.
+ */
+static struct burst_sample currents;
+static int currents_err = -ENODATA;
+#endif
+
 /**
- * @brief Define all the columns that are collected.
- *
- * This function must only contain calls to experiment_add_column.
+ * @brief Sample every transimpedance amplifier channel at once.
  */
-static void declare_columns(struct experiment* e) {
-    //                           Column Name              Units
-    experiment_add_column(e,     "Current 22KX 1",        "mA");
-    experiment_add_column(e,     "Current 22KX 2",        "mA");
-    experiment_add_column(e,     "Current 10KX 1",        "mA");
-    experiment_add_column(e,     "Current 10KX 2",        "mA");
+static int fetch_currents(void) {
+#if defined(CONFIG_BIOLOGGER_BURST)
+    return currents_err = burst_latest(&currents);
+#else
+    return sensor_sample_fetch(ximpedance_amp);
+#endif
 }
 
+#if defined(CONFIG_BIOLOGGER_RAW_CURRENTS)
 /**
- * @brief Perform all data collection.
+ * @brief Read the ADC code of a single transimpedance amplifier channel, as
+ *        sampled by the last fetch_currents.
  *
- * This function must only contain calls to experiment_row_add_value.
+ * @return The code, or INT32_MIN if the channel could not be read. The error
+ *         is then stored in err.
+ */
+static int32_t read_code(enum ximpedance_amp_sensor_channel chan, int* err) {
+#if defined(CONFIG_BIOLOGGER_BURST)
+    if (currents_err != 0) {
+        *err = currents_err;
+        return INT32_MIN;
+    }
+
+    return currents.codes[chan - XIMPEDANCE_CHAN_22KX_CODE_1];
+#else
+    struct sensor_value val;
+    int ret;
+
+    if ((ret = sensor_channel_get(ximpedance_amp, (int)chan, &val)) != 0) {
+        LOG_ERR("Failed to fetch the sensor channel %d value (%d).", chan, ret);
+        *err = ret;
+        return INT32_MIN;
+    }
+
+    return val.val1;
+#endif
+}
+#else
+/**
+ * @brief Read a single transimpedance amplifier channel, in milliamps, as
+ *        sampled by the last fetch_currents.
  *
- * @warning There must be as many calls to experiment_row_add_value as there
- *          are to experiment_add_column in declare_columns.
+ * @return The current, or NaN if the channel could not be read. The error is
+ *         then stored in err.
  */
-static int collect_data_10hz(struct experiment_row* r) {
-    int err = 0; // 0 means no error :)
-    
-    if ((err = sensor_sample_fetch(ximpedance_amp)) != 0) {
-        LOG_ERR("Failed to sample the results from the transimpedance "
-                "amplifier (%d).", err);
+static double read_current(enum ximpedance_amp_sensor_channel chan, int* err) {
+#if defined(CONFIG_BIOLOGGER_BURST)
+    if (currents_err != 0) {
+        *err = currents_err;
+        return NAN;
     }
 
-    static const enum ximpedance_amp_sensor_channel
-    ximpedance_amp_channels[] = {
-        XIMPEDANCE_CHAN_22KX_MILLIAMPS_1,
-        XIMPEDANCE_CHAN_22KX_MILLIAMPS_2,
-        XIMPEDANCE_CHAN_10KX_MILLIAMPS_1,
-        XIMPEDANCE_CHAN_10KX_MILLIAMPS_2,
-    };
-    for (size_t i = 0; i < ARRAY_SIZE(ximpedance_amp_channels); i++) {
-        struct sensor_value val;
-        if ((err = sensor_channel_get(ximpedance_amp,
-                                      (int)ximpedance_amp_channels[i],
-                                      &val)) != 0) {
-            LOG_ERR("Failed to fetch the sensor channel %d value (%d).",
-                    ximpedance_amp_channels[i], err);
-            err = MIN(err, 0);
-        }
+    return currents.nanoamps[chan - XIMPEDANCE_CHAN_22KX_MILLIAMPS_1] / 1e6;
+#else
+    struct sensor_value val;
+    int ret;
 
-        const double value_milliamps = sensor_value_to_double(&val);
+    if ((ret = sensor_channel_get(ximpedance_amp, (int)chan, &val)) != 0) {
+        LOG_ERR("Failed to fetch the sensor channel %d value (%d).", chan, ret);
+        *err = ret;
+        return NAN;
+    }
 
-        experiment_row_add_value(r, value_milliamps);
+    return sensor_value_to_double(&val);
+#endif
+}
+#endif
+
+/**
+ * @brief Read the latest temperature, in degrees Celsius.
+ *
+ * The thermometer is sampled in the background, so this only reads out the
+ * latest cached value. Missing or stale readings are logged as NaN so the
+ * columns stay aligned.
+ */
+static double read_temperature(void) {
+    struct thermometer_reading temperature;
+    if (thermometer_latest(&temperature) != 0) {
+        return NAN;
     }
+    return temperature.celsius;
+}
+
+/**
+ * @brief Perform all data collection.
+ *
+ * Every column of columns.h is filled in from its source expression.
+ */
+static int collect_data_10hz(struct experiment_row* r) {
+    int err = 0; // 0 means no error :)
 
-    // Printout every 10th row.
-    if (collection_counter == 0) {
-        const struct strv printout = experiment_row_format(r);
-        printk("%s\n", printout.str);
-        k_free(printout.str);
+    if ((err = fetch_currents()) != 0) {
+        LOG_ERR("Failed to sample the results from the transimpedance "
+                "amplifier (%d).", err);
     }
-    collection_counter = (collection_counter + 1) % 10;
+
+#define COLLECT(field, type, name, unit, source) r->values.field = (source);
+    EXPERIMENT_COLUMNS(COLLECT)
+#undef COLLECT
 
     return err;
 }
@@ -133,13 +213,34 @@ int main(void) {
     observer_t observer = OBSERVER_INIT(main_observer);
 
     // Initialize the storage module which is responsible for storing
-    // experiment data.
-    storage_t storage = storage_init(observer);
+    // experiment data. The card is expected to keep up with the longest
+    // possible rows.
+    storage_t storage = storage_init(
+        observer, STORAGE_BACKEND,
+        EXPERIMENT_ROW_STR_MAX * 1000 / SAMPLING_PERIOD_MS);
     if (storage == NULL) {
         LOG_ERR("Could not initialize storage.");
         return -ENOMEM;
     }
 
+    // Bring up USB. The host sees a CDC-ACM port on which every row published
+    // on the sample bus is streamed live, and the SD card once
+    // "biologger export start" is run.
+    struct usbd_contex* usb;
+    if ((err = usb_init(&usb)) != 0) {
+        LOG_ERR("Failed to initialize USB (%d).", err);
+    } else {
+#if defined(CONFIG_USBD_CDC_ACM_CLASS)
+        if ((err = usb_stream_init()) != 0) {
+            LOG_ERR("Failed to initialize the USB stream (%d).", err);
+        }
+#endif
+
+        if ((err = usbd_enable(usb)) != 0) {
+            LOG_ERR("Failed to enable USB (%d).", err);
+        }
+    }
+
     // Initialize the trutime module which provides with accurate time data.
     trutime_t time_provider = TRUTIME_INIT(time_provider, observer);
 
@@ -149,6 +250,18 @@ int main(void) {
         observer_flag_raise(observer, OBSERVER_FLAG_DRIVER_MIA);
     }
 
+    // Start acquiring the temperature in the background. The thermometer
+    // raises OBSERVER_FLAG_DRIVER_MIA itself if the sensor is missing.
+    if ((err = thermometer_init(observer)) != 0) {
+        LOG_ERR("Failed to initialize the thermometer (%d).", err);
+    }
+
+    // Print rows off the sample bus on the console from a low-priority
+    // thread. The rate and columns are set with "biologger telemetry".
+    if ((err = telemetry_init()) != 0) {
+        LOG_ERR("Failed to initialize the telemetry (%d).", err);
+    }
+
     // Wait until trutime is available. Sometimes this takes quite some time.
     do {
         LOG_INF("Waiting for trutime support.");
@@ -164,31 +277,58 @@ int main(void) {
         return -1;
     }
 
-    // Populate the experiment with all the required columns.
-    declare_columns(experiment);
+    // Rows are formatted and written out on a thread of the experiment, so the
+    // card never holds up the sampling below.
+    if ((err = experiment_subscribe(experiment)) != 0) {
+        LOG_ERR("Failed to subscribe the experiment to the rows (%d).", err);
+        return err;
+    }
+
+    // Record the health of the firmware next to the data.
+    if ((err = health_init(storage, time_provider, experiment,
+                           SAMPLING_PERIOD_MS)) != 0) {
+        LOG_ERR("Failed to initialize the health records (%d).", err);
+    }
+
+#if defined(CONFIG_BIOLOGGER_BURST)
+    // From here on, the amplifier is sampled by the burst capture.
+    if ((err = burst_init(storage, time_provider, experiment)) != 0) {
+        LOG_ERR("Failed to initialize the burst capture (%d).", err);
+    }
+#endif
 
     while (1) {
         const uint64_t start = k_uptime_get();
+        health_mark_sample();
+        PERF_BEGIN(loop);
 
         // We are creating a new time sample -- create a new row.
-        struct experiment_row* row = experiment_row_new(
-            trutime_millis_since(
-                time_provider,
-                experiment_start_time(experiment)
-            )
+        PERF_BEGIN(timestamp);
+        const unsigned long long millis_since_start = trutime_millis_since(
+            time_provider,
+            experiment_start_time(experiment)
         );
+        PERF_END(PERF_STAGE_TIMESTAMP, timestamp);
+
+        PERF_BEGIN(alloc);
+        struct experiment_row* row = experiment_row_new(millis_since_start);
+        PERF_END(PERF_STAGE_ROW_ALLOC, alloc);
         if (row == NULL) {
+            // The sample is skipped, but the loop still sleeps below. The
+            // subscribers which free rows all run at a lower priority.
             LOG_ERR("Failed to allocate sufficient memory for a new row.");
-            continue;
-        }
-
-        // Collect the specified data into the experiment.
-        (void)collect_data_10hz(row);
+        } else {
+            // Collect the specified data into the experiment.
+            PERF_BEGIN(fetch);
+            (void)collect_data_10hz(row);
+            PERF_END(PERF_STAGE_SENSOR_FETCH, fetch);
 
-        // Push these values into the experiment.
-        if ((err = experiment_push_row(experiment, row)) != 0) {
-            LOG_ERR("Failed to push a row into the experiment (%d)", err);
+            // Hand the row to the experiment, the USB host and the console at
+            // once. This never blocks -- a subscriber that does not keep up
+            // only misses the row itself.
+            sample_bus_publish(row);
         }
+        PERF_END(PERF_STAGE_LOOP, loop);
 
         const uint64_t stop = k_uptime_get();
         int64_t sleep_period;
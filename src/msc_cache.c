@@ -0,0 +1,227 @@
+#include "msc_cache.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/drivers/disk.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/disk_access.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/usb/class/usbd_msc.h>
+
+// How many reads in a row must continue where the previous one stopped before
+// the cache starts reading ahead. A single sequential read is too common
+// during FAT lookups to be worth a long transfer.
+#define SEQUENTIAL_STREAK_THRESHOLD 2
+
+LOG_MODULE_REGISTER(msc_cache);
+
+// Without the USB mass storage class, e.g. in the native_sim benchmarks, the
+// cache is a plain disk nobody reads.
+#if defined(CONFIG_USBD_MSC_CLASS)
+USBD_DEFINE_MSC_LUN(SDCACHE, "Zephyr", "SD", "0.00");
+#endif
+
+// At least one byte, so that a build without read-ahead still has a buffer.
+static uint8_t window_buf[MAX(CONFIG_BIOLOGGER_MSC_READ_AHEAD_SIZE, 1)]
+    __aligned(4);
+
+static struct {
+    const char* backing;
+    /*!< The geometry of the card at the last msc_cache_refresh. With a
+     * window_capacity of 0, every read goes straight to the card. */
+    uint32_t sector_sz;
+    uint32_t sector_count;
+    uint32_t window_capacity; /*!< In sectors. */
+
+    struct k_mutex lock;
+    uint32_t window_start;
+    uint32_t window_count; /*!< 0 if the window is empty. */
+    atomic_val_t window_generation;
+
+    uint32_t next_sequential;
+    uint32_t streak;
+
+    /*!< Bumped by msc_cache_invalidate. */
+    atomic_t generation;
+
+    atomic_t hits;
+    atomic_t misses;
+    atomic_t prefetched;
+} cache;
+
+static bool window_holds(uint32_t sector) {
+    return cache.window_count != 0
+        && sector >= cache.window_start
+        && sector - cache.window_start < cache.window_count;
+}
+
+static int fill_window(uint32_t sector) {
+    int err;
+
+    const uint32_t fill = MIN(cache.window_capacity,
+                              cache.sector_count - sector);
+    cache.window_count = 0;
+    cache.window_generation = atomic_get(&cache.generation);
+
+    if ((err = disk_access_read(cache.backing, window_buf, sector, fill))
+            != 0) {
+        LOG_ERR("Failed to read ahead %u sectors at %u (%d).",
+                fill, sector, err);
+        return err;
+    }
+
+    cache.window_start = sector;
+    cache.window_count = fill;
+    atomic_add(&cache.prefetched, fill);
+    return 0;
+}
+
+static int cache_disk_init(struct disk_info* disk) {
+    return disk_access_init(cache.backing);
+}
+
+static int cache_disk_status(struct disk_info* disk) {
+    return disk_access_status(cache.backing);
+}
+
+static int cache_disk_read(struct disk_info* disk, uint8_t* buf,
+                           uint32_t sector, uint32_t count) {
+    int err = 0;
+
+    k_mutex_lock(&cache.lock, K_FOREVER);
+
+    // The firmware wrote to the card since the window was filled.
+    if (cache.window_generation != atomic_get(&cache.generation)) {
+        cache.window_count = 0;
+    }
+
+    cache.streak = sector == cache.next_sequential ? cache.streak + 1 : 0;
+    cache.next_sequential = sector + count;
+    const bool sequential = cache.streak >= SEQUENTIAL_STREAK_THRESHOLD;
+
+    while (count > 0) {
+        if (window_holds(sector)) {
+            const uint32_t n = MIN(count, cache.window_start
+                                   + cache.window_count - sector);
+            memcpy(buf,
+                   &window_buf[(sector - cache.window_start)
+                               * cache.sector_sz],
+                   n * cache.sector_sz);
+            atomic_add(&cache.hits, n);
+
+            buf += n * cache.sector_sz;
+            sector += n;
+            count -= n;
+            continue;
+        }
+
+        // Requests at least as large as the window are already multi-block
+        // reads, so they gain nothing from a detour through the window.
+        if (sequential && count < cache.window_capacity
+                && sector < cache.sector_count) {
+            if ((err = fill_window(sector)) == 0) {
+                continue;
+            }
+        }
+
+        err = disk_access_read(cache.backing, buf, sector, count);
+        atomic_add(&cache.misses, count);
+        break;
+    }
+
+    k_mutex_unlock(&cache.lock);
+    return err;
+}
+
+static int cache_disk_write(struct disk_info* disk, const uint8_t* buf,
+                            uint32_t sector, uint32_t count) {
+    k_mutex_lock(&cache.lock, K_FOREVER);
+
+    if (cache.window_count != 0
+            && sector < cache.window_start + cache.window_count
+            && cache.window_start < sector + count) {
+        cache.window_count = 0;
+    }
+    const int err = disk_access_write(cache.backing, buf, sector, count);
+
+    k_mutex_unlock(&cache.lock);
+    return err;
+}
+
+static int cache_disk_ioctl(struct disk_info* disk, uint8_t cmd, void* buf) {
+    return disk_access_ioctl(cache.backing, cmd, buf);
+}
+
+static const struct disk_operations cache_disk_ops = {
+    .init = cache_disk_init,
+    .status = cache_disk_status,
+    .read = cache_disk_read,
+    .write = cache_disk_write,
+    .ioctl = cache_disk_ioctl,
+};
+
+static struct disk_info cache_disk = {
+    .name = MSC_CACHE_DISK_NAME,
+    .ops = &cache_disk_ops,
+};
+
+int msc_cache_init(const char* backing_disk_name) {
+    int err;
+
+    // There may be no card yet, so nothing is read ahead until the first
+    // msc_cache_refresh.
+    cache.backing = backing_disk_name;
+    cache.window_capacity = 0;
+    k_mutex_init(&cache.lock);
+
+    if ((err = disk_access_register(&cache_disk)) != 0) {
+        LOG_ERR("Failed to register the %s disk (%d).",
+                MSC_CACHE_DISK_NAME, err);
+        return err;
+    }
+
+    return 0;
+}
+
+void msc_cache_refresh(void) {
+    uint32_t sector_sz, sector_count;
+    int err;
+
+    k_mutex_lock(&cache.lock, K_FOREVER);
+
+    cache.window_count = 0;
+    cache.window_capacity = 0;
+
+    if (CONFIG_BIOLOGGER_MSC_READ_AHEAD_SIZE == 0) {
+        LOG_INF("Read-ahead is off, USB reads go straight to the card.");
+    } else if ((err = disk_access_ioctl(cache.backing,
+                                        DISK_IOCTL_GET_SECTOR_SIZE,
+                                        &sector_sz)) != 0
+        || (err = disk_access_ioctl(cache.backing, DISK_IOCTL_GET_SECTOR_COUNT,
+                                    &sector_count)) != 0) {
+        LOG_ERR("Could not query the geometry of %s, not reading ahead (%d).",
+                cache.backing, err);
+    } else if (sector_sz == 0 || sector_sz > sizeof(window_buf)) {
+        LOG_ERR("Unsupported sector size %u, not reading ahead.", sector_sz);
+    } else {
+        cache.sector_sz = sector_sz;
+        cache.sector_count = sector_count;
+        cache.window_capacity = sizeof(window_buf) / sector_sz;
+        LOG_INF("Reading ahead up to %u of %u sectors for USB.",
+                cache.window_capacity, sector_count);
+    }
+
+    k_mutex_unlock(&cache.lock);
+}
+
+void msc_cache_invalidate(void) {
+    atomic_inc(&cache.generation);
+}
+
+void msc_cache_stats_get(struct msc_cache_stats* stats) {
+    stats->hits = atomic_get(&cache.hits);
+    stats->misses = atomic_get(&cache.misses);
+    stats->prefetched = atomic_get(&cache.prefetched);
+}
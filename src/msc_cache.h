@@ -0,0 +1,64 @@
+/**
+ * @brief Read-ahead cache between the USB mass storage class and the SD card.
+ *
+ * @details
+ * The USB mass storage class reads the card one sector at a time, which turns
+ * a bulk file copy into thousands of single-block SDMMC transfers. This module
+ * registers a disk of its own, MSC_CACHE_DISK_NAME, which the mass storage
+ * LUN is exported from. Reads which continue where the previous one stopped
+ * are served from a window which is refilled with a single multi-block read of
+ * CONFIG_BIOLOGGER_MSC_READ_AHEAD_SIZE bytes. Random reads and writes go
+ * straight to the card, and so does every read if that size is 0.
+ *
+ * The cache is layered over the exported snapshot (see usb_export.h), which
+ * only changes when an export begins or ends. msc_cache_invalidate is called
+ * at those points. The card may have been swapped between two exports, so
+ * msc_cache_refresh reads its geometry again whenever an export begins.
+ */
+#ifndef MSC_CACHE_H
+#define MSC_CACHE_H
+
+#include <stdint.h>
+
+#define MSC_CACHE_DISK_NAME "SDCACHE"
+
+/**
+ * @brief Cache counters, in sectors.
+ */
+struct msc_cache_stats {
+    /*!< Sectors served from the read-ahead window. */
+    uint32_t hits;
+    /*!< Sectors read straight from the card. */
+    uint32_t misses;
+    /*!< Sectors read into the read-ahead window. */
+    uint32_t prefetched;
+};
+
+/**
+ * @brief Register the cache disk on top of the given backing disk.
+ *
+ * @param [in] backing_disk_name The name of the disk to cache, e.g.
+ *                                USB_EXPORT_HOST_DISK_NAME.
+ *
+ * @return 0 on success or the error returned by disk_access_register.
+ */
+int msc_cache_init(const char* backing_disk_name);
+
+/**
+ * @brief Read the geometry of the backing disk again and drop the read-ahead
+ *        window. If it cannot be read, every read goes straight to the disk.
+ */
+void msc_cache_refresh(void);
+
+/**
+ * @brief Drop everything held in the read-ahead window. Safe to call from any
+ *        thread and never blocks.
+ */
+void msc_cache_invalidate(void);
+
+/**
+ * @brief Retrieve the cache counters.
+ */
+void msc_cache_stats_get(struct msc_cache_stats* stats);
+
+#endif /* MSC_CACHE_H */
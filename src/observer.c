@@ -1,6 +1,7 @@
 #include "observer.h"
 #include "thread_specs.h"
 #include <stdbool.h>
+#include <sys/errno.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/gpio.h>
@@ -13,27 +14,72 @@ LOG_MODULE_REGISTER(observer, CONFIG_LOG_DEFAULT_LEVEL);
 static const struct gpio_dt_spec status_led =
     GPIO_DT_SPEC_GET_OR(STATUS_LED, gpios, {0});
 
-static void observer_flag(observer_t o, enum observer_flag f, bool s) {
-    o->flag_states[f] = s;
-
-    o->app_state =
-        o->flag_states[OBSERVER_FLAG_NO_DISK]
-        || o->flag_states[OBSERVER_FLAG_DRIVER_MIA]
+/*
+ * The events object holds three groups of bits. For every flag f, bit f is
+ * posted while the flag is raised and bit f + EVENT_LOWERED_SHIFT is posted
+ * while it is lowered, so waiters can block on either state. The remaining bit
+ * wakes the LED thread whenever the app_state changes.
+ */
+#define EVENT_LOWERED_SHIFT 16
+#define EVENT_FLAGS_MASK \
+    (BIT_MASK(OBSERVER_FLAG_COUNT) \
+     | (BIT_MASK(OBSERVER_FLAG_COUNT) << EVENT_LOWERED_SHIFT))
+#define EVENT_STATE_CHANGED BIT(31)
+
+BUILD_ASSERT(OBSERVER_FLAG_COUNT <= EVENT_LOWERED_SHIFT,
+             "Too many observer flags to fit in the events object.");
+
+static enum app_state app_state_from_flags(atomic_val_t flags) {
+    return
+        flags & (OBSERVER_FLAG_MASK(OBSERVER_FLAG_NO_DISK)
+                 | OBSERVER_FLAG_MASK(OBSERVER_FLAG_DRIVER_MIA))
             ? APP_STATE_DEVICE_FAULT :
-        o->flag_states[OBSERVER_FLAG_NO_GPS_CLOCK]
+        flags & OBSERVER_FLAG_MASK(OBSERVER_FLAG_NO_GPS_CLOCK)
             ? APP_STATE_WAITING_FOR_TIMESYNC :
         APP_STATE_SAMPLING;
 }
 
+static uint32_t events_from_flags(atomic_val_t flags) {
+    const uint32_t raised = flags & BIT_MASK(OBSERVER_FLAG_COUNT);
+    const uint32_t lowered = ~flags & BIT_MASK(OBSERVER_FLAG_COUNT);
+    return raised | (lowered << EVENT_LOWERED_SHIFT);
+}
+
+static void observer_flag(observer_t o, enum observer_flag f, bool s) {
+    if (s) {
+        atomic_or(&o->flags, OBSERVER_FLAG_MASK(f));
+    } else {
+        atomic_and(&o->flags, ~OBSERVER_FLAG_MASK(f));
+    }
+
+    // Another thread may change the flags while we publish them. Rather than
+    // locking, republish from a fresh snapshot until the bitset is stable so
+    // that whoever publishes last publishes the latest flags.
+    atomic_val_t flags;
+    do {
+        flags = atomic_get(&o->flags);
+
+        k_event_set_masked(&o->events, events_from_flags(flags),
+                           EVENT_FLAGS_MASK);
+
+        const enum app_state state = app_state_from_flags(flags);
+        if (atomic_set(&o->app_state, state) != state) {
+            k_event_post(&o->events, EVENT_STATE_CHANGED);
+        }
+    } while (atomic_get(&o->flags) != flags);
+}
+
 static void blink_status_runnable(void* p0, void* p1, void* p2) {
     observer_t observer = (observer_t)p0;
 
-    // Repeatedly we will blink the LED as part of the LED thread.
+    // Repeatedly we will blink the LED as part of the LED thread. Rather than
+    // sleeping, every phase waits on a state change so that the LED reflects
+    // a new state immediately.
     while (true) {
         uint16_t blink_period_ms = 1000;
         uint16_t high_side_time_ms = 100;
 
-        switch (observer->app_state) {
+        switch ((enum app_state)atomic_get(&observer->app_state)) {
             case APP_STATE_SAMPLING:
                 blink_period_ms = 500;
                 high_side_time_ms = 200;
@@ -52,12 +98,18 @@ static void blink_status_runnable(void* p0, void* p1, void* p2) {
 
         const uint16_t low_side_time_ms = blink_period_ms - high_side_time_ms;
 
+        uint16_t phase_time_ms;
         if (!gpio_pin_get_dt(&status_led)) {
             gpio_pin_set_dt(&status_led, 1);
-            k_msleep(high_side_time_ms);
+            phase_time_ms = high_side_time_ms;
         } else {
             gpio_pin_set_dt(&status_led, 0);
-            k_msleep(low_side_time_ms);
+            phase_time_ms = low_side_time_ms;
+        }
+
+        if (k_event_wait(&observer->events, EVENT_STATE_CHANGED, false,
+                         K_MSEC(phase_time_ms)) != 0) {
+            k_event_clear(&observer->events, EVENT_STATE_CHANGED);
         }
     }
 }
@@ -66,7 +118,9 @@ K_THREAD_STACK_DEFINE(work_thread_stack, THREAD_BLINK_STATUS0_STACK_SIZE);
 static struct k_thread work_thread_data;
 
 observer_t observer_start(observer_t observer) {
-    observer->app_state = APP_STATE_DEVICE_FAULT;
+    k_event_init(&observer->events);
+    atomic_set(&observer->app_state, APP_STATE_DEVICE_FAULT);
+    atomic_clear(&observer->flags);
 
     for (int i = 0; i < OBSERVER_FLAG_COUNT; i++) {
         observer_flag(observer, i, false);
@@ -91,6 +145,7 @@ observer_t observer_start(observer_t observer) {
         blink_status_runnable, observer, NULL, NULL,
         THREAD_BLINK_STATUS0_PRIORITY, 0, K_NO_WAIT
     );
+    k_thread_name_set(&work_thread_data, "observer");
 
     return observer;
 }
@@ -102,3 +157,18 @@ void observer_flag_raise(observer_t o, enum observer_flag f) {
 void observer_flag_lower(observer_t o, enum observer_flag f) {
     observer_flag(o, f, false);
 }
+
+int observer_wait_for_all(observer_t o, uint32_t flags, bool state,
+                          k_timeout_t timeout) {
+    flags &= BIT_MASK(OBSERVER_FLAG_COUNT);
+    if (flags == 0) {
+        return 0;
+    }
+
+    const uint32_t events = state ? flags : flags << EVENT_LOWERED_SHIFT;
+    if (k_event_wait_all(&o->events, events, false, timeout) == 0) {
+        return -EAGAIN;
+    }
+
+    return 0;
+}
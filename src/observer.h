@@ -5,7 +5,11 @@
 #ifndef OBSERVER_H
 #define OBSERVER_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
 
 /**
  * @brief The state the application is in.
@@ -50,9 +54,23 @@ enum observer_flag {
     OBSERVER_FLAG_COUNT,
 };
 
+/**
+ * @brief Convert an observer_flag into its bit in a flag mask.
+ */
+#define OBSERVER_FLAG_MASK(flag) BIT(flag)
+
+/**
+ * @brief The observer state.
+ *
+ * @details
+ * The flags are kept as an atomic bitset so they may be raised and lowered
+ * from any thread or ISR without a lock. Every change is mirrored into the
+ * events object which the LED thread and observer_wait_for_all block on.
+ */
 typedef struct {
-    enum app_state app_state;
-    bool flag_states[OBSERVER_FLAG_COUNT];
+    atomic_t app_state; /*!< The current enum app_state. */
+    atomic_t flags; /*!< Bitset of the raised flags. */
+    struct k_event events; /*!< Mirrors flags and signals state changes. */
 } observer_data;
 
 typedef observer_data* observer_t;
@@ -85,13 +103,14 @@ void observer_flag_lower(observer_t, enum observer_flag flag);
  * @brief Wait until all the flags are are of the specified state.
  *
  * @param [in] observer The observer object.
- * @param [in] flags The flags to all wait for.
+ * @param [in] flags A mask of the flags to all wait for, built with
+ *                   OBSERVER_FLAG_MASK.
  * @param [in] state The state you wish the flags to be in.
- * @param [in] timeout The maximum timeout PER flag.
+ * @param [in] timeout The maximum timeout to wait for all flags.
  *
- * @return int zero if all flags were given.
+ * @return int zero if all flags were given, -EAGAIN if the timeout expired.
  */
-int observer_wait_for_all(observer_t observer, enum observer_flag* flags,
+int observer_wait_for_all(observer_t observer, uint32_t flags,
                           bool state, k_timeout_t timeout);
 
 #endif /* OBSERVER_H */
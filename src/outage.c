@@ -0,0 +1,368 @@
+#include "outage.h"
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/sys/util.h>
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+#include <zephyr/fs/fcb.h>
+#include <zephyr/storage/flash_map.h>
+#endif
+
+// Longer rows are not buffered. Fits a full health record.
+#define MAX_ROW_LEN 1040
+
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+#if !FIXED_PARTITION_EXISTS(outage_partition)
+#error "CONFIG_BIOLOGGER_OUTAGE_FLASH needs an outage_partition in flash."
+#endif
+#define OUTAGE_PARTITION_ID FIXED_PARTITION_ID(outage_partition)
+#define FCB_MAGIC 0x6f757467 // "outg"
+#define FCB_VERSION 1
+#define MAX_FLASH_SECTORS 16
+// Flash writes are padded up to the write block size.
+#define MAX_FLASH_ALIGN 8
+#else
+#define MAX_FLASH_ALIGN 0
+#endif
+
+LOG_MODULE_REGISTER(outage);
+
+/**
+ * @brief Precedes every row, both in RAM and in flash.
+ */
+struct record_header {
+    uint8_t stream;
+    uint16_t len;
+} __packed;
+
+/**
+ * @brief Where the row returned by outage_front came from.
+ */
+enum tier {
+    TIER_NONE,
+    TIER_RAM,
+    TIER_FLASH,
+};
+
+RING_BUF_DECLARE(ram_ring, CONFIG_BIOLOGGER_OUTAGE_RAM_SIZE);
+static uint32_t ram_rows;
+
+// A whole record, on its way between the tiers or out of the backlog.
+static uint8_t record_buf[sizeof(struct record_header) + MAX_ROW_LEN
+                         + MAX_FLASH_ALIGN] __aligned(4);
+static enum tier front_tier = TIER_NONE;
+
+static struct outage_stats stats;
+
+/******************************************************************************
+ * Flash tier.
+ *****************************************************************************/
+
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+static struct fcb fcb;
+static struct flash_sector flash_sectors[MAX_FLASH_SECTORS];
+static bool flash_ready = false;
+static bool flash_full = false;
+static uint32_t flash_rows;
+// The last entry consumed, or zeroed if there is none. Everything up to it
+// stays in flash until the next boot.
+static struct fcb_entry flash_read_loc;
+// The last entry appended, or zeroed if there is none.
+static struct fcb_entry flash_write_loc;
+// The entry returned by outage_front.
+static struct fcb_entry flash_front_loc;
+
+static int erase_partition(void) {
+    const struct flash_area* area;
+    int err;
+
+    if ((err = flash_area_open(OUTAGE_PARTITION_ID, &area)) != 0) {
+        return err;
+    }
+    err = flash_area_erase(area, 0, area->fa_size);
+    flash_area_close(area);
+    return err;
+}
+
+/**
+ * @brief Erase whatever the previous boot left behind. This is the only place
+ *        flash is erased, as storage_init runs before the first sample.
+ */
+static int flash_init(void) {
+    uint32_t sector_count = ARRAY_SIZE(flash_sectors);
+    int err;
+
+    if ((err = flash_area_get_sectors(OUTAGE_PARTITION_ID, &sector_count,
+                                      flash_sectors)) != 0) {
+        LOG_ERR("Failed to list the outage partition sectors (%d).", err);
+        return err;
+    }
+
+    fcb = (struct fcb){
+        .f_magic = FCB_MAGIC,
+        .f_version = FCB_VERSION,
+        .f_sector_cnt = sector_count,
+        .f_sectors = flash_sectors,
+    };
+
+    // Anything but an FCB of ours is wiped.
+    if ((err = fcb_init(OUTAGE_PARTITION_ID, &fcb)) != 0) {
+        LOG_WRN("Erasing the outage partition (%d).", err);
+        if ((err = erase_partition()) != 0
+                || (err = fcb_init(OUTAGE_PARTITION_ID, &fcb)) != 0) {
+            LOG_ERR("Failed to set up the outage partition (%d).", err);
+            return err;
+        }
+    }
+
+    if (!fcb_is_empty(&fcb) && (err = fcb_clear(&fcb)) != 0) {
+        LOG_ERR("Failed to clear the outage partition (%d).", err);
+        return err;
+    }
+
+    flash_rows = 0;
+    flash_read_loc = (struct fcb_entry){ 0 };
+    flash_write_loc = (struct fcb_entry){ 0 };
+    flash_full = false;
+    flash_ready = true;
+    return 0;
+}
+
+/**
+ * @brief Mark every row in flash as consumed. Nothing is erased, see
+ *        flash_init.
+ */
+static void flash_consume_all(void) {
+    flash_rows = 0;
+    flash_read_loc = flash_write_loc;
+}
+
+static int flash_append(const uint8_t* record, size_t len) {
+    struct fcb_entry loc;
+    int err;
+
+    if (!flash_ready) {
+        return -ENODEV;
+    }
+
+    // Erasing a sector would stall the CPU, and sampling with it, for over a
+    // second. Rows consumed since boot therefore keep their space.
+    if ((err = fcb_append(&fcb, len, &loc)) != 0) {
+        if (err == -ENOSPC && !flash_full) {
+            LOG_WRN("The outage partition is used up until the next boot.");
+            flash_full = true;
+        }
+        return err;
+    }
+
+    if ((err = flash_area_write(fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), record,
+                                ROUND_UP(len, MAX(fcb.f_align, 1)))) != 0) {
+        LOG_ERR("Failed to write a row to flash (%d).", err);
+        return err;
+    }
+
+    if ((err = fcb_append_finish(&fcb, &loc)) != 0) {
+        return err;
+    }
+    flash_write_loc = loc;
+    return 0;
+}
+
+/**
+ * @brief Read the oldest row in flash into record_buf. Rows which cannot be
+ *        read back are lost.
+ */
+static int flash_front(void) {
+    int err;
+
+    while (flash_rows > 0) {
+        flash_front_loc = flash_read_loc;
+        if ((err = fcb_getnext(&fcb, &flash_front_loc)) != 0) {
+            LOG_ERR("Lost track of %u rows in flash (%d).", flash_rows, err);
+            stats.rows_lost += flash_rows;
+            flash_consume_all();
+            break;
+        }
+
+        if (flash_front_loc.fe_data_len <= sizeof(record_buf)
+                && (err = flash_area_read(
+                        fcb.fap, FCB_ENTRY_FA_DATA_OFF(flash_front_loc),
+                        record_buf, flash_front_loc.fe_data_len)) == 0) {
+            return 0;
+        }
+
+        LOG_WRN("Lost a row which could not be read from flash.");
+        stats.rows_lost++;
+        flash_read_loc = flash_front_loc;
+        flash_rows--;
+    }
+
+    return -ENODATA;
+}
+#endif
+
+/******************************************************************************
+ * RAM tier.
+ *****************************************************************************/
+
+/**
+ * @brief Copy the oldest record in RAM into record_buf, without removing it.
+ *
+ * @return The size of the record.
+ */
+static size_t ram_front(void) {
+    struct record_header header;
+
+    (void)ring_buf_peek(&ram_ring, (uint8_t*)&header, sizeof(header));
+    const size_t size = sizeof(header) + header.len;
+    (void)ring_buf_peek(&ram_ring, record_buf, size);
+    return size;
+}
+
+/**
+ * @brief Make room in RAM by moving its oldest record to flash.
+ */
+static int spill_oldest(void) {
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+    int err;
+
+    if (ram_rows == 0) {
+        return -ENOSPC;
+    }
+
+    const size_t size = ram_front();
+    if ((err = flash_append(record_buf, size)) != 0) {
+        return err;
+    }
+
+    (void)ring_buf_get(&ram_ring, NULL, size);
+    ram_rows--;
+    flash_rows++;
+    return 0;
+#else
+    return -ENOSPC;
+#endif
+}
+
+/******************************************************************************
+ * Backlog.
+ *****************************************************************************/
+
+int outage_init(void) {
+    ring_buf_reset(&ram_ring);
+    ram_rows = 0;
+    front_tier = TIER_NONE;
+    stats = (struct outage_stats){ 0 };
+
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+    return flash_init();
+#else
+    return 0;
+#endif
+}
+
+int outage_push(enum storage_stream stream, const struct strv row) {
+    const struct record_header header = {
+        .stream = stream,
+        .len = row.len,
+    };
+    const size_t size = sizeof(header) + row.len;
+
+    if (row.len > MAX_ROW_LEN) {
+        stats.rows_lost++;
+        return -EMSGSIZE;
+    }
+
+    // Spilling reuses record_buf, and may move the front row.
+    front_tier = TIER_NONE;
+    while (ring_buf_space_get(&ram_ring) < size) {
+        if (spill_oldest() != 0) {
+            stats.rows_lost++;
+            return -ENOSPC;
+        }
+    }
+
+    (void)ring_buf_put(&ram_ring, (const uint8_t*)&header, sizeof(header));
+    (void)ring_buf_put(&ram_ring, (const uint8_t*)row.str, row.len);
+    ram_rows++;
+    stats.rows_stored++;
+    return 0;
+}
+
+bool outage_pending(void) {
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+    if (flash_rows > 0) {
+        return true;
+    }
+#endif
+    return ram_rows > 0;
+}
+
+int outage_front(enum storage_stream* stream, struct strv* row) {
+    front_tier = TIER_NONE;
+
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+    if (flash_rows > 0 && flash_front() == 0) {
+        front_tier = TIER_FLASH;
+    }
+#endif
+    if (front_tier == TIER_NONE) {
+        if (ram_rows == 0) {
+            return -ENODATA;
+        }
+        (void)ram_front();
+        front_tier = TIER_RAM;
+    }
+
+    struct record_header header;
+    memcpy(&header, record_buf, sizeof(header));
+    *stream = header.stream;
+    *row = (struct strv){
+        .str = (char*)record_buf + sizeof(header),
+        .len = header.len,
+    };
+    return 0;
+}
+
+void outage_pop(void) {
+    switch (front_tier) {
+        case TIER_RAM:
+            (void)ring_buf_get(&ram_ring, NULL, ram_front());
+            ram_rows--;
+            break;
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+        case TIER_FLASH:
+            flash_read_loc = flash_front_loc;
+            flash_rows--;
+            break;
+#endif
+        default:
+            return;
+    }
+
+    front_tier = TIER_NONE;
+    stats.rows_replayed++;
+}
+
+void outage_discard(void) {
+    stats.rows_lost += ram_rows;
+    ring_buf_reset(&ram_ring);
+    ram_rows = 0;
+    front_tier = TIER_NONE;
+
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+    stats.rows_lost += flash_rows;
+    flash_consume_all();
+#endif
+}
+
+void outage_stats_get(struct outage_stats* out) {
+    *out = stats;
+    out->rows_pending = ram_rows;
+#if defined(CONFIG_BIOLOGGER_OUTAGE_FLASH)
+    out->rows_pending += flash_rows;
+    out->rows_in_flash = flash_rows;
+#endif
+}
@@ -0,0 +1,98 @@
+/**
+ * @brief Holds on to the rows written while the SD card is unavailable, and
+ *        hands them back in order once it returns.
+ *
+ * @details
+ * Rows are first kept in a RAM ring of CONFIG_BIOLOGGER_OUTAGE_RAM_SIZE
+ * bytes. If CONFIG_BIOLOGGER_OUTAGE_FLASH is enabled and the ring fills up,
+ * its oldest rows are moved to the "outage_partition" flash partition, so
+ * everything in flash is always older than everything in RAM. Rows which fit
+ * in neither are lost.
+ *
+ * The backlog is a single queue shared by every stream. outage_front and
+ * outage_pop hand it back oldest first, from flash and then from RAM.
+ *
+ * Erasing a flash sector stalls the CPU for over a second, so nothing is
+ * erased while sampling. Replayed rows are only marked consumed, and keep
+ * their space until outage_init erases it on the next boot, before sampling
+ * starts. The rows of a previous boot are never replayed, since they belong to
+ * a transaction which no longer exists. The partition therefore holds at most
+ * its size of rows per boot.
+ *
+ * @warning Only ever used by the storage thread, which is why nothing here is
+ *          locked.
+ */
+#ifndef OUTAGE_H
+#define OUTAGE_H
+
+#include "storage.h"
+#include "str.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief What happened to the rows that could not be written right away.
+ */
+struct outage_stats {
+    /*!< The total number of rows put in the backlog. */
+    uint32_t rows_stored;
+    /*!< The total number of rows handed back out of the backlog. */
+    uint32_t rows_replayed;
+    /*!< The total number of rows which did not fit, or were discarded. */
+    uint32_t rows_lost;
+    /*!< The number of rows currently in the backlog. */
+    uint32_t rows_pending;
+    /*!< The number of those which are in flash. */
+    uint32_t rows_in_flash;
+};
+
+/**
+ * @brief Prepare the RAM ring and erase the flash partition if needed. Must be
+ *        called before sampling starts.
+ *
+ * @return 0 on success. On error, the RAM ring is still usable.
+ */
+int outage_init(void);
+
+/**
+ * @brief Append a row to the backlog.
+ *
+ * @param [in] stream The stream the row belongs to.
+ * @param [in] row The row, including its newline. It is copied.
+ *
+ * @return 0 on success, -EMSGSIZE if the row is too long to be buffered or
+ *         -ENOSPC if there is no room left. The row is lost in both cases.
+ */
+int outage_push(enum storage_stream stream, const struct strv row);
+
+/**
+ * @brief Whether there is anything in the backlog.
+ */
+bool outage_pending(void);
+
+/**
+ * @brief Retrieve the oldest row of the backlog without removing it.
+ *
+ * @param [out] stream The stream the row belongs to.
+ * @param [out] row The row. Valid until the next call into this module.
+ *
+ * @return 0 on success, -ENODATA if the backlog is empty.
+ */
+int outage_front(enum storage_stream* stream, struct strv* row);
+
+/**
+ * @brief Remove the row returned by outage_front, once it has been written.
+ */
+void outage_pop(void);
+
+/**
+ * @brief Throw the whole backlog away. Its rows are counted as lost.
+ */
+void outage_discard(void);
+
+/**
+ * @brief Retrieve the backlog counters.
+ */
+void outage_stats_get(struct outage_stats* stats);
+
+#endif /* OUTAGE_H */
@@ -0,0 +1,117 @@
+#include "perf.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/spinlock.h>
+
+static const char* const stage_names[PERF_STAGE_COUNT] = {
+    [PERF_STAGE_LOOP] = "loop",
+    [PERF_STAGE_ROW_ALLOC] = "row alloc",
+    [PERF_STAGE_SENSOR_FETCH] = "sensor fetch",
+    [PERF_STAGE_TIMESTAMP] = "timestamp",
+    [PERF_STAGE_PUSH] = "push",
+    [PERF_STAGE_FORMAT] = "format",
+    [PERF_STAGE_WRITE] = "write",
+    [PERF_STAGE_SYNC] = "sync",
+};
+
+// Stages are recorded from the sampling and storage threads and read from the
+// shell. Every critical section is a handful of instructions.
+static struct k_spinlock lock;
+static struct perf_stage_stats stats[PERF_STAGE_COUNT];
+
+static unsigned int bucket_of(uint32_t cycles) {
+    if (cycles == 0) {
+        return 0;
+    }
+    return MIN(32 - __builtin_clz(cycles), PERF_HISTOGRAM_BUCKETS - 1);
+}
+
+void perf_record(enum perf_stage stage, uint32_t start) {
+    // Unsigned arithmetic takes care of the counter wrapping around.
+    const uint32_t cycles = k_cycle_get_32() - start;
+    struct perf_stage_stats* s = &stats[stage];
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (s->count == 0 || cycles < s->min) {
+        s->min = cycles;
+    }
+    if (cycles > s->max) {
+        s->max = cycles;
+    }
+    s->count++;
+    s->total += cycles;
+    s->histogram[bucket_of(cycles)]++;
+    k_spin_unlock(&lock, key);
+}
+
+void perf_stats_get(enum perf_stage stage, struct perf_stage_stats* out) {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    *out = stats[stage];
+    k_spin_unlock(&lock, key);
+}
+
+void perf_reset(void) {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    memset(stats, 0, sizeof(stats));
+    k_spin_unlock(&lock, key);
+}
+
+const char* perf_stage_name(enum perf_stage stage) {
+    return stage_names[stage];
+}
+
+/******************************************************************************
+ * Shell commands.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+static int cmd_perf_show(const struct shell* sh, size_t argc, char** argv) {
+    struct perf_stage_stats s;
+
+    shell_print(sh, "%-12s %8s %10s %10s %10s", "stage", "count", "min [us]",
+                "mean [us]", "max [us]");
+    for (size_t i = 0; i < PERF_STAGE_COUNT; i++) {
+        perf_stats_get(i, &s);
+        if (s.count == 0) {
+            shell_print(sh, "%-12s %8u", stage_names[i], 0);
+            continue;
+        }
+
+        shell_print(sh, "%-12s %8u %10u %10u %10u", stage_names[i], s.count,
+                    k_cyc_to_us_floor32(s.min),
+                    (uint32_t)k_cyc_to_us_floor64(s.total / s.count),
+                    k_cyc_to_us_floor32(s.max));
+
+        // Only the buckets that were hit, as "<upper bound in us>:count".
+        shell_fprintf(sh, SHELL_NORMAL, "%12s", "");
+        for (size_t b = 0; b < PERF_HISTOGRAM_BUCKETS; b++) {
+            if (s.histogram[b] != 0) {
+                shell_fprintf(sh, SHELL_NORMAL, " <%llu:%u",
+                              k_cyc_to_us_ceil64(1ull << b), s.histogram[b]);
+            }
+        }
+        shell_fprintf(sh, SHELL_NORMAL, "\n");
+    }
+
+    return 0;
+}
+
+static int cmd_perf_reset(const struct shell* sh, size_t argc, char** argv) {
+    perf_reset();
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(perf_cmds,
+    SHELL_CMD(show, NULL, "Show the duration of every sampling stage.",
+              cmd_perf_show),
+    SHELL_CMD(reset, NULL, "Clear the durations.", cmd_perf_reset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((biologger), perf, &perf_cmds,
+                 "Time the stages of the sampling loop.", NULL, 0, 0);
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @brief Times every stage a sample goes through, from allocating its row to
+ *        syncing it to the card.
+ *
+ * @details
+ * Every stage keeps the minimum, mean and maximum duration seen and a
+ * histogram with power-of-two buckets, all in cycles of k_cycle_get_32. A
+ * stage is timed by wrapping it in PERF_BEGIN and PERF_END, which cost two
+ * cycle counter reads and a short spinlock:
+ *
+ * @code{.c}
+ * PERF_BEGIN(fetch);
+ * collect_data_10hz(row);
+ * PERF_END(PERF_STAGE_SENSOR_FETCH, fetch);
+ * @endcode
+ *
+ * The statistics are printed and cleared from the shell:
+ *
+ *   biologger perf show     Print every stage.
+ *   biologger perf reset    Start counting afresh.
+ *
+ * Without CONFIG_BIOLOGGER_PERF both macros expand to nothing and none of
+ * this module is built.
+ */
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/*!< Bucket i counts durations below 2^i cycles, and at least 2^(i - 1). */
+#define PERF_HISTOGRAM_BUCKETS 32
+
+enum perf_stage {
+    /*!< One whole iteration of the sampling loop, excluding its sleep. */
+    PERF_STAGE_LOOP,
+    /*!< Allocating a new experiment row. */
+    PERF_STAGE_ROW_ALLOC,
+    /*!< Reading every sensor into the row. */
+    PERF_STAGE_SENSOR_FETCH,
+    /*!< Computing the row's timestamp. */
+    PERF_STAGE_TIMESTAMP,
+    /*!< experiment_push_row, including the flushes it triggers, on the
+     * experiment thread. */
+    PERF_STAGE_PUSH,
+    /*!< Formatting a single row into CSV. */
+    PERF_STAGE_FORMAT,
+    /*!< Writing a single row to its file, on the storage thread. */
+    PERF_STAGE_WRITE,
+    /*!< Syncing a file and the card, on the storage thread. */
+    PERF_STAGE_SYNC,
+
+    PERF_STAGE_COUNT,
+};
+
+/**
+ * @brief The statistics of a single stage. All durations are in cycles.
+ */
+struct perf_stage_stats {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t histogram[PERF_HISTOGRAM_BUCKETS];
+};
+
+#if defined(CONFIG_BIOLOGGER_PERF)
+
+/**
+ * @brief Record that a stage took the cycles since start.
+ *
+ * @param [in] stage The stage.
+ * @param [in] start The k_cycle_get_32 value when the stage began.
+ */
+void perf_record(enum perf_stage stage, uint32_t start);
+
+/**
+ * @brief Copy the statistics of a stage.
+ */
+void perf_stats_get(enum perf_stage stage, struct perf_stage_stats* stats);
+
+/**
+ * @brief Clear the statistics of every stage.
+ */
+void perf_reset(void);
+
+/**
+ * @brief The human-readable name of a stage.
+ */
+const char* perf_stage_name(enum perf_stage stage);
+
+#define PERF_BEGIN(name) const uint32_t perf_##name##_start = k_cycle_get_32()
+#define PERF_END(stage, name) perf_record((stage), perf_##name##_start)
+
+#else
+
+#define PERF_BEGIN(name)
+#define PERF_END(stage, name) do {} while (0)
+
+#endif /* CONFIG_BIOLOGGER_PERF */
+
+#endif /* PERF_H */
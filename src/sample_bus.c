@@ -0,0 +1,88 @@
+#include "sample_bus.h"
+#include "experiment.h"
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/slist.h>
+
+LOG_MODULE_REGISTER(sample_bus);
+
+/*
+ * Subscribers are only ever appended, and a node is complete before the list
+ * points to it, so publishing walks the list without taking the lock.
+ */
+static sys_slist_t subscribers = SYS_SLIST_STATIC_INIT(&subscribers);
+static struct k_spinlock subscribers_lock;
+
+static atomic_t sequence = ATOMIC_INIT(0);
+
+void sample_bus_subscribe(struct sample_bus_subscriber* subscriber) {
+    k_spinlock_key_t key = k_spin_lock(&subscribers_lock);
+    sys_slist_append(&subscribers, &subscriber->node);
+    k_spin_unlock(&subscribers_lock, key);
+
+    LOG_INF("%s subscribed to the rows.", subscriber->name);
+}
+
+void sample_bus_publish(struct experiment_row* row) {
+    struct sample_bus_subscriber* subscriber;
+
+    row->seq = (uint32_t)atomic_inc(&sequence);
+
+    SYS_SLIST_FOR_EACH_CONTAINER(&subscribers, subscriber, node) {
+        // The reference is taken before the row is queued, since a subscriber
+        // of a higher priority may be done with it before k_msgq_put returns.
+        experiment_row_ref(row);
+        if (k_msgq_put(subscriber->queue, &row, K_NO_WAIT) != 0) {
+            experiment_row_unref(row);
+            atomic_inc(&subscriber->rows_dropped);
+            continue;
+        }
+        atomic_inc(&subscriber->rows_queued);
+    }
+
+    experiment_row_unref(row);
+}
+
+struct experiment_row* sample_bus_take(
+    struct sample_bus_subscriber* subscriber,
+    k_timeout_t timeout
+) {
+    struct experiment_row* row;
+
+    if (k_msgq_get(subscriber->queue, &row, timeout) != 0) {
+        return NULL;
+    }
+    return row;
+}
+
+/******************************************************************************
+ * Shell commands.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+static int cmd_bus_status(const struct shell* sh, size_t argc, char** argv) {
+    struct sample_bus_subscriber* subscriber;
+
+    shell_print(sh, "Rows published: %u", (uint32_t)atomic_get(&sequence));
+    SYS_SLIST_FOR_EACH_CONTAINER(&subscribers, subscriber, node) {
+        shell_print(sh, "%s: %u queued, %u dropped, %u waiting",
+                    subscriber->name,
+                    (uint32_t)atomic_get(&subscriber->rows_queued),
+                    (uint32_t)atomic_get(&subscriber->rows_dropped),
+                    k_msgq_num_used_get(subscriber->queue));
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(bus_cmds,
+    SHELL_CMD(status, NULL, "Show how many rows every subscriber took.",
+              cmd_bus_status),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((biologger), bus, &bus_cmds,
+                 "Inspect the sample bus.", NULL, 0, 0);
+#endif
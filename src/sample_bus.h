@@ -0,0 +1,112 @@
+/**
+ * @brief Hands every row to each of its consumers without copying it.
+ *
+ * @details
+ * The sampling thread publishes every row exactly once with
+ * sample_bus_publish. Each subscriber owns a queue which only ever holds
+ * pointers to rows. A row carries a reference count, one for every queue it
+ * sits in and every subscriber still reading it, and goes back to the row pool
+ * once the last one has released it with experiment_row_unref.
+ *
+ * Publishing never blocks. If the queue of a subscriber is full, the row is
+ * dropped for that subscriber alone and counted, so a slow subscriber never
+ * holds up the sampling thread or any other subscriber.
+ *
+ * A published row is read-only. The one exception is its node, which belongs
+ * to the experiment, see experiment_subscribe.
+ *
+ * Example:
+ * @code{.c}
+ * SAMPLE_BUS_SUBSCRIBER_DEFINE(console_subscriber, 4);
+ *
+ * // On the sampling thread.
+ * sample_bus_publish(row);
+ *
+ * // On the thread of the subscriber.
+ * sample_bus_subscribe(&console_subscriber);
+ * while (true) {
+ *     struct experiment_row* row = sample_bus_take(&console_subscriber,
+ *                                                  K_FOREVER);
+ *     // ...
+ *     experiment_row_unref(row);
+ * }
+ * @endcode
+ *
+ * "biologger bus status" shows how many rows every subscriber took and
+ * dropped.
+ */
+#ifndef SAMPLE_BUS_H
+#define SAMPLE_BUS_H
+
+#include "experiment.h"
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/slist.h>
+
+/**
+ * @brief A consumer of the rows, and its queue.
+ */
+struct sample_bus_subscriber {
+    /*!< For the shell. */
+    const char* name;
+    /*!< Pointers to the rows the subscriber has not taken yet. */
+    struct k_msgq* queue;
+    /*!< The number of rows queued for the subscriber. */
+    atomic_t rows_queued;
+    /*!< The number of rows dropped because the queue was full. */
+    atomic_t rows_dropped;
+    sys_snode_t node;
+};
+
+/*
+ * The queue depth of every subscriber. A subscriber holds up to its depth in
+ * queued rows, plus the row it is working on, and all of them stay allocated,
+ * see CONFIG_BIOLOGGER_STATIC_ROWS. A new subscriber must be added here.
+ */
+// The rows published while the experiment waits for the storage queue.
+#define SAMPLE_BUS_EXPERIMENT_DEPTH 8
+// Rows keep arriving while a line is printed. Those that are skipped due to
+// the rate are let go right away, so this is a few lines worth at most.
+#define SAMPLE_BUS_TELEMETRY_DEPTH 4
+// The thread frames rows as fast as they come, so it only needs to ride out
+// being preempted for a few rows.
+#define SAMPLE_BUS_USB_STREAM_DEPTH 4
+
+/**
+ * @brief Define a subscriber whose queue holds up to depth rows.
+ */
+#define SAMPLE_BUS_SUBSCRIBER_DEFINE(_name, _depth)                         \
+    K_MSGQ_DEFINE(_name##_queue, sizeof(struct experiment_row*), (_depth),  \
+                  sizeof(void*));                                           \
+    static struct sample_bus_subscriber _name = {                           \
+        .name = #_name,                                                     \
+        .queue = &_name##_queue,                                            \
+    }
+
+/**
+ * @brief Start queueing every row published from now on for subscriber.
+ *        Subscribers are never removed.
+ */
+void sample_bus_subscribe(struct sample_bus_subscriber* subscriber);
+
+/**
+ * @brief Hand a row to every subscriber. Never blocks.
+ *
+ * @param [in] row A row fresh from experiment_row_new. The caller's reference
+ *                 is taken over, so the row must not be touched afterwards.
+ */
+void sample_bus_publish(struct experiment_row* row);
+
+/**
+ * @brief Take the oldest row queued for subscriber.
+ *
+ * @return The row, which the caller must release with experiment_row_unref,
+ *         or NULL if none was published in time.
+ */
+struct experiment_row* sample_bus_take(
+    struct sample_bus_subscriber* subscriber,
+    k_timeout_t timeout
+);
+
+#endif /* SAMPLE_BUS_H */
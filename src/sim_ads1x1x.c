@@ -0,0 +1,241 @@
+#include "sim_bottom.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/i2c_emul.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#define REG_CONVERSION 0x00
+#define REG_CONFIG 0x01
+#define REG_COUNT 4
+#define CONFIG_OS BIT(15)
+#define CONFIG_RESET 0x8583
+#define INPUTS 4
+#define MAX_SCRIPT_POINTS 4096
+
+// The built-in signal: a sine around the middle of the amplifier lookup
+// tables, with a different period on every input.
+#define SINE_MEAN_UV 1000000
+#define SINE_AMPLITUDE_UV 400000
+#define SINE_BASE_PERIOD_MS 60000
+
+LOG_MODULE_REGISTER(sim_ads1x1x);
+
+/**
+ * @brief An ADS1015 or ADS1115 on the emulated I2C bus. The Zephyr ads1x1x
+ *        driver talks to it as it would to the chip, so ximpedance_amp and
+ *        everything above it run unmodified.
+ *
+ * @details
+ * Only single-shot conversions are emulated: writing the config register with
+ * OS set converts the inputs selected by MUX at the PGA range right away, and
+ * reading the config register always reports the conversion as done.
+ */
+struct ads1x1x_emul_data {
+    uint16_t regs[REG_COUNT];
+    uint8_t pointer;
+};
+
+struct ads1x1x_emul_cfg {
+    /*!< 12 for the ADS1015, 16 for the ADS1115. */
+    uint8_t resolution;
+};
+
+// The full scale range of every PGA setting, in microvolts.
+static const int32_t pga_fsr_uv[8] = {
+    6144000, 4096000, 2048000, 1024000, 512000, 256000, 256000, 256000,
+};
+
+static struct sim_script_point script[MAX_SCRIPT_POINTS];
+static size_t script_len;
+
+// Inputs set from the shell take precedence over the script.
+static int32_t override_uv[INPUTS];
+static bool overridden[INPUTS];
+
+/**
+ * @brief The voltage on an input at the current uptime, interpolated between
+ *        the script points. The script loops.
+ */
+static int32_t scripted_uv(size_t input, int64_t now_ms) {
+    if (script_len == 0) {
+        const double period = SINE_BASE_PERIOD_MS * (input + 2) / 2.0;
+        return SINE_MEAN_UV
+            + SINE_AMPLITUDE_UV * sin(2.0 * M_PI * now_ms / period);
+    }
+
+    const uint32_t end = script[script_len - 1].ms;
+    const uint32_t t = end == 0 ? 0 : now_ms % end;
+    size_t i = 0;
+    while (i + 1 < script_len && script[i + 1].ms <= t) {
+        i++;
+    }
+    if (i + 1 == script_len) {
+        return script[i].microvolts[input];
+    }
+
+    const struct sim_script_point* a = &script[i];
+    const struct sim_script_point* b = &script[i + 1];
+    return a->microvolts[input] + (int64_t)(b->microvolts[input]
+        - a->microvolts[input]) * (t - a->ms) / (b->ms - a->ms);
+}
+
+static int32_t input_uv(size_t input) {
+    return overridden[input] ? override_uv[input]
+        : scripted_uv(input, k_uptime_get());
+}
+
+/**
+ * @brief The voltage between the inputs selected by MUX.
+ */
+static int32_t mux_uv(uint8_t mux) {
+    switch (mux) {
+        case 0: return input_uv(0) - input_uv(1);
+        case 1: return input_uv(0) - input_uv(3);
+        case 2: return input_uv(1) - input_uv(3);
+        case 3: return input_uv(2) - input_uv(3);
+        default: return input_uv(mux - 4);
+    }
+}
+
+static void convert(const struct emul* target) {
+    struct ads1x1x_emul_data* data = target->data;
+    const struct ads1x1x_emul_cfg* cfg = target->cfg;
+    const uint16_t config = data->regs[REG_CONFIG];
+
+    const int32_t fsr = pga_fsr_uv[(config >> 9) & 0x7];
+    const int64_t code = (int64_t)mux_uv((config >> 12) & 0x7) * 32768 / fsr;
+    const int16_t clamped = CLAMP(code, INT16_MIN, INT16_MAX);
+
+    // The ADS1015 leaves the low four bits of the register zero.
+    data->regs[REG_CONVERSION] =
+        (uint16_t)clamped & GENMASK(15, 16 - cfg->resolution);
+}
+
+static int ads1x1x_emul_transfer(const struct emul* target,
+                                 struct i2c_msg* msgs, int num_msgs,
+                                 int addr) {
+    struct ads1x1x_emul_data* data = target->data;
+
+    for (int i = 0; i < num_msgs; i++) {
+        struct i2c_msg* msg = &msgs[i];
+
+        if (msg->flags & I2C_MSG_READ) {
+            if (msg->len != 2) {
+                return -EIO;
+            }
+            uint16_t value = data->regs[data->pointer];
+            if (data->pointer == REG_CONFIG) {
+                value |= CONFIG_OS;
+            }
+            sys_put_be16(value, msg->buf);
+            continue;
+        }
+
+        if (msg->len < 1 || msg->buf[0] >= REG_COUNT) {
+            return -EIO;
+        }
+        data->pointer = msg->buf[0];
+
+        if (msg->len == 3) {
+            data->regs[data->pointer] = sys_get_be16(&msg->buf[1]);
+            if (data->pointer == REG_CONFIG
+                    && (data->regs[REG_CONFIG] & CONFIG_OS)) {
+                convert(target);
+                data->regs[REG_CONFIG] &= ~CONFIG_OS;
+            }
+        } else if (msg->len != 1) {
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
+static const struct i2c_emul_api ads1x1x_emul_api = {
+    .transfer = ads1x1x_emul_transfer,
+};
+
+static int ads1x1x_emul_init(const struct emul* target,
+                             const struct device* parent) {
+    struct ads1x1x_emul_data* data = target->data;
+    const char* path = CONFIG_BIOLOGGER_SIM_ADC_SCRIPT;
+
+    data->regs[REG_CONFIG] = CONFIG_RESET;
+    data->pointer = REG_CONVERSION;
+
+    if (path[0] != '\0' && script_len == 0) {
+        const int n = sim_script_load(path, script, ARRAY_SIZE(script));
+        if (n <= 0) {
+            LOG_ERR("Failed to read the ADC script \"%s\", using the "
+                    "built-in signal.", path);
+        } else {
+            script_len = n;
+            LOG_INF("Read %d points from the ADC script \"%s\".", n, path);
+        }
+    }
+
+    return 0;
+}
+
+#define ADS1X1X_EMUL(n, res)                                                  \
+    static struct ads1x1x_emul_data ads1x1x_emul_data_##res##_##n;            \
+    static const struct ads1x1x_emul_cfg ads1x1x_emul_cfg_##res##_##n = {     \
+        .resolution = res,                                                    \
+    };                                                                        \
+    EMUL_DT_INST_DEFINE(n, ads1x1x_emul_init,                                 \
+                        &ads1x1x_emul_data_##res##_##n,                       \
+                        &ads1x1x_emul_cfg_##res##_##n, &ads1x1x_emul_api,     \
+                        NULL);
+
+#define DT_DRV_COMPAT ti_ads1015
+#define ADS1015_EMUL(n) ADS1X1X_EMUL(n, 12)
+DT_INST_FOREACH_STATUS_OKAY(ADS1015_EMUL)
+#undef DT_DRV_COMPAT
+
+#define DT_DRV_COMPAT ti_ads1115
+#define ADS1115_EMUL(n) ADS1X1X_EMUL(n, 16)
+DT_INST_FOREACH_STATUS_OKAY(ADS1115_EMUL)
+#undef DT_DRV_COMPAT
+
+/******************************************************************************
+ * Shell commands.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+static int cmd_ain(const struct shell* sh, size_t argc, char** argv) {
+    const long input = strtol(argv[1], NULL, 10);
+
+    if (input < 0 || input >= INPUTS) {
+        shell_error(sh, "The inputs are 0 to %d.", INPUTS - 1);
+        return -EINVAL;
+    }
+
+    if (strcmp(argv[2], "script") == 0) {
+        overridden[input] = false;
+    } else {
+        override_uv[input] = strtol(argv[2], NULL, 10);
+        overridden[input] = true;
+    }
+
+    shell_print(sh, "AIN%ld: %d uV", input, input_uv(input));
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((biologger, sim), ain, NULL,
+                 "Hold an ADC input at a voltage, or hand it back to the "
+                 "script: <input> <uV | script>", cmd_ain, 3, 0);
+
+// The other emulators add their own commands under "biologger sim".
+SHELL_SUBCMD_SET_CREATE(sim_cmds, (biologger, sim));
+SHELL_SUBCMD_ADD((biologger), sim, &sim_cmds,
+                 "Control the native_sim emulators.", NULL, 0, 0);
+#endif
@@ -0,0 +1,61 @@
+/*
+ * Built against the host's C library, outside of Zephyr.
+ */
+#include "sim_bottom.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+uint8_t* sim_disk_map(const char* path, uint64_t size) {
+    void* mapping;
+
+    if (path[0] == '\0') {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return mapping == MAP_FAILED ? NULL : mapping;
+    }
+
+    const int fd = open(path, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // The file stays sparse, so a large image only costs what is written.
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return mapping == MAP_FAILED ? NULL : mapping;
+}
+
+int sim_disk_sync(uint8_t* mapping, uint64_t size) {
+    return msync(mapping, size, MS_SYNC);
+}
+
+int sim_script_load(const char* path, struct sim_script_point* points,
+                    size_t max) {
+    char line[256];
+    size_t count = 0;
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    while (count < max && fgets(line, sizeof(line), file) != NULL) {
+        struct sim_script_point* p = &points[count];
+        if (line[0] != '#'
+                && sscanf(line, "%u %d %d %d %d", &p->ms, &p->microvolts[0],
+                          &p->microvolts[1], &p->microvolts[2],
+                          &p->microvolts[3]) == 5) {
+            count++;
+        }
+    }
+
+    fclose(file);
+    return count;
+}
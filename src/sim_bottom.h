@@ -0,0 +1,48 @@
+/**
+ * @brief What the simulation needs from the host, for code running on
+ *        native_sim.
+ */
+#ifndef SIM_BOTTOM_H
+#define SIM_BOTTOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Map the disk image at path into memory, creating it if needed.
+ *
+ * @param [in] path The image file, or "" for an anonymous mapping which is
+ *                  lost on exit.
+ * @param [in] size The size of the image in bytes. A larger existing image is
+ *                  truncated, a smaller one is extended with zeros.
+ *
+ * @return The mapping, or NULL on failure.
+ */
+uint8_t* sim_disk_map(const char* path, uint64_t size);
+
+/**
+ * @brief Write the mapping back to its file.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int sim_disk_sync(uint8_t* mapping, uint64_t size);
+
+/**
+ * @brief A point of an ADC script, see sim_script_load.
+ */
+struct sim_script_point {
+    uint32_t ms;
+    int32_t microvolts[4];
+};
+
+/**
+ * @brief Read an ADC script: one point per line, as the uptime in
+ *        milliseconds followed by the four inputs in microvolts, separated by
+ *        whitespace. Lines starting with '#' are ignored.
+ *
+ * @return The number of points read, or -1 if the file cannot be read.
+ */
+int sim_script_load(const char* path, struct sim_script_point* points,
+                    size_t max);
+
+#endif /* SIM_BOTTOM_H */
@@ -0,0 +1,113 @@
+#include "sim_bottom.h"
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/drivers/disk.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/disk_access.h>
+
+#define SECTOR_SIZE 512
+#define SECTOR_COUNT (CONFIG_BIOLOGGER_SIM_DISK_SIZE_MB * 2048u)
+#define DISK_SIZE ((uint64_t)SECTOR_COUNT * SECTOR_SIZE)
+
+LOG_MODULE_REGISTER(sim_disk);
+
+// The image, mapped into the host's memory by the bottom.
+static uint8_t* image;
+
+static int sim_disk_init(struct disk_info* disk) {
+    return 0;
+}
+
+static int sim_disk_status(struct disk_info* disk) {
+    return image != NULL ? DISK_STATUS_OK : DISK_STATUS_NOMEDIA;
+}
+
+static int sim_disk_read(struct disk_info* disk, uint8_t* buf,
+                         uint32_t sector, uint32_t count) {
+    if (image == NULL) {
+        return -ENODEV;
+    }
+    if (sector >= SECTOR_COUNT || count > SECTOR_COUNT - sector) {
+        return -EINVAL;
+    }
+
+    memcpy(buf, image + (uint64_t)sector * SECTOR_SIZE, count * SECTOR_SIZE);
+    return 0;
+}
+
+static int sim_disk_write(struct disk_info* disk, const uint8_t* buf,
+                          uint32_t sector, uint32_t count) {
+    if (image == NULL) {
+        return -ENODEV;
+    }
+    if (sector >= SECTOR_COUNT || count > SECTOR_COUNT - sector) {
+        return -EINVAL;
+    }
+
+    memcpy(image + (uint64_t)sector * SECTOR_SIZE, buf, count * SECTOR_SIZE);
+    return 0;
+}
+
+static int sim_disk_ioctl(struct disk_info* disk, uint8_t cmd, void* buf) {
+    switch (cmd) {
+        case DISK_IOCTL_GET_SECTOR_COUNT:
+            *(uint32_t*)buf = SECTOR_COUNT;
+            return 0;
+        case DISK_IOCTL_GET_SECTOR_SIZE:
+            *(uint32_t*)buf = SECTOR_SIZE;
+            return 0;
+        case DISK_IOCTL_GET_ERASE_BLOCK_SZ:
+            *(uint32_t*)buf = 1;
+            return 0;
+        case DISK_IOCTL_CTRL_SYNC:
+            // An anonymous mapping has no file to write back to.
+            if (CONFIG_BIOLOGGER_SIM_DISK_IMAGE[0] == '\0') {
+                return 0;
+            }
+            return sim_disk_sync(image, DISK_SIZE) != 0 ? -EIO : 0;
+        case DISK_IOCTL_CTRL_INIT:
+        case DISK_IOCTL_CTRL_DEINIT:
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+static const struct disk_operations sim_disk_ops = {
+    .init = sim_disk_init,
+    .status = sim_disk_status,
+    .read = sim_disk_read,
+    .write = sim_disk_write,
+    .ioctl = sim_disk_ioctl,
+};
+
+static struct disk_info sim_disk = {
+    .name = CONFIG_BIOLOGGER_SIM_DISK_NAME,
+    .ops = &sim_disk_ops,
+};
+
+/**
+ * @brief Map the image and register the disk before main runs, the way the
+ *        SDMMC driver registers the card on the logger.
+ */
+static int sim_disk_register(void) {
+    int err;
+
+    if ((image = sim_disk_map(CONFIG_BIOLOGGER_SIM_DISK_IMAGE, DISK_SIZE))
+            == NULL) {
+        LOG_ERR("Failed to map the %u MB disk image \"%s\".",
+                CONFIG_BIOLOGGER_SIM_DISK_SIZE_MB,
+                CONFIG_BIOLOGGER_SIM_DISK_IMAGE);
+    }
+
+    if ((err = disk_access_register(&sim_disk)) != 0) {
+        LOG_ERR("Failed to register the %s disk (%d).",
+                CONFIG_BIOLOGGER_SIM_DISK_NAME, err);
+        return err;
+    }
+
+    return 0;
+}
+
+SYS_INIT(sim_disk_register, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
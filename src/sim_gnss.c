@@ -0,0 +1,128 @@
+#include "thread_specs.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#define DT_GNSS_UART DT_BUS(DT_NODELABEL(gnss))
+#define MAX_SENTENCE 96
+// Somewhere on the UC Berkeley campus, as ddmm.mmmm.
+#define LATITUDE "3752.2146,N"
+#define LONGITUDE "12215.5560,W"
+
+LOG_MODULE_REGISTER(sim_gnss);
+
+static const struct device* const uart_dev = DEVICE_DT_GET(DT_GNSS_UART);
+
+K_THREAD_STACK_DEFINE(sim_gnss_thread_stack, THREAD_SIM_GNSS_STACK_SIZE);
+static struct k_thread sim_gnss_thread_data;
+
+// Cleared from the shell to simulate losing the sky.
+static bool fix_allowed = true;
+
+/**
+ * @brief Finish an NMEA sentence with its checksum and hand it to the UART the
+ *        GNSS driver listens on.
+ */
+static void put_sentence(char* sentence, size_t len) {
+    uint8_t checksum = 0;
+
+    // The checksum covers everything between '$' and '*'.
+    for (size_t i = 1; i < len; i++) {
+        checksum ^= sentence[i];
+    }
+    len += snprintf(sentence + len, MAX_SENTENCE - len, "*%02X\r\n", checksum);
+
+    uart_emul_put_rx_data(uart_dev, (const uint8_t*)sentence, len);
+}
+
+/**
+ * @brief Send the GGA and RMC sentences of one epoch. The receiver only
+ *        reports a fix once CONFIG_BIOLOGGER_SIM_GNSS_FIX_DELAY_S have passed,
+ *        like a cold start.
+ */
+static void put_epoch(void) {
+    char sentence[MAX_SENTENCE];
+    struct tm utc;
+    int len;
+
+    const int64_t uptime_s = k_uptime_get() / 1000;
+    const time_t now = CONFIG_BIOLOGGER_SIM_GNSS_EPOCH + uptime_s;
+    gmtime_r(&now, &utc);
+
+    const bool fix = fix_allowed
+        && uptime_s >= CONFIG_BIOLOGGER_SIM_GNSS_FIX_DELAY_S;
+
+    len = snprintf(sentence, sizeof(sentence),
+                   "$GPGGA,%02d%02d%02d.00,%s,%s,%d,%02d,0.9,52.0,M,-29.9,M,,",
+                   utc.tm_hour, utc.tm_min, utc.tm_sec, LATITUDE, LONGITUDE,
+                   fix ? 1 : 0, fix ? 8 : 0);
+    put_sentence(sentence, len);
+
+    len = snprintf(sentence, sizeof(sentence),
+                   "$GPRMC,%02d%02d%02d.00,%c,%s,%s,0.0,0.0,%02d%02d%02d,,,%c",
+                   utc.tm_hour, utc.tm_min, utc.tm_sec, fix ? 'A' : 'V',
+                   LATITUDE, LONGITUDE, utc.tm_mday, utc.tm_mon + 1,
+                   utc.tm_year % 100, fix ? 'A' : 'N');
+    put_sentence(sentence, len);
+}
+
+static void sim_gnss_thread(void* p1, void* p2, void* p3) {
+    while (true) {
+        put_epoch();
+        k_sleep(K_SECONDS(1));
+    }
+}
+
+/**
+ * @brief Start feeding the GNSS driver once the devices are up.
+ */
+static int sim_gnss_init(void) {
+    if (!device_is_ready(uart_dev)) {
+        LOG_ERR("The emulated GNSS UART is not ready.");
+        return -ENODEV;
+    }
+
+    k_thread_create(
+        &sim_gnss_thread_data,
+        sim_gnss_thread_stack,
+        K_THREAD_STACK_SIZEOF(sim_gnss_thread_stack),
+        sim_gnss_thread, NULL, NULL, NULL,
+        THREAD_SIM_GNSS_PRIORITY, 0, K_NO_WAIT
+    );
+    k_thread_name_set(&sim_gnss_thread_data, "sim_gnss");
+
+    return 0;
+}
+
+SYS_INIT(sim_gnss_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+/******************************************************************************
+ * Shell commands.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+static int cmd_gnss(const struct shell* sh, size_t argc, char** argv) {
+    if (strcmp(argv[1], "on") == 0) {
+        fix_allowed = true;
+    } else if (strcmp(argv[1], "off") == 0) {
+        fix_allowed = false;
+    } else {
+        shell_error(sh, "Expected \"on\" or \"off\".");
+        return -EINVAL;
+    }
+
+    shell_print(sh, "The simulated receiver %s a fix.",
+                fix_allowed ? "may get" : "has lost");
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((biologger, sim), gnss, NULL,
+                 "Let the simulated GNSS receiver get a fix or lose it: "
+                 "<on | off>", cmd_gnss, 2, 0);
+#endif
@@ -0,0 +1,91 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+#define DT_DRV_COMPAT biologger_sim_thermometer
+
+// A day in the field: 20 °C, give or take 5.
+#define MEAN_MILLICELSIUS 20000
+#define AMPLITUDE_MILLICELSIUS 5000
+#define PERIOD_MS (24 * 60 * 60 * 1000)
+
+/**
+ * @brief Stands in for the TSic on native_sim, which has no PWM capture to
+ *        read one with. Reports a slow daily swing unless held at a value
+ *        from the shell.
+ */
+struct sim_thermometer_data {
+    int32_t millicelsius;
+};
+
+// Set from the shell, shared by every instance.
+static bool held;
+static int32_t held_millicelsius;
+
+static int sim_thermometer_sample_fetch(const struct device* dev,
+                                        enum sensor_channel chan) {
+    struct sim_thermometer_data* data = dev->data;
+
+    if (chan != SENSOR_CHAN_ALL && chan != SENSOR_CHAN_AMBIENT_TEMP) {
+        return -ENOTSUP;
+    }
+
+    data->millicelsius = held ? held_millicelsius
+        : MEAN_MILLICELSIUS + AMPLITUDE_MILLICELSIUS
+            * sin(2.0 * M_PI * k_uptime_get() / PERIOD_MS);
+    return 0;
+}
+
+static int sim_thermometer_channel_get(const struct device* dev,
+                                       enum sensor_channel chan,
+                                       struct sensor_value* val) {
+    const struct sim_thermometer_data* data = dev->data;
+
+    if (chan != SENSOR_CHAN_AMBIENT_TEMP) {
+        return -ENOTSUP;
+    }
+
+    return sensor_value_from_milli(val, data->millicelsius);
+}
+
+static const struct sensor_driver_api sim_thermometer_api = {
+    .sample_fetch = sim_thermometer_sample_fetch,
+    .channel_get = sim_thermometer_channel_get,
+};
+
+#define SIM_THERMOMETER_DEFINE(n)                                             \
+    static struct sim_thermometer_data sim_thermometer_data_##n;              \
+    SENSOR_DEVICE_DT_INST_DEFINE(n, NULL, NULL, &sim_thermometer_data_##n,    \
+                                 NULL, POST_KERNEL,                           \
+                                 CONFIG_SENSOR_INIT_PRIORITY,                 \
+                                 &sim_thermometer_api);
+
+DT_INST_FOREACH_STATUS_OKAY(SIM_THERMOMETER_DEFINE)
+
+/******************************************************************************
+ * Shell commands.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+static int cmd_temp(const struct shell* sh, size_t argc, char** argv) {
+    if (strcmp(argv[1], "day") == 0) {
+        held = false;
+        shell_print(sh, "The temperature follows the day again.");
+        return 0;
+    }
+
+    held_millicelsius = strtol(argv[1], NULL, 10);
+    held = true;
+    shell_print(sh, "The temperature is held at %d m°C.", held_millicelsius);
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((biologger, sim), temp, NULL,
+                 "Hold the temperature, or let it follow the day again: "
+                 "<m°C | day>", cmd_temp, 2, 0);
+#endif
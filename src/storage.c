@@ -1,53 +1,123 @@
 // TODO(markovejnovic): Ton of duplication in this file.
+#include "card_probe.h"
 #include "observer.h"
+#include "outage.h"
+#include "perf.h"
 #include "storage.h"
+#include "storage_backend.h"
 #include "str.h"
 #include "thread_specs.h"
-#include "zephyr/fs/fs_interface.h"
-#include <ff.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/errno.h>
 #include <time.h>
-#include <zephyr/drivers/disk.h>
-#include <zephyr/fs/fs.h>
+#include <zephyr/drivers/gpio.h>
 #include <zephyr/kernel.h>
 #include <zephyr/kernel/thread.h>
 #include <zephyr/kernel/thread_stack.h>
 #include <zephyr/logging/log.h>
-#include <zephyr/storage/disk_access.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/sys/slist.h>
-#include <zephyr/usb/class/usbd_msc.h>
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/usbd.h>
 
 #define CONFIG_MAX_ROWS_BEFORE_SYNC 20
 
+#if defined(CONFIG_BIOLOGGER_CARD_PROBE)
+// The largest write rows of the data stream are gathered into. The card probe
+// picks how much of it to use.
+#define WRITE_BUFFER_SIZE CONFIG_BIOLOGGER_STORAGE_WRITE_BUFFER_SIZE
+#endif
+
 #define MAX_PATH 256
-#define DISK_NAME "SD"
-#define DISK_MOUNT_POINT "/"DISK_NAME":"
-#define MIN_DISK_SIZE_MB 1024
-#define SECTOR_MAX 2048
+// Segments after the first one are named "<transaction>-001<suffix>", etc.
+#define SEGMENT_SUFFIX_FMT "-%03u"
+
+// Index entries are at most this far apart in data timestamps. Finding a time
+// in a log then costs a binary search over the index and reading at most this
+// much data.
+#define INDEX_INTERVAL_MS (CONFIG_BIOLOGGER_STORAGE_INDEX_INTERVAL_S * 1000ull)
+#define INDEX_HEADER "Timestamp [ms],Offset [B]\n"
+// "#end,<rows>,<first timestamp>,<last timestamp>,<data file size>"
+#define INDEX_FOOTER_FMT "#end,%u,%llu,%llu,%lld\n"
+
+// The depth of the request queue and the memory reserved for rows waiting to
+// be written. Together they bound how far producers may run ahead of the card
+// before they are told to back off.
+#define REQUEST_QUEUE_DEPTH 32
+#define PAYLOAD_POOL_SIZE 8192
+
+// The storage thread never checks the card more often than this, no matter
+// how many write errors are reported.
+#define HEALTH_MIN_CHECK_INTERVAL_MS 500
+// While writes succeed the card is not probed at all, but the free space on the
+// FAT partition is still checked this often.
+#define HEALTH_FREE_SPACE_CHECK_PERIOD_MS 60000
+
+// Rows held back during an outage are replayed in batches this far apart, and
+// only while no other request is waiting, so live rows always come first.
+#define REPLAY_PERIOD_MS 100
+#define REPLAY_BATCH_ROWS \
+    MAX(CONFIG_BIOLOGGER_OUTAGE_REPLAY_RATE * REPLAY_PERIOD_MS / 1000, 1)
+
+// The card-detect pin is optional. If the SDMMC node declares one, the
+// storage thread is woken up as soon as the card is inserted or removed.
+#define DT_SDMMC DT_NODELABEL(sdmmc1)
+#define HAS_CARD_DETECT DT_NODE_HAS_PROP(DT_SDMMC, cd_gpios)
 
 LOG_MODULE_REGISTER(storage);
 
 struct usbd_contex* usb_device;
-USBD_DEFINE_MSC_LUN(SD, "Zephyr", DISK_NAME, "0.00");
 
-struct storage {
-    size_t open_objects;
-    const char* disk_name;
-    struct fs_mount_t mount_point;
+/**
+ * @brief The suffix appended to the transaction name for each stream.
+ */
+static const char* const stream_suffixes[STORAGE_STREAM_COUNT] = {
+    [STORAGE_STREAM_DATA] = ".csv",
+    [STORAGE_STREAM_HEALTH] = ".health.csv",
+    [STORAGE_STREAM_ROLLUP] = ".rollup.csv",
+    [STORAGE_STREAM_BURST] = ".burst.csv",
+    [STORAGE_STREAM_INDEX] = ".idx",
+};
 
-    FATFS fat_fs;
+struct stream_file {
+    char path[MAX_PATH];
+    struct storage_backend_file on_disk;
+    bool open;
+    size_t writes_since_sync;
+    /*!< The stream is split into a new segment every time the card is
+     * exported, so that the host only ever sees closed files. */
+    unsigned int segment;
+    /*!< Whether the current segment was created on the card. */
+    bool exists;
+    /*!< The size of the current segment, i.e. where the next write lands.
+     * This includes what is still buffered. */
+    off_t size;
+    /*!< The bytes at the end of the segment which are still in write_buffer.
+     * Only ever non-zero for STORAGE_STREAM_DATA. */
+    size_t buffered;
+    /*!< The bytes written to the card since the last sync. */
+    size_t bytes_since_sync;
+};
 
-    observer_t observer;
+/**
+ * @brief What is known about the rows of the current data segment.
+ */
+struct stream_index {
+    uint32_t rows;
+    uint64_t first_ms;
+    uint64_t last_ms;
+    /*!< The first timestamp that deserves a new index entry. */
+    uint64_t next_entry_ms;
+};
 
-    struct {
-        uint32_t sz;
-        uint32_t count;
+struct storage {
+    size_t open_objects;
+    /*!< Where the streams are written to. */
+    const struct storage_backend* backend;
 
-        uint64_t disk_sz_mb;
-    } block;
+    observer_t observer;
 
     struct {
         struct k_condvar recv;
@@ -56,9 +126,48 @@ struct storage {
     } availability;
 
     struct {
-        char path[MAX_PATH];
-        struct fs_file_t on_disk;
-        size_t writes_since_sync;
+        atomic_t flags; /*!< See enum health_flag. */
+        int64_t last_check_ms;
+        int64_t last_routine_ms;
+        int64_t last_space_check_ms;
+#if HAS_CARD_DETECT
+        struct gpio_callback card_detect_cb;
+#endif
+    } health;
+
+    struct {
+        int64_t last_replay_ms;
+    } outage;
+
+    /*!< How writes to the card are sized, see card_probe.h. */
+    struct {
+        /*!< Rows of the data stream are gathered into writes of this many
+         * bytes. 0 writes every row as it comes. */
+        size_t write_size;
+        /*!< Gathered writes end on a multiple of this many bytes. */
+        size_t align;
+        /*!< Sync the data stream once this many bytes were written to it.
+         * 0 syncs every CONFIG_MAX_ROWS_BEFORE_SYNC rows instead. */
+        size_t sync_bytes;
+        /*!< Whether the card was measured since it was mounted. */
+        bool probed;
+        /*!< What the data stream is expected to need, see storage_init. */
+        uint32_t data_bytes_per_s;
+    } tuning;
+
+    struct {
+        atomic_t rows_written;
+        atomic_t rows_dropped;
+        atomic_t io_errors;
+        atomic_t queued_bytes;
+    } stats;
+
+    struct {
+        /*!< The transaction name, i.e. the path of every stream file without
+         * its suffix. Empty while there is no transaction. */
+        char base_path[MAX_PATH];
+        struct stream_file streams[STORAGE_STREAM_COUNT];
+        struct stream_index index;
     } work_file;
 };
 
@@ -66,157 +175,1182 @@ struct experiment {
     storage_t storage;
 };
 
-enum block_device_status {
-    BLOCK_DEVICE_STATUS_APPEARS_SENSIBLE,
-    BLOCK_DEVICE_STATUS_NO_OR_BAD_DISK,
-    BLOCK_DEVICE_STATUS_NO_SPACE_ON_DISK,
-    BLOCK_DEVICE_STATUS_NO_OR_CORRUPT_FAT,
-    BLOCK_DEVICE_STATUS_NO_SPACE_ON_FAT,
+/**
+ * @brief Events reported to the health monitoring by the rest of the module.
+ */
+enum health_flag {
+    /*!< A write or sync succeeded since the last routine check. */
+    HEALTH_FLAG_IO_OK,
+    /*!< A write or sync failed since the last check. */
+    HEALTH_FLAG_IO_FAILED,
+    /*!< The card-detect pin changed since the last check. */
+    HEALTH_FLAG_CARD_CHANGED,
 };
 
-static bool sdcard_got_dced(storage_t storage) {
-    // As discussed in storage_init, we choose to blindly assume the card is
-    // reachable if the sector size is currently unknown. This is safe to do
-    // out of two reasons -- other fallbacks MUST cover the case of no card
-    // being in in the first place.
-    if (storage->block.sz == UINT32_MAX) {
-        return false;
+/**
+ * @brief The operations the storage thread performs on behalf of the other
+ *        threads.
+ */
+enum request_type {
+    REQUEST_OPEN,
+    REQUEST_WRITE,
+    REQUEST_READ,
+    REQUEST_SYNC,
+    REQUEST_CLOSE,
+    REQUEST_REMOUNT,
+    REQUEST_STATUS,
+    REQUEST_EXPORT_BEGIN,
+    REQUEST_EXPORT_END,
+    /*!< Does nothing but wake the storage thread up to check the card. */
+    REQUEST_HEALTH,
+};
+
+/**
+ * @brief Lives on the stack of a thread waiting for its request to complete.
+ */
+struct request_reply {
+    struct k_sem done;
+    int err;
+};
+
+struct request {
+    enum request_type type;
+    enum storage_stream stream;
+    union {
+        /*!< REQUEST_WRITE: the row and its newline, in payload_heap. */
+        struct strv payload;
+        /*!< REQUEST_OPEN: the transaction start time. */
+        struct tm start_time;
+        /*!< REQUEST_STATUS: where to write the status. */
+        struct storage_status* status;
+        /*!< REQUEST_READ: what to read and where to store it. */
+        struct {
+            off_t offset;
+            char* buf;
+            size_t len;
+            off_t* size;
+        } read;
+    };
+    /*!< NULL if nobody is waiting for the request. */
+    struct request_reply* reply;
+};
+
+K_MSGQ_DEFINE(request_queue, sizeof(struct request), REQUEST_QUEUE_DEPTH, 4);
+K_HEAP_DEFINE(payload_heap, PAYLOAD_POOL_SIZE);
+
+#if HAS_CARD_DETECT
+static const struct gpio_dt_spec card_detect =
+    GPIO_DT_SPEC_GET(DT_SDMMC, cd_gpios);
+#endif
+
+// Scratch buffer for copying the header into a new segment. Only ever touched
+// by the storage thread.
+static char header_copy_buf[128];
+// Scratch buffer for index entries. Only ever touched by the storage thread.
+static char index_line_buf[64];
+
+#if defined(CONFIG_BIOLOGGER_CARD_PROBE)
+// Rows of the data stream waiting to be written together. Only ever touched by
+// the storage thread.
+static uint8_t write_buffer[WRITE_BUFFER_SIZE] __aligned(4);
+BUILD_ASSERT(IS_POWER_OF_TWO(WRITE_BUFFER_SIZE),
+             "Writes are sized in powers of two.");
+#endif
+
+#if defined(CONFIG_SHELL)
+static storage_t shell_storage;
+#endif
+
+/**
+ * @brief Record the result of a write or sync for the health monitoring.
+ */
+static void report_io(storage_t storage, int err) {
+    if (err >= 0) {
+        atomic_set_bit(&storage->health.flags, HEALTH_FLAG_IO_OK);
+        return;
     }
 
-    uint8_t* data = k_malloc(storage->block.sz);
-    if (data == NULL) {
-        return false;
+    atomic_inc(&storage->stats.io_errors);
+    atomic_set_bit(&storage->health.flags, HEALTH_FLAG_IO_FAILED);
+}
+
+static void set_available(storage_t storage, bool available) {
+    k_mutex_lock(&storage->availability.lock, K_FOREVER);
+    storage->availability.available = available;
+    if (available) {
+        k_condvar_broadcast(&storage->availability.recv);
+    }
+    k_mutex_unlock(&storage->availability.lock);
+
+    // Whichever card comes back is measured before anything is logged to it.
+    if (!available) {
+        storage->tuning.probed = false;
     }
-    bool res = disk_access_read(DISK_NAME, data, 2048, 1) != 0;
-    k_free(data);
-    return res;
 }
 
-static int storage_get_status(storage_t storage,
-                              enum block_device_status* status,
-                              uint64_t* extra_status) {
-    *status = -1;
+#if HAS_CARD_DETECT
+static void card_detect_isr(const struct device* port,
+                            struct gpio_callback* cb,
+                            gpio_port_pins_t pins) {
+    storage_t storage = CONTAINER_OF(cb, struct storage,
+                                     health.card_detect_cb);
 
-    if (storage == NULL) {
-        return -EINVAL;
+    atomic_set_bit(&storage->health.flags, HEALTH_FLAG_CARD_CHANGED);
+
+    // If the queue is full the storage thread is busy anyways and will notice
+    // the flag once it is done.
+    const struct request req = { .type = REQUEST_HEALTH };
+    (void)k_msgq_put(&request_queue, &req, K_NO_WAIT);
+}
+
+static int card_detect_init(storage_t storage) {
+    int err;
+
+    if (!gpio_is_ready_dt(&card_detect)) {
+        LOG_ERR("Card detect @ %s:%d is not ready.",
+                card_detect.port->name, card_detect.pin);
+        return -ENODEV;
     }
 
-    int errnum;
+    if ((err = gpio_pin_configure_dt(&card_detect, GPIO_INPUT)) != 0) {
+        LOG_ERR("Failed to configure the card detect pin (%d).", err);
+        return err;
+    }
+
+    gpio_init_callback(&storage->health.card_detect_cb, card_detect_isr,
+                       BIT(card_detect.pin));
+    if ((err = gpio_add_callback_dt(&card_detect,
+                                    &storage->health.card_detect_cb)) != 0) {
+        LOG_ERR("Failed to add the card detect callback (%d).", err);
+        return err;
+    }
+
+    if ((err = gpio_pin_interrupt_configure_dt(&card_detect,
+                                               GPIO_INT_EDGE_BOTH)) != 0) {
+        LOG_ERR("Failed to enable the card detect interrupt (%d).", err);
+        return err;
+    }
+
+    return 0;
+}
+#endif
+
+K_THREAD_STACK_DEFINE(management_thread_stack,
+                      THREAD_BLOCK_STORAGE_MANAGEMENT_STACK_SIZE);
+static struct k_thread management_thread_data;
+
+/******************************************************************************
+ * Operations performed by the storage thread. None of these may be called from
+ * any other thread.
+ *****************************************************************************/
+
+static void stream_path(storage_t storage, enum storage_stream stream,
+                        unsigned int segment, char* path) {
+    if (segment == 0) {
+        snprintk(path, MAX_PATH, "%s%s", storage->work_file.base_path,
+                 stream_suffixes[stream]);
+    } else {
+        snprintk(path, MAX_PATH, "%s" SEGMENT_SUFFIX_FMT "%s",
+                 storage->work_file.base_path, segment,
+                 stream_suffixes[stream]);
+    }
+}
+
+/**
+ * @brief Repeat the first line of the stream's first segment, i.e. its
+ *        header, at the top of the freshly created current segment.
+ */
+static int copy_header(storage_t storage, enum storage_stream stream) {
+    const struct storage_backend_api* api = storage->backend->api;
+    struct stream_file* file = &storage->work_file.streams[stream];
+    char first_path[MAX_PATH];
+    struct storage_backend_file first;
+    off_t first_size;
+    off_t offset = 0;
+    ssize_t n;
+    int err;
 
-    if ((errnum = disk_access_status(DISK_NAME)) != DISK_STATUS_OK
-        || sdcard_got_dced(storage)) {
-        LOG_ERR("Querying the status of %s failed. Error: %d",
-                DISK_NAME, errnum);
-        *status = BLOCK_DEVICE_STATUS_NO_OR_BAD_DISK;
-        return -ENOTBLK; // Cannot trust DISK_STATUS_OK to be zero.
+    if (api->read == NULL) {
+        return -ENOTSUP;
     }
 
-    if ((errnum = disk_access_ioctl(DISK_NAME, DISK_IOCTL_GET_SECTOR_COUNT,
-                                   &storage->block.count))) {
-        LOG_ERR("Could not figure out how many blocks are in the device. "
-                "Error: %d", errnum);
-        return errnum;
+    stream_path(storage, stream, 0, first_path);
+    if ((err = api->open(storage->backend, &first, first_path, &first_size))
+            != 0) {
+        return err;
     }
-    LOG_DBG("There are %d blocks on this device", storage->block.count);
 
-    if ((errnum = disk_access_ioctl(DISK_NAME, DISK_IOCTL_GET_SECTOR_SIZE,
-                                   &storage->block.sz))) {
-        LOG_ERR("Could not figure out the size of the block on this device. "
-                "Error: %d", errnum);
-        return errnum;
+    while ((n = api->read(storage->backend, &first, offset, header_copy_buf,
+                          sizeof(header_copy_buf))) > 0) {
+        const char* eol = memchr(header_copy_buf, '\n', n);
+        const size_t len = eol != NULL ? eol - header_copy_buf + 1 : n;
+
+        if ((err = api->append(storage->backend, &file->on_disk,
+                               header_copy_buf, len)) < 0) {
+            break;
+        }
+        err = 0;
+        offset += n;
+        file->size += len;
+
+        if (eol != NULL) {
+            break;
+        }
+    }
+    if (n < 0) {
+        err = n;
     }
 
-    storage->block.disk_sz_mb =
-        (uint64_t)storage->block.sz * (uint64_t)storage->block.count
-        / 1024ull / 1024ull;
-    LOG_DBG("The disk size is: %llu MB", storage->block.disk_sz_mb);
+    (void)api->close(storage->backend, &first);
+    return err;
+}
+
+static int open_stream(storage_t storage, enum storage_stream stream) {
+    struct stream_file* file = &storage->work_file.streams[stream];
+    int err;
 
-    if (storage->block.disk_sz_mb < MIN_DISK_SIZE_MB) {
-        LOG_ERR("The disk is %llu MB which is less than the min %d MB.",
-                storage->block.disk_sz_mb, MIN_DISK_SIZE_MB);
-        *status = BLOCK_DEVICE_STATUS_NO_SPACE_ON_DISK;
-        *extra_status = storage->block.disk_sz_mb;
-        return -ENOMEM;
+    if (file->open) {
+        return 0;
     }
 
-    struct fs_statvfs filesystem_stats;
-    if ((errnum = fs_statvfs(storage->mount_point.mnt_point,
-                            &filesystem_stats)) != FR_OK) {
-        LOG_ERR("Could not query information on %s.",
-                storage->mount_point.mnt_point);
-        *status = BLOCK_DEVICE_STATUS_NO_OR_CORRUPT_FAT;
-        return errnum;
+    if (storage->work_file.base_path[0] == '\0') {
+        LOG_ERR("Cannot open stream %d outside of a transaction.", stream);
+        return -EBADF;
     }
 
-    const uint64_t space_left_mb =
-        (uint64_t)filesystem_stats.f_bfree * (uint64_t)filesystem_stats.f_frsize
-        / 1024ull / 1024ull;
-    if (space_left_mb < MIN_DISK_SIZE_MB) {
-        LOG_ERR("The FAT parition has GB %llu free. Less than the min %d GB.",
-                space_left_mb, MIN_DISK_SIZE_MB);
-        *status = BLOCK_DEVICE_STATUS_NO_SPACE_ON_FAT;
-        return -ENOMEM;
+    stream_path(storage, stream, file->segment, file->path);
+
+    // The file may already hold data from before a remount. Writes are
+    // appended, so they land at its end.
+    if ((err = storage->backend->api->open(storage->backend, &file->on_disk,
+                                           file->path, &file->size)) != 0) {
+        LOG_ERR("Failed to create a new file %s (%d).", file->path, err);
+        return err;
     }
+    // Rows gathered before a remount still go at the end.
+    file->size += file->buffered;
+
+    file->open = true;
+    file->writes_since_sync = 0;
+    file->bytes_since_sync = 0;
+
+    if (!file->exists && stream == STORAGE_STREAM_INDEX) {
+        if ((err = storage->backend->api->append(
+                storage->backend, &file->on_disk, INDEX_HEADER,
+                sizeof(INDEX_HEADER) - 1)) < 0) {
+            LOG_WRN("Index %s has no header (%d).", file->path, err);
+        } else {
+            file->size += err;
+        }
+    } else if (!file->exists && file->segment > 0) {
+        if ((err = copy_header(storage, stream)) != 0) {
+            LOG_WRN("Segment %s has no header (%d).", file->path, err);
+        }
+    }
+    file->exists = true;
 
-    *status = BLOCK_DEVICE_STATUS_APPEARS_SENSIBLE;
     return 0;
 }
 
-static int setup(storage_t storage) {
+/**
+ * @brief Make what was written to the card so far survive a power loss. Rows
+ *        still gathered in write_buffer are left there.
+ */
+static int sync_file(storage_t storage, enum storage_stream stream) {
+    struct stream_file* file = &storage->work_file.streams[stream];
     int err;
-    if ((err = disk_access_status(DISK_NAME)) != DISK_STATUS_OK
-        || sdcard_got_dced(storage)) {
-        LOG_ERR("Querying the status of %s failed. Error: %d",
-                DISK_NAME, err);
-        return -ENOTBLK; // Cannot trust DISK_STATUS_OK to be zero.
+
+    if (!file->open) {
+        return 0;
     }
 
-    if ((err = disk_access_ioctl(DISK_NAME, DISK_IOCTL_GET_SECTOR_COUNT,
-                                   &storage->block.count))) {
-        LOG_ERR("Could not figure out how many blocks are in the device. "
-                "Error: %d", err);
+    PERF_BEGIN(sync);
+    if ((err = storage->backend->api->sync(storage->backend,
+                                           &file->on_disk)) != 0) {
+        LOG_ERR("Failed to synchronize %s. (%d)", file->path, err);
+        report_io(storage, err);
         return err;
     }
-    LOG_DBG("There are %d blocks on this device", storage->block.count);
+    PERF_END(PERF_STAGE_SYNC, sync);
+    report_io(storage, 0);
+
+    file->writes_since_sync = 0;
+    file->bytes_since_sync = 0;
+    return 0;
+}
+
+static int flush_buffer(storage_t storage, size_t* written);
+
+/**
+ * @brief Write out everything appended to the stream and sync it.
+ */
+static int sync_stream(storage_t storage, enum storage_stream stream) {
+    int err;
 
-    if ((err = disk_access_ioctl(DISK_NAME, DISK_IOCTL_GET_SECTOR_SIZE,
-                                   &storage->block.sz))) {
-        LOG_ERR("Could not figure out the size of the block on this device. "
-                "Error: %d", err);
+    if (stream == STORAGE_STREAM_DATA
+            && (err = flush_buffer(storage, NULL)) != 0) {
         return err;
     }
+    return sync_file(storage, stream);
+}
 
-    storage->block.disk_sz_mb =
-        (uint64_t)storage->block.sz * (uint64_t)storage->block.count
-        / 1024ull / 1024ull;
-    LOG_DBG("The disk size is: %llu MB", storage->block.disk_sz_mb);
-
-    if (storage->block.disk_sz_mb < MIN_DISK_SIZE_MB) {
-        LOG_ERR("The disk is %llu MB which is less than the min %d MB.",
-                storage->block.disk_sz_mb, MIN_DISK_SIZE_MB);
-        return -ENOMEM;
-    }
-    // In this case we can also try our best to remount the FAT device in hopes
-    // it will come up. The block device exists for sure, so we can give this a
-    // shot. Let's not flag this as a fault just yet...
-    if ((err = fs_mount(&storage->mount_point)) != FR_OK) {
-        LOG_ERR("Could not mount the disk %s at %s. Error: %d",
-                storage->disk_name,
-                storage->mount_point.mnt_point, err);
-        // Well we tried and failed, that doesn't look good --
-        // mark it as gonezo.
-        observer_flag_raise(storage->observer,
-                            OBSERVER_FLAG_NO_DISK);
-    } else {
-        // We mounted the disk! In order to avoid waiting for
-        // the next cycle, let's immediately re-run this
-        // procedure.
-        LOG_INF("Successfully mounted an SD card.");
+static int sync_all(storage_t storage) {
+    int err = 0;
+    for (size_t i = 0; i < STORAGE_STREAM_COUNT; i++) {
+        err = MIN(err, sync_stream(storage, i));
+    }
+    return err;
+}
+
+static int write_stream(storage_t storage, enum storage_stream stream,
+                        const struct strv payload);
+
+/**
+ * @brief Append the footer to the index of the current data segment.
+ */
+static void finish_index(storage_t storage) {
+    const struct stream_index* index = &storage->work_file.index;
+    int err;
+
+    // Only bother while the index is being written, i.e. the card was fine a
+    // moment ago.
+    if (index->rows == 0
+            || !storage->work_file.streams[STORAGE_STREAM_INDEX].open) {
+        return;
+    }
+
+    const int len = snprintk(
+        index_line_buf, sizeof(index_line_buf), INDEX_FOOTER_FMT,
+        index->rows, index->first_ms, index->last_ms,
+        (long long)storage->work_file.streams[STORAGE_STREAM_DATA].size);
+    if ((err = write_stream(storage, STORAGE_STREAM_INDEX,
+                            (struct strv) { index_line_buf, len })) != 0) {
+        LOG_WRN("Failed to write the index footer (%d).", err);
+    }
+}
+
+static int close_all(storage_t storage) {
+    finish_index(storage);
+
+    int err = sync_all(storage);
+    if (err != 0) {
+        LOG_ERR("Failed to flush storage before closing. (%d)", err);
+    }
+
+    for (size_t i = 0; i < STORAGE_STREAM_COUNT; i++) {
+        struct stream_file* file = &storage->work_file.streams[i];
+        if (file->open) {
+            err = MIN(err, storage->backend->api->close(storage->backend,
+                                                        &file->on_disk));
+            file->open = false;
+        }
     }
 
     return err;
 }
 
+/**
+ * @brief Parse the timestamp a data row starts with.
+ *
+ * @return false if the row does not start with one, e.g. for the header.
+ */
+static bool row_timestamp(const struct strv row, uint64_t* ms) {
+    uint64_t value = 0;
+    size_t i;
+
+    for (i = 0; i < row.len && row.str[i] >= '0' && row.str[i] <= '9'; i++) {
+        value = value * 10 + (row.str[i] - '0');
+    }
+    if (i == 0) {
+        return false;
+    }
+
+    *ms = value;
+    return true;
+}
+
+/**
+ * @brief Account for a data row written at offset, and add it to the index if
+ *        it is the first one of its interval.
+ */
+static void index_row(storage_t storage, const struct strv row,
+                      off_t offset) {
+    struct stream_index* index = &storage->work_file.index;
+    uint64_t ms;
+    int err;
+
+    if (INDEX_INTERVAL_MS == 0 || !row_timestamp(row, &ms)) {
+        return;
+    }
+
+    const bool first = index->rows == 0;
+    if (first) {
+        index->first_ms = ms;
+    }
+    index->rows++;
+    index->last_ms = ms;
+
+    if (!first && ms < index->next_entry_ms) {
+        return;
+    }
+    index->next_entry_ms = ms - ms % INDEX_INTERVAL_MS + INDEX_INTERVAL_MS;
+
+    const int len = snprintk(index_line_buf, sizeof(index_line_buf),
+                             "%llu,%lld\n", ms, (long long)offset);
+    if ((err = write_stream(storage, STORAGE_STREAM_INDEX,
+                            (struct strv) { index_line_buf, len })) != 0) {
+        LOG_WRN("Failed to index the row at %llu ms (%d).", ms, err);
+    }
+}
+
+/**
+ * @brief Append a row to the card right away.
+ */
+static int append_stream(storage_t storage, enum storage_stream stream,
+                         const struct strv payload) {
+    struct stream_file* file = &storage->work_file.streams[stream];
+    int err;
+
+    PERF_BEGIN(write);
+    if ((err = storage->backend->api->append(storage->backend, &file->on_disk,
+                                             payload.str, payload.len)) < 0) {
+        LOG_ERR("Failed to write row to the disk (%d).", err);
+        report_io(storage, err);
+        return err;
+    }
+    PERF_END(PERF_STAGE_WRITE, write);
+    report_io(storage, 0);
+    file->size += payload.len;
+    file->bytes_since_sync += payload.len;
+    return 0;
+}
+
+/**
+ * @brief Write out the rows of the data stream gathered in write_buffer.
+ *
+ * @param [out] written If not NULL, the number of bytes which reached the
+ *                      card, even on error. They are gone from the buffer.
+ */
+static int flush_buffer(storage_t storage, size_t* written) {
+    if (written != NULL) {
+        *written = 0;
+    }
+
+#if defined(CONFIG_BIOLOGGER_CARD_PROBE)
+    struct stream_file* file =
+        &storage->work_file.streams[STORAGE_STREAM_DATA];
+    int err;
+
+    if (file->buffered == 0) {
+        return 0;
+    }
+
+    if ((err = open_stream(storage, STORAGE_STREAM_DATA)) != 0) {
+        report_io(storage, err);
+        return err;
+    }
+
+    PERF_BEGIN(write);
+    const ssize_t n = storage->backend->api->append(
+        storage->backend, &file->on_disk, write_buffer, file->buffered);
+    if (n < 0) {
+        LOG_ERR("Failed to write %zu buffered bytes to the disk (%d).",
+                file->buffered, (int)n);
+        report_io(storage, n);
+        return n;
+    }
+    PERF_END(PERF_STAGE_WRITE, write);
+    report_io(storage, 0);
+
+    // Whatever did not fit stays at the front of the buffer.
+    if (written != NULL) {
+        *written = n;
+    }
+    file->buffered -= n;
+    memmove(write_buffer, write_buffer + n, file->buffered);
+    file->bytes_since_sync += n;
+    return file->buffered == 0 ? 0 : -ENOSPC;
+#else
+    return 0;
+#endif
+}
+
+#if defined(CONFIG_BIOLOGGER_CARD_PROBE)
+/**
+ * @brief Gather a data row into write_buffer, and write the buffer out once it
+ *        reaches the next multiple of the alignment in the file.
+ *
+ * @return 0 once the whole row is buffered or written, including when a failed
+ *         write took part of it and the rest stays buffered. On error, none
+ *         of it is, so it can be held back as a whole.
+ */
+static int buffer_row(storage_t storage, const struct strv payload) {
+    struct stream_file* file =
+        &storage->work_file.streams[STORAGE_STREAM_DATA];
+    int err;
+
+    // A row longer than a write would be split over several, and could end
+    // up half written.
+    if (payload.len > storage->tuning.write_size) {
+        if ((err = flush_buffer(storage, NULL)) != 0) {
+            return err;
+        }
+        return append_stream(storage, STORAGE_STREAM_DATA, payload);
+    }
+
+    // Where the buffer is written out, so that the write ends on the
+    // alignment. After the card was probed again, the buffer may already hold
+    // more than that and is written out as is.
+    const size_t on_disk = file->size - file->buffered;
+    const size_t target = MAX(storage->tuning.write_size
+                              - on_disk % storage->tuning.align,
+                              file->buffered);
+    const size_t head = MIN(payload.len, target - file->buffered);
+
+    memcpy(write_buffer + file->buffered, payload.str, head);
+    file->buffered += head;
+    if (file->buffered < target) {
+        file->size += payload.len;
+        return 0;
+    }
+
+    const size_t earlier = file->buffered - head;
+    size_t written;
+    if ((err = flush_buffer(storage, &written)) != 0) {
+        if (written <= earlier) {
+            // None of the row reached the card, and all of its head is still
+            // at the end of the buffer.
+            file->buffered -= head;
+            return err;
+        }
+
+        // The write reached into the row, so it cannot be held back any
+        // more. The rest of it is buffered behind what reached the card, and
+        // goes out with the next write.
+        memcpy(write_buffer + file->buffered, payload.str + head,
+               payload.len - head);
+        file->buffered += payload.len - head;
+        file->size += payload.len;
+        return 0;
+    }
+
+    memcpy(write_buffer, payload.str + head, payload.len - head);
+    file->buffered = payload.len - head;
+    file->size += payload.len;
+    return 0;
+}
+#endif
+
+static bool sync_due(storage_t storage, enum storage_stream stream) {
+    struct stream_file* file = &storage->work_file.streams[stream];
+
+    if (stream == STORAGE_STREAM_DATA && storage->tuning.sync_bytes > 0) {
+        return file->bytes_since_sync >= storage->tuning.sync_bytes;
+    }
+    return ++file->writes_since_sync > CONFIG_MAX_ROWS_BEFORE_SYNC;
+}
+
+static int write_stream(storage_t storage, enum storage_stream stream,
+                        const struct strv payload) {
+    struct stream_file* file = &storage->work_file.streams[stream];
+    int err;
+
+    if ((err = open_stream(storage, stream)) != 0) {
+        report_io(storage, err);
+        return err;
+    }
+    const off_t offset = file->size;
+
+#if defined(CONFIG_BIOLOGGER_CARD_PROBE)
+    if (stream == STORAGE_STREAM_DATA && storage->tuning.write_size > 0) {
+        err = buffer_row(storage, payload);
+    } else {
+        err = append_stream(storage, stream, payload);
+    }
+#else
+    err = append_stream(storage, stream, payload);
+#endif
+    if (err != 0) {
+        return err;
+    }
+
+    // Only rows of the data file count, not the lines of the index, health,
+    // rollup and burst files.
+    if (stream == STORAGE_STREAM_DATA) {
+        atomic_inc(&storage->stats.rows_written);
+        index_row(storage, payload, offset);
+    }
+
+    // Only what reached the card is synced, so that gathered rows keep
+    // going out in aligned writes.
+    if (sync_due(storage, stream)) {
+        if ((err = sync_file(storage, stream)) != 0) {
+            LOG_ERR("Failed to flush data to disk (%d).", err);
+        }
+    }
+
+    return 0;
+}
+
+static int read_stream(storage_t storage, enum storage_stream stream,
+                       off_t offset, char* buf, size_t len, off_t* size) {
+    struct stream_file* file = &storage->work_file.streams[stream];
+    int err;
+
+    if (size != NULL) {
+        *size = 0;
+    }
+
+    // Never create a file just to find out it is empty.
+    if (!file->exists) {
+        return 0;
+    }
+
+    // Rows still gathered in RAM are written out so they can be read back.
+    if (stream == STORAGE_STREAM_DATA
+            && (err = flush_buffer(storage, NULL)) != 0) {
+        LOG_WRN("The last %zu bytes of %s cannot be read yet (%d).",
+                file->buffered, file->path, err);
+    }
+
+    if ((err = open_stream(storage, stream)) != 0) {
+        report_io(storage, err);
+        return err;
+    }
+
+    if (size != NULL) {
+        *size = file->size;
+    }
+    if (offset >= file->size) {
+        return 0;
+    }
+
+    if (storage->backend->api->read == NULL) {
+        return -ENOTSUP;
+    }
+
+    const ssize_t n = storage->backend->api->read(storage->backend,
+                                                  &file->on_disk, offset,
+                                                  buf, len);
+    if (n < 0) {
+        LOG_ERR("Failed to read %s (%d).", file->path, (int)n);
+    }
+    report_io(storage, n);
+    return n;
+}
+
+/******************************************************************************
+ * Outage backlog, see outage.h.
+ *****************************************************************************/
+
+/**
+ * @brief Write a row, or hold it back in the backlog if the card cannot take
+ *        it right now.
+ *
+ * @details
+ * As long as the backlog is not empty, new rows are appended to it rather
+ * than written, so that every stream stays in order once it is replayed.
+ */
+static int write_or_hold(storage_t storage, enum storage_stream stream,
+                         const struct strv payload) {
+    // Outside of a transaction there is nothing to replay the row into.
+    if (storage->work_file.base_path[0] == '\0') {
+        return write_stream(storage, stream, payload);
+    }
+
+    if (storage->availability.available && !outage_pending()
+            && write_stream(storage, stream, payload) == 0) {
+        return 0;
+    }
+
+    return outage_push(stream, payload);
+}
+
+/**
+ * @brief Write up to count rows of the backlog, oldest first.
+ *
+ * @return The number of rows written. Stops at the first failed write, which
+ *         leaves the row in the backlog.
+ */
+static size_t replay_backlog(storage_t storage, size_t count) {
+    size_t written;
+
+    for (written = 0; written < count; written++) {
+        enum storage_stream stream;
+        struct strv row;
+        int err;
+
+        if (outage_front(&stream, &row) != 0) {
+            break;
+        }
+
+        if ((err = write_stream(storage, stream, row)) != 0) {
+            LOG_WRN("Pausing the replay of the backlog (%d).", err);
+            break;
+        }
+        outage_pop();
+    }
+
+    if (written > 0 && !outage_pending()) {
+        LOG_INF("Replayed the whole backlog.");
+    }
+    return written;
+}
+
+/**
+ * @brief Write out what is left of the backlog before its transaction ends.
+ *        Whatever cannot be written is lost.
+ */
+static void finish_backlog(storage_t storage) {
+    if (!outage_pending()) {
+        return;
+    }
+
+    if (storage->availability.available) {
+        (void)replay_backlog(storage, SIZE_MAX);
+    }
+
+    if (outage_pending()) {
+        struct outage_stats stats;
+        outage_stats_get(&stats);
+        LOG_ERR("Lost %u rows held back for the closing transaction.",
+                stats.rows_pending);
+        outage_discard();
+    }
+}
+
+static bool replay_needed(storage_t storage, int64_t now) {
+    return storage->availability.available
+        && outage_pending()
+        && k_msgq_num_used_get(&request_queue) == 0
+        && now - storage->outage.last_replay_ms >= REPLAY_PERIOD_MS;
+}
+
+static void reset_segments(storage_t storage) {
+    for (size_t i = 0; i < STORAGE_STREAM_COUNT; i++) {
+        struct stream_file* file = &storage->work_file.streams[i];
+        // close_all wrote out the buffer unless the card failed.
+        if (file->buffered > 0) {
+            LOG_ERR("Lost the last %zu bytes of %s.", file->buffered,
+                    file->path);
+            file->buffered = 0;
+        }
+        file->segment = 0;
+        file->exists = false;
+    }
+    storage->work_file.index = (struct stream_index){ 0 };
+}
+
+static int open_transaction(storage_t storage, const struct tm* start_time) {
+    int err;
+
+    finish_backlog(storage);
+    if ((err = close_all(storage)) != 0) {
+        LOG_ERR("Failed to close the previous transaction (%d).", err);
+    }
+
+    const int root_len = snprintk(storage->work_file.base_path, MAX_PATH,
+                                  "%s/", storage->backend->root);
+    strftime(storage->work_file.base_path + root_len, MAX_PATH - root_len,
+             "%Y-%m-%dT%H.%M.%S", start_time);
+    reset_segments(storage);
+
+    // The data stream is opened eagerly so that a bad card is reported to the
+    // experiment right away. Other streams only appear once written to.
+    if ((err = open_stream(storage, STORAGE_STREAM_DATA)) != 0) {
+        return err;
+    }
+
+    return sync_stream(storage, STORAGE_STREAM_DATA);
+}
+
+static int remount(storage_t storage) {
+    // Any open handle belongs to the old mount and is useless now. Writes
+    // reopen their stream in append mode once the card is back. The card may
+    // also have been swapped, so the snapshot is worthless.
+    (void)close_all(storage);
+    // The card may be a different one, measure it again once it is up.
+    storage->tuning.probed = false;
+
+    if (storage->backend->api->remount == NULL) {
+        return 0;
+    }
+    return storage->backend->api->remount(storage->backend);
+}
+
+static int begin_export(storage_t storage) {
+    int err;
+
+    if (storage->backend->api->export_begin == NULL) {
+        return -ENOTSUP;
+    }
+
+    if (!storage->availability.available) {
+        return -ENODEV;
+    }
+
+    // Every closed segment must be complete on the card before it is frozen
+    // into the snapshot.
+    if ((err = close_all(storage)) != 0) {
+        return err;
+    }
+
+    // Whatever is logged from now on goes into new segments. Those only ever
+    // occupy clusters which are free in the snapshot, so writing them costs
+    // the snapshot nothing but the directory and FAT sectors.
+    for (size_t i = 0; i < STORAGE_STREAM_COUNT; i++) {
+        struct stream_file* file = &storage->work_file.streams[i];
+        if (file->exists) {
+            file->segment++;
+            file->exists = false;
+        }
+    }
+
+    // Every data segment gets an index of the same number, even if nothing
+    // was indexed in the previous one.
+    storage->work_file.streams[STORAGE_STREAM_INDEX].segment =
+        storage->work_file.streams[STORAGE_STREAM_DATA].segment;
+    storage->work_file.index = (struct stream_index){ 0 };
+
+    return storage->backend->api->export_begin(storage->backend);
+}
+
+static void end_export(storage_t storage) {
+    if (storage->backend->api->export_end != NULL) {
+        storage->backend->api->export_end(storage->backend);
+    }
+}
+
+static void fill_status(storage_t storage, struct storage_status* status) {
+    struct outage_stats outage;
+    struct storage_backend_stats backend;
+    outage_stats_get(&outage);
+    storage->backend->api->stats(storage->backend, &backend);
+
+    *status = (struct storage_status){
+        .available = storage->availability.available,
+        .disk_sz_mb = backend.size_mb,
+        .queued_requests = k_msgq_num_used_get(&request_queue),
+        .queued_bytes = atomic_get(&storage->stats.queued_bytes),
+        .rows_written = atomic_get(&storage->stats.rows_written),
+        .rows_dropped = atomic_get(&storage->stats.rows_dropped),
+        .io_errors = atomic_get(&storage->stats.io_errors),
+        .rows_pending = outage.rows_pending,
+        .rows_stored = outage.rows_stored,
+        .rows_replayed = outage.rows_replayed,
+        .rows_lost = outage.rows_lost,
+        .write_size = storage->tuning.write_size,
+        .write_align = storage->tuning.align,
+        .sync_bytes = storage->tuning.sync_bytes,
+    };
+}
+
+static void free_payload(storage_t storage, struct strv payload) {
+    atomic_sub(&storage->stats.queued_bytes, payload.len);
+    k_heap_free(&payload_heap, payload.str);
+}
+
+static void serve_request(storage_t storage, struct request* req) {
+    int err = 0;
+
+    switch (req->type) {
+        case REQUEST_OPEN:
+            err = open_transaction(storage, &req->start_time);
+            break;
+        case REQUEST_WRITE:
+            err = write_or_hold(storage, req->stream, req->payload);
+            free_payload(storage, req->payload);
+            break;
+        case REQUEST_READ:
+            err = read_stream(storage, req->stream, req->read.offset,
+                              req->read.buf, req->read.len, req->read.size);
+            break;
+        case REQUEST_SYNC:
+            err = sync_all(storage);
+            break;
+        case REQUEST_CLOSE:
+            finish_backlog(storage);
+            err = close_all(storage);
+            storage->work_file.base_path[0] = '\0';
+            reset_segments(storage);
+            break;
+        case REQUEST_REMOUNT:
+            if ((err = remount(storage)) != 0) {
+                set_available(storage, false);
+                observer_flag_raise(storage->observer, OBSERVER_FLAG_NO_DISK);
+            }
+            // Let the health monitoring confirm the card is usable.
+            atomic_set_bit(&storage->health.flags, HEALTH_FLAG_CARD_CHANGED);
+            break;
+        case REQUEST_STATUS:
+            fill_status(storage, req->status);
+            break;
+        case REQUEST_EXPORT_BEGIN:
+            err = begin_export(storage);
+            break;
+        case REQUEST_EXPORT_END:
+            end_export(storage);
+            break;
+        case REQUEST_HEALTH:
+            break;
+    }
+
+    if (req->reply != NULL) {
+        req->reply->err = err;
+        k_sem_give(&req->reply->done);
+    }
+}
+
+/******************************************************************************
+ * Health monitoring, also performed by the storage thread.
+ *****************************************************************************/
+
+static bool health_check_urgent(storage_t storage) {
+    return atomic_test_bit(&storage->health.flags, HEALTH_FLAG_IO_FAILED)
+        || atomic_test_bit(&storage->health.flags, HEALTH_FLAG_CARD_CHANGED);
+}
+
+/**
+ * @brief Decide whether the storage thread needs to query the card.
+ *
+ * @details
+ * Querying the card costs a sector read and, for the FAT checks, possibly
+ * several more. As long as writes keep succeeding there is no point in
+ * spending bus time on it, so the card is only checked right away if a write
+ * failed or the card-detect pin changed. Otherwise it is checked once every
+ * management period, and only if the card is not available yet or nothing has
+ * been written since the previous period. Free space is checked separately at
+ * a much slower rate.
+ */
+static bool health_check_needed(storage_t storage, int64_t now) {
+    if (now - storage->health.last_check_ms < HEALTH_MIN_CHECK_INTERVAL_MS) {
+        return false;
+    }
+
+    if (health_check_urgent(storage)) {
+        atomic_clear_bit(&storage->health.flags, HEALTH_FLAG_IO_FAILED);
+        atomic_clear_bit(&storage->health.flags, HEALTH_FLAG_CARD_CHANGED);
+        return true;
+    }
+
+    if (now - storage->health.last_routine_ms
+            < THREAD_BLOCK_STORAGE_MANAGEMENT_PERIOD_MS) {
+        return false;
+    }
+    storage->health.last_routine_ms = now;
+
+    const bool io_ok = atomic_test_and_clear_bit(&storage->health.flags,
+                                                 HEALTH_FLAG_IO_OK);
+    if (!io_ok || !storage->availability.available) {
+        return true;
+    }
+
+    return now - storage->health.last_space_check_ms
+        >= HEALTH_FREE_SPACE_CHECK_PERIOD_MS;
+}
+
+/**
+ * @brief How long the storage thread may wait for a request before it has to
+ *        look at the health of the card again, or replay more of the backlog.
+ */
+static k_timeout_t health_check_timeout(storage_t storage, int64_t now) {
+    int64_t deadline = health_check_urgent(storage)
+        ? storage->health.last_check_ms + HEALTH_MIN_CHECK_INTERVAL_MS
+        : storage->health.last_routine_ms
+            + THREAD_BLOCK_STORAGE_MANAGEMENT_PERIOD_MS;
+
+    if (storage->availability.available && outage_pending()) {
+        deadline = MIN(deadline,
+                       storage->outage.last_replay_ms + REPLAY_PERIOD_MS);
+    }
+
+    return deadline <= now ? K_NO_WAIT : K_MSEC(deadline - now);
+}
+
+#if defined(CONFIG_BIOLOGGER_CARD_PROBE)
+static void log_profile(storage_t storage, const struct card_profile* profile) {
+    for (size_t i = 0; i < profile->result_count; i++) {
+        const struct card_probe_result* result = &profile->results[i];
+        LOG_INF("%5u B writes: %u KiB/s, slowest %u us.", result->write_size,
+                result->bytes_per_s / 1024, result->worst_write_us);
+    }
+    LOG_INF("Writing %u B at a time, aligned to %u B, syncing every %u B. "
+            "Off alignment: %u KiB/s, slowest sync: %u us.",
+            profile->write_size, profile->align, profile->sync_bytes,
+            profile->misaligned_bytes_per_s / 1024, profile->worst_sync_us);
+
+    const uint32_t needed = storage->tuning.data_bytes_per_s;
+    if (needed == 0) {
+        return;
+    }
+
+    if (profile->bytes_per_s < needed) {
+        LOG_WRN("The card writes %u B/s but the data may need %u B/s. Rows "
+                "will be dropped.", profile->bytes_per_s, needed);
+    }
+
+    // Rows keep arriving while the card stalls, and only the payload pool
+    // holds them until it is done.
+    const uint64_t stalled_bytes =
+        (uint64_t)profile->worst_stall_us * needed / 1000000ull;
+    if (stalled_bytes > PAYLOAD_POOL_SIZE) {
+        LOG_WRN("The card stalled for %u ms, during which %llu B of rows "
+                "arrive, more than the %u B queue. Rows may be dropped.",
+                profile->worst_stall_us / 1000, stalled_bytes,
+                PAYLOAD_POOL_SIZE);
+    }
+}
+#endif
+
+/**
+ * @brief Measure a card which was just mounted, and size the writes to it.
+ */
+static void probe_card(storage_t storage) {
+#if defined(CONFIG_BIOLOGGER_CARD_PROBE)
+    struct card_profile profile;
+    int err;
+
+    if (storage->tuning.probed) {
+        return;
+    }
+    storage->tuning.probed = true;
+
+    // Rows keep arriving while the card is measured, and only the request
+    // queue and the payload pool hold them. The probe takes at most half of
+    // the time the pool lasts at the highest data rate.
+    uint32_t budget_ms = CONFIG_BIOLOGGER_CARD_PROBE_MAX_MS;
+    if (storage->tuning.data_bytes_per_s > 0) {
+        budget_ms = MIN(budget_ms, (uint64_t)PAYLOAD_POOL_SIZE * 1000ull
+                                       / storage->tuning.data_bytes_per_s / 2);
+    }
+
+    // The buffer only provides the bytes to write, so rows waiting in it are
+    // not disturbed.
+    LOG_INF("Measuring the card for up to %u ms...", budget_ms);
+    if ((err = card_probe_run(storage->backend, write_buffer,
+                              sizeof(write_buffer), budget_ms,
+                              &profile)) != 0) {
+        LOG_WRN("Could not measure the card, writing rows as they come (%d).",
+                err);
+        storage->tuning.write_size = 0;
+        storage->tuning.align = 0;
+        storage->tuning.sync_bytes = 0;
+        return;
+    }
+
+    log_profile(storage, &profile);
+    storage->tuning.write_size = profile.write_size;
+    storage->tuning.align = profile.align;
+    storage->tuning.sync_bytes = profile.sync_bytes;
+#endif
+}
+
+static void check_health(storage_t storage, int64_t now) {
+    enum storage_backend_status status;
+
+    const size_t MAX_STATUS_UPDATE_COUNT = 3;
+    size_t status_update_count = 0;
+    query_status: {
+        status = -1;
+        int errnum = storage->backend->api->status(storage->backend, &status);
+        switch (status) {
+            case STORAGE_BACKEND_STATUS_APPEARS_SENSIBLE:
+                LOG_DBG("It appears the disk is operating normally.");
+                storage->health.last_space_check_ms = now;
+                // Nothing is logged to the card before it was measured. A
+                // remount may swap the card without it ever being marked
+                // unavailable, so this goes by probed alone.
+                if (!storage->tuning.probed) {
+                    probe_card(storage);
+                }
+                observer_flag_lower(storage->observer,
+                                    OBSERVER_FLAG_NO_DISK);
+                set_available(storage, true);
+                break;
+            case STORAGE_BACKEND_STATUS_NO_OR_BAD_DISK:
+                LOG_INF("It appears the disk is unavailable / corrupt.");
+                observer_flag_raise(storage->observer,
+                                    OBSERVER_FLAG_NO_DISK);
+                set_available(storage, false);
+
+                // TODO(markovejnovic): Here would be a good spot to
+                // attempt to reinitialize the SD card, however there is no
+                // support for that at the moment.
+
+                break;
+            case STORAGE_BACKEND_STATUS_NO_SPACE_ON_DISK:
+                LOG_INF("It appears the disk is too small.");
+                observer_flag_raise(storage->observer,
+                                    OBSERVER_FLAG_NO_DISK);
+                set_available(storage, false);
+                break;
+            case STORAGE_BACKEND_STATUS_NO_OR_CORRUPT_FS:
+                LOG_INF("It appears the disk does not have a good "
+                        "filesystem.");
+                // In this case we can also try our best to remount the
+                // device in hopes it will come up. The block device exists
+                // for sure, so we can give this a shot. Let's not flag
+                // this as a fault just yet...
+                if ((errnum = remount(storage)) != 0) {
+                    // Well we tried and failed, that doesn't look good --
+                    // mark it as gonezo.
+                    observer_flag_raise(storage->observer,
+                                        OBSERVER_FLAG_NO_DISK);
+                    set_available(storage, false);
+                } else {
+                    // We mounted the disk! In order to avoid waiting for
+                    // the next cycle, let's immediately re-run this
+                    // procedure.
+                    status_update_count++;
+                    if (status_update_count < MAX_STATUS_UPDATE_COUNT) {
+                        goto query_status;
+                    }
+                }
+                break;
+            case STORAGE_BACKEND_STATUS_NO_SPACE_ON_FS:
+                LOG_INF("It appears the filesystem is too small.");
+                observer_flag_raise(storage->observer,
+                                    OBSERVER_FLAG_NO_DISK);
+                set_available(storage, false);
+                break;
+            default:
+                LOG_ERR("Received an unreasonable and unexpected value "
+                        "from the %s backend: %d", storage->backend->name,
+                        status);
+                // Not the user's fault -- let's not confuse them.
+                observer_flag_lower(storage->observer,
+                                    OBSERVER_FLAG_NO_DISK);
+                break;
+        }
+    }
+}
+
+#if defined(CONFIG_BIOLOGGER_STATIC_ALLOC)
+// There is only ever a single storage, since there is a single storage thread.
+static struct storage storage_data;
+static bool storage_data_in_use;
+
+static storage_t alloc_storage(void) {
+    if (storage_data_in_use) {
+        return NULL;
+    }
+    storage_data_in_use = true;
+    return &storage_data;
+}
+
+static void free_storage(storage_t storage) {
+    storage_data_in_use = false;
+}
+#else
+static storage_t alloc_storage(void) {
+    return k_malloc(sizeof(struct storage));
+}
+
+static void free_storage(storage_t storage) {
+    k_free(storage);
+}
+#endif
+
 int storage_close(storage_t storage) {
     if (storage == NULL) {
         return 0;
@@ -232,146 +1366,98 @@ int storage_close(storage_t storage) {
         return -EMFILE;
     }
 
-    k_free(storage);
+    // The storage thread must not outlive the object it serves.
+    k_thread_abort(&management_thread_data);
+    end_export(storage);
+#if defined(CONFIG_SHELL)
+    shell_storage = NULL;
+#endif
+
+    free_storage(storage);
     return err;
 }
 
-K_THREAD_STACK_DEFINE(management_thread_stack,
-                      THREAD_BLOCK_STORAGE_MANAGEMENT_STACK_SIZE);
-static struct k_thread management_thread_data;
-
 static void management_thread_runnable(void* p0, void* p1, void* p2) {
     LOG_INF("Starting to manage storage...");
 
     storage_t storage = p0;
 
-    // Preferring while-true over deadline scheduler for convenience. Totally
-    // okay poor performance here.
+    // This thread is the only one to ever touch the card. It serves requests
+    // as they arrive and, in between, checks the health of the card whenever
+    // health_check_needed says so and replays the rows held back while it was
+    // unavailable.
     while (true) {
-        const uint32_t start = k_uptime_get_32();
-
-        enum block_device_status status;
-        uint64_t extra_status;
-
-        const size_t MAX_STATUS_UPDATE_COUNT = 3;
-        size_t status_update_count = 0;
-        query_status: {
-            int errnum = storage_get_status(storage, &status, &extra_status);
-            switch (status) {
-                case BLOCK_DEVICE_STATUS_APPEARS_SENSIBLE:
-                    LOG_DBG("It appears the disk is operating normally.");
-                    observer_flag_lower(storage->observer,
-                                        OBSERVER_FLAG_NO_DISK);
-                    storage->availability.available = true;
-                    k_condvar_broadcast(&storage->availability.recv);
-                    break;
-                case BLOCK_DEVICE_STATUS_NO_OR_BAD_DISK:
-                    LOG_INF("It appears the disk is unavailable / corrupt.");
-                    observer_flag_raise(storage->observer,
-                                        OBSERVER_FLAG_NO_DISK);
-
-                    // TODO(markovejnovic): Here would be a good spot to
-                    // attempt to reinitialize the SD card, however there is no
-                    // support for that at the moment.
+        struct request req;
+        const k_timeout_t wait = health_check_timeout(storage,
+                                                      k_uptime_get());
+        if (k_msgq_get(&request_queue, &req, wait) == 0) {
+            serve_request(storage, &req);
+        }
 
-                    break;
-                case BLOCK_DEVICE_STATUS_NO_SPACE_ON_DISK:
-                    LOG_INF("It appears the disk is too small.");
-                    observer_flag_raise(storage->observer,
-                                        OBSERVER_FLAG_NO_DISK);
-                    break;
-                case BLOCK_DEVICE_STATUS_NO_OR_CORRUPT_FAT:
-                    LOG_INF("It appears the disk does not have a good FAT "
-                            "partition.");
-                    // In this case we can also try our best to remount the FAT
-                    // device in hopes it will come up. The block device exists
-                    // for sure, so we can give this a shot. Let's not flag
-                    // this as a fault just yet...
-                    if ((errnum = fs_mount(&storage->mount_point)) != FR_OK) {
-                        LOG_ERR("Could not mount the disk %s at %s. Error: %d",
-                                storage->disk_name,
-                                storage->mount_point.mnt_point, errnum);
-                        // Well we tried and failed, that doesn't look good --
-                        // mark it as gonezo.
-                        observer_flag_raise(storage->observer,
-                                            OBSERVER_FLAG_NO_DISK);
-                    } else {
-                        // We mounted the disk! In order to avoid waiting for
-                        // the next cycle, let's immediately re-run this
-                        // procedure.
-                        LOG_INF("Successfully mounted an SD card.");
-                        status_update_count++;
-                        if (status_update_count < MAX_STATUS_UPDATE_COUNT) {
-                            goto query_status;
-                        }
-                    }
-                    break;
-                case BLOCK_DEVICE_STATUS_NO_SPACE_ON_FAT:
-                    LOG_INF("It appears the FAT partition is too small.");
-                    observer_flag_raise(storage->observer,
-                                        OBSERVER_FLAG_NO_DISK);
-                    break;
-                default:
-                    LOG_ERR("Received an unreasonable and unexpected value "
-                            "from storage_get_status: %d", status);
-                    // Not the user's fault -- let's not confuse them.
-                    observer_flag_lower(storage->observer,
-                                        OBSERVER_FLAG_NO_DISK);
-                    break;
-            }
+        const int64_t now = k_uptime_get();
+        if (health_check_needed(storage, now)) {
+            storage->health.last_check_ms = now;
+            check_health(storage, now);
         }
 
-        const uint32_t stop = k_uptime_get_32();
-        k_msleep(THREAD_BLOCK_STORAGE_MANAGEMENT_PERIOD_MS - (stop - start));
+        if (replay_needed(storage, now)) {
+            storage->outage.last_replay_ms = now;
+            (void)replay_backlog(storage, REPLAY_BATCH_ROWS);
+        }
     }
 }
 
-storage_t storage_init(observer_t observer) {
+storage_t storage_init(observer_t observer,
+                       const struct storage_backend* backend,
+                       uint32_t data_bytes_per_s) {
     LOG_INF("Initializing storage...");
-    storage_t storage = k_malloc(sizeof(struct storage));
+    storage_t storage = alloc_storage();
     if (storage == NULL) {
-        LOG_ERR("Could not k_malloc for storage_init.");
+        LOG_ERR("Could not allocate the storage.");
         return NULL;
     }
 
     *storage = (struct storage){
         .open_objects = 0,
-        .disk_name = DISK_NAME,
-        .mount_point = (struct fs_mount_t){
-            .type = FS_FATFS,
-            .fs_data = &storage->fat_fs,
-            .mnt_point = DISK_MOUNT_POINT,
-        },
+        .backend = backend,
         .observer = observer,
-        .block = {
-            // UINT32_MAX max indicates that the block size has not been
-            // initialized. In this case, we shall assume the SD card is
-            // reachable as actually performing a read requires an extremely
-            // expensive memory allocation, possibly up to 8K, depending on the
-            // sector size.
-            .sz = UINT32_MAX,
-        },
         .availability = {
             .available = false,
         },
+        .tuning = {
+            .data_bytes_per_s = data_bytes_per_s,
+        },
     };
 
-    fs_file_t_init(&storage->work_file.on_disk);
     k_condvar_init(&storage->availability.recv);
     k_mutex_init(&storage->availability.lock);
+    atomic_clear(&storage->health.flags);
+    // Have the storage thread check the card as soon as it starts.
+    atomic_set_bit(&storage->health.flags, HEALTH_FLAG_CARD_CHANGED);
 
     int errnum;
 
-    if ((errnum = disk_access_init(DISK_NAME)) != 0) {
-        LOG_ERR("Cannot open a handle to the SDMMC device. Error: %d", errnum);
+    if ((errnum = backend->api->init(backend)) != 0) {
+        LOG_ERR("Cannot bring up the %s storage backend (%d).", backend->name,
+                errnum);
         goto exit_fault;
     }
 
-    setup(storage);
+    // Rows written while the card is unavailable are held back here. Without
+    // the flash partition, they only fit in RAM.
+    if ((errnum = outage_init()) != 0) {
+        LOG_WRN("Only RAM can hold rows during an outage (%d).", errnum);
+    }
+
+#if HAS_CARD_DETECT
+    if ((errnum = card_detect_init(storage)) != 0) {
+        LOG_WRN("Card detection is unavailable, relying on write errors only "
+                "(%d).", errnum);
+    }
+#endif
 
-    // This module shall start a management thread that will manage the
-    // storage. We do not need this to be extremely zealous, just need to know
-    // some basics on the device.
+    // This module shall start a thread that will own and manage the storage.
+    // It checks the card right away, which makes the storage available.
     LOG_DBG("Beginning SD card management thread...");
     k_thread_create(
         &management_thread_data,
@@ -380,83 +1466,253 @@ storage_t storage_init(observer_t observer) {
         management_thread_runnable, storage, NULL, NULL,
         THREAD_BLOCK_STORAGE_MANAGEMENT_PRIORITY, 0, K_NO_WAIT
     );
+    k_thread_name_set(&management_thread_data, "storage");
 
+#if defined(CONFIG_SHELL)
+    shell_storage = storage;
+#endif
     return storage;
 
 exit_fault:
-    k_free(storage);
+    free_storage(storage);
     return NULL;
 }
 
-int storage_transaction(storage_t storage, const struct tm *start_time) {
+/**
+ * @brief Queue a request and block until the storage thread has served it.
+ */
+static int submit_and_wait(struct request* req) {
+    struct request_reply reply = { .err = 0 };
     int err;
 
-    strftime(storage->work_file.path, MAX_PATH,
-             DISK_MOUNT_POINT "/%Y-%m-%dT%H.%m.%S.csv", start_time);
+    k_sem_init(&reply.done, 0, 1);
+    req->reply = &reply;
 
-    if ((err = fs_open(&storage->work_file.on_disk, storage->work_file.path,
-                       FS_O_CREATE | FS_O_WRITE | FS_O_APPEND)) != 0) {
-        LOG_ERR("Failed to create a new file %s (%d).",
-                storage->work_file.path, err);
+    if ((err = k_msgq_put(&request_queue, req, K_FOREVER)) != 0) {
+        return err;
     }
-    storage_flush(storage);
 
-    return err;
+    k_sem_take(&reply.done, K_FOREVER);
+    return reply.err;
 }
 
-int storage_write_row(storage_t storage, const struct strv row) {
-    int err = 0;
+int storage_transaction(storage_t storage, const struct tm *start_time) {
+    struct request req = {
+        .type = REQUEST_OPEN,
+        .start_time = *start_time,
+    };
 
-    if ((err = fs_write(&storage->work_file.on_disk, row.str, row.len)) < 0) {
-        LOG_ERR("Failed to write row to the disk (%d).", err);
-        return err;
-    }
+    return submit_and_wait(&req);
+}
 
-    if ((err = fs_write(&storage->work_file.on_disk, "\n", 1)) < 0) {
-        LOG_ERR("Failed to write row newline to the disk (%d).", err);
-        return err;
+int storage_write_row(storage_t storage, enum storage_stream stream,
+                      const struct strv row, k_timeout_t timeout) {
+    // The index is only ever written by the storage thread.
+    if (stream >= STORAGE_STREAM_COUNT || stream == STORAGE_STREAM_INDEX) {
+        return -EINVAL;
     }
 
-    if (++storage->work_file.writes_since_sync > CONFIG_MAX_ROWS_BEFORE_SYNC) {
-        if ((err = storage_flush(storage)) != 0) {
-            LOG_ERR("Failed to flush data to disk (%d).", err);
-        }
+    // The timeout covers both waiting for payload memory and for a slot in the
+    // queue.
+    const k_timepoint_t deadline = sys_timepoint_calc(timeout);
+
+    // The newline is appended here so that the storage thread writes each row
+    // with a single append.
+    const size_t len = row.len + 1;
+    char* payload = k_heap_alloc(&payload_heap, len, timeout);
+    if (payload == NULL) {
+        atomic_inc(&storage->stats.rows_dropped);
+        return -ENOBUFS;
+    }
+    memcpy(payload, row.str, row.len);
+    payload[row.len] = '\n';
+    atomic_add(&storage->stats.queued_bytes, len);
+
+    const struct request req = {
+        .type = REQUEST_WRITE,
+        .stream = stream,
+        .payload = { .str = payload, .len = len },
+        .reply = NULL,
+    };
+    if (k_msgq_put(&request_queue, &req, sys_timepoint_timeout(deadline))
+            != 0) {
+        free_payload(storage, req.payload);
+        atomic_inc(&storage->stats.rows_dropped);
+        return -ENOBUFS;
     }
 
     return 0;
 }
 
-int storage_close_file(storage_t storage) {
-    int err;
-    if ((err = storage_flush(storage)) != 0) {
-        LOG_ERR("Failed to flush storage before closing. (%d)", err);
+int storage_read(storage_t storage, enum storage_stream stream, off_t offset,
+                 char* buf, size_t len, off_t* size) {
+    if (stream >= STORAGE_STREAM_COUNT || offset < 0) {
+        return -EINVAL;
     }
-    return fs_close(&storage->work_file.on_disk);
+
+    struct request req = {
+        .type = REQUEST_READ,
+        .stream = stream,
+        .read = {
+            .offset = offset,
+            .buf = buf,
+            .len = len,
+            .size = size,
+        },
+    };
+
+    return submit_and_wait(&req);
+}
+
+int storage_close_file(storage_t storage) {
+    struct request req = { .type = REQUEST_CLOSE };
+    return submit_and_wait(&req);
 }
 
 void storage_wait_until_available(storage_t storage) {
-    if (storage->availability.available) {
-        return;
+    k_mutex_lock(&storage->availability.lock, K_FOREVER);
+    while (!storage->availability.available) {
+        k_condvar_wait(&storage->availability.recv,
+                       &storage->availability.lock,
+                       K_FOREVER);
     }
-
-    k_condvar_wait(&storage->availability.recv,
-                   &storage->availability.lock,
-                   K_FOREVER);
+    k_mutex_unlock(&storage->availability.lock);
 }
 
 int storage_flush(storage_t storage) {
-    int err = 0;
-    if ((err = fs_sync(&storage->work_file.on_disk)) != 0) {
-        LOG_ERR("Failed to synchronize the filesystem. (%d)", err);
-        return err;
+    struct request req = { .type = REQUEST_SYNC };
+    return submit_and_wait(&req);
+}
+
+int storage_remount(storage_t storage) {
+    const struct request req = { .type = REQUEST_REMOUNT };
+    return k_msgq_put(&request_queue, &req, K_FOREVER);
+}
+
+int storage_status(storage_t storage, struct storage_status* status) {
+    struct request req = {
+        .type = REQUEST_STATUS,
+        .status = status,
+    };
+
+    return submit_and_wait(&req);
+}
+
+int storage_export_begin(storage_t storage) {
+    struct request req = { .type = REQUEST_EXPORT_BEGIN };
+    return submit_and_wait(&req);
+}
+
+int storage_export_end(storage_t storage) {
+    struct request req = { .type = REQUEST_EXPORT_END };
+    return submit_and_wait(&req);
+}
+
+/******************************************************************************
+ * Shell commands.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+static int cmd_export_start(const struct shell* sh, size_t argc, char** argv) {
+    int err;
+
+    if (shell_storage == NULL) {
+        shell_error(sh, "Storage is not initialized.");
+        return -ENODEV;
     }
 
-    if ((err = disk_access_ioctl(DISK_NAME, DISK_IOCTL_CTRL_SYNC, NULL)) != 0) {
-        LOG_ERR("Failed to synchronize the disk. (%d)", err);
+    if ((err = storage_export_begin(shell_storage)) != 0) {
+        shell_error(sh, "Could not export the card (%d).", err);
         return err;
     }
 
-    storage->work_file.writes_since_sync = 0;
+    shell_print(sh, "Exporting every closed log over USB. Logging continues "
+                "into new segments.");
+    return 0;
+}
 
-    return err;
+static int cmd_export_stop(const struct shell* sh, size_t argc, char** argv) {
+    if (shell_storage == NULL) {
+        shell_error(sh, "Storage is not initialized.");
+        return -ENODEV;
+    }
+
+    return storage_export_end(shell_storage);
+}
+
+static int cmd_export_status(const struct shell* sh, size_t argc,
+                             char** argv) {
+    struct storage_export_status status;
+
+    if (shell_storage == NULL) {
+        shell_error(sh, "Storage is not initialized.");
+        return -ENODEV;
+    }
+
+    const struct storage_backend* backend = shell_storage->backend;
+    if (backend->api->export_status == NULL) {
+        shell_print(sh, "Exporting: not supported by the %s backend",
+                    backend->name);
+        return 0;
+    }
+    backend->api->export_status(backend, &status);
+
+    shell_print(sh, "Exporting: %s", status.active
+                ? (status.overflowed ? "ejected, out of room" : "yes") : "no");
+    shell_print(sh, "Preserved sectors: %u/%u", status.preserved_sectors,
+                status.preserved_capacity);
+    return 0;
 }
+
+SHELL_STATIC_SUBCMD_SET_CREATE(export_cmds,
+    SHELL_CMD(start, NULL, "Export a read-only snapshot of the card.",
+              cmd_export_start),
+    SHELL_CMD(stop, NULL, "Stop exporting the card.", cmd_export_stop),
+    SHELL_CMD(status, NULL, "Show the state of the export.",
+              cmd_export_status),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((biologger), export, &export_cmds,
+                 "Export closed logs over USB while logging.", NULL, 0, 0);
+
+static int cmd_storage_status(const struct shell* sh, size_t argc,
+                              char** argv) {
+    struct storage_status status;
+    int err;
+
+    if (shell_storage == NULL) {
+        shell_error(sh, "Storage is not initialized.");
+        return -ENODEV;
+    }
+
+    if ((err = storage_status(shell_storage, &status)) != 0) {
+        shell_error(sh, "Could not query the storage (%d).", err);
+        return err;
+    }
+
+    shell_print(sh, "Card: %s, %llu MB", status.available ? "available"
+                : "unavailable", status.disk_sz_mb);
+    shell_print(sh, "Written %u rows, dropped %u, %u IO errors",
+                status.rows_written, status.rows_dropped, status.io_errors);
+    shell_print(sh, "Held back %u rows, %u still waiting, replayed %u, "
+                "lost %u", status.rows_stored, status.rows_pending,
+                status.rows_replayed, status.rows_lost);
+    if (status.write_size > 0) {
+        shell_print(sh, "Writes of %u B aligned to %u B, synced every %u B",
+                    status.write_size, status.write_align, status.sync_bytes);
+    } else {
+        shell_print(sh, "Writes of a row at a time");
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(storage_cmds,
+    SHELL_CMD(status, NULL, "Show the state of the card and the rows held "
+              "back while it was unavailable.", cmd_storage_status),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((biologger), storage, &storage_cmds,
+                 "SD card storage.", NULL, 0, 0);
+#endif
@@ -3,9 +3,22 @@
  *        card as well as USB storage.
  *
  * @details
- * This module manages the SD card by spawning a new thread in which it will
- * periodically poll the SD card for its state. The state of the SD card
- * informs the module as to which state it itself should be in.
+ * This module owns the SD card through a single storage thread. Nothing else
+ * ever touches the disk or FatFs: every public function below turns into a
+ * request on a bounded queue which the storage thread serves in order. Between
+ * requests, the same thread monitors the health of the card, so remounting can
+ * never race with a write. The thread reaches the card through a
+ * storage_backend, which may also be a raw log, RAM or the host's disk, see
+ * storage_backend.h.
+ *
+ * Writes are asynchronous. The row is copied into a fixed-size payload pool
+ * and the producer returns immediately. If the pool or the queue is full, the
+ * producer waits for at most the timeout it provided and is then told to back
+ * off with -ENOBUFS. Several producers may write at the same time, each into
+ * its own storage_stream.
+ *
+ * The card can be exported to a USB host while logging continues, see
+ * storage_export_begin.
  *
  * Due to limitations in Zephyr (and my own lack of time/willpower), the SD
  * card cannot be hotplugged.
@@ -16,9 +29,13 @@
 #ifndef STORAGE_H
 #define STORAGE_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
+#include <zephyr/kernel.h>
 #include <zephyr/sys/slist.h>
 #include "observer.h"
+#include "storage_backend.h"
 #include "str.h"
 
 typedef struct experiment* experiment_t;
@@ -26,11 +43,79 @@ typedef struct experiment_row* experiment_row_t;
 
 typedef struct storage* storage_t;
 
+/**
+ * @brief The files making up a single transaction. Every stream is written to
+ *        its own file, named after the transaction start time and the stream
+ *        suffix. A stream's file is only created once something is written
+ *        into it.
+ */
+enum storage_stream {
+    /*!< The experiment data, stored as "<start time>.csv". */
+    STORAGE_STREAM_DATA,
+    /*!< Periodic health records, stored as "<start time>.health.csv". */
+    STORAGE_STREAM_HEALTH,
+    /*!< Per-interval statistics of every column, stored as
+     * "<start time>.rollup.csv". */
+    STORAGE_STREAM_ROLLUP,
+    /*!< High-rate captures around trigger events, stored as
+     * "<start time>.burst.csv". See burst.h. */
+    STORAGE_STREAM_BURST,
+    /*!< A sparse time index into the data, stored as "<start time>.idx".
+     * Written by the storage module itself, see storage_write_row. */
+    STORAGE_STREAM_INDEX,
+
+    STORAGE_STREAM_COUNT,
+};
+
+/**
+ * @brief A snapshot of the storage module state.
+ */
+struct storage_status {
+    /*!< Whether the card is mounted and believed to be healthy. */
+    bool available;
+    /*!< The size of the card in MB, or 0 if unknown. */
+    uint64_t disk_sz_mb;
+    /*!< The number of requests currently waiting in the queue. */
+    uint32_t queued_requests;
+    /*!< The number of payload bytes currently waiting to be written. */
+    size_t queued_bytes;
+    /*!< The total number of rows of the data file written to disk. */
+    uint32_t rows_written;
+    /*!< The total number of rows rejected because the queue was full. */
+    uint32_t rows_dropped;
+    /*!< The total number of failed writes and syncs. */
+    uint32_t io_errors;
+    /*!< The number of rows held back until the card is available again. */
+    uint32_t rows_pending;
+    /*!< The total number of rows held back because the card was unavailable. */
+    uint32_t rows_stored;
+    /*!< The total number of held back rows written to the card since. */
+    uint32_t rows_replayed;
+    /*!< The total number of held back rows lost for lack of room. */
+    uint32_t rows_lost;
+    /*!< The size of the writes rows of the data stream are gathered into, or
+     * 0 if every row is written as it comes. See card_probe.h. */
+    uint32_t write_size;
+    /*!< Gathered writes end on a multiple of this many bytes. */
+    uint32_t write_align;
+    /*!< The data stream is synced after this many bytes, or every few rows if
+     * 0. */
+    uint32_t sync_bytes;
+};
+
 /**
  * @brief Initialize the storage module.
  * @param [in] observer The observer module.
+ * @param [in] backend Where to write the streams, e.g. &storage_backend_fatfs.
+ * @param [in] data_bytes_per_s The most STORAGE_STREAM_DATA is expected to
+ *                              need. If CONFIG_BIOLOGGER_CARD_PROBE is set,
+ *                              every card is measured once mounted and a
+ *                              warning is logged if it cannot keep up. 0 if
+ *                              unknown.
  */
-storage_t storage_init(observer_t observer);
+storage_t storage_init(observer_t observer,
+                       const struct storage_backend* backend,
+                       uint32_t data_bytes_per_s);
 
 /**
  * @brief Neatly close the storage module.
@@ -50,18 +135,53 @@ int storage_close(storage_t);
 int storage_transaction(storage_t storage, const struct tm* start_time);
 
 /**
- * @brief Write a row to the currently open file.
+ * @brief Queue a row to be written to a stream of the current transaction.
+ *
  * @param [in] storage The storage module.
- * @param [in] row The row to write.
+ * @param [in] stream The stream to write into.
+ * @param [in] row The row to write. It is copied, so it may be reused as soon
+ *                 as this function returns.
+ * @param [in] timeout How long to wait for space in the queue.
  * @note You should not have a trailing newline.
- * @return An error code if any.
+ * @note Rows which cannot be written because the card is unavailable are
+ *       held back in RAM and internal flash and written once it is back, in
+ *       order and behind whatever was held back before them. See outage.h.
+ * @note Rows of STORAGE_STREAM_DATA which start with a timestamp in
+ *       milliseconds are indexed: once every
+ *       CONFIG_BIOLOGGER_STORAGE_INDEX_INTERVAL_S seconds of timestamps, the
+ *       timestamp and the offset of the row in its file are appended to
+ *       STORAGE_STREAM_INDEX. When the file is closed, a footer holding the
+ *       row count, the first and last timestamps and the file size follows.
+ * @return 0 once the row is queued, -ENOBUFS if the queue stayed full for the
+ *         whole timeout, -EINVAL for STORAGE_STREAM_INDEX.
  *
  * @warning storage_wait_until_available must pass before this can be called.
  */
-int storage_write_row(storage_t storage, const struct strv row);
+int storage_write_row(storage_t storage, enum storage_stream stream,
+                      const struct strv row, k_timeout_t timeout);
+
+/**
+ * @brief Read part of the current segment of a stream, as written so far.
+ *
+ * @details
+ * The read is served by the storage thread between writes, so reading a file
+ * piece by piece never holds up logging for long. Rows still waiting in the
+ * queue are not visible yet.
+ *
+ * @param [in] storage The storage module.
+ * @param [in] stream The stream to read from.
+ * @param [in] offset Where to start reading.
+ * @param [out] buf Where to store the data.
+ * @param [in] len The most bytes to read.
+ * @param [out] size If not NULL, the size of the segment.
+ * @return The number of bytes read, 0 past the end of the segment or if it was
+ *         not created yet, or a negative error code.
+ */
+int storage_read(storage_t storage, enum storage_stream stream, off_t offset,
+                 char* buf, size_t len, off_t* size);
 
 /**
- * @brief Close the currently open file.
+ * @brief Close the currently open files.
  * @param [in] storage The storage module.
  *
  * @note You do not normally need to call this as storage_close will call it
@@ -78,9 +198,46 @@ int storage_close_file(storage_t storage);
 void storage_wait_until_available(storage_t storage);
 
 /**
- * @brief Flush any cached state to disk.
+ * @brief Flush any cached state to disk. Returns once every row queued before
+ *        this call is on the disk.
  * @param [in] storage The storage module.
  */
 int storage_flush(storage_t storage);
 
+/**
+ * @brief Ask the storage thread to remount the card at its next opportunity.
+ * @param [in] storage The storage module.
+ * @return 0 once the request is queued.
+ */
+int storage_remount(storage_t storage);
+
+/**
+ * @brief Query the state of the storage module.
+ * @param [in] storage The storage module.
+ * @param [out] status The status to fill in.
+ * @return An error code if any.
+ */
+int storage_status(storage_t storage, struct storage_status* status);
+
+/**
+ * @brief Expose every log closed so far to the USB host as a read-only
+ *        snapshot of the card, without interrupting logging.
+ *
+ * @details
+ * Every open stream is closed and continues in a new segment, named after the
+ * transaction with a "-001", "-002", ... suffix and starting with a copy of
+ * the stream header. The host sees the card as it was before those segments
+ * were created. See usb_export.h.
+ *
+ * @return 0 on success, -ENODEV if the card is not available or -EALREADY if
+ *         the card is already exported.
+ */
+int storage_export_begin(storage_t storage);
+
+/**
+ * @brief Stop exposing the card to the USB host. The host sees the medium
+ *        being removed.
+ */
+int storage_export_end(storage_t storage);
+
 #endif // STORAGE_H
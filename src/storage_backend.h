@@ -0,0 +1,145 @@
+/**
+ * @brief The medium the storage module writes its streams to.
+ *
+ * @details
+ * The storage thread does not talk to FatFs or the disk itself. Every file
+ * operation, and every question about the health of the medium, goes through
+ * the storage_backend handed to storage_init:
+ *
+ * - storage_backend_fatfs: files on the FAT volume of the SD card. This is
+ *   what the logger uses, and the only backend which can be exported over USB.
+ * - storage_backend_raw: a single append-only log written straight into the
+ *   sectors of the card, without a filesystem. See storage_raw.c for the
+ *   format.
+ * - storage_backend_ram: the most recent bytes of every file, in RAM. Nothing
+ *   survives a reboot.
+ * - storage_backend_host: files in a directory of the computer running
+ *   native_sim.
+ *
+ * Each is only built if its CONFIG_BIOLOGGER_STORAGE_BACKEND_* option is set.
+ *
+ * Backends are only ever called from the storage thread, and from storage_init
+ * before that thread exists, which is why none of them lock anything.
+ */
+#ifndef STORAGE_BACKEND_H
+#define STORAGE_BACKEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <zephyr/fs/fs.h>
+
+/**
+ * @brief What the backend thinks of its medium.
+ */
+enum storage_backend_status {
+    STORAGE_BACKEND_STATUS_APPEARS_SENSIBLE,
+    STORAGE_BACKEND_STATUS_NO_OR_BAD_DISK,
+    STORAGE_BACKEND_STATUS_NO_SPACE_ON_DISK,
+    /*!< The disk is fine but the filesystem is not. Remounting may help. */
+    STORAGE_BACKEND_STATUS_NO_OR_CORRUPT_FS,
+    STORAGE_BACKEND_STATUS_NO_SPACE_ON_FS,
+};
+
+/**
+ * @brief An open file, as far as the backend is concerned.
+ */
+struct storage_backend_file {
+    union {
+        /*!< storage_backend_fatfs. */
+        struct fs_file_t fs;
+        /*!< Every other backend. */
+        int id;
+    };
+};
+
+/**
+ * @brief What the backend knows about its medium.
+ */
+struct storage_backend_stats {
+    /*!< The size of the medium in MB, or 0 if unknown. */
+    uint64_t size_mb;
+    /*!< The total number of bytes appended since storage_init. */
+    uint64_t bytes_written;
+};
+
+/**
+ * @brief The state of an export of the medium over USB.
+ */
+struct storage_export_status {
+    bool active;
+    /*!< Whether the export was aborted because it ran out of room. */
+    bool overflowed;
+    /*!< The number of sectors preserved for the snapshot. */
+    uint32_t preserved_sectors;
+    /*!< The most sectors that can be preserved before the export aborts. */
+    uint32_t preserved_capacity;
+};
+
+struct storage_backend;
+
+/**
+ * @brief The operations of a backend. Every function returns 0 or the number
+ *        of bytes transferred on success, and a negative error code otherwise.
+ */
+struct storage_backend_api {
+    /*!< Bring the medium up. Only fails if the backend can never work. */
+    int (*init)(const struct storage_backend* backend);
+    /*!< Check whether the medium can be written to. */
+    int (*status)(const struct storage_backend* backend,
+                  enum storage_backend_status* status);
+    /*!< Drop every open file and start over, e.g. after the card was
+     * swapped. NULL if there is nothing to remount. */
+    int (*remount)(const struct storage_backend* backend);
+    /*!< Open path for appending, creating it if needed, and tell its size. */
+    int (*open)(const struct storage_backend* backend,
+                struct storage_backend_file* file, const char* path,
+                off_t* size);
+    ssize_t (*append)(const struct storage_backend* backend,
+                      struct storage_backend_file* file, const void* buf,
+                      size_t len);
+    /*!< Read back what was appended. NULL if the backend cannot. */
+    ssize_t (*read)(const struct storage_backend* backend,
+                    struct storage_backend_file* file, off_t offset,
+                    void* buf, size_t len);
+    /*!< Make everything appended so far survive a power loss. */
+    int (*sync)(const struct storage_backend* backend,
+                struct storage_backend_file* file);
+    int (*close)(const struct storage_backend* backend,
+                 struct storage_backend_file* file);
+    /*!< Delete the file at path, which must not be open. NULL if the backend
+     * cannot give the space back. */
+    int (*remove)(const struct storage_backend* backend, const char* path);
+    void (*stats)(const struct storage_backend* backend,
+                  struct storage_backend_stats* stats);
+    /*!< Expose a snapshot of the medium over USB. NULL if unsupported. */
+    int (*export_begin)(const struct storage_backend* backend);
+    void (*export_end)(const struct storage_backend* backend);
+    /*!< Retrieve the state of the export. Unlike the rest, may be called from
+     * any thread. NULL if exports are unsupported. */
+    void (*export_status)(const struct storage_backend* backend,
+                          struct storage_export_status* status);
+};
+
+struct storage_backend {
+    /*!< For logs and benchmark reports. */
+    const char* name;
+    /*!< Prepended to every path, e.g. the mount point. */
+    const char* root;
+    const struct storage_backend_api* api;
+};
+
+#if defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_FATFS)
+extern const struct storage_backend storage_backend_fatfs;
+#endif
+#if defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_RAW)
+extern const struct storage_backend storage_backend_raw;
+#endif
+#if defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_RAM)
+extern const struct storage_backend storage_backend_ram;
+#endif
+#if defined(CONFIG_BIOLOGGER_STORAGE_BACKEND_HOST)
+extern const struct storage_backend storage_backend_host;
+#endif
+
+#endif /* STORAGE_BACKEND_H */
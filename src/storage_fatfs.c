@@ -0,0 +1,303 @@
+#include "msc_cache.h"
+#include "storage_backend.h"
+#include "usb_export.h"
+#include <ff.h>
+#include <stdint.h>
+#include <sys/errno.h>
+#include <zephyr/drivers/disk.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/disk_access.h>
+
+#define DISK_NAME USB_EXPORT_FIRMWARE_DISK_NAME
+#define DISK_MOUNT_POINT "/"DISK_NAME":"
+#define MIN_DISK_SIZE_MB CONFIG_BIOLOGGER_STORAGE_MIN_DISK_SIZE_MB
+#define SECTOR_MAX 2048
+#define PROBE_SECTOR 2048
+
+LOG_MODULE_REGISTER(storage_fatfs);
+
+static FATFS fat_fs;
+
+static struct fs_mount_t mount_point = {
+    .type = FS_FATFS,
+    .fs_data = &fat_fs,
+    .mnt_point = DISK_MOUNT_POINT,
+};
+
+static struct {
+    // UINT32_MAX indicates that the block size has not been initialized. In
+    // this case, we shall assume the SD card is reachable as we cannot know
+    // whether a sector fits into the probe buffer.
+    uint32_t sz;
+    uint32_t count;
+
+    uint64_t disk_sz_mb;
+} block = {
+    .sz = UINT32_MAX,
+};
+
+static uint64_t bytes_written;
+
+// Scratch buffer for probing the card.
+static uint8_t probe_sector_buf[SECTOR_MAX] __aligned(4);
+
+static bool sdcard_got_dced(void) {
+    // As discussed in fatfs_init, we choose to blindly assume the card is
+    // reachable if the sector size is currently unknown. This is safe to do
+    // out of two reasons -- other fallbacks MUST cover the case of no card
+    // being in in the first place.
+    if (block.sz == UINT32_MAX || block.sz > SECTOR_MAX) {
+        return false;
+    }
+
+    return disk_access_read(DISK_NAME, probe_sector_buf, PROBE_SECTOR, 1) != 0;
+}
+
+/**
+ * @brief Query the geometry of the card.
+ */
+static int query_block(void) {
+    int err;
+
+    if ((err = disk_access_status(DISK_NAME)) != DISK_STATUS_OK
+        || sdcard_got_dced()) {
+        LOG_ERR("Querying the status of %s failed. Error: %d",
+                DISK_NAME, err);
+        return -ENOTBLK; // Cannot trust DISK_STATUS_OK to be zero.
+    }
+
+    if ((err = disk_access_ioctl(DISK_NAME, DISK_IOCTL_GET_SECTOR_COUNT,
+                                 &block.count))) {
+        LOG_ERR("Could not figure out how many blocks are in the device. "
+                "Error: %d", err);
+        return err;
+    }
+    LOG_DBG("There are %d blocks on this device", block.count);
+
+    if ((err = disk_access_ioctl(DISK_NAME, DISK_IOCTL_GET_SECTOR_SIZE,
+                                 &block.sz))) {
+        LOG_ERR("Could not figure out the size of the block on this device. "
+                "Error: %d", err);
+        return err;
+    }
+
+    block.disk_sz_mb = (uint64_t)block.sz * (uint64_t)block.count
+        / 1024ull / 1024ull;
+    LOG_DBG("The disk size is: %llu MB", block.disk_sz_mb);
+
+    if (block.disk_sz_mb < MIN_DISK_SIZE_MB) {
+        LOG_ERR("The disk is %llu MB which is less than the min %d MB.",
+                block.disk_sz_mb, MIN_DISK_SIZE_MB);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+static int fatfs_status(const struct storage_backend* backend,
+                        enum storage_backend_status* status) {
+    int err;
+
+    if ((err = query_block()) != 0) {
+        *status = err == -ENOMEM ? STORAGE_BACKEND_STATUS_NO_SPACE_ON_DISK
+            : STORAGE_BACKEND_STATUS_NO_OR_BAD_DISK;
+        return err;
+    }
+
+    struct fs_statvfs filesystem_stats;
+    if ((err = fs_statvfs(mount_point.mnt_point, &filesystem_stats))
+            != FR_OK) {
+        LOG_ERR("Could not query information on %s.", mount_point.mnt_point);
+        *status = STORAGE_BACKEND_STATUS_NO_OR_CORRUPT_FS;
+        return err;
+    }
+
+    const uint64_t space_left_mb =
+        (uint64_t)filesystem_stats.f_bfree * (uint64_t)filesystem_stats.f_frsize
+        / 1024ull / 1024ull;
+    if (space_left_mb < MIN_DISK_SIZE_MB) {
+        LOG_ERR("The FAT parition has GB %llu free. Less than the min %d GB.",
+                space_left_mb, MIN_DISK_SIZE_MB);
+        *status = STORAGE_BACKEND_STATUS_NO_SPACE_ON_FS;
+        return -ENOMEM;
+    }
+
+    *status = STORAGE_BACKEND_STATUS_APPEARS_SENSIBLE;
+    return 0;
+}
+
+static int fatfs_remount(const struct storage_backend* backend) {
+    int err;
+
+    (void)fs_unmount(&mount_point);
+    usb_export_end();
+
+    if ((err = fs_mount(&mount_point)) != FR_OK) {
+        LOG_ERR("Could not mount the disk %s at %s. Error: %d",
+                DISK_NAME, mount_point.mnt_point, err);
+        return err;
+    }
+
+    LOG_INF("Successfully mounted an SD card.");
+    return 0;
+}
+
+static int fatfs_init(const struct storage_backend* backend) {
+    int err;
+
+    // FatFs mounts the card through the export layer, which must therefore
+    // exist before anything touches DISK_NAME.
+    if ((err = usb_export_init()) != 0) {
+        return err;
+    }
+
+    if ((err = disk_access_init(DISK_NAME)) != 0) {
+        LOG_ERR("Cannot open a handle to the SDMMC device. Error: %d", err);
+        return err;
+    }
+
+    // The USB host reads the exported snapshot through the read-ahead cache.
+    // Without it the firmware can still log, so this is not fatal.
+    if ((err = msc_cache_init(USB_EXPORT_HOST_DISK_NAME)) != 0) {
+        LOG_WRN("USB mass storage is unavailable (%d).", err);
+    }
+
+    // A missing or unformatted card is not fatal either. The storage thread
+    // keeps checking and remounts once it shows up.
+    if (query_block() == 0 && (err = fs_mount(&mount_point)) != FR_OK) {
+        LOG_ERR("Could not mount the disk %s at %s. Error: %d",
+                DISK_NAME, mount_point.mnt_point, err);
+    }
+
+    return 0;
+}
+
+static int fatfs_open(const struct storage_backend* backend,
+                      struct storage_backend_file* file, const char* path,
+                      off_t* size) {
+    int err;
+
+    // Files are also read back through the same handle. Writes are appended
+    // no matter where reads left the file position.
+    fs_file_t_init(&file->fs);
+    if ((err = fs_open(&file->fs, path,
+                       FS_O_CREATE | FS_O_RDWR | FS_O_APPEND)) != 0) {
+        return err;
+    }
+
+    // The file may already hold data from before a remount. Writes are
+    // appended, so they land at its end.
+    if ((err = fs_seek(&file->fs, 0, FS_SEEK_END)) != 0) {
+        LOG_WRN("Failed to find the end of %s (%d).", path, err);
+    }
+    *size = MAX(fs_tell(&file->fs), 0);
+    return 0;
+}
+
+static ssize_t fatfs_append(const struct storage_backend* backend,
+                            struct storage_backend_file* file,
+                            const void* buf, size_t len) {
+    const ssize_t n = fs_write(&file->fs, buf, len);
+    if (n > 0) {
+        bytes_written += n;
+    }
+    return n;
+}
+
+static ssize_t fatfs_read(const struct storage_backend* backend,
+                          struct storage_backend_file* file, off_t offset,
+                          void* buf, size_t len) {
+    int err;
+
+    if ((err = fs_seek(&file->fs, offset, FS_SEEK_SET)) != 0) {
+        return err;
+    }
+    return fs_read(&file->fs, buf, len);
+}
+
+static int fatfs_sync(const struct storage_backend* backend,
+                      struct storage_backend_file* file) {
+    int err;
+
+    if ((err = fs_sync(&file->fs)) != 0) {
+        LOG_ERR("Failed to synchronize the filesystem. (%d)", err);
+        return err;
+    }
+
+    if ((err = disk_access_ioctl(DISK_NAME, DISK_IOCTL_CTRL_SYNC, NULL)) != 0) {
+        LOG_ERR("Failed to synchronize the disk. (%d)", err);
+        return err;
+    }
+
+    return 0;
+}
+
+static int fatfs_close(const struct storage_backend* backend,
+                       struct storage_backend_file* file) {
+    return fs_close(&file->fs);
+}
+
+static int fatfs_remove(const struct storage_backend* backend,
+                        const char* path) {
+    return fs_unlink(path);
+}
+
+static void fatfs_stats(const struct storage_backend* backend,
+                        struct storage_backend_stats* stats) {
+    *stats = (struct storage_backend_stats){
+        .size_mb = block.sz == UINT32_MAX ? 0 : block.disk_sz_mb,
+        .bytes_written = bytes_written,
+    };
+}
+
+static int fatfs_export_begin(const struct storage_backend* backend) {
+    const struct usb_export_volume volume = {
+        .fat_bits = fat_fs.fs_type == FS_FAT32 ? 32
+            : fat_fs.fs_type == FS_FAT16 ? 16 : 0,
+        .fat_start = fat_fs.fatbase,
+        .data_start = fat_fs.database,
+        .sectors_per_cluster = fat_fs.csize,
+        .fat_entries = fat_fs.n_fatent,
+    };
+    return usb_export_begin(&volume);
+}
+
+static void fatfs_export_end(const struct storage_backend* backend) {
+    usb_export_end();
+}
+
+static void fatfs_export_status(const struct storage_backend* backend,
+                                struct storage_export_status* status) {
+    struct usb_export_status export;
+
+    usb_export_status_get(&export);
+    *status = (struct storage_export_status){
+        .active = export.active,
+        .overflowed = export.overflowed,
+        .preserved_sectors = export.preserved_sectors,
+        .preserved_capacity = CONFIG_BIOLOGGER_USB_EXPORT_COW_SECTORS,
+    };
+}
+
+static const struct storage_backend_api fatfs_api = {
+    .init = fatfs_init,
+    .status = fatfs_status,
+    .remount = fatfs_remount,
+    .open = fatfs_open,
+    .append = fatfs_append,
+    .read = fatfs_read,
+    .sync = fatfs_sync,
+    .close = fatfs_close,
+    .remove = fatfs_remove,
+    .stats = fatfs_stats,
+    .export_begin = fatfs_export_begin,
+    .export_end = fatfs_export_end,
+    .export_status = fatfs_export_status,
+};
+
+const struct storage_backend storage_backend_fatfs = {
+    .name = "fatfs",
+    .root = DISK_MOUNT_POINT,
+    .api = &fatfs_api,
+};
@@ -0,0 +1,102 @@
+#include "storage_backend.h"
+#include "storage_host_bottom.h"
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/logging/log.h>
+
+#define HOST_DIR CONFIG_BIOLOGGER_STORAGE_HOST_DIR
+
+LOG_MODULE_REGISTER(storage_host);
+
+static uint64_t bytes_written;
+
+static int host_init(const struct storage_backend* backend) {
+    LOG_INF("Storing logs in %s on the host.", HOST_DIR);
+    return 0;
+}
+
+static int host_status(const struct storage_backend* backend,
+                       enum storage_backend_status* status) {
+    *status = STORAGE_BACKEND_STATUS_APPEARS_SENSIBLE;
+    return 0;
+}
+
+static int host_open(const struct storage_backend* backend,
+                     struct storage_backend_file* file, const char* path,
+                     off_t* size) {
+    // Every file of a transaction lands directly in HOST_DIR.
+    const char* name = strrchr(path, '/');
+    int64_t host_size;
+
+    name = name != NULL ? name + 1 : path;
+    if ((file->id = host_file_open(HOST_DIR, name, &host_size)) < 0) {
+        LOG_ERR("Failed to open %s/%s on the host.", HOST_DIR, name);
+        return -EIO;
+    }
+
+    *size = host_size;
+    return 0;
+}
+
+static ssize_t host_append(const struct storage_backend* backend,
+                           struct storage_backend_file* file, const void* buf,
+                           size_t len) {
+    const int64_t n = host_file_append(file->id, buf, len);
+    if (n < 0) {
+        return -EIO;
+    }
+
+    bytes_written += n;
+    return n;
+}
+
+static ssize_t host_read(const struct storage_backend* backend,
+                         struct storage_backend_file* file, off_t offset,
+                         void* buf, size_t len) {
+    const int64_t n = host_file_read(file->id, offset, buf, len);
+    return n < 0 ? -EIO : n;
+}
+
+static int host_sync(const struct storage_backend* backend,
+                     struct storage_backend_file* file) {
+    return host_file_sync(file->id) != 0 ? -EIO : 0;
+}
+
+static int host_close(const struct storage_backend* backend,
+                      struct storage_backend_file* file) {
+    return host_file_close(file->id) != 0 ? -EIO : 0;
+}
+
+static int host_remove(const struct storage_backend* backend,
+                       const char* path) {
+    const char* name = strrchr(path, '/');
+
+    name = name != NULL ? name + 1 : path;
+    return host_file_remove(HOST_DIR, name) != 0 ? -EIO : 0;
+}
+
+static void host_stats(const struct storage_backend* backend,
+                       struct storage_backend_stats* stats) {
+    *stats = (struct storage_backend_stats){
+        .size_mb = 0,
+        .bytes_written = bytes_written,
+    };
+}
+
+static const struct storage_backend_api host_api = {
+    .init = host_init,
+    .status = host_status,
+    .open = host_open,
+    .append = host_append,
+    .read = host_read,
+    .sync = host_sync,
+    .close = host_close,
+    .remove = host_remove,
+    .stats = host_stats,
+};
+
+const struct storage_backend storage_backend_host = {
+    .name = "host",
+    .root = "",
+    .api = &host_api,
+};
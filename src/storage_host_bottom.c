@@ -0,0 +1,58 @@
+/*
+ * Built against the host's C library, outside of Zephyr.
+ */
+#include "storage_host_bottom.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int host_file_open(const char* dir, const char* name, int64_t* size) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    (void)mkdir(dir, 0755);
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name)
+            >= (int)sizeof(path)) {
+        return -1;
+    }
+
+    const int fd = open(path, O_CREAT | O_RDWR | O_APPEND, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    *size = st.st_size;
+    return fd;
+}
+
+int64_t host_file_append(int fd, const void* buf, size_t len) {
+    return write(fd, buf, len);
+}
+
+int64_t host_file_read(int fd, int64_t offset, void* buf, size_t len) {
+    return pread(fd, buf, len, offset);
+}
+
+int host_file_sync(int fd) {
+    return fsync(fd);
+}
+
+int host_file_close(int fd) {
+    return close(fd);
+}
+
+int host_file_remove(const char* dir, const char* name) {
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name)
+            >= (int)sizeof(path)) {
+        return -1;
+    }
+    return unlink(path);
+}
@@ -0,0 +1,33 @@
+/**
+ * @brief Files on the host, for the host storage backend on native_sim.
+ *
+ * @details
+ * Every function returns -1 on failure, since the host's errno values do not
+ * have to match Zephyr's.
+ */
+#ifndef STORAGE_HOST_BOTTOM_H
+#define STORAGE_HOST_BOTTOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Open dir/name for appending, creating dir and the file if needed.
+ *
+ * @param [out] size The current size of the file.
+ *
+ * @return The file descriptor.
+ */
+int host_file_open(const char* dir, const char* name, int64_t* size);
+
+int64_t host_file_append(int fd, const void* buf, size_t len);
+
+int64_t host_file_read(int fd, int64_t offset, void* buf, size_t len);
+
+int host_file_sync(int fd);
+
+int host_file_close(int fd);
+
+int host_file_remove(const char* dir, const char* name);
+
+#endif /* STORAGE_HOST_BOTTOM_H */
@@ -0,0 +1,197 @@
+#include "storage_backend.h"
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#define FILE_COUNT CONFIG_BIOLOGGER_STORAGE_RAM_FILES
+#define FILE_SIZE CONFIG_BIOLOGGER_STORAGE_RAM_FILE_SIZE
+#define MAX_PATH 64
+
+LOG_MODULE_REGISTER(storage_ram);
+
+/**
+ * @brief A file, of which only the last FILE_SIZE bytes are kept in a ring.
+ *        Appending costs a memcpy no matter how long the file grows, and
+ *        reading anything older fails with -ENODATA. Once every slot is taken,
+ *        the least recently opened closed file is forgotten to make room.
+ */
+struct ram_file {
+    char path[MAX_PATH];
+    bool open;
+    /*!< The number of bytes ever appended. */
+    off_t size;
+    /*!< Bumped every time the file is opened, to pick what to forget. */
+    uint32_t last_open;
+    uint8_t data[FILE_SIZE];
+};
+
+static struct ram_file files[FILE_COUNT];
+static uint32_t open_count;
+static uint64_t bytes_written;
+
+static int ram_init(const struct storage_backend* backend) {
+    memset(files, 0, sizeof(files));
+    open_count = 0;
+    bytes_written = 0;
+    return 0;
+}
+
+static int ram_status(const struct storage_backend* backend,
+                      enum storage_backend_status* status) {
+    *status = STORAGE_BACKEND_STATUS_APPEARS_SENSIBLE;
+    return 0;
+}
+
+/**
+ * @brief Find the slot of path, or the one to reuse for it.
+ */
+static struct ram_file* find_slot(const char* path) {
+    struct ram_file* victim = NULL;
+
+    for (size_t i = 0; i < FILE_COUNT; i++) {
+        struct ram_file* f = &files[i];
+        if (strcmp(f->path, path) == 0) {
+            return f;
+        }
+        if (!f->open
+                && (victim == NULL || f->last_open < victim->last_open)) {
+            victim = f;
+        }
+    }
+
+    return victim;
+}
+
+static int ram_open(const struct storage_backend* backend,
+                    struct storage_backend_file* file, const char* path,
+                    off_t* size) {
+    if (strlen(path) >= MAX_PATH) {
+        return -ENAMETOOLONG;
+    }
+
+    struct ram_file* f = find_slot(path);
+    if (f == NULL) {
+        return -ENFILE;
+    }
+
+    if (strcmp(f->path, path) != 0) {
+        if (f->path[0] != '\0') {
+            LOG_DBG("Forgetting %s.", f->path);
+        }
+        strcpy(f->path, path);
+        f->size = 0;
+    }
+
+    f->open = true;
+    f->last_open = ++open_count;
+    file->id = f - files;
+    *size = f->size;
+    return 0;
+}
+
+static ssize_t ram_append(const struct storage_backend* backend,
+                          struct storage_backend_file* file, const void* buf,
+                          size_t len) {
+    struct ram_file* f = &files[file->id];
+    const uint8_t* src = buf;
+
+    // Only the tail of a write larger than the ring survives anyways.
+    if (len > FILE_SIZE) {
+        f->size += len - FILE_SIZE;
+        src += len - FILE_SIZE;
+    }
+
+    for (size_t left = MIN(len, FILE_SIZE); left > 0;) {
+        const size_t at = f->size % FILE_SIZE;
+        const size_t n = MIN(left, FILE_SIZE - at);
+        memcpy(&f->data[at], src, n);
+        src += n;
+        left -= n;
+        f->size += n;
+    }
+
+    bytes_written += len;
+    return len;
+}
+
+static ssize_t ram_read(const struct storage_backend* backend,
+                        struct storage_backend_file* file, off_t offset,
+                        void* buf, size_t len) {
+    const struct ram_file* f = &files[file->id];
+    uint8_t* dst = buf;
+
+    if (offset >= f->size) {
+        return 0;
+    }
+    if (f->size - offset > FILE_SIZE) {
+        return -ENODATA;
+    }
+
+    const size_t total = MIN(len, (size_t)(f->size - offset));
+    for (size_t left = total; left > 0;) {
+        const size_t at = offset % FILE_SIZE;
+        const size_t n = MIN(left, FILE_SIZE - at);
+        memcpy(dst, &f->data[at], n);
+        dst += n;
+        left -= n;
+        offset += n;
+    }
+
+    return total;
+}
+
+static int ram_sync(const struct storage_backend* backend,
+                    struct storage_backend_file* file) {
+    return 0;
+}
+
+static int ram_close(const struct storage_backend* backend,
+                     struct storage_backend_file* file) {
+    files[file->id].open = false;
+    return 0;
+}
+
+static int ram_remove(const struct storage_backend* backend,
+                      const char* path) {
+    for (size_t i = 0; i < FILE_COUNT; i++) {
+        struct ram_file* f = &files[i];
+        if (strcmp(f->path, path) == 0) {
+            if (f->open) {
+                return -EBUSY;
+            }
+            f->path[0] = '\0';
+            f->size = 0;
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+static void ram_stats(const struct storage_backend* backend,
+                      struct storage_backend_stats* stats) {
+    *stats = (struct storage_backend_stats){
+        .size_mb = sizeof(files) / 1024ull / 1024ull,
+        .bytes_written = bytes_written,
+    };
+}
+
+static const struct storage_backend_api ram_api = {
+    .init = ram_init,
+    .status = ram_status,
+    .open = ram_open,
+    .append = ram_append,
+    .read = ram_read,
+    .sync = ram_sync,
+    .close = ram_close,
+    .remove = ram_remove,
+    .stats = ram_stats,
+};
+
+const struct storage_backend storage_backend_ram = {
+    .name = "ram",
+    .root = "",
+    .api = &ram_api,
+};
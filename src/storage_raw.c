@@ -0,0 +1,326 @@
+#include "storage_backend.h"
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/drivers/disk.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/disk_access.h>
+#include <zephyr/sys/util.h>
+
+#define DISK_NAME CONFIG_BIOLOGGER_STORAGE_DISK_NAME
+#define START_SECTOR CONFIG_BIOLOGGER_STORAGE_RAW_START_SECTOR
+#define SECTOR_SIZE 512
+#define SECTOR_MAGIC 0x676f6c62 // "blog"
+#define MAX_FILES 16
+#define MAX_PATH 64
+// Set in the file number of the record naming a file.
+#define RECORD_NAME 0x80
+
+LOG_MODULE_REGISTER(storage_raw);
+
+/**
+ * @brief Starts every sector of the log.
+ *
+ * @details
+ * The log is a run of sectors starting at START_SECTOR, the n-th of which
+ * carries seq n. The first sector which does not is where the log ends, so
+ * it is found with a binary search on boot. The log never wraps around, so
+ * the region has to be erased to start over.
+ *
+ * The payload of a sector is a sequence of records, each a record_header
+ * followed by len bytes. The bytes of a file are the concatenation of its
+ * records in log order. A record with RECORD_NAME set in its file number
+ * holds the path of that file, and comes before its first bytes. File numbers
+ * start over on every boot, and every transaction has files of its own.
+ */
+struct sector_header {
+    uint32_t magic;
+    uint32_t seq;
+    /*!< The number of payload bytes in use. The rest is zero. */
+    uint16_t used;
+    uint16_t reserved;
+} __packed;
+
+struct record_header {
+    uint8_t file;
+    uint16_t len;
+} __packed;
+
+#define PAYLOAD_SIZE (SECTOR_SIZE - sizeof(struct sector_header))
+
+static uint8_t sector_buf[SECTOR_SIZE] __aligned(4);
+// Whether the end of the log was found, i.e. appending is possible.
+static bool ready;
+// The number of sectors the log may occupy.
+static uint32_t sector_count;
+// The sector being filled, and how much of its payload is in use.
+static uint32_t current;
+static size_t used;
+// Whether sector_buf holds bytes which are not on the disk yet.
+static bool dirty;
+
+static char paths[MAX_FILES][MAX_PATH];
+static off_t sizes[MAX_FILES];
+static size_t file_count;
+static uint64_t bytes_written;
+
+static struct sector_header* header(void) {
+    return (struct sector_header*)sector_buf;
+}
+
+static bool sector_valid(uint32_t seq) {
+    return disk_access_read(DISK_NAME, sector_buf, START_SECTOR + seq, 1) == 0
+        && header()->magic == SECTOR_MAGIC
+        && header()->seq == seq
+        && header()->used <= PAYLOAD_SIZE;
+}
+
+/**
+ * @brief Find where the log ends and load its last sector, if it has room
+ *        left.
+ */
+static int locate_end(void) {
+    uint32_t count;
+    uint32_t size;
+    int err;
+
+    ready = false;
+
+    if ((err = disk_access_ioctl(DISK_NAME, DISK_IOCTL_GET_SECTOR_COUNT,
+                                 &count)) != 0
+            || (err = disk_access_ioctl(DISK_NAME, DISK_IOCTL_GET_SECTOR_SIZE,
+                                        &size)) != 0) {
+        LOG_ERR("Could not query the geometry of %s (%d).", DISK_NAME, err);
+        return err;
+    }
+
+    if (size != SECTOR_SIZE || count <= START_SECTOR) {
+        LOG_ERR("%s has %u sectors of %u B, the log needs more than %u of "
+                "%u B.", DISK_NAME, count, size, START_SECTOR, SECTOR_SIZE);
+        return -ENOTSUP;
+    }
+    sector_count = count - START_SECTOR;
+
+    uint32_t lo = 0;
+    uint32_t hi = sector_count;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (sector_valid(mid)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo > 0 && sector_valid(lo - 1) && header()->used < PAYLOAD_SIZE) {
+        current = lo - 1;
+        used = header()->used;
+    } else {
+        memset(sector_buf, 0, sizeof(sector_buf));
+        current = lo;
+        used = 0;
+    }
+    dirty = false;
+    file_count = 0;
+
+    LOG_INF("The log on %s continues at sector %u of %u.", DISK_NAME,
+            current, sector_count);
+    ready = true;
+    return 0;
+}
+
+static int write_sector(void) {
+    *header() = (struct sector_header){
+        .magic = SECTOR_MAGIC,
+        .seq = current,
+        .used = used,
+    };
+    return disk_access_write(DISK_NAME, sector_buf, START_SECTOR + current, 1);
+}
+
+/**
+ * @brief Append a single record, moving on to the next sector if needed.
+ *
+ * @return The number of bytes of data which fit in the record.
+ */
+static ssize_t append_record(uint8_t file, const uint8_t* data, size_t len) {
+    int err;
+
+    if (PAYLOAD_SIZE - used <= sizeof(struct record_header)) {
+        if ((err = write_sector()) != 0) {
+            return err;
+        }
+        memset(sector_buf, 0, sizeof(sector_buf));
+        current++;
+        used = 0;
+        dirty = false;
+    }
+
+    if (current >= sector_count) {
+        return -ENOSPC;
+    }
+
+    const struct record_header record = {
+        .file = file,
+        .len = MIN(len, PAYLOAD_SIZE - used - sizeof(record)),
+    };
+    uint8_t* at = sector_buf + sizeof(struct sector_header) + used;
+    memcpy(at, &record, sizeof(record));
+    memcpy(at + sizeof(record), data, record.len);
+    used += sizeof(record) + record.len;
+    dirty = true;
+    return record.len;
+}
+
+static ssize_t append(uint8_t file, const uint8_t* data, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        const ssize_t n = append_record(file, data + done, len - done);
+        if (n < 0) {
+            return n;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+static int raw_init(const struct storage_backend* backend) {
+    int err;
+
+    BUILD_ASSERT(MAX_FILES <= RECORD_NAME, "File numbers overlap the flag.");
+
+    if ((err = disk_access_init(DISK_NAME)) != 0) {
+        LOG_ERR("Cannot open a handle to %s (%d).", DISK_NAME, err);
+        return err;
+    }
+
+    // A missing card is not fatal. The storage thread keeps checking and
+    // remounts once it shows up.
+    (void)locate_end();
+    return 0;
+}
+
+static int raw_status(const struct storage_backend* backend,
+                      enum storage_backend_status* status) {
+    if (disk_access_status(DISK_NAME) != DISK_STATUS_OK) {
+        *status = STORAGE_BACKEND_STATUS_NO_OR_BAD_DISK;
+        return -ENOTBLK;
+    }
+
+    if (!ready) {
+        *status = STORAGE_BACKEND_STATUS_NO_OR_CORRUPT_FS;
+        return -ENODEV;
+    }
+
+    if (current >= sector_count) {
+        *status = STORAGE_BACKEND_STATUS_NO_SPACE_ON_DISK;
+        return -ENOSPC;
+    }
+
+    *status = STORAGE_BACKEND_STATUS_APPEARS_SENSIBLE;
+    return 0;
+}
+
+static int raw_remount(const struct storage_backend* backend) {
+    return locate_end();
+}
+
+static int raw_open(const struct storage_backend* backend,
+                    struct storage_backend_file* file, const char* path,
+                    off_t* size) {
+    ssize_t err;
+
+    if (!ready) {
+        return -ENODEV;
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        if (strcmp(paths[i], path) == 0) {
+            file->id = i;
+            *size = sizes[i];
+            return 0;
+        }
+    }
+
+    const size_t len = strlen(path);
+    if (len >= MAX_PATH) {
+        return -ENAMETOOLONG;
+    }
+    if (file_count == MAX_FILES) {
+        return -ENFILE;
+    }
+
+    if ((err = append(RECORD_NAME | file_count, (const uint8_t*)path, len))
+            < 0) {
+        return err;
+    }
+
+    strcpy(paths[file_count], path);
+    sizes[file_count] = 0;
+    file->id = file_count++;
+    *size = 0;
+    return 0;
+}
+
+static ssize_t raw_append(const struct storage_backend* backend,
+                          struct storage_backend_file* file, const void* buf,
+                          size_t len) {
+    if (!ready) {
+        return -ENODEV;
+    }
+
+    const ssize_t n = append(file->id, buf, len);
+    if (n > 0) {
+        sizes[file->id] += n;
+        bytes_written += n;
+    }
+    return n;
+}
+
+static int raw_sync(const struct storage_backend* backend,
+                    struct storage_backend_file* file) {
+    int err;
+
+    // The partial sector is written again every time, until it is full.
+    if (dirty) {
+        if ((err = write_sector()) != 0) {
+            return err;
+        }
+        dirty = false;
+    }
+
+    return disk_access_ioctl(DISK_NAME, DISK_IOCTL_CTRL_SYNC, NULL);
+}
+
+static int raw_close(const struct storage_backend* backend,
+                     struct storage_backend_file* file) {
+    // The file number stays bound to its path until the next remount, so
+    // reopening the file continues it.
+    return 0;
+}
+
+static void raw_stats(const struct storage_backend* backend,
+                      struct storage_backend_stats* stats) {
+    *stats = (struct storage_backend_stats){
+        .size_mb = (uint64_t)sector_count * SECTOR_SIZE / 1024ull / 1024ull,
+        .bytes_written = bytes_written,
+    };
+}
+
+static const struct storage_backend_api raw_api = {
+    .init = raw_init,
+    .status = raw_status,
+    .remount = raw_remount,
+    .open = raw_open,
+    .append = raw_append,
+    .sync = raw_sync,
+    .close = raw_close,
+    .stats = raw_stats,
+};
+
+const struct storage_backend storage_backend_raw = {
+    .name = "raw",
+    .root = "",
+    .api = &raw_api,
+};
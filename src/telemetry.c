@@ -0,0 +1,194 @@
+#include "telemetry.h"
+#include "experiment.h"
+#include "sample_bus.h"
+#include "thread_specs.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/printk.h>
+#if defined(CONFIG_SHELL_BACKEND_SERIAL)
+#include <zephyr/shell/shell_uart.h>
+#endif
+
+#define MAX_CELL_WIDTH 24
+#define MAX_LINE_LEN ((MAX_CELL_WIDTH + 1) * (TELEMETRY_MAX_COLUMNS + 1))
+
+LOG_MODULE_REGISTER(telemetry);
+
+SAMPLE_BUS_SUBSCRIBER_DEFINE(telemetry_subscriber, SAMPLE_BUS_TELEMETRY_DEPTH);
+
+static atomic_t rate = ATOMIC_INIT(TELEMETRY_DEFAULT_RATE);
+static atomic_t columns = ATOMIC_INIT(UINT32_MAX);
+
+static atomic_t rows_printed = ATOMIC_INIT(0);
+
+// Only ever touched by the telemetry thread.
+static uint32_t rows_since_print = 0;
+static char line_buf[MAX_LINE_LEN];
+
+K_THREAD_STACK_DEFINE(telemetry_thread_stack, THREAD_TELEMETRY_STACK_SIZE);
+static struct k_thread telemetry_thread_data;
+
+static void format_row(const struct experiment_row* row) {
+    char* write_buf = line_buf;
+
+    write_buf += snprintk(write_buf, MAX_CELL_WIDTH, "%llu",
+                          row->millis_since_start);
+
+    const uint32_t mask = atomic_get(&columns);
+    const size_t count = MIN(EXPERIMENT_COLUMN_COUNT, TELEMETRY_MAX_COLUMNS);
+    for (size_t i = 0; i < count; i++) {
+        if (mask & BIT(i)) {
+            write_buf += snprintk(write_buf, MAX_CELL_WIDTH, ",%10.10f",
+                                  experiment_row_value(row, i));
+        }
+    }
+}
+
+static void print_line(void) {
+#if defined(CONFIG_SHELL_BACKEND_SERIAL)
+    // The shell owns the console UART and drains it from its TX interrupt.
+    shell_fprintf(shell_backend_uart_get_ptr(), SHELL_NORMAL, "%s\n",
+                  line_buf);
+#else
+    printk("%s\n", line_buf);
+#endif
+}
+
+/**
+ * @brief Whether the next row is due to be printed.
+ */
+static bool row_due(void) {
+    const uint32_t every_nth = atomic_get(&rate);
+    if (every_nth == 0) {
+        return false;
+    }
+
+    if (++rows_since_print < every_nth) {
+        return false;
+    }
+    rows_since_print = 0;
+    return true;
+}
+
+static void telemetry_thread_runnable(void* p0, void* p1, void* p2) {
+    LOG_INF("Starting to print telemetry...");
+
+    while (true) {
+        struct experiment_row* row = sample_bus_take(&telemetry_subscriber,
+                                                     K_FOREVER);
+        if (row == NULL) {
+            continue;
+        }
+
+        if (!row_due()) {
+            experiment_row_unref(row);
+            continue;
+        }
+
+        // The row is let go before printing, which may take a while at a low
+        // baud rate.
+        format_row(row);
+        experiment_row_unref(row);
+
+        print_line();
+        atomic_inc(&rows_printed);
+    }
+}
+
+int telemetry_init(void) {
+    sample_bus_subscribe(&telemetry_subscriber);
+
+    k_thread_create(
+        &telemetry_thread_data,
+        telemetry_thread_stack,
+        K_THREAD_STACK_SIZEOF(telemetry_thread_stack),
+        telemetry_thread_runnable, NULL, NULL, NULL,
+        THREAD_TELEMETRY_PRIORITY, 0, K_NO_WAIT
+    );
+    k_thread_name_set(&telemetry_thread_data, "telemetry");
+
+    LOG_INF("Initialized the telemetry.");
+    return 0;
+}
+
+void telemetry_set_rate(uint32_t every_nth) {
+    atomic_set(&rate, every_nth);
+}
+
+void telemetry_set_columns(uint32_t mask) {
+    atomic_set(&columns, mask);
+}
+
+void telemetry_stats_get(struct telemetry_stats* stats) {
+    stats->rows_printed = atomic_get(&rows_printed);
+    stats->rows_dropped = atomic_get(&telemetry_subscriber.rows_dropped);
+}
+
+/******************************************************************************
+ * Shell commands.
+ *****************************************************************************/
+
+#if defined(CONFIG_SHELL)
+static int cmd_rate(const struct shell* sh, size_t argc, char** argv) {
+    char* end;
+    const unsigned long every_nth = strtoul(argv[1], &end, 10);
+    if (*end != '\0') {
+        shell_error(sh, "Invalid rate: %s", argv[1]);
+        return -EINVAL;
+    }
+
+    telemetry_set_rate(every_nth);
+    return 0;
+}
+
+static int cmd_columns(const struct shell* sh, size_t argc, char** argv) {
+    if (argc == 2 && strcmp(argv[1], "all") == 0) {
+        telemetry_set_columns(UINT32_MAX);
+        return 0;
+    }
+
+    uint32_t mask = 0;
+    for (size_t i = 1; i < argc; i++) {
+        char* end;
+        const unsigned long column = strtoul(argv[i], &end, 10);
+        if (*end != '\0' || column >= TELEMETRY_MAX_COLUMNS) {
+            shell_error(sh, "Invalid column: %s", argv[i]);
+            return -EINVAL;
+        }
+        mask |= BIT(column);
+    }
+
+    telemetry_set_columns(mask);
+    return 0;
+}
+
+static int cmd_status(const struct shell* sh, size_t argc, char** argv) {
+    struct telemetry_stats stats;
+    telemetry_stats_get(&stats);
+
+    shell_print(sh, "Printing every %u rows, columns 0x%08x",
+                (uint32_t)atomic_get(&rate), (uint32_t)atomic_get(&columns));
+    shell_print(sh, "Printed %u rows, dropped %u", stats.rows_printed,
+                stats.rows_dropped);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(telemetry_cmds,
+    SHELL_CMD_ARG(rate, NULL, "Print every n-th row, 0 to stop.",
+                  cmd_rate, 2, 0),
+    SHELL_CMD_ARG(columns, NULL, "Print \"all\" columns or only the listed "
+                  "column indices.", cmd_columns, 2, TELEMETRY_MAX_COLUMNS - 1),
+    SHELL_CMD(status, NULL, "Show the telemetry settings and counters.",
+              cmd_status),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((biologger), telemetry, &telemetry_cmds,
+                 "Console telemetry.", NULL, 0, 0);
+#endif
@@ -0,0 +1,67 @@
+/**
+ * @brief Prints a subset of the experiment rows to the console without ever
+ *        holding up the sampling thread.
+ *
+ * @details
+ * The telemetry subscribes to the sample bus, see sample_bus.h. A low-priority
+ * thread takes every row off its queue, formats the selected columns of every
+ * n-th row and prints them on the shell console. The shell's UART backend is
+ * interrupt-driven, so the console baud rate only ever delays the telemetry
+ * thread. If the queue is full, rows are dropped for the console alone and
+ * counted.
+ *
+ * The rate and columns are set from the shell:
+ *
+ *   biologger telemetry rate <n>        Print every n-th row, 0 to stop.
+ *   biologger telemetry columns all     Print every column.
+ *   biologger telemetry columns 0 2 4   Print only these columns.
+ *   biologger telemetry status          Show the settings and counters.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "experiment.h"
+#include <stdint.h>
+
+/*!< Only the first TELEMETRY_MAX_COLUMNS columns may be printed. */
+#define TELEMETRY_MAX_COLUMNS 32
+/*!< Print one row per second at the default 10 Hz sampling rate. */
+#define TELEMETRY_DEFAULT_RATE 10
+
+/**
+ * @brief Counters describing the telemetry so far.
+ */
+struct telemetry_stats {
+    /*!< The number of rows printed. */
+    uint32_t rows_printed;
+    /*!< The number of rows dropped because the console did not keep up. */
+    uint32_t rows_dropped;
+};
+
+/**
+ * @brief Subscribe to the sample bus and start the telemetry thread.
+ *
+ * @return 0 on success.
+ */
+int telemetry_init(void);
+
+/**
+ * @brief Print every n-th row pushed.
+ *
+ * @param [in] every_nth 0 stops printing altogether.
+ */
+void telemetry_set_rate(uint32_t every_nth);
+
+/**
+ * @brief Select the columns to print.
+ *
+ * @param [in] mask Bit i selects column i.
+ */
+void telemetry_set_columns(uint32_t mask);
+
+/**
+ * @brief Retrieve the telemetry counters.
+ */
+void telemetry_stats_get(struct telemetry_stats* stats);
+
+#endif /* TELEMETRY_H */
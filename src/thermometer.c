@@ -0,0 +1,122 @@
+#include "thermometer.h"
+#include "observer.h"
+#include "thread_specs.h"
+#include <stdbool.h>
+#include <sys/errno.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/spinlock.h>
+
+#define DT_TSIC DT_NODELABEL(tsic_506)
+
+LOG_MODULE_REGISTER(thermometer);
+
+static const struct device* const tsic_dev = DEVICE_DT_GET(DT_TSIC);
+
+/*
+ * The published reading. The lock is only ever held for the duration of a
+ * struct copy, so neither the acquisition thread nor the sampling thread can
+ * be held up by the other.
+ */
+static struct k_spinlock published_lock;
+static struct thermometer_reading published;
+static bool published_valid = false;
+
+static void publish(const struct thermometer_reading* reading) {
+    k_spinlock_key_t key = k_spin_lock(&published_lock);
+    published = *reading;
+    published_valid = true;
+    k_spin_unlock(&published_lock, key);
+}
+
+static int acquire(struct thermometer_reading* out) {
+    int err;
+
+    if ((err = sensor_sample_fetch(tsic_dev)) != 0) {
+        return err;
+    }
+
+    struct sensor_value val;
+    if ((err = sensor_channel_get(tsic_dev, SENSOR_CHAN_AMBIENT_TEMP,
+                                  &val)) != 0) {
+        return err;
+    }
+
+    out->celsius = sensor_value_to_double(&val);
+    out->uptime_ms = k_uptime_get();
+    return 0;
+}
+
+K_THREAD_STACK_DEFINE(acquisition_thread_stack, THREAD_THERMOMETER_STACK_SIZE);
+static struct k_thread acquisition_thread_data;
+
+static void acquisition_thread_runnable(void* p0, void* p1, void* p2) {
+    LOG_INF("Starting to acquire temperature...");
+
+    // Only report the first failure of a streak, otherwise an unplugged sensor
+    // floods the log at 10Hz.
+    bool failing = false;
+
+    while (true) {
+        const uint32_t start = k_uptime_get_32();
+
+        struct thermometer_reading reading;
+        int err;
+        if ((err = acquire(&reading)) != 0) {
+            if (!failing) {
+                LOG_WRN("Failed to acquire a temperature reading (%d).", err);
+            }
+            failing = true;
+        } else {
+            if (failing) {
+                LOG_INF("Temperature readings recovered.");
+            }
+            failing = false;
+            publish(&reading);
+        }
+
+        const uint32_t elapsed = k_uptime_get_32() - start;
+        if (elapsed < THREAD_THERMOMETER_PERIOD_MS) {
+            k_msleep(THREAD_THERMOMETER_PERIOD_MS - elapsed);
+        }
+    }
+}
+
+int thermometer_init(observer_t observer) {
+    if (!device_is_ready(tsic_dev)) {
+        LOG_ERR("The TSIC temperature sensor is not ready.");
+        observer_flag_raise(observer, OBSERVER_FLAG_DRIVER_MIA);
+        return -ENODEV;
+    }
+
+    k_thread_create(
+        &acquisition_thread_data,
+        acquisition_thread_stack,
+        K_THREAD_STACK_SIZEOF(acquisition_thread_stack),
+        acquisition_thread_runnable, NULL, NULL, NULL,
+        THREAD_THERMOMETER_PRIORITY, 0, K_NO_WAIT
+    );
+    k_thread_name_set(&acquisition_thread_data, "thermometer");
+
+    LOG_INF("Initialized the thermometer.");
+    return 0;
+}
+
+int thermometer_latest(struct thermometer_reading* out) {
+    k_spinlock_key_t key = k_spin_lock(&published_lock);
+    const bool valid = published_valid;
+    *out = published;
+    k_spin_unlock(&published_lock, key);
+
+    if (!valid) {
+        return -ENODATA;
+    }
+
+    if (k_uptime_get() - out->uptime_ms > THERMOMETER_STALE_AFTER_MS) {
+        return -ESTALE;
+    }
+
+    return 0;
+}
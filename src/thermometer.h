@@ -0,0 +1,57 @@
+/**
+ * @brief Module responsible for providing the ambient temperature from the
+ *        TSIC 506 sensor without blocking the sampling thread.
+ *
+ * @details
+ * The TSIC 506 transmits its readings over ZACwire, which the tsic-xx6 driver
+ * decodes with PWM capture. Fetching a fresh reading may take up to a full
+ * ZACwire frame, which is far too long for the 10Hz sampling loop. This module
+ * therefore runs its own low-priority thread which pulls readings from the
+ * driver at the rate the sensor produces them and publishes the latest valid
+ * value together with the uptime at which it was acquired. The sampling thread
+ * only ever copies that cached value.
+ */
+#ifndef THERMOMETER_H
+#define THERMOMETER_H
+
+#include "observer.h"
+#include <stdint.h>
+
+/**
+ * @brief Readings older than this are considered stale. The TSIC 506 publishes
+ *        a new frame every 100ms so this allows for a few lost frames.
+ */
+#define THERMOMETER_STALE_AFTER_MS 1000
+
+/**
+ * @brief A single published temperature reading.
+ */
+struct thermometer_reading {
+    /*!< The temperature in degrees Celsius. */
+    double celsius;
+    /*!< The k_uptime_get() at which this reading was acquired. */
+    int64_t uptime_ms;
+};
+
+/**
+ * @brief Initialize the module and start the acquisition thread.
+ *
+ * @param [in] observer The application observer.
+ *
+ * @return 0 on success or -ENODEV if the sensor is not ready.
+ */
+int thermometer_init(observer_t observer);
+
+/**
+ * @brief Retrieve the latest published reading. This function never blocks
+ *        and runs in constant time.
+ *
+ * @param [out] out The reading to write to.
+ *
+ * @return 0 on success, -ENODATA if no reading was ever published or
+ *         -ESTALE if the latest reading is older than
+ *         THERMOMETER_STALE_AFTER_MS.
+ */
+int thermometer_latest(struct thermometer_reading* out);
+
+#endif /* THERMOMETER_H */
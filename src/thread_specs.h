@@ -1,6 +1,31 @@
 #define THREAD_BLINK_STATUS0_STACK_SIZE 256
 #define THREAD_BLINK_STATUS0_PRIORITY 7
 
-#define THREAD_BLOCK_STORAGE_MANAGEMENT_STACK_SIZE 2048
+#define THREAD_BLOCK_STORAGE_MANAGEMENT_STACK_SIZE 4096
 #define THREAD_BLOCK_STORAGE_MANAGEMENT_PRIORITY 11
 #define THREAD_BLOCK_STORAGE_MANAGEMENT_PERIOD_MS 1999
+
+#define THREAD_THERMOMETER_STACK_SIZE 1024
+#define THREAD_THERMOMETER_PRIORITY 10
+#define THREAD_THERMOMETER_PERIOD_MS 100
+
+#define THREAD_TELEMETRY_STACK_SIZE 1536
+#define THREAD_TELEMETRY_PRIORITY 14
+
+#define THREAD_EXPERIMENT_STACK_SIZE 2048
+#define THREAD_EXPERIMENT_PRIORITY 8
+
+#define THREAD_USB_STREAM_STACK_SIZE 1024
+#define THREAD_USB_STREAM_PRIORITY 12
+
+#define THREAD_HEALTH_STACK_SIZE 2048
+#define THREAD_HEALTH_PRIORITY 13
+
+#define THREAD_BURST_SAMPLE_STACK_SIZE 1024
+#define THREAD_BURST_SAMPLE_PRIORITY 6
+
+#define THREAD_BURST_WRITE_STACK_SIZE 1536
+#define THREAD_BURST_WRITE_PRIORITY 12
+
+#define THREAD_SIM_GNSS_STACK_SIZE 1024
+#define THREAD_SIM_GNSS_PRIORITY 9
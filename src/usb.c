@@ -113,10 +113,10 @@ int usb_init(struct usbd_contex** pctx) {
         return err;
     }
 
+    // The STM32F412 OTG_FS peripheral only has a full-speed PHY, so there is
+    // nothing to gain from asking for high speed. Bulk throughput is instead
+    // improved by the read-ahead cache in msc_cache.c.
     const enum usbd_speed target_speed = USBD_SPEED_FS;
-        //usbd_caps_speed(&usb_device) >= USBD_SPEED_HS
-        //    ? USBD_SPEED_HS
-        //    : USBD_SPEED_FS;
     if ((err = add_configuration(&usb_device, target_speed,
                                  target_speed == USBD_SPEED_HS
                                      ? &default_hs_config
@@ -0,0 +1,351 @@
+#include "msc_cache.h"
+#include "usb_export.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/drivers/disk.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/disk_access.h>
+#include <zephyr/sys/byteorder.h>
+
+// The snapshot only supports the sector size every SD card uses, so that the
+// preserved sectors can live in a static table.
+#define SECTOR_SZ 512
+#define FAT32_ENTRY_MASK 0x0fffffff
+
+LOG_MODULE_REGISTER(usb_export);
+
+static uint8_t preserved_buf[CONFIG_BIOLOGGER_USB_EXPORT_COW_SECTORS][SECTOR_SZ]
+    __aligned(4);
+static uint8_t fat_buf[SECTOR_SZ] __aligned(4);
+
+static struct {
+    /*!< Held across every access to the card, so that the host never reads a
+     * sector between the firmware overwriting it and it being preserved. */
+    struct k_mutex lock;
+
+    bool active;
+    bool overflowed;
+    struct usb_export_volume volume;
+
+    /*!< preserved_sectors[i] is the sector whose snapshot contents are in
+     * preserved_buf[i]. */
+    uint32_t preserved_sectors[CONFIG_BIOLOGGER_USB_EXPORT_COW_SECTORS];
+    uint32_t preserved_count;
+
+    /*!< The FAT sector held in fat_buf, or UINT32_MAX. */
+    uint32_t fat_buf_sector;
+} export;
+
+static int find_preserved(uint32_t sector) {
+    for (uint32_t i = 0; i < export.preserved_count; i++) {
+        if (export.preserved_sectors[i] == sector) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Read a single sector as it was at the time of the snapshot.
+ */
+static int read_snapshot_sector(uint8_t* buf, uint32_t sector) {
+    const int i = find_preserved(sector);
+    if (i >= 0) {
+        memcpy(buf, preserved_buf[i], SECTOR_SZ);
+        return 0;
+    }
+
+    // Anything not preserved has not been overwritten since the snapshot.
+    return disk_access_read(USB_EXPORT_PHYSICAL_DISK_NAME, buf, sector, 1);
+}
+
+/**
+ * @brief Whether the sector was referred to by the filesystem at the time of
+ *        the snapshot, i.e. whether the host may read it.
+ */
+static bool in_use_at_snapshot(uint32_t sector) {
+    const struct usb_export_volume* v = &export.volume;
+
+    // The boot sector, FSInfo, the FATs and the FAT16 root directory.
+    if (sector < v->data_start) {
+        return true;
+    }
+
+    const uint32_t cluster = (sector - v->data_start) / v->sectors_per_cluster
+        + 2;
+    if (cluster >= v->fat_entries) {
+        return true;
+    }
+
+    const uint32_t offset = cluster * (v->fat_bits / 8);
+    const uint32_t fat_sector = v->fat_start + offset / SECTOR_SZ;
+    if (export.fat_buf_sector != fat_sector) {
+        export.fat_buf_sector = UINT32_MAX;
+        if (read_snapshot_sector(fat_buf, fat_sector) != 0) {
+            // Preserving a sector too many is harmless, losing one is not.
+            return true;
+        }
+        export.fat_buf_sector = fat_sector;
+    }
+
+    const uint8_t* entry = &fat_buf[offset % SECTOR_SZ];
+    const uint32_t next = v->fat_bits == 16
+        ? sys_get_le16(entry)
+        : sys_get_le32(entry) & FAT32_ENTRY_MASK;
+
+    return next != 0;
+}
+
+static int preserve(uint32_t sector) {
+    int err;
+
+    if (export.preserved_count == ARRAY_SIZE(export.preserved_sectors)) {
+        return -ENOSPC;
+    }
+
+    const uint32_t i = export.preserved_count;
+    if ((err = disk_access_read(USB_EXPORT_PHYSICAL_DISK_NAME,
+                                preserved_buf[i], sector, 1)) != 0) {
+        return err;
+    }
+
+    export.preserved_sectors[i] = sector;
+    export.preserved_count++;
+    return 0;
+}
+
+/**
+ * @brief Preserve every sector in the range which the host may still read.
+ */
+static void preserve_range(uint32_t sector, uint32_t count) {
+    int err;
+
+    for (uint32_t s = sector; s < sector + count; s++) {
+        if (find_preserved(s) >= 0 || !in_use_at_snapshot(s)) {
+            continue;
+        }
+
+        if ((err = preserve(s)) != 0) {
+            LOG_ERR("Could not preserve sector %u (%d), ejecting the "
+                    "exported card.", s, err);
+            export.overflowed = true;
+            msc_cache_invalidate();
+            return;
+        }
+    }
+}
+
+/******************************************************************************
+ * The disk FatFs mounts.
+ *****************************************************************************/
+
+static int firmware_disk_init(struct disk_info* disk) {
+    return disk_access_init(USB_EXPORT_PHYSICAL_DISK_NAME);
+}
+
+static int firmware_disk_status(struct disk_info* disk) {
+    return disk_access_status(USB_EXPORT_PHYSICAL_DISK_NAME);
+}
+
+static int firmware_disk_read(struct disk_info* disk, uint8_t* buf,
+                              uint32_t sector, uint32_t count) {
+    return disk_access_read(USB_EXPORT_PHYSICAL_DISK_NAME, buf, sector, count);
+}
+
+static int firmware_disk_write(struct disk_info* disk, const uint8_t* buf,
+                               uint32_t sector, uint32_t count) {
+    k_mutex_lock(&export.lock, K_FOREVER);
+
+    if (export.active && !export.overflowed) {
+        preserve_range(sector, count);
+    }
+    const int err = disk_access_write(USB_EXPORT_PHYSICAL_DISK_NAME, buf,
+                                      sector, count);
+
+    k_mutex_unlock(&export.lock);
+    return err;
+}
+
+static int firmware_disk_ioctl(struct disk_info* disk, uint8_t cmd,
+                               void* buf) {
+    return disk_access_ioctl(USB_EXPORT_PHYSICAL_DISK_NAME, cmd, buf);
+}
+
+static const struct disk_operations firmware_disk_ops = {
+    .init = firmware_disk_init,
+    .status = firmware_disk_status,
+    .read = firmware_disk_read,
+    .write = firmware_disk_write,
+    .ioctl = firmware_disk_ioctl,
+};
+
+static struct disk_info firmware_disk = {
+    .name = USB_EXPORT_FIRMWARE_DISK_NAME,
+    .ops = &firmware_disk_ops,
+};
+
+/******************************************************************************
+ * The disk the USB host sees.
+ *****************************************************************************/
+
+static bool host_may_read(void) {
+    return export.active && !export.overflowed;
+}
+
+static int host_disk_init(struct disk_info* disk) {
+    // The card belongs to the firmware, which initializes it.
+    return 0;
+}
+
+static int host_disk_status(struct disk_info* disk) {
+    return host_may_read() ? DISK_STATUS_OK : DISK_STATUS_NOMEDIA;
+}
+
+static int host_disk_read(struct disk_info* disk, uint8_t* buf,
+                          uint32_t sector, uint32_t count) {
+    int err;
+
+    k_mutex_lock(&export.lock, K_FOREVER);
+
+    if (!host_may_read()) {
+        err = -EIO;
+        goto exit;
+    }
+
+    if ((err = disk_access_read(USB_EXPORT_PHYSICAL_DISK_NAME, buf, sector,
+                                count)) != 0) {
+        goto exit;
+    }
+
+    for (uint32_t i = 0; i < export.preserved_count; i++) {
+        const uint32_t s = export.preserved_sectors[i];
+        if (s >= sector && s - sector < count) {
+            memcpy(&buf[(s - sector) * SECTOR_SZ], preserved_buf[i],
+                   SECTOR_SZ);
+        }
+    }
+
+exit:
+    k_mutex_unlock(&export.lock);
+    return err;
+}
+
+static int host_disk_write(struct disk_info* disk, const uint8_t* buf,
+                           uint32_t sector, uint32_t count) {
+    return -EROFS;
+}
+
+static int host_disk_ioctl(struct disk_info* disk, uint8_t cmd, void* buf) {
+    switch (cmd) {
+        case DISK_IOCTL_GET_SECTOR_COUNT:
+        case DISK_IOCTL_GET_SECTOR_SIZE:
+        case DISK_IOCTL_GET_ERASE_BLOCK_SZ:
+            return disk_access_ioctl(USB_EXPORT_PHYSICAL_DISK_NAME, cmd, buf);
+        case DISK_IOCTL_CTRL_SYNC:
+            // Nothing is ever written through this disk.
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+static const struct disk_operations host_disk_ops = {
+    .init = host_disk_init,
+    .status = host_disk_status,
+    .read = host_disk_read,
+    .write = host_disk_write,
+    .ioctl = host_disk_ioctl,
+};
+
+static struct disk_info host_disk = {
+    .name = USB_EXPORT_HOST_DISK_NAME,
+    .ops = &host_disk_ops,
+};
+
+int usb_export_init(void) {
+    int err;
+
+    k_mutex_init(&export.lock);
+
+    if ((err = disk_access_register(&firmware_disk)) != 0) {
+        LOG_ERR("Failed to register the %s disk (%d).",
+                USB_EXPORT_FIRMWARE_DISK_NAME, err);
+        return err;
+    }
+
+    if ((err = disk_access_register(&host_disk)) != 0) {
+        LOG_ERR("Failed to register the %s disk (%d).",
+                USB_EXPORT_HOST_DISK_NAME, err);
+        return err;
+    }
+
+    return 0;
+}
+
+int usb_export_begin(const struct usb_export_volume* volume) {
+    uint32_t sector_sz;
+    int err;
+
+    if (volume->fat_bits != 16 && volume->fat_bits != 32) {
+        LOG_ERR("Cannot export a FAT%u volume.", volume->fat_bits);
+        return -ENOTSUP;
+    }
+
+    if ((err = disk_access_ioctl(USB_EXPORT_PHYSICAL_DISK_NAME,
+                                 DISK_IOCTL_GET_SECTOR_SIZE,
+                                 &sector_sz)) != 0) {
+        return err;
+    }
+    if (sector_sz != SECTOR_SZ) {
+        LOG_ERR("Cannot export a card with %u byte sectors.", sector_sz);
+        return -ENOTSUP;
+    }
+
+    k_mutex_lock(&export.lock, K_FOREVER);
+
+    if (export.active) {
+        err = -EALREADY;
+    } else {
+        export.volume = *volume;
+        export.preserved_count = 0;
+        export.fat_buf_sector = UINT32_MAX;
+        export.overflowed = false;
+        export.active = true;
+        err = 0;
+    }
+
+    k_mutex_unlock(&export.lock);
+
+    if (err == 0) {
+        // The card may not be the one there was at boot or the last export.
+        msc_cache_refresh();
+        LOG_INF("Exporting a snapshot of the card over USB.");
+    }
+    return err;
+}
+
+void usb_export_end(void) {
+    k_mutex_lock(&export.lock, K_FOREVER);
+    const bool was_active = export.active;
+    export.active = false;
+    export.preserved_count = 0;
+    k_mutex_unlock(&export.lock);
+
+    if (was_active) {
+        msc_cache_invalidate();
+        LOG_INF("Stopped exporting the card over USB.");
+    }
+}
+
+void usb_export_status_get(struct usb_export_status* status) {
+    k_mutex_lock(&export.lock, K_FOREVER);
+    *status = (struct usb_export_status){
+        .active = export.active,
+        .overflowed = export.overflowed,
+        .preserved_sectors = export.preserved_count,
+    };
+    k_mutex_unlock(&export.lock);
+}
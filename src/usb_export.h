@@ -0,0 +1,99 @@
+/**
+ * @brief Exports a frozen, read-only view of the SD card to the USB host while
+ *        the firmware keeps logging to it.
+ *
+ * @details
+ * This module sits between FatFs and the physical card and registers two
+ * disks on top of USB_EXPORT_PHYSICAL_DISK_NAME:
+ *
+ * - USB_EXPORT_FIRMWARE_DISK_NAME is what FatFs mounts. It is the card itself,
+ *   except that writes preserve the snapshot first while exporting.
+ * - USB_EXPORT_HOST_DISK_NAME is what the USB mass storage class exports. It
+ *   reports no medium unless an export is in progress, in which case it is a
+ *   write-protected snapshot of the card as it was when the export began.
+ *
+ * The snapshot is copy-on-write. While exporting, every sector the firmware is
+ * about to overwrite which was in use at the time of the snapshot (the boot
+ * sector, the FATs and directories) is first preserved in RAM and served to
+ * the host from there. Sectors in clusters which were free at the snapshot are
+ * written straight through, as no consistent view of the filesystem refers to
+ * them. The storage module starts a fresh segment of every log when an export
+ * begins, so the live file only ever grows into free clusters and the host
+ * sees every closed segment, untouched. The export is started and stopped
+ * through the storage module, see storage_export_begin.
+ *
+ * Only a handful of metadata sectors change per megabyte logged, but should
+ * more than CONFIG_BIOLOGGER_USB_EXPORT_COW_SECTORS of them change during a
+ * single export, the snapshot can no longer be kept consistent and the medium
+ * is reported as removed.
+ */
+#ifndef USB_EXPORT_H
+#define USB_EXPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define USB_EXPORT_PHYSICAL_DISK_NAME CONFIG_BIOLOGGER_STORAGE_DISK_NAME
+#define USB_EXPORT_FIRMWARE_DISK_NAME "SD"
+#define USB_EXPORT_HOST_DISK_NAME "SDEXPORT"
+
+/**
+ * @brief The layout of the FAT volume, needed to tell which sectors were in
+ *        use at the time of the snapshot. All values are in sectors unless
+ *        stated otherwise.
+ */
+struct usb_export_volume {
+    /*!< 16 or 32. */
+    uint8_t fat_bits;
+    /*!< The first sector of the first FAT. */
+    uint32_t fat_start;
+    /*!< The first sector of cluster 2. */
+    uint32_t data_start;
+    uint32_t sectors_per_cluster;
+    /*!< The number of FAT entries, including the two reserved ones. */
+    uint32_t fat_entries;
+};
+
+/**
+ * @brief The state of the export.
+ */
+struct usb_export_status {
+    bool active;
+    /*!< Whether the export was aborted because it ran out of room. */
+    bool overflowed;
+    /*!< The number of sectors preserved for the snapshot. */
+    uint32_t preserved_sectors;
+};
+
+/**
+ * @brief Register the disks. Must be called before anything accesses
+ *        USB_EXPORT_FIRMWARE_DISK_NAME.
+ *
+ * @return 0 on success or the error returned by disk_access_register.
+ */
+int usb_export_init(void);
+
+/**
+ * @brief Take a snapshot of the card and expose it to the host.
+ *
+ * @param [in] volume The layout of the mounted FAT volume.
+ *
+ * @warning Must be called by the thread which writes to the card, between
+ *          writes, with every file synced.
+ *
+ * @return 0 on success, -EALREADY if an export is in progress or -ENOTSUP if
+ *         the volume type cannot be exported.
+ */
+int usb_export_begin(const struct usb_export_volume* volume);
+
+/**
+ * @brief Stop exposing the snapshot to the host and release it.
+ */
+void usb_export_end(void);
+
+/**
+ * @brief Retrieve the state of the export.
+ */
+void usb_export_status_get(struct usb_export_status* status);
+
+#endif /* USB_EXPORT_H */
@@ -0,0 +1,183 @@
+#include "usb_stream.h"
+#include "experiment.h"
+#include "sample_bus.h"
+#include "thread_specs.h"
+#include <string.h>
+#include <sys/errno.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/ring_buffer.h>
+
+// The ring holds a couple of seconds worth of rows, which is plenty to ride
+// out a host that is briefly busy.
+#define TX_RING_SIZE 4096
+// The largest chunk handed to the CDC-ACM FIFO at once.
+#define TX_CHUNK_SIZE 64
+
+#define FRAME_HEADER_LEN 10
+#define FRAME_CRC_LEN 2
+#define ROW_PAYLOAD_LEN(values) (sizeof(uint64_t) + (values) * sizeof(float))
+#define MAX_FRAME_LEN \
+    (FRAME_HEADER_LEN + ROW_PAYLOAD_LEN(EXPERIMENT_COLUMN_COUNT) \
+     + FRAME_CRC_LEN)
+
+#define DT_CDC_ACM DT_NODELABEL(cdc_acm_uart0)
+
+LOG_MODULE_REGISTER(usb_stream);
+
+static const struct device* const cdc_acm_dev = DEVICE_DT_GET(DT_CDC_ACM);
+
+RING_BUF_DECLARE(tx_ring, TX_RING_SIZE);
+static struct k_spinlock tx_lock;
+
+SAMPLE_BUS_SUBSCRIBER_DEFINE(usb_stream_subscriber,
+                             SAMPLE_BUS_USB_STREAM_DEPTH);
+
+static atomic_t rows_queued = ATOMIC_INIT(0);
+static atomic_t rows_dropped = ATOMIC_INIT(0);
+
+K_THREAD_STACK_DEFINE(usb_stream_thread_stack, THREAD_USB_STREAM_STACK_SIZE);
+static struct k_thread usb_stream_thread_data;
+
+/**
+ * @brief Serialize a row into a frame.
+ *
+ * @return The length of the frame.
+ */
+static size_t frame_row(uint8_t* frame, const struct experiment_row* row,
+                        uint32_t seq) {
+    const uint16_t payload_len = ROW_PAYLOAD_LEN(EXPERIMENT_COLUMN_COUNT);
+
+    sys_put_le16(USB_STREAM_MAGIC, &frame[0]);
+    frame[2] = USB_STREAM_VERSION;
+    frame[3] = USB_STREAM_RECORD_ROW;
+    sys_put_le16(payload_len, &frame[4]);
+    sys_put_le32(seq, &frame[6]);
+
+    uint8_t* payload = &frame[FRAME_HEADER_LEN];
+    sys_put_le64(row->millis_since_start, payload);
+    payload += sizeof(uint64_t);
+
+    for (size_t i = 0; i < EXPERIMENT_COLUMN_COUNT; i++) {
+        const float value = (float)experiment_row_value(row, i);
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        sys_put_le32(bits, payload);
+        payload += sizeof(bits);
+    }
+
+    // The magic is left out of the CRC so that the receiver can resynchronize
+    // on it without having to know anything else.
+    const uint16_t crc = crc16_ccitt(0xffff, &frame[2],
+                                     FRAME_HEADER_LEN - 2 + payload_len);
+    sys_put_le16(crc, payload);
+
+    return FRAME_HEADER_LEN + payload_len + FRAME_CRC_LEN;
+}
+
+static void interrupt_handler(const struct device* dev, void* user_data) {
+    ARG_UNUSED(user_data);
+
+    while (uart_irq_update(dev) && uart_irq_is_pending(dev)) {
+        if (uart_irq_rx_ready(dev)) {
+            // Nothing is expected from the host. Discard whatever it sends so
+            // the interrupt does not stay pending.
+            uint8_t discard[16];
+            while (uart_fifo_read(dev, discard, sizeof(discard)) > 0) {
+            }
+        }
+
+        if (uart_irq_tx_ready(dev)) {
+            k_spinlock_key_t key = k_spin_lock(&tx_lock);
+
+            uint8_t* data;
+            const uint32_t len = ring_buf_get_claim(&tx_ring, &data,
+                                                    TX_CHUNK_SIZE);
+            if (len == 0) {
+                uart_irq_tx_disable(dev);
+                k_spin_unlock(&tx_lock, key);
+                break;
+            }
+
+            const int sent = uart_fifo_fill(dev, data, len);
+            ring_buf_get_finish(&tx_ring, MAX(sent, 0));
+
+            k_spin_unlock(&tx_lock, key);
+        }
+    }
+}
+
+/**
+ * @brief Queue a row for the host.
+ */
+static void queue_row(const struct experiment_row* row) {
+    uint8_t frame[MAX_FRAME_LEN];
+
+    // Rows dropped anywhere before this point, or right here, leave a gap in
+    // the sequence numbers, which is how the host finds out about drops.
+    const size_t len = frame_row(frame, row, row->seq);
+
+    k_spinlock_key_t key = k_spin_lock(&tx_lock);
+    const bool fits = ring_buf_space_get(&tx_ring) >= len;
+    if (fits) {
+        ring_buf_put(&tx_ring, frame, len);
+    }
+    k_spin_unlock(&tx_lock, key);
+
+    if (!fits) {
+        atomic_inc(&rows_dropped);
+        return;
+    }
+
+    atomic_inc(&rows_queued);
+    uart_irq_tx_enable(cdc_acm_dev);
+}
+
+static void usb_stream_thread_runnable(void* p0, void* p1, void* p2) {
+    while (true) {
+        struct experiment_row* row = sample_bus_take(&usb_stream_subscriber,
+                                                     K_FOREVER);
+        if (row == NULL) {
+            continue;
+        }
+
+        queue_row(row);
+        experiment_row_unref(row);
+    }
+}
+
+int usb_stream_init(void) {
+    if (!device_is_ready(cdc_acm_dev)) {
+        LOG_ERR("The CDC-ACM device is not ready.");
+        return -ENODEV;
+    }
+
+    uart_irq_callback_user_data_set(cdc_acm_dev, interrupt_handler, NULL);
+    uart_irq_rx_enable(cdc_acm_dev);
+
+    sample_bus_subscribe(&usb_stream_subscriber);
+
+    k_thread_create(
+        &usb_stream_thread_data,
+        usb_stream_thread_stack,
+        K_THREAD_STACK_SIZEOF(usb_stream_thread_stack),
+        usb_stream_thread_runnable, NULL, NULL, NULL,
+        THREAD_USB_STREAM_PRIORITY, 0, K_NO_WAIT
+    );
+    k_thread_name_set(&usb_stream_thread_data, "usb_stream");
+
+    LOG_INF("Initialized the USB stream.");
+    return 0;
+}
+
+void usb_stream_stats_get(struct usb_stream_stats* stats) {
+    stats->rows_queued = atomic_get(&rows_queued);
+    stats->rows_dropped = atomic_get(&rows_dropped)
+        + atomic_get(&usb_stream_subscriber.rows_dropped);
+}
@@ -0,0 +1,66 @@
+/**
+ * @brief Streams every experiment row to a USB host as compact binary frames
+ *        over CDC-ACM.
+ *
+ * @details
+ * The stream subscribes to the sample bus, see sample_bus.h. Its thread
+ * serializes every row into a frame and queues it into a fixed-size ring
+ * buffer which the CDC-ACM interrupt handler drains as fast as the host reads.
+ * If the host is slow or absent, the ring fills up and new rows are dropped
+ * and counted instead of ever blocking the sampling thread.
+ *
+ * Every frame is laid out as follows. All integers are little-endian.
+ *
+ * | Offset | Size | Field                                            |
+ * |--------|------|--------------------------------------------------|
+ * | 0      | 2    | USB_STREAM_MAGIC                                 |
+ * | 2      | 1    | USB_STREAM_VERSION                               |
+ * | 3      | 1    | enum usb_stream_record                           |
+ * | 4      | 2    | Payload length N                                 |
+ * | 6      | 4    | Sequence number, incremented for every row       |
+ * | 10     | N    | Payload                                          |
+ * | 10 + N | 2    | CRC-16/CCITT (reflected, seed 0xffff) of 2..10+N |
+ *
+ * The payload of a USB_STREAM_RECORD_ROW is the u64 milliseconds since the
+ * experiment start, followed by every value of the row as a float32. Gaps in
+ * the sequence numbers tell the host how many rows were dropped.
+ *
+ * The host-side receiver lives in tools/stream-receiver.
+ */
+#ifndef USB_STREAM_H
+#define USB_STREAM_H
+
+#include "experiment.h"
+#include <stdint.h>
+
+#define USB_STREAM_MAGIC 0x4c42 // "BL"
+#define USB_STREAM_VERSION 1
+
+enum usb_stream_record {
+    USB_STREAM_RECORD_ROW = 1,
+};
+
+/**
+ * @brief Counters describing the stream so far.
+ */
+struct usb_stream_stats {
+    /*!< The number of rows queued for the host. */
+    uint32_t rows_queued;
+    /*!< The number of rows dropped because the queue was full. */
+    uint32_t rows_dropped;
+};
+
+/**
+ * @brief Subscribe the stream to the sample bus. The USB device stack must be
+ *        initialized separately with usb_init.
+ *
+ * @return 0 on success or -ENODEV if the CDC-ACM device is not ready.
+ */
+int usb_stream_init(void);
+
+/**
+ * @brief Retrieve the stream counters.
+ */
+void usb_stream_stats_get(struct usb_stream_stats* stats);
+
+#endif /* USB_STREAM_H */
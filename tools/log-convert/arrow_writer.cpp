@@ -0,0 +1,389 @@
+#include "arrow_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace biologger {
+
+namespace {
+
+// See format/Schema.fbs and format/Message.fbs in the Arrow repository.
+constexpr int16_t METADATA_VERSION_V5 = 4;
+constexpr uint8_t MESSAGE_HEADER_SCHEMA = 1;
+constexpr uint8_t MESSAGE_HEADER_RECORD_BATCH = 3;
+constexpr uint8_t TYPE_INT = 2;
+constexpr uint8_t TYPE_FLOATING_POINT = 3;
+constexpr int16_t PRECISION_DOUBLE = 2;
+constexpr uint32_t CONTINUATION = 0xffffffff;
+
+constexpr char MAGIC[] = "ARROW1";
+constexpr size_t MAGIC_LEN = 6;
+
+constexpr size_t align8(size_t n) { return (n + 7) & ~size_t{7}; }
+
+/**
+ * @brief A minimal flatbuffer builder. Like the real one, it builds the
+ *        buffer back to front, so every object must be created before the
+ *        objects referring to it. Offsets are counted from the end of the
+ *        buffer.
+ */
+class FlatBuilder {
+public:
+    using Offset = uint32_t;
+
+    Offset size() const { return static_cast<Offset>(buf_.size()); }
+
+    /**
+     * @brief Pad so that once `extra` more bytes are written, the size is a
+     *        multiple of `alignment`.
+     */
+    void prep(size_t alignment, size_t extra) {
+        const size_t pad = (alignment - (buf_.size() + extra) % alignment)
+            % alignment;
+        buf_.insert(buf_.begin(), pad, 0);
+    }
+
+    template <typename T>
+    void push(T value) {
+        prep(sizeof(T), sizeof(T));
+        uint8_t bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        buf_.insert(buf_.begin(), bytes, bytes + sizeof(T));
+    }
+
+    void push_offset(Offset target) {
+        prep(sizeof(uint32_t), sizeof(uint32_t));
+        push<uint32_t>(static_cast<uint32_t>(size() + sizeof(uint32_t))
+                       - target);
+    }
+
+    Offset string(std::string_view s) {
+        prep(sizeof(uint32_t), s.size() + 1);
+        buf_.insert(buf_.begin(), 0);
+        buf_.insert(buf_.begin(), s.begin(), s.end());
+        push<uint32_t>(static_cast<uint32_t>(s.size()));
+        return size();
+    }
+
+    Offset offset_vector(const std::vector<Offset>& offsets) {
+        prep(sizeof(uint32_t), offsets.size() * sizeof(uint32_t));
+        for (auto it = offsets.rbegin(); it != offsets.rend(); ++it) {
+            push_offset(*it);
+        }
+        push<uint32_t>(static_cast<uint32_t>(offsets.size()));
+        return size();
+    }
+
+    /**
+     * @brief A vector of structs made of 8-byte fields, given in their final
+     *        little-endian layout.
+     */
+    Offset struct_vector(const std::vector<uint8_t>& bytes, size_t count) {
+        prep(sizeof(uint32_t), bytes.size());
+        prep(sizeof(uint64_t), bytes.size());
+        buf_.insert(buf_.begin(), bytes.begin(), bytes.end());
+        push<uint32_t>(static_cast<uint32_t>(count));
+        return size();
+    }
+
+    void start_table() {
+        table_start_ = size();
+        fields_.clear();
+    }
+
+    template <typename T>
+    void field(uint16_t id, T value) {
+        push(value);
+        fields_.push_back({id, static_cast<Offset>(size())});
+    }
+
+    void field_offset(uint16_t id, Offset target) {
+        push_offset(target);
+        fields_.push_back({id, static_cast<Offset>(size())});
+    }
+
+    Offset end_table() {
+        push<int32_t>(0);
+        const Offset table = size();
+
+        uint16_t field_count = 0;
+        for (const auto& f : fields_) {
+            field_count = std::max<uint16_t>(field_count, f.id + 1);
+        }
+        std::vector<uint16_t> slots(field_count, 0);
+        for (const auto& f : fields_) {
+            slots[f.id] = static_cast<uint16_t>(table - f.at);
+        }
+
+        for (auto it = slots.rbegin(); it != slots.rend(); ++it) {
+            push<uint16_t>(*it);
+        }
+        push<uint16_t>(static_cast<uint16_t>(table - table_start_));
+        push<uint16_t>(static_cast<uint16_t>(4 + 2 * field_count));
+        const Offset vtable = size();
+
+        const int32_t soffset = static_cast<int32_t>(vtable - table);
+        std::memcpy(&buf_[buf_.size() - table], &soffset, sizeof(soffset));
+        return table;
+    }
+
+    /**
+     * @brief Write the root offset and return the finished buffer, padded to
+     *        a multiple of 8 bytes.
+     */
+    std::vector<uint8_t> finish(Offset root) {
+        prep(sizeof(uint64_t), sizeof(uint32_t));
+        push_offset(root);
+        return std::move(buf_);
+    }
+
+private:
+    struct FieldLocation {
+        uint16_t id;
+        Offset at;
+    };
+
+    std::vector<uint8_t> buf_;
+    std::vector<FieldLocation> fields_;
+    size_t table_start_ = 0;
+};
+
+void put_le64(std::vector<uint8_t>& out, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+}
+
+FlatBuilder::Offset field(FlatBuilder& fb, const Column& column,
+                          bool is_timestamp) {
+    std::vector<FlatBuilder::Offset> metadata;
+    if (!column.unit.empty()) {
+        const auto key = fb.string("unit");
+        const auto value = fb.string(column.unit);
+        fb.start_table();
+        fb.field_offset(0, key);
+        fb.field_offset(1, value);
+        metadata.push_back(fb.end_table());
+    }
+    const auto metadata_vector = fb.offset_vector(metadata);
+
+    fb.start_table();
+    if (is_timestamp) {
+        fb.field<int32_t>(0, 64);
+        fb.field<uint8_t>(1, 0);
+    } else {
+        fb.field<int16_t>(0, PRECISION_DOUBLE);
+    }
+    const auto type = fb.end_table();
+
+    const auto name = fb.string(column.name);
+    // Arrow's own reader rejects fields without a children vector, even when
+    // they have no children.
+    const auto children = fb.offset_vector({});
+
+    fb.start_table();
+    fb.field_offset(0, name);
+    fb.field<uint8_t>(1, 0);
+    fb.field<uint8_t>(2, is_timestamp ? TYPE_INT : TYPE_FLOATING_POINT);
+    fb.field_offset(3, type);
+    fb.field_offset(5, children);
+    fb.field_offset(6, metadata_vector);
+    return fb.end_table();
+}
+
+FlatBuilder::Offset schema(FlatBuilder& fb, const Log& log) {
+    std::vector<FlatBuilder::Offset> fields;
+    fields.push_back(field(fb, log.timestamp, true));
+    for (const Column& column : log.columns) {
+        fields.push_back(field(fb, column, false));
+    }
+    const auto fields_vector = fb.offset_vector(fields);
+
+    fb.start_table();
+    fb.field<int16_t>(0, 0); // Little endian.
+    fb.field_offset(1, fields_vector);
+    return fb.end_table();
+}
+
+std::vector<uint8_t> message(FlatBuilder& fb, uint8_t header_type,
+                             FlatBuilder::Offset header, int64_t body_len) {
+    fb.start_table();
+    fb.field<int16_t>(0, METADATA_VERSION_V5);
+    fb.field<uint8_t>(1, header_type);
+    fb.field_offset(2, header);
+    fb.field<int64_t>(3, body_len);
+    return fb.finish(fb.end_table());
+}
+
+/**
+ * @brief Where a message ended up in the file, as recorded in the footer.
+ */
+struct Block {
+    uint64_t offset;
+    uint32_t metadata_len;
+    uint64_t body_len;
+};
+
+class File {
+public:
+    explicit File(const std::string& path)
+        : path_(path), f_(std::fopen(path.c_str(), "wb")) {
+        if (f_ == nullptr) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        std::setvbuf(f_, nullptr, _IOFBF, 1 << 20);
+    }
+
+    ~File() {
+        if (f_ != nullptr) {
+            std::fclose(f_);
+        }
+    }
+
+    void write(const void* data, size_t len) {
+        if (len != 0 && std::fwrite(data, 1, len, f_) != len) {
+            throw std::system_error(errno, std::generic_category(), path_);
+        }
+        written_ += len;
+    }
+
+    void pad_to_8() {
+        static const uint8_t zeros[8] = {};
+        write(zeros, align8(written_) - written_);
+    }
+
+    void close() {
+        const int err = std::fclose(f_);
+        f_ = nullptr;
+        if (err != 0) {
+            throw std::system_error(errno, std::generic_category(), path_);
+        }
+    }
+
+    uint64_t written() const { return written_; }
+
+private:
+    std::string path_;
+    std::FILE* f_;
+    uint64_t written_ = 0;
+};
+
+/**
+ * @brief Write an encapsulated message: the continuation marker, the padded
+ *        metadata length and the metadata. The body is up to the caller.
+ */
+Block write_message(File& file, const std::vector<uint8_t>& metadata,
+                    uint64_t body_len) {
+    const Block block = {
+        file.written(),
+        static_cast<uint32_t>(2 * sizeof(uint32_t) + metadata.size()),
+        body_len,
+    };
+    const uint32_t prefix[2] = {CONTINUATION,
+                                static_cast<uint32_t>(metadata.size())};
+    file.write(prefix, sizeof(prefix));
+    file.write(metadata.data(), metadata.size());
+    return block;
+}
+
+} // namespace
+
+uint64_t write_arrow_file(const Log& log, const std::string& path,
+                          size_t batch_rows) {
+    File file(path);
+    file.write(MAGIC, MAGIC_LEN);
+    file.pad_to_8();
+
+    {
+        FlatBuilder fb;
+        const auto header = schema(fb, log);
+        write_message(file, message(fb, MESSAGE_HEADER_SCHEMA, header, 0), 0);
+    }
+
+    std::vector<Block> batches;
+    const size_t columns = log.columns.size() + 1;
+    batch_rows = std::max<size_t>(batch_rows, 1);
+
+    for (size_t first = 0; first < log.rows() || first == 0;
+         first += batch_rows) {
+        const size_t rows = std::min(batch_rows, log.rows() - first);
+        const uint64_t column_len = align8(rows * sizeof(double));
+
+        // Each column has an empty validity bitmap (nothing is null) and its
+        // values, back to back in the body.
+        std::vector<uint8_t> nodes;
+        std::vector<uint8_t> buffers;
+        for (size_t c = 0; c < columns; c++) {
+            put_le64(nodes, rows);
+            put_le64(nodes, 0);
+            put_le64(buffers, c * column_len);
+            put_le64(buffers, 0);
+            put_le64(buffers, c * column_len);
+            put_le64(buffers, rows * sizeof(double));
+        }
+
+        FlatBuilder fb;
+        const auto buffers_vector = fb.struct_vector(buffers, 2 * columns);
+        const auto nodes_vector = fb.struct_vector(nodes, columns);
+        fb.start_table();
+        fb.field<int64_t>(0, static_cast<int64_t>(rows));
+        fb.field_offset(1, nodes_vector);
+        fb.field_offset(2, buffers_vector);
+        const auto header = fb.end_table();
+
+        const uint64_t body_len = column_len * columns;
+        batches.push_back(write_message(
+            file, message(fb, MESSAGE_HEADER_RECORD_BATCH, header, body_len),
+            body_len));
+
+        static const uint8_t zeros[8] = {};
+        const size_t pad = column_len - rows * sizeof(double);
+        file.write(&log.timestamps_ms[first], rows * sizeof(uint64_t));
+        file.write(zeros, pad);
+        for (const auto& values : log.values) {
+            file.write(&values[first], rows * sizeof(double));
+            file.write(zeros, pad);
+        }
+
+        if (log.rows() == 0) {
+            break;
+        }
+    }
+
+    // End of stream.
+    const uint32_t eos[2] = {CONTINUATION, 0};
+    file.write(eos, sizeof(eos));
+
+    FlatBuilder fb;
+    std::vector<uint8_t> blocks;
+    for (const Block& b : batches) {
+        put_le64(blocks, b.offset);
+        put_le64(blocks, b.metadata_len);
+        put_le64(blocks, b.body_len);
+    }
+    const auto batches_vector = fb.struct_vector(blocks, batches.size());
+    const auto dictionaries_vector = fb.struct_vector({}, 0);
+    const auto footer_schema = schema(fb, log);
+    fb.start_table();
+    fb.field<int16_t>(0, METADATA_VERSION_V5);
+    fb.field_offset(1, footer_schema);
+    fb.field_offset(2, dictionaries_vector);
+    fb.field_offset(3, batches_vector);
+    const std::vector<uint8_t> footer = fb.finish(fb.end_table());
+
+    file.write(footer.data(), footer.size());
+    const uint32_t footer_len = static_cast<uint32_t>(footer.size());
+    file.write(&footer_len, sizeof(footer_len));
+    file.write(MAGIC, MAGIC_LEN);
+
+    const uint64_t written = file.written();
+    file.close();
+    return written;
+}
+
+} // namespace biologger
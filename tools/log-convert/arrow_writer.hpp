@@ -0,0 +1,32 @@
+/**
+ * @brief Writes a biologger::Log as an Apache Arrow IPC file (also known as
+ *        Feather v2), readable by pyarrow, pandas, polars, DuckDB, etc.
+ *
+ * The writer has no dependencies. It emits the little flatbuffer metadata the
+ * format needs by hand: a schema with an unsigned 64-bit timestamp column and
+ * one float64 column per value column, each field carrying its unit as the
+ * "unit" metadata key, followed by record batches of at most batch_rows rows
+ * and the file footer.
+ */
+#ifndef LOG_CONVERT_ARROW_WRITER_HPP
+#define LOG_CONVERT_ARROW_WRITER_HPP
+
+#include "log_reader.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace biologger {
+
+/**
+ * @brief Write the log to path. Throws std::system_error on I/O errors.
+ *
+ * @return The number of bytes written.
+ */
+uint64_t write_arrow_file(const Log& log, const std::string& path,
+                          size_t batch_rows = 1 << 20);
+
+} // namespace biologger
+
+#endif // LOG_CONVERT_ARROW_WRITER_HPP
@@ -0,0 +1,208 @@
+/**
+ * @brief Converts every biologger log found in a directory tree, e.g. a
+ *        mounted card image, into Apache Arrow IPC files, in parallel.
+ *
+ * Usage:
+ *   log-convert <input dir> [--out <dir>] [--jobs <n>] [--batch-rows <n>]
+ *
+ * Every file ending in ".csv" whose header starts with the timestamp column
+ * the firmware writes is converted to a ".arrow" file with the same relative
+ * path under the output directory (the input directory by default). The
+ * schema is taken from the header: a uint64 "Timestamp" column and one
+ * float64 column per value, each carrying its unit as field metadata.
+ *
+ * Largest logs are converted first, on a work-stealing pool with one worker
+ * per core, and every finished log is reported with its throughput.
+ */
+#include "arrow_writer.hpp"
+#include "log_reader.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::string_view TIMESTAMP_HEADER = "Timestamp [ms]";
+
+struct Options {
+    fs::path input;
+    fs::path output;
+    size_t jobs = std::thread::hardware_concurrency();
+    size_t batch_rows = 1 << 20;
+};
+
+struct Job {
+    fs::path input;
+    fs::path output;
+    uintmax_t size;
+};
+
+void usage(const char* argv0) {
+    std::fprintf(stderr,
+                 "usage: %s <input dir> [--out <dir>] [--jobs <n>] "
+                 "[--batch-rows <n>]\n", argv0);
+}
+
+bool parse_args(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--out" && i + 1 < argc) {
+            opts.output = argv[++i];
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            opts.jobs = std::stoul(argv[++i]);
+        } else if (arg == "--batch-rows" && i + 1 < argc) {
+            opts.batch_rows = std::stoul(argv[++i]);
+        } else if (opts.input.empty() && arg[0] != '-') {
+            opts.input = arg;
+        } else {
+            return false;
+        }
+    }
+
+    if (opts.output.empty()) {
+        opts.output = opts.input;
+    }
+    return !opts.input.empty();
+}
+
+bool is_log(const fs::path& path) {
+    if (path.extension() != ".csv") {
+        return false;
+    }
+
+    std::ifstream in(path);
+    std::string first(TIMESTAMP_HEADER.size(), '\0');
+    in.read(first.data(), static_cast<std::streamsize>(first.size()));
+    return in && first == TIMESTAMP_HEADER;
+}
+
+std::vector<Job> discover(const Options& opts) {
+    std::vector<Job> jobs;
+
+    for (const auto& entry : fs::recursive_directory_iterator(
+             opts.input, fs::directory_options::skip_permission_denied)) {
+        if (!entry.is_regular_file() || !is_log(entry.path())) {
+            continue;
+        }
+
+        fs::path output = opts.output
+            / fs::relative(entry.path(), opts.input);
+        output.replace_extension(".arrow");
+        jobs.push_back({entry.path(), output, entry.file_size()});
+    }
+
+    // The largest logs go first so that no core is left converting one huge
+    // log on its own at the end.
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+        return a.size > b.size;
+    });
+    return jobs;
+}
+
+double mb(uintmax_t bytes) {
+    return static_cast<double>(bytes) / (1 << 20);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<Job> jobs;
+    try {
+        jobs = discover(opts);
+    } catch (const fs::filesystem_error& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    if (jobs.empty()) {
+        std::fprintf(stderr, "No logs found in %s.\n", opts.input.c_str());
+        return 1;
+    }
+
+    std::mutex print_lock;
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<uint64_t> total_rows{0};
+    uintmax_t total_bytes = 0;
+    for (const Job& job : jobs) {
+        total_bytes += job.size;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        biologger::ThreadPool pool(opts.jobs);
+        std::fprintf(stderr, "Converting %zu logs (%.1f MB) on %zu workers.\n",
+                     jobs.size(), mb(total_bytes), pool.size());
+
+        for (const Job& job : jobs) {
+            pool.submit([&, job] {
+                const auto job_start = std::chrono::steady_clock::now();
+                std::string error;
+                size_t rows = 0;
+                size_t malformed = 0;
+
+                try {
+                    fs::create_directories(job.output.parent_path());
+                    const biologger::Log log =
+                        biologger::read_log(job.input.string());
+                    biologger::write_arrow_file(log, job.output.string(),
+                                                opts.batch_rows);
+                    rows = log.rows();
+                    malformed = log.malformed_rows;
+                } catch (const std::exception& e) {
+                    error = e.what();
+                }
+
+                const double seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - job_start).count();
+                const size_t n = done.fetch_add(1) + 1;
+                total_rows.fetch_add(rows);
+
+                std::lock_guard<std::mutex> lock(print_lock);
+                if (!error.empty()) {
+                    failed.fetch_add(1);
+                    std::fprintf(stderr, "[%zu/%zu] %s: %s\n", n, jobs.size(),
+                                 job.input.c_str(), error.c_str());
+                    return;
+                }
+                std::printf("[%zu/%zu] %s: %zu rows (%zu malformed), "
+                            "%.1f MB in %.2f s, %.0f rows/s, %.1f MB/s\n",
+                            n, jobs.size(), job.input.c_str(), rows,
+                            malformed, mb(job.size), seconds,
+                            static_cast<double>(rows) / seconds,
+                            mb(job.size) / seconds);
+                std::fflush(stdout);
+            });
+        }
+
+        pool.wait();
+    }
+    const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::printf("Converted %zu of %zu logs: %llu rows, %.1f MB in %.2f s, "
+                "%.0f rows/s, %.1f MB/s\n",
+                jobs.size() - failed.load(), jobs.size(),
+                static_cast<unsigned long long>(total_rows.load()),
+                mb(total_bytes), seconds,
+                static_cast<double>(total_rows.load()) / seconds,
+                mb(total_bytes) / seconds);
+    return failed.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/**
+ * @brief A small work-stealing thread pool.
+ *
+ * Every worker owns a deque of tasks. Workers run tasks from the back of their
+ * own deque and, once out of work, steal from the front of another worker's.
+ * Tasks submitted from outside the pool are dealt round-robin and queued at
+ * the front, so each worker runs them in submission order and thieves take
+ * the ones that would have run last. Converting logs of very different sizes
+ * thus keeps every core busy until the very end, without a single shared
+ * queue all workers contend on.
+ */
+#ifndef LOG_CONVERT_THREAD_POOL_HPP
+#define LOG_CONVERT_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace biologger {
+
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(size_t workers) {
+        workers = workers == 0 ? 1 : workers;
+        for (size_t i = 0; i < workers; i++) {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < workers; i++) {
+            threads_.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(idle_lock_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        for (auto& t : threads_) {
+            t.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return threads_.size(); }
+
+    void submit(Task task) {
+        // A task submitted by a worker is the next one it runs. Anything else
+        // is spread across all deques and, within a deque, run in submission
+        // order.
+        const bool from_worker = current_worker_ != NOT_A_WORKER
+            && current_pool_ == this;
+        const size_t q = from_worker
+            ? current_worker_
+            : next_queue_.fetch_add(1) % queues_.size();
+
+        pending_.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(queues_[q]->lock);
+            if (from_worker) {
+                queues_[q]->tasks.push_back(std::move(task));
+            } else {
+                queues_[q]->tasks.push_front(std::move(task));
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(idle_lock_);
+            queued_++;
+        }
+        work_available_.notify_one();
+    }
+
+    /**
+     * @brief Block until every submitted task has finished.
+     */
+    void wait() {
+        std::unique_lock<std::mutex> lock(idle_lock_);
+        all_done_.wait(lock, [this] { return pending_.load() == 0; });
+    }
+
+private:
+    static constexpr size_t NOT_A_WORKER = static_cast<size_t>(-1);
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    bool pop_own(size_t self, Task& task) {
+        Queue& q = *queues_[self];
+        std::lock_guard<std::mutex> lock(q.lock);
+        if (q.tasks.empty()) {
+            return false;
+        }
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t self, Task& task) {
+        for (size_t i = 1; i < queues_.size(); i++) {
+            Queue& q = *queues_[(self + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.lock);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        current_worker_ = self;
+        current_pool_ = this;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(idle_lock_);
+                work_available_.wait(lock, [this] {
+                    return queued_ > 0 || stopping_;
+                });
+                if (queued_ == 0 && stopping_) {
+                    return;
+                }
+                queued_--;
+            }
+
+            // One task is reserved for this worker, so one of the deques
+            // holds it, unless another worker got to it first and this one
+            // finds a different one instead.
+            Task task;
+            while (!pop_own(self, task) && !steal(self, task)) {
+                std::this_thread::yield();
+            }
+
+            task();
+
+            if (pending_.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(idle_lock_);
+                all_done_.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_queue_{0};
+    std::atomic<size_t> pending_{0};
+
+    std::mutex idle_lock_;
+    std::condition_variable work_available_;
+    std::condition_variable all_done_;
+    /*!< The number of tasks in the deques no worker has reserved yet. */
+    size_t queued_ = 0;
+    bool stopping_ = false;
+
+    static inline thread_local size_t current_worker_ = NOT_A_WORKER;
+    static inline thread_local ThreadPool* current_pool_ = nullptr;
+};
+
+} // namespace biologger
+
+#endif // LOG_CONVERT_THREAD_POOL_HPP
@@ -0,0 +1,237 @@
+/**
+ * @brief Compares the log reader against a straightforward getline/stod
+ *        parser on a synthetic log.
+ *
+ * Usage:
+ *   logreader-bench [--size-mb <n>] [--columns <n>] [--keep] [<path>]
+ *
+ * A log of roughly the requested size is generated at <path> (by default in
+ * /tmp) unless it already exists, read once to warm the page cache, and then
+ * parsed by both readers. Both results are checked to be bit-identical.
+ */
+#include "log_reader.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::string path = "/tmp/biologger-logreader-bench.csv";
+    size_t size_mb = 2048;
+    size_t columns = 5;
+    bool keep = false;
+};
+
+void usage(const char* argv0) {
+    std::fprintf(stderr,
+                 "usage: %s [--size-mb <n>] [--columns <n>] [--keep] "
+                 "[<path>]\n", argv0);
+}
+
+bool parse_args(int argc, char** argv, Options& opts) {
+    bool have_path = false;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--size-mb" && i + 1 < argc) {
+            opts.size_mb = std::stoul(argv[++i]);
+        } else if (arg == "--columns" && i + 1 < argc) {
+            opts.columns = std::stoul(argv[++i]);
+        } else if (arg == "--keep") {
+            opts.keep = true;
+        } else if (!have_path && arg[0] != '-') {
+            opts.path = arg;
+            have_path = true;
+        } else {
+            return false;
+        }
+    }
+    return opts.columns > 0;
+}
+
+bool file_exists(const std::string& path) {
+    struct stat st {};
+    return stat(path.c_str(), &st) == 0;
+}
+
+/**
+ * @brief Write a log laid out exactly like the firmware's, with values
+ *        resembling the transimpedance amplifier currents and temperature.
+ */
+bool generate(const Options& opts) {
+    std::FILE* out = std::fopen(opts.path.c_str(), "w");
+    if (out == nullptr) {
+        std::perror(opts.path.c_str());
+        return false;
+    }
+    std::setvbuf(out, nullptr, _IOFBF, 1 << 20);
+
+    std::fputs("Timestamp [ms]", out);
+    for (size_t c = 0; c < opts.columns; c++) {
+        std::fprintf(out, ",Column %zu [mA]", c);
+    }
+    std::fputc('\n', out);
+
+    std::mt19937_64 rng(42);
+    std::normal_distribution<double> noise(0.0, 0.05);
+
+    const uint64_t target = static_cast<uint64_t>(opts.size_mb) << 20;
+    uint64_t written = 0;
+    char line[4096];
+    for (uint64_t ms = 0; written < target; ms += 100) {
+        int len = std::snprintf(line, sizeof(line), "%" PRIu64, ms);
+        for (size_t c = 0; c < opts.columns; c++) {
+            const double base = c % 2 == 0 ? 0.25 : -1.5;
+            len += std::snprintf(line + len, sizeof(line) - len, ",%10.10f",
+                                 base * static_cast<double>(c + 1)
+                                 + noise(rng));
+        }
+        line[len++] = '\n';
+        std::fwrite(line, 1, len, out);
+        written += len;
+    }
+
+    return std::fclose(out) == 0;
+}
+
+/**
+ * @brief What a generic reader does: one line at a time, split on commas,
+ *        std::stod every cell.
+ */
+biologger::Log parse_naive(const std::string& path) {
+    std::ifstream in(path);
+    biologger::Log log;
+
+    std::string line;
+    std::getline(in, line);
+    const auto header = biologger::parse_header(line);
+    log.timestamp = header.front();
+    log.columns.assign(header.begin() + 1, header.end());
+    log.values.resize(log.columns.size());
+
+    std::vector<std::string> cells;
+    while (std::getline(in, line)) {
+        cells.clear();
+        size_t start = 0;
+        while (true) {
+            const size_t comma = line.find(',', start);
+            cells.push_back(line.substr(start, comma - start));
+            if (comma == std::string::npos) {
+                break;
+            }
+            start = comma + 1;
+        }
+
+        if (cells.size() != log.columns.size() + 1) {
+            log.malformed_rows++;
+            continue;
+        }
+
+        log.timestamps_ms.push_back(std::stoull(cells[0]));
+        for (size_t c = 0; c < log.columns.size(); c++) {
+            log.values[c].push_back(std::stod(cells[c + 1]));
+        }
+    }
+
+    return log;
+}
+
+/**
+ * @brief A hash of every bit of the parsed data, so the two results can be
+ *        compared without keeping both in memory.
+ */
+uint64_t fingerprint(const biologger::Log& log) {
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&h](uint64_t v) { h = (h ^ v) * 1099511628211ull; };
+
+    for (const uint64_t ts : log.timestamps_ms) {
+        mix(ts);
+    }
+    for (const auto& column : log.values) {
+        for (const double v : column) {
+            uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            mix(bits);
+        }
+    }
+    return h;
+}
+
+struct Result {
+    double seconds;
+    size_t rows;
+    uint64_t fingerprint;
+};
+
+template <typename F>
+Result run(const char* name, uint64_t bytes, F parse) {
+    const auto start = std::chrono::steady_clock::now();
+    const biologger::Log log = parse();
+    const auto stop = std::chrono::steady_clock::now();
+
+    const double seconds = std::chrono::duration<double>(stop - start).count();
+    const double mb = static_cast<double>(bytes) / (1 << 20);
+    std::printf("%-8s %8.3f s %10.1f MB/s %12.0f rows/s  (%zu rows, "
+                "%zu malformed)\n",
+                name, seconds, mb / seconds,
+                static_cast<double>(log.rows()) / seconds, log.rows(),
+                log.malformed_rows);
+
+    return {seconds, log.rows(), fingerprint(log)};
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const bool generated = !file_exists(opts.path);
+    if (generated) {
+        std::fprintf(stderr, "Generating %zu MB at %s...\n", opts.size_mb,
+                     opts.path.c_str());
+        if (!generate(opts)) {
+            return 1;
+        }
+    }
+
+    uint64_t bytes;
+    {
+        // Touch every page so that neither reader pays for the disk.
+        const biologger::MappedFile file(opts.path);
+        const std::string_view contents = file.contents();
+        bytes = contents.size();
+        volatile char sink = 0;
+        for (size_t i = 0; i < contents.size(); i += 4096) {
+            sink = sink + contents[i];
+        }
+    }
+
+    const Result naive = run("naive", bytes,
+                             [&] { return parse_naive(opts.path); });
+    const Result fast = run("mmap", bytes,
+                            [&] { return biologger::read_log(opts.path); });
+
+    std::printf("speedup  %8.2fx\n", naive.seconds / fast.seconds);
+
+    if (generated && !opts.keep) {
+        std::remove(opts.path.c_str());
+    }
+
+    if (naive.rows != fast.rows || naive.fingerprint != fast.fingerprint) {
+        std::fprintf(stderr, "The readers disagree!\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include "calibration.hpp"
+#include "log_reader.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+namespace biologger {
+
+namespace {
+
+constexpr std::string_view CODE_UNIT = "code";
+constexpr std::string_view MILLIVOLTS_SUFFIX = "mV";
+constexpr std::string_view TABLE_SUFFIX = ".csv";
+
+template <typename T>
+bool parse_number(std::string_view text, T& out) {
+    const auto result = std::from_chars(text.data(), text.data() + text.size(),
+                                        out);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+bool parse_hash(std::string_view text, uint32_t& out) {
+    const auto result = std::from_chars(text.data(), text.data() + text.size(),
+                                        out, 16);
+    return text.size() == 8 && result.ec == std::errc()
+        && result.ptr == text.data() + text.size();
+}
+
+/**
+ * @brief Split off the text up to the first delimiter, or all of it.
+ */
+std::string_view next_field(std::string_view& text, char delimiter) {
+    const size_t end = text.find(delimiter);
+    const std::string_view field = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    return field;
+}
+
+} // namespace
+
+double CodeUnit::microvolts(double code) const {
+    return code * full_scale_mv * 1000.0 / std::ldexp(1.0, resolution);
+}
+
+std::optional<CodeUnit> parse_code_unit(std::string_view unit) {
+    if (next_field(unit, ';') != CODE_UNIT) {
+        return std::nullopt;
+    }
+
+    CodeUnit out;
+    bool have_res = false, have_fs = false, have_cal = false;
+    while (!unit.empty()) {
+        std::string_view value = next_field(unit, ';');
+        const std::string_view key = next_field(value, '=');
+
+        if (key == "res") {
+            have_res = parse_number(value, out.resolution);
+        } else if (key == "fs") {
+            if (value.size() <= MILLIVOLTS_SUFFIX.size()
+                    || value.substr(value.size() - MILLIVOLTS_SUFFIX.size())
+                        != MILLIVOLTS_SUFFIX) {
+                return std::nullopt;
+            }
+            value.remove_suffix(MILLIVOLTS_SUFFIX.size());
+            have_fs = parse_number(value, out.full_scale_mv);
+        } else if (key == "cal") {
+            const size_t at = value.rfind('@');
+            if (at == std::string_view::npos || at == 0) {
+                return std::nullopt;
+            }
+            out.calibration_id = value.substr(0, at);
+            have_cal = parse_hash(value.substr(at + 1), out.calibration_hash);
+        }
+    }
+
+    if (!have_res || !have_fs || !have_cal || out.resolution > 31) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+uint32_t fnv1a(std::string_view text) {
+    uint32_t hash = 0x811c9dc5u;
+    for (const char c : text) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x01000193u;
+    }
+    return hash;
+}
+
+Calibration::Calibration(std::string id, std::string_view text)
+    : id_(std::move(id)), hash_(fnv1a(text)) {
+    // The first line is the header.
+    next_field(text, '\n');
+
+    while (!text.empty()) {
+        std::string_view line = next_field(text, '\n');
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+
+        const std::string_view voltage = next_field(line, ',');
+        double uv, na;
+        if (parse_number(voltage, uv) && parse_number(line, na)) {
+            points_.emplace_back(uv, na);
+        }
+    }
+
+    if (points_.size() < 2) {
+        throw std::invalid_argument("The calibration " + id_
+                                    + " has less than two points.");
+    }
+    std::sort(points_.begin(), points_.end());
+}
+
+Calibration Calibration::read(const std::string& path) {
+    std::string id = path.substr(path.find_last_of('/') + 1);
+    if (id.size() > TABLE_SUFFIX.size()
+            && id.compare(id.size() - TABLE_SUFFIX.size(), TABLE_SUFFIX.size(),
+                          TABLE_SUFFIX) == 0) {
+        id.resize(id.size() - TABLE_SUFFIX.size());
+    }
+
+    const MappedFile file(path);
+    return Calibration(std::move(id), file.contents());
+}
+
+double Calibration::milliamps(double microvolts) const {
+    if (std::isnan(microvolts)) {
+        return microvolts;
+    }
+
+    if (microvolts <= points_.front().first) {
+        return points_.front().second / 1e6;
+    }
+    if (microvolts >= points_.back().first) {
+        return points_.back().second / 1e6;
+    }
+
+    const auto above = std::upper_bound(
+        points_.begin(), points_.end(), microvolts,
+        [](double uv, const std::pair<double, double>& point) {
+            return uv < point.first;
+        });
+    const auto below = above - 1;
+    const double t = (microvolts - below->first)
+        / (above->first - below->first);
+    return (below->second + t * (above->second - below->second)) / 1e6;
+}
+
+Calibration find_calibration(const std::string& dir, const CodeUnit& unit) {
+    Calibration calibration = Calibration::read(
+        dir + "/" + unit.calibration_id + std::string(TABLE_SUFFIX));
+
+    if (calibration.hash() != unit.calibration_hash) {
+        char message[128];
+        std::snprintf(message, sizeof(message),
+                      "The calibration %s is %08x, the log was written with "
+                      "%08x.", unit.calibration_id.c_str(), calibration.hash(),
+                      unit.calibration_hash);
+        throw std::runtime_error(message);
+    }
+    return calibration;
+}
+
+std::vector<double> CalibratedColumn::to_vector() const {
+    std::vector<double> out(size());
+    for (size_t row = 0; row < out.size(); row++) {
+        out[row] = (*this)[row];
+    }
+    return out;
+}
+
+} // namespace biologger
@@ -0,0 +1,145 @@
+/**
+ * @brief Turns the raw ADC codes of logs written with
+ *        CONFIG_BIOLOGGER_RAW_CURRENTS into currents.
+ *
+ * Such a log has a column of codes per amplifier channel instead of a column
+ * of currents. The unit of the column describes the codes and names the
+ * calibration table the firmware was built with:
+ *
+ *   ADC 22KX 1 [code;res=11;fs=2048mV;cal=22x-1@209cec18]
+ *
+ * A code of 2^res stands for fs at the ADC, exactly as in Zephyr's
+ * adc_raw_to_millivolts. The calibration tables live in
+ * calibration/ximpedance-cal/tables, one "<id>.csv" per table:
+ *
+ *   Voltage [uV],Current [nA]
+ *   <microvolts at the ADC>,<nanoamps into the amplifier>
+ *   ...
+ *
+ * and the hash is the FNV-1a hash of that file. The codes stay as they were
+ * logged, and a CalibratedColumn computes the currents only when they are
+ * read, so any table can be applied to any log, including one made long after
+ * the log was written:
+ *
+ * @code{.cpp}
+ * const biologger::Log log = biologger::read_log("2024-05-01T10.00.00.csv");
+ * const auto unit = biologger::parse_code_unit(log.columns[0].unit);
+ * const biologger::Calibration as_logged = biologger::find_calibration(
+ *     "calibration/ximpedance-cal/tables", *unit);
+ * const biologger::CalibratedColumn current(log.values[0], *unit, as_logged);
+ * // current[r] is the current of row r in milliamps.
+ * @endcode
+ */
+#ifndef LOGREADER_CALIBRATION_HPP
+#define LOGREADER_CALIBRATION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace biologger {
+
+/**
+ * @brief What the unit of a column of codes says about it.
+ */
+struct CodeUnit {
+    /*!< A code of 2^resolution stands for full_scale_mv. */
+    unsigned resolution = 0;
+    double full_scale_mv = 0;
+    /*!< The table the firmware was built with, e.g. "22x-1". */
+    std::string calibration_id;
+    uint32_t calibration_hash = 0;
+
+    /*!< The voltage at the ADC a code stands for, in microvolts. */
+    double microvolts(double code) const;
+};
+
+/**
+ * @brief Parse the unit of a column, e.g. "code;res=11;fs=2048mV;cal=22x-1@
+ *        209cec18".
+ *
+ * @return Nothing if the column does not hold codes, or its unit is malformed.
+ */
+std::optional<CodeUnit> parse_code_unit(std::string_view unit);
+
+/**
+ * @brief The 32-bit FNV-1a hash of text, which names a calibration table.
+ */
+uint32_t fnv1a(std::string_view text);
+
+/**
+ * @brief A calibration table of the amplifier.
+ */
+class Calibration {
+public:
+    /**
+     * @brief Parse a table held in memory. Throws std::invalid_argument if it
+     *        has less than two points.
+     */
+    Calibration(std::string id, std::string_view text);
+
+    /**
+     * @brief Memory-map and parse the table at the given path. Its id is the
+     *        file name without ".csv".
+     */
+    static Calibration read(const std::string& path);
+
+    const std::string& id() const { return id_; }
+    uint32_t hash() const { return hash_; }
+
+    /**
+     * @brief The current at the given voltage, interpolated linearly between
+     *        the two closest points and held at the first and last point
+     *        outside of the table.
+     *
+     * @return The current in milliamps, NaN if the voltage is NaN.
+     */
+    double milliamps(double microvolts) const;
+
+private:
+    std::string id_;
+    uint32_t hash_;
+    /*!< Microvolts and nanoamps, in increasing voltage. */
+    std::vector<std::pair<double, double>> points_;
+};
+
+/**
+ * @brief Load the table a column was logged with from dir. Throws
+ *        std::system_error if there is no such table and std::runtime_error if
+ *        it is not the one the firmware was built with.
+ */
+Calibration find_calibration(const std::string& dir, const CodeUnit& unit);
+
+/**
+ * @brief A column of codes seen as currents. Nothing is computed until a row
+ *        is read. The codes and the calibration must outlive the column.
+ */
+class CalibratedColumn {
+public:
+    CalibratedColumn(const std::vector<double>& codes, const CodeUnit& unit,
+                     const Calibration& calibration)
+        : codes_(&codes), unit_(unit), calibration_(&calibration) {}
+
+    size_t size() const { return codes_->size(); }
+
+    /*!< The current of a row in milliamps, NaN where the code is missing. */
+    double operator[](size_t row) const {
+        return calibration_->milliamps(unit_.microvolts((*codes_)[row]));
+    }
+
+    /*!< Every current at once, e.g. to replace the column of codes. */
+    std::vector<double> to_vector() const;
+
+private:
+    const std::vector<double>* codes_;
+    CodeUnit unit_;
+    const Calibration* calibration_;
+};
+
+} // namespace biologger
+
+#endif // LOGREADER_CALIBRATION_HPP
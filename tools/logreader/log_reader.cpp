@@ -0,0 +1,514 @@
+#include "log_reader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace biologger {
+
+namespace {
+
+// The fast path multiplies the integer part by 10^10, which must stay below
+// 2^53 for the integer to be exact in a double.
+constexpr size_t FIXED10_DECIMALS = 10;
+constexpr size_t FIXED10_MAX_INTEGER_DIGITS = 5;
+constexpr uint64_t FIXED10_SCALE = 10000000000ull;
+
+// The delimiters are found 64 bytes at a time, one bit per byte.
+constexpr size_t BLOCK_SIZE = 64;
+
+constexpr std::string_view LOG_SUFFIX = ".csv";
+constexpr std::string_view INDEX_SUFFIX = ".idx";
+constexpr std::string_view INDEX_FOOTER = "#end,";
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "parse_eight_digits assumes a little-endian host");
+
+/**
+ * @brief Whether the 8 bytes are all ASCII digits.
+ */
+inline bool is_eight_digits(uint64_t v) {
+    return ((v & 0xf0f0f0f0f0f0f0f0ull)
+            | (((v + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4))
+        == 0x3333333333333333ull;
+}
+
+/**
+ * @brief Convert 8 ASCII digits to their value with a handful of multiplies
+ *        instead of eight dependent ones.
+ */
+inline uint32_t parse_eight_digits(uint64_t v) {
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000ff000000ffull) * (100 + (1000000ull << 32)))
+         + (((v >> 16) & 0x000000ff000000ffull) * (1 + (10000ull << 32))))
+        >> 32;
+    return static_cast<uint32_t>(v);
+}
+
+/**
+ * @brief A bitmask of the ',' and '\n' among the 64 bytes at p.
+ */
+inline uint64_t delimiter_mask(const char* p) {
+#if defined(__AVX2__)
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    uint64_t mask = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; i += 32) {
+        const __m256i chunk = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(p + i));
+        const __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, comma),
+                                             _mm256_cmpeq_epi8(chunk, newline));
+        mask |= static_cast<uint64_t>(
+            static_cast<uint32_t>(_mm256_movemask_epi8(hits))) << i;
+    }
+    return mask;
+#elif defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p + i));
+        const __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, comma),
+                                          _mm_cmpeq_epi8(chunk, newline));
+        mask |= static_cast<uint64_t>(_mm_movemask_epi8(hits)) << i;
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        if (p[i] == ',' || p[i] == '\n') {
+            mask |= 1ull << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+bool parse_u64(const char* begin, const char* end, uint64_t& out) {
+    const auto result = std::from_chars(begin, end, out);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parse_double(const char* begin, const char* end, double& out) {
+    if (parse_fixed10(begin, end, out)) {
+        return true;
+    }
+
+    const auto result = std::from_chars(begin, end, out);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'
+                          || s.back() == '\r')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+/**
+ * @brief Assembles rows field by field as the delimiters are found.
+ */
+class RowBuilder {
+public:
+    explicit RowBuilder(Log& log)
+        : log_(log), row_(log.columns.size()) {}
+
+    void field(const char* begin, const char* end, bool end_of_row) {
+        if (end_of_row && end != begin && end[-1] == '\r') {
+            end--;
+        }
+
+        if (ok_) {
+            if (column_ == 0) {
+                ok_ = parse_u64(begin, end, timestamp_);
+            } else if (column_ <= row_.size()) {
+                ok_ = parse_double(begin, end, row_[column_ - 1]);
+            } else {
+                ok_ = false;
+            }
+        }
+        column_++;
+
+        if (end_of_row) {
+            finish_row(begin == end);
+        }
+    }
+
+private:
+    void finish_row(bool last_field_empty) {
+        if (ok_ && column_ == row_.size() + 1) {
+            log_.timestamps_ms.push_back(timestamp_);
+            for (size_t c = 0; c < row_.size(); c++) {
+                log_.values[c].push_back(row_[c]);
+            }
+        } else if (!(column_ == 1 && last_field_empty)) {
+            // Blank lines are not worth reporting.
+            log_.malformed_rows++;
+        }
+
+        column_ = 0;
+        ok_ = true;
+    }
+
+    Log& log_;
+    std::vector<double> row_;
+    uint64_t timestamp_ = 0;
+    size_t column_ = 0;
+    bool ok_ = true;
+};
+
+/**
+ * @brief Parse the rows of a log, i.e. everything after its header, into a
+ *        log whose columns are already known.
+ */
+void parse_rows(Log& log, std::string_view body) {
+    // Guess the number of rows from the first one so that the columns are
+    // not reallocated over and over.
+    const size_t first_row_len = body.find('\n');
+    if (first_row_len != std::string_view::npos && first_row_len > 0) {
+        const size_t estimate = body.size() / (first_row_len + 1) + 1;
+        log.timestamps_ms.reserve(estimate);
+        for (auto& column : log.values) {
+            column.reserve(estimate);
+        }
+    }
+
+    RowBuilder rows(log);
+    const char* base = body.data();
+    const char* field = base;
+
+    auto scan = [&](const char* origin, uint64_t mask) {
+        while (mask != 0) {
+            const char* delimiter = origin
+                + static_cast<size_t>(__builtin_ctzll(mask));
+            mask &= mask - 1;
+            rows.field(field, delimiter, *delimiter == '\n');
+            field = delimiter + 1;
+        }
+    };
+
+    size_t offset = 0;
+    for (; offset + BLOCK_SIZE <= body.size(); offset += BLOCK_SIZE) {
+        scan(base + offset, delimiter_mask(base + offset));
+    }
+
+    // The last partial block is padded with bytes that are not delimiters.
+    if (offset < body.size()) {
+        char tail[BLOCK_SIZE];
+        std::memset(tail, ' ', sizeof(tail));
+        std::memcpy(tail, base + offset, body.size() - offset);
+        scan(base + offset, delimiter_mask(tail));
+    }
+
+    // A last row without its newline was most likely cut off mid-write, but
+    // it may just as well be complete.
+    if (field < base + body.size()) {
+        rows.field(field, base + body.size(), true);
+    }
+}
+
+/**
+ * @brief Set up the columns of a log from the header at the start of text.
+ *
+ * @return The offset of the first row, or text.size() if there is none.
+ */
+size_t parse_log_header(Log& log, std::string_view text) {
+    const size_t header_end = text.find('\n');
+    std::vector<Column> header = parse_header(text.substr(0, header_end));
+    log.timestamp = std::move(header.front());
+    log.columns.assign(std::make_move_iterator(header.begin() + 1),
+                       std::make_move_iterator(header.end()));
+    log.values.resize(log.columns.size());
+
+    return header_end == std::string_view::npos ? text.size()
+                                                : header_end + 1;
+}
+
+/**
+ * @brief Split a line of the index into its comma separated numbers.
+ */
+template <size_t N>
+bool parse_index_fields(std::string_view line, uint64_t (&out)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        const size_t comma = i + 1 < N ? line.find(',')
+                                       : std::string_view::npos;
+        if (i + 1 < N && comma == std::string_view::npos) {
+            return false;
+        }
+
+        const std::string_view field = trim(line.substr(0, comma));
+        if (!parse_u64(field.data(), field.data() + field.size(), out[i])) {
+            return false;
+        }
+        line.remove_prefix(comma == std::string_view::npos ? line.size()
+                                                           : comma + 1);
+    }
+    return true;
+}
+
+} // namespace
+
+MappedFile::MappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0) {
+        const int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+
+    // mmap refuses empty mappings, an empty file is simply empty.
+    if (size_ != 0) {
+        data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data_ == MAP_FAILED) {
+            const int err = errno;
+            data_ = nullptr;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+}
+
+std::vector<Column> parse_header(std::string_view line) {
+    std::vector<Column> columns;
+
+    while (true) {
+        const size_t comma = line.find(',');
+        const std::string_view cell = trim(line.substr(0, comma));
+
+        Column column;
+        const size_t open = cell.empty() ? std::string_view::npos
+                                         : cell.rfind(" [");
+        if (open != std::string_view::npos && cell.back() == ']') {
+            column.name = cell.substr(0, open);
+            column.unit = cell.substr(open + 2, cell.size() - open - 3);
+        } else {
+            column.name = cell;
+        }
+        columns.push_back(std::move(column));
+
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        line.remove_prefix(comma + 1);
+    }
+
+    if (columns.empty() || columns.front().name.empty()) {
+        throw std::invalid_argument("The log has no header.");
+    }
+    return columns;
+}
+
+bool parse_fixed10(const char* begin, const char* end, double& out) {
+    const char* p = begin;
+    const bool negative = p != end && *p == '-';
+    if (negative) {
+        p++;
+    }
+
+    const size_t len = static_cast<size_t>(end - p);
+    if (len < FIXED10_DECIMALS + 2
+            || len > FIXED10_DECIMALS + 1 + FIXED10_MAX_INTEGER_DIGITS) {
+        return false;
+    }
+
+    const char* dot = end - FIXED10_DECIMALS - 1;
+    if (*dot != '.') {
+        return false;
+    }
+
+    uint64_t integer = 0;
+    for (; p < dot; p++) {
+        const unsigned digit = static_cast<unsigned char>(*p) - '0';
+        if (digit > 9) {
+            return false;
+        }
+        integer = integer * 10 + digit;
+    }
+
+    uint64_t eight;
+    std::memcpy(&eight, dot + 1, sizeof(eight));
+    const unsigned d9 = static_cast<unsigned char>(dot[9]) - '0';
+    const unsigned d10 = static_cast<unsigned char>(dot[10]) - '0';
+    if (!is_eight_digits(eight) || d9 > 9 || d10 > 9) {
+        return false;
+    }
+    const uint64_t decimals = uint64_t{parse_eight_digits(eight)} * 100
+        + d9 * 10 + d10;
+
+    // Both operands are exact, so the division rounds exactly once, like
+    // strtod does.
+    const double value = static_cast<double>(integer * FIXED10_SCALE + decimals)
+        / static_cast<double>(FIXED10_SCALE);
+    out = negative ? -value : value;
+    return true;
+}
+
+Log parse_log(std::string_view text) {
+    Log log;
+
+    const size_t body_start = parse_log_header(log, text);
+    parse_rows(log, text.substr(body_start));
+
+    return log;
+}
+
+Log read_log(const std::string& path) {
+    const MappedFile file(path);
+    return parse_log(file.contents());
+}
+
+std::string index_path(const std::string& log_path) {
+    const std::string_view path = log_path;
+    const bool is_csv = path.size() >= LOG_SUFFIX.size()
+        && path.substr(path.size() - LOG_SUFFIX.size()) == LOG_SUFFIX;
+
+    std::string out(is_csv ? path.substr(0, path.size() - LOG_SUFFIX.size())
+                           : path);
+    out += INDEX_SUFFIX;
+    return out;
+}
+
+LogIndex parse_index(std::string_view text) {
+    LogIndex index;
+
+    while (!text.empty()) {
+        const size_t eol = text.find('\n');
+        const std::string_view line = trim(text.substr(0, eol));
+        text.remove_prefix(eol == std::string_view::npos ? text.size()
+                                                         : eol + 1);
+
+        if (line.substr(0, INDEX_FOOTER.size()) == INDEX_FOOTER) {
+            uint64_t fields[4];
+            if (parse_index_fields(line.substr(INDEX_FOOTER.size()), fields)) {
+                index.footer = IndexFooter{static_cast<size_t>(fields[0]),
+                                           fields[1], fields[2], fields[3]};
+            }
+            continue;
+        }
+
+        // The header, and anything cut off, does not parse.
+        uint64_t fields[2];
+        if (!parse_index_fields(line, fields)) {
+            continue;
+        }
+
+        // Entries only ever move forward, anything else cannot be searched.
+        const IndexEntry entry{fields[0], fields[1]};
+        if (!index.entries.empty()
+                && (entry.timestamp_ms < index.entries.back().timestamp_ms
+                    || entry.offset < index.entries.back().offset)) {
+            continue;
+        }
+        index.entries.push_back(entry);
+    }
+
+    return index;
+}
+
+LogIndex read_index(const std::string& path) {
+    const MappedFile file(path);
+    return parse_index(file.contents());
+}
+
+std::pair<size_t, size_t> index_range(const LogIndex& index, uint64_t from_ms,
+                                      uint64_t to_ms, size_t log_size) {
+    const auto& entries = index.entries;
+
+    // Every row before an entry is older than it, so the range starts at the
+    // last entry at or before from_ms...
+    auto first = std::upper_bound(
+        entries.begin(), entries.end(), from_ms,
+        [](uint64_t ms, const IndexEntry& e) { return ms < e.timestamp_ms; });
+    const size_t begin = first == entries.begin()
+        ? 0 : static_cast<size_t>(std::prev(first)->offset);
+
+    // ...and every row from an entry on is at least as new, so it ends at the
+    // first entry after to_ms.
+    auto last = std::upper_bound(
+        entries.begin(), entries.end(), to_ms,
+        [](uint64_t ms, const IndexEntry& e) { return ms < e.timestamp_ms; });
+    const size_t end = last == entries.end()
+        ? log_size : static_cast<size_t>(last->offset);
+
+    return {std::min(begin, log_size), std::min(std::max(begin, end),
+                                                log_size)};
+}
+
+Log read_log_range(const std::string& path, uint64_t from_ms, uint64_t to_ms) {
+    const MappedFile file(path);
+    const std::string_view text = file.contents();
+
+    Log log;
+    const size_t body_start = parse_log_header(log, text);
+
+    size_t begin = body_start;
+    size_t end = text.size();
+    try {
+        const auto range = index_range(read_index(index_path(path)), from_ms,
+                                       to_ms, text.size());
+        begin = std::max(range.first, body_start);
+        end = std::max(range.second, begin);
+    } catch (const std::system_error&) {
+        // Without an index, the whole log is read.
+    }
+    parse_rows(log, text.substr(begin, end - begin));
+
+    // Only the rows at both ends of the range may be outside of it.
+    const auto& ts = log.timestamps_ms;
+    const size_t keep_begin = static_cast<size_t>(
+        std::lower_bound(ts.begin(), ts.end(), from_ms) - ts.begin());
+    const size_t keep_end = static_cast<size_t>(
+        std::upper_bound(ts.begin(), ts.end(), to_ms) - ts.begin());
+    if (keep_begin >= keep_end) {
+        log.timestamps_ms.clear();
+        for (auto& column : log.values) {
+            column.clear();
+        }
+        return log;
+    }
+
+    log.timestamps_ms.erase(log.timestamps_ms.begin() + keep_end,
+                            log.timestamps_ms.end());
+    log.timestamps_ms.erase(log.timestamps_ms.begin(),
+                            log.timestamps_ms.begin() + keep_begin);
+    for (auto& column : log.values) {
+        column.erase(column.begin() + keep_end, column.end());
+        column.erase(column.begin(), column.begin() + keep_begin);
+    }
+
+    return log;
+}
+
+} // namespace biologger
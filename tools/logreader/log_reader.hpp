@@ -0,0 +1,185 @@
+/**
+ * @brief Fast reader for the CSV logs the firmware writes to the SD card.
+ *
+ * The logs have a fixed layout, written by src/experiment.c:
+ *
+ *   Timestamp [ms],<name> [<unit>],<name> [<unit>],...
+ *   <u64 ms>,<value>,<value>,...
+ *
+ * where every value is printed with "%10.10f". The reader memory-maps the
+ * file, finds the delimiters with SIMD and parses the values with a fast path
+ * specialized for exactly ten decimals, falling back to std::from_chars for
+ * anything else (NaN, huge values). The result is one contiguous array per
+ * column.
+ *
+ * Rows which do not have as many fields as the header, such as a row cut off
+ * by a power loss, are skipped and counted.
+ *
+ * Next to every log the firmware writes a sparse time index, "<log>.idx":
+ *
+ *   Timestamp [ms],Offset [B]
+ *   <u64 ms>,<u64 offset of the row in the log>
+ *   ...
+ *   #end,<rows>,<first ms>,<last ms>,<log size>
+ *
+ * with an entry for the first row of every interval of
+ * CONFIG_BIOLOGGER_STORAGE_INDEX_INTERVAL_S, and a footer once the log is
+ * closed. read_log_range uses it to only parse the part of the log that
+ * covers a time range.
+ *
+ * Logs written with CONFIG_BIOLOGGER_RAW_CURRENTS hold ADC codes instead of
+ * currents, see calibration.hpp.
+ */
+#ifndef LOGREADER_LOG_READER_HPP
+#define LOGREADER_LOG_READER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace biologger {
+
+/**
+ * @brief A column as declared in the header, e.g. "Temperature [C]".
+ */
+struct Column {
+    std::string name;
+    std::string unit;
+};
+
+/**
+ * @brief A whole log, stored column by column.
+ */
+struct Log {
+    /*!< The timestamp column. */
+    Column timestamp;
+    /*!< The value columns, in file order. */
+    std::vector<Column> columns;
+
+    /*!< Milliseconds since the start of the experiment, one per row. */
+    std::vector<uint64_t> timestamps_ms;
+    /*!< values[c][r] is the value of column c in row r. */
+    std::vector<std::vector<double>> values;
+
+    /*!< The number of rows that were skipped because they were malformed. */
+    size_t malformed_rows = 0;
+
+    size_t rows() const { return timestamps_ms.size(); }
+};
+
+/**
+ * @brief An index entry: the first row at or after timestamp_ms starts at
+ *        offset in the log.
+ */
+struct IndexEntry {
+    uint64_t timestamp_ms;
+    uint64_t offset;
+};
+
+/**
+ * @brief What the firmware knew about the log when it closed it.
+ */
+struct IndexFooter {
+    size_t rows;
+    uint64_t first_ms;
+    uint64_t last_ms;
+    uint64_t log_size;
+};
+
+/**
+ * @brief The time index of a log.
+ */
+struct LogIndex {
+    /*!< In increasing timestamp and offset order. */
+    std::vector<IndexEntry> entries;
+    /*!< The last footer, missing if the log was never closed cleanly. */
+    std::optional<IndexFooter> footer;
+};
+
+/**
+ * @brief A read-only memory mapping of a whole file. Throws std::system_error
+ *        if the file cannot be opened or mapped.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view contents() const {
+        return {static_cast<const char*>(data_), size_};
+    }
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/**
+ * @brief Split a header line into its columns. The first one is the
+ *        timestamp. Throws std::invalid_argument if there is no column at all.
+ */
+std::vector<Column> parse_header(std::string_view line);
+
+/**
+ * @brief Parse a value printed with "%10.10f", i.e. an optional minus sign, up
+ *        to five integer digits, a dot and exactly ten decimals.
+ *
+ * @return false if the text does not have that exact layout, in which case
+ *         out is left untouched. Otherwise the result is the same as the one
+ *         of strtod.
+ */
+bool parse_fixed10(const char* begin, const char* end, double& out);
+
+/**
+ * @brief Parse a whole log held in memory.
+ */
+Log parse_log(std::string_view text);
+
+/**
+ * @brief Memory-map and parse the log at the given path.
+ */
+Log read_log(const std::string& path);
+
+/**
+ * @brief The path of the index of the log at the given path, i.e. the log
+ *        path with ".csv" replaced by ".idx".
+ */
+std::string index_path(const std::string& log_path);
+
+/**
+ * @brief Parse an index held in memory. Malformed lines, such as one cut off
+ *        by a power loss, are skipped.
+ */
+LogIndex parse_index(std::string_view text);
+
+/**
+ * @brief Memory-map and parse the index at the given path.
+ */
+LogIndex read_index(const std::string& path);
+
+/**
+ * @brief The byte range [first, second) of a log of log_size bytes that holds
+ *        every row with a timestamp in [from_ms, to_ms], found with two
+ *        binary searches over the index. It may hold other rows as well, and
+ *        starts at 0 if the index does not bound it from below.
+ */
+std::pair<size_t, size_t> index_range(const LogIndex& index, uint64_t from_ms,
+                                      uint64_t to_ms, size_t log_size);
+
+/**
+ * @brief Read only the rows with a timestamp in [from_ms, to_ms] of the log at
+ *        the given path. If the log has an index, only the part of it the
+ *        index points at is parsed. Otherwise the whole log is.
+ */
+Log read_log_range(const std::string& path, uint64_t from_ms, uint64_t to_ms);
+
+} // namespace biologger
+
+#endif // LOGREADER_LOG_READER_HPP
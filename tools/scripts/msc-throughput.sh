@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+# Measure how fast a file can be copied off the biologger over USB mass
+# storage.
+#
+# Usage: msc-throughput.sh <file on the mounted card> [runs]
+#
+# The host page cache is dropped before every run (which needs root) so that
+# each run actually goes over USB. Run it once on a build with the default
+# CONFIG_BIOLOGGER_MSC_READ_AHEAD_SIZE and once on a build with it set to 0,
+# which reads every sector straight from the card, to compare.
+set -euo pipefail
+
+if [[ $# -lt 1 ]]; then
+    echo "usage: $0 <file on the mounted card> [runs]" >&2
+    exit 2
+fi
+
+file="$1"
+runs="${2:-3}"
+size=$(stat -c %s "$file")
+
+for run in $(seq 1 "$runs"); do
+    sync
+    echo 3 | sudo tee /proc/sys/vm/drop_caches > /dev/null
+
+    start=$(date +%s.%N)
+    dd if="$file" of=/dev/null bs=1M iflag=direct status=none
+    stop=$(date +%s.%N)
+
+    awk -v size="$size" -v start="$start" -v stop="$stop" -v run="$run" \
+        'BEGIN { printf "run %d: %.2f MB/s\n", run,
+                 size / (stop - start) / 1024 / 1024 }'
+done
@@ -0,0 +1,177 @@
+/**
+ * @brief Decoder for the binary row stream the firmware sends over USB
+ *        CDC-ACM. The frame layout is documented in src/usb_stream.h.
+ */
+#ifndef STREAM_RECEIVER_FRAME_HPP
+#define STREAM_RECEIVER_FRAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+namespace biologger {
+
+constexpr uint16_t STREAM_MAGIC = 0x4c42;
+constexpr uint8_t STREAM_VERSION = 1;
+constexpr uint8_t STREAM_RECORD_ROW = 1;
+
+constexpr size_t FRAME_HEADER_LEN = 10;
+constexpr size_t FRAME_CRC_LEN = 2;
+// An upper bound on the number of columns in src/columns.h.
+constexpr size_t MAX_COLUMNS = 128;
+constexpr size_t MAX_PAYLOAD_LEN =
+    sizeof(uint64_t) + MAX_COLUMNS * sizeof(float);
+
+/**
+ * @brief A decoded row.
+ */
+struct Row {
+    uint32_t sequence;
+    uint64_t millis_since_start;
+    std::vector<float> values;
+};
+
+/**
+ * @brief The same CRC-16/CCITT the firmware computes with Zephyr's
+ *        crc16_ccitt().
+ */
+inline uint16_t crc16_ccitt(uint16_t seed, const uint8_t* src, size_t len) {
+    for (; len > 0; len--) {
+        const uint8_t e = static_cast<uint8_t>(seed ^ *src++);
+        const uint8_t f = static_cast<uint8_t>(e ^ (e << 4));
+        seed = static_cast<uint16_t>((seed >> 8) ^ (f << 8) ^ (f << 3)
+                                     ^ (f >> 4));
+    }
+    return seed;
+}
+
+inline uint16_t get_le16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t get_le32(const uint8_t* p) {
+    return static_cast<uint32_t>(get_le16(p))
+        | (static_cast<uint32_t>(get_le16(p + 2)) << 16);
+}
+
+inline uint64_t get_le64(const uint8_t* p) {
+    return static_cast<uint64_t>(get_le32(p))
+        | (static_cast<uint64_t>(get_le32(p + 4)) << 32);
+}
+
+/**
+ * @brief Incrementally decodes frames from an unreliable byte stream.
+ *
+ * Bytes are fed in as they arrive. Corrupt or truncated frames are skipped by
+ * resynchronizing on the next magic number.
+ */
+class FrameDecoder {
+public:
+    void feed(const uint8_t* data, size_t len) {
+        buf_.insert(buf_.end(), data, data + len);
+    }
+
+    /**
+     * @brief Decode the next complete row, if there is one.
+     */
+    std::optional<Row> next() {
+        while (true) {
+            const size_t start = find_magic();
+            if (start == NPOS) {
+                // Keep a possible first magic byte around for the next feed.
+                discard(buf_.empty() ? 0 : buf_.size() - 1);
+                return std::nullopt;
+            }
+            discard(start);
+
+            if (buf_.size() < FRAME_HEADER_LEN) {
+                return std::nullopt;
+            }
+
+            const uint16_t payload_len = get_le16(&buf_[4]);
+            if (buf_[2] != STREAM_VERSION || payload_len > MAX_PAYLOAD_LEN) {
+                resync();
+                continue;
+            }
+
+            const size_t frame_len = FRAME_HEADER_LEN + payload_len
+                + FRAME_CRC_LEN;
+            if (buf_.size() < frame_len) {
+                return std::nullopt;
+            }
+
+            const uint16_t crc = crc16_ccitt(
+                0xffff, &buf_[2], FRAME_HEADER_LEN - 2 + payload_len);
+            if (crc != get_le16(&buf_[FRAME_HEADER_LEN + payload_len])) {
+                resync();
+                continue;
+            }
+
+            std::optional<Row> row;
+            if (buf_[3] == STREAM_RECORD_ROW
+                    && payload_len >= sizeof(uint64_t)
+                    && (payload_len - sizeof(uint64_t)) % sizeof(float) == 0) {
+                row = decode_row(&buf_[FRAME_HEADER_LEN], payload_len);
+                row->sequence = get_le32(&buf_[6]);
+            } else {
+                corrupt_frames_++;
+            }
+
+            discard(frame_len);
+            if (row) {
+                return row;
+            }
+        }
+    }
+
+    /**
+     * @brief The number of frames that were skipped because they were
+     *        corrupt.
+     */
+    size_t corrupt_frames() const { return corrupt_frames_; }
+
+private:
+    static constexpr size_t NPOS = static_cast<size_t>(-1);
+
+    size_t find_magic() const {
+        for (size_t i = 0; i + 1 < buf_.size(); i++) {
+            if (get_le16(&buf_[i]) == STREAM_MAGIC) {
+                return i;
+            }
+        }
+        return NPOS;
+    }
+
+    void discard(size_t n) {
+        buf_.erase(buf_.begin(), buf_.begin() + static_cast<ptrdiff_t>(n));
+    }
+
+    void resync() {
+        corrupt_frames_++;
+        discard(1);
+    }
+
+    static Row decode_row(const uint8_t* payload, size_t len) {
+        Row row;
+        row.millis_since_start = get_le64(payload);
+
+        const size_t count = (len - sizeof(uint64_t)) / sizeof(float);
+        row.values.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t bits = get_le32(payload + sizeof(uint64_t)
+                                           + i * sizeof(float));
+            std::memcpy(&row.values[i], &bits, sizeof(float));
+        }
+
+        return row;
+    }
+
+    std::vector<uint8_t> buf_;
+    size_t corrupt_frames_ = 0;
+};
+
+} // namespace biologger
+
+#endif // STREAM_RECEIVER_FRAME_HPP
@@ -0,0 +1,180 @@
+/**
+ * @brief Receives the live binary row stream from the biologger's CDC-ACM
+ *        port and either prints it or writes it to a CSV file.
+ *
+ * Usage:
+ *   stream-receiver <device> [--csv <out.csv>] [--columns <a,b,...>]
+ *
+ * <device> is usually /dev/ttyACM0 but may be any file holding a captured
+ * stream, or "-" for stdin.
+ */
+#include "frame.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void on_signal(int) { stop_requested = 1; }
+
+struct Options {
+    std::string device;
+    std::string csv_path;
+    std::string columns;
+};
+
+void usage(const char* argv0) {
+    std::fprintf(stderr,
+                 "usage: %s <device> [--csv <out.csv>] [--columns <a,b,...>]\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--csv" && i + 1 < argc) {
+            opts.csv_path = argv[++i];
+        } else if (arg == "--columns" && i + 1 < argc) {
+            opts.columns = argv[++i];
+        } else if (opts.device.empty() && (arg == "-" || arg[0] != '-')) {
+            opts.device = arg;
+        } else {
+            return false;
+        }
+    }
+    return !opts.device.empty();
+}
+
+/**
+ * @brief Put a serial port into raw mode. Files and pipes are left alone.
+ */
+void make_raw(int fd) {
+    if (!isatty(fd)) {
+        return;
+    }
+
+    termios tio{};
+    if (tcgetattr(fd, &tio) != 0) {
+        return;
+    }
+    cfmakeraw(&tio);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+}
+
+void write_header(std::FILE* out, const std::string& columns,
+                  size_t value_count) {
+    std::fputs("Timestamp [ms]", out);
+    if (!columns.empty()) {
+        std::fprintf(out, ",%s\n", columns.c_str());
+        return;
+    }
+    for (size_t i = 0; i < value_count; i++) {
+        std::fprintf(out, ",Column %zu", i);
+    }
+    std::fputc('\n', out);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const int fd = opts.device == "-"
+        ? STDIN_FILENO
+        : open(opts.device.c_str(), O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+        std::fprintf(stderr, "Could not open %s: %s\n", opts.device.c_str(),
+                     std::strerror(errno));
+        return 1;
+    }
+    make_raw(fd);
+
+    std::FILE* out = stdout;
+    if (!opts.csv_path.empty()) {
+        out = std::fopen(opts.csv_path.c_str(), "w");
+        if (out == nullptr) {
+            std::fprintf(stderr, "Could not open %s: %s\n",
+                         opts.csv_path.c_str(), std::strerror(errno));
+            return 1;
+        }
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    biologger::FrameDecoder decoder;
+    bool header_written = false;
+    bool have_sequence = false;
+    uint32_t next_sequence = 0;
+    uint64_t rows = 0;
+    uint64_t dropped = 0;
+
+    uint8_t buf[4096];
+    while (!stop_requested) {
+        const ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::fprintf(stderr, "Read failed: %s\n", std::strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        decoder.feed(buf, static_cast<size_t>(n));
+
+        while (auto row = decoder.next()) {
+            if (have_sequence && row->sequence != next_sequence) {
+                // Unsigned arithmetic handles the sequence wrapping around.
+                dropped += row->sequence - next_sequence;
+            }
+            have_sequence = true;
+            next_sequence = row->sequence + 1;
+            rows++;
+
+            if (!header_written) {
+                write_header(out, opts.columns, row->values.size());
+                header_written = true;
+            }
+
+            std::fprintf(out, "%" PRIu64, row->millis_since_start);
+            for (const float v : row->values) {
+                std::fprintf(out, ",%.9g", static_cast<double>(v));
+            }
+            std::fputc('\n', out);
+        }
+
+        // Live printing should show up right away, files can be buffered.
+        if (out == stdout) {
+            std::fflush(out);
+        }
+    }
+
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    std::fprintf(stderr, "Received %" PRIu64 " rows, %" PRIu64
+                 " dropped by the device, %zu corrupt frames.\n",
+                 rows, dropped, decoder.corrupt_frames());
+    return 0;
+}